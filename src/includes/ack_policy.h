@@ -0,0 +1,122 @@
+/**
+*   @file ack_policy.h
+*   @brief Policy deciding when the receiver sends an ACK.
+*
+*   Acknowledging every data packet doubles the packet rate on the return path. Since
+*   every ACK carries a SACK block describing the whole receive window, one ACK can
+*   stand in for several packets. The receiver therefore holds back the ACK of an
+*   in-order packet until `frequency` packets are waiting for one or until `delayMs`
+*   elapsed since the first of them arrived, whichever comes first. Packets that
+*   arrive out of order, duplicates and packets that fill a gap are acknowledged at
+*   once, so the sender's loss detection is never delayed.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef ACK_POLICY_H
+#define ACK_POLICY_H
+
+#include <netinet/in.h>
+#include <sys/time.h>
+
+/**
+ * @def DEFAULT_ACK_FREQUENCY
+ * Definition specifying how many in-order packets are acknowledged by one ACK by default.
+ */
+#define DEFAULT_ACK_FREQUENCY 2
+
+/**
+ * @def MAX_ACK_FREQUENCY
+ * Definition specifying the largest number of packets one ACK may stand in for.
+ */
+#define MAX_ACK_FREQUENCY 64
+
+/**
+ * @def DEFAULT_ACK_DELAY_MS
+ * Definition specifying how long an ACK may be held back by default, in ms. It must
+ * stay well below the sender's minimum retransmission timeout.
+ */
+#define DEFAULT_ACK_DELAY_MS 1
+
+/**
+ * @struct AckPolicy
+ * @brief Packets waiting for an ACK and the limits on how long they may wait.
+ */
+typedef struct {
+    int frequency;                  /**< Number of packets after which an ACK is sent at once. */
+    double delayMs;                 /**< Longest time an ACK may be held back. */
+    int pendingPackets;             /**< Packets received since the last ACK. */
+    struct timeval firstPendingTime;/**< Arrival time of the oldest packet waiting for an ACK. */
+    long long sequenceNumber;       /**< Sequence number of the latest packet waiting for an ACK. */
+    unsigned int timestamp;         /**< Timestamp of the latest packet waiting for an ACK. */
+    struct sockaddr_in destAddr;    /**< Address the pending ACK is sent to. */
+} AckPolicy;
+
+/**
+ * @brief Initializes an ACK policy.
+ *
+ * @param policy The policy to initialize.
+ * @param frequency Number of packets acknowledged by one ACK; 1 acknowledges every packet.
+ * @param delayMs Longest time an ACK may be held back.
+ */
+void initAckPolicy(AckPolicy *policy, int frequency, double delayMs) {
+    policy->frequency = frequency;
+    policy->delayMs = delayMs;
+    policy->pendingPackets = 0;
+}
+
+/**
+ * @brief Records a received packet and decides whether it must be acknowledged now.
+ *
+ * The packet becomes the one the next ACK echoes, so the sender takes its RTT sample
+ * from the latest packet acknowledged.
+ *
+ * @param policy The policy.
+ * @param sequenceNumber The sequence number of the packet.
+ * @param timestamp The timestamp of the packet.
+ * @param senderAddr The address of the sender.
+ * @param isImmediate Non-zero if the packet was out of order, a duplicate or filled a gap.
+ * @return int Non-zero if an ACK must be sent now.
+ */
+int recordPacket(AckPolicy *policy, long long sequenceNumber, unsigned int timestamp,
+                 struct sockaddr_in *senderAddr, int isImmediate) {
+    if (policy->pendingPackets == 0) {
+        gettimeofday(&policy->firstPendingTime, NULL);
+    }
+    policy->pendingPackets++;
+    policy->sequenceNumber = sequenceNumber;
+    policy->timestamp = timestamp;
+    policy->destAddr = *senderAddr;
+
+    return isImmediate || policy->pendingPackets >= policy->frequency;
+}
+
+/**
+ * @brief Returns how long the receiver may wait before the pending ACK is due.
+ *
+ * @param policy The policy.
+ * @return double The remaining time in ms, 0 if the ACK is due, or -1 if no ACK is pending.
+ */
+double ackDelayRemaining(AckPolicy *policy) {
+    if (policy->pendingPackets == 0) {
+        return -1;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    double elapsedMs = (now.tv_sec - policy->firstPendingTime.tv_sec) * 1000.0
+                     + (now.tv_usec - policy->firstPendingTime.tv_usec) / 1000.0;
+    return elapsedMs >= policy->delayMs ? 0 : policy->delayMs - elapsedMs;
+}
+
+/**
+ * @brief Clears the pending packets once their ACK was sent.
+ *
+ * @param policy The policy.
+ */
+void ackSent(AckPolicy *policy) {
+    policy->pendingPackets = 0;
+}
+
+#endif
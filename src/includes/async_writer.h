@@ -0,0 +1,588 @@
+/**
+*   @file async_writer.h
+*   @brief Asynchronous, offset-addressed file writer fed by lock-free queues.
+*
+*   The receiver must never stall its network loop on a slow disk, since that delays
+*   ACKs and inflates the RTT seen by the sender. An AsyncWriter owns a pool of packet
+*   buffers and a writer thread. The network thread takes a free buffer from the pool,
+*   receives a packet into it, or several with GRO, records the file offset of each
+*   payload as a segment of the buffer and submits it. The writer thread writes every
+*   segment at its offset, merging segments that are adjacent in the file into one
+*   pwritev call, so packets land where they belong even when they arrive out of order,
+*   and then returns the buffer to the pool. Buffers travel between the two threads through two
+*   single-producer single-consumer ring buffers, so neither side ever takes a lock.
+*   A writer is not tied to one file: every submitted buffer names the WriteTarget, an
+*   open destination file, its payloads belong to, so one writer and one pool serve
+*   every file the network thread receives. A target may also be a memory buffer or a
+*   write callback instead of a file, for programs that receive into librudp sinks.
+*   When the pool runs dry the network thread simply gets no buffer and drops the
+*   packet, which the sender retransmits later. A buffer with no segments may instead
+*   ask the writer to sync its file to disk, which then covers every write queued
+*   before it; the caller learns it is done from the ticket the writer stores in the
+*   target, without waiting. fallocate is a GNU extension, so
+*   _GNU_SOURCE must be defined before the first system header.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @def WRITE_POOL_SIZE
+ * Definition specifying the default number of packet buffers shared between the
+ * network thread and the writer thread. It must be a power of two.
+ */
+#define WRITE_POOL_SIZE 1024
+
+/**
+ * @def MAX_WRITE_SEGMENTS
+ * Definition specifying the largest number of payloads recorded in one buffer, which
+ * is the most datagrams the kernel coalesces with GRO.
+ */
+#define MAX_WRITE_SEGMENTS 64
+
+/**
+ * @def PREALLOCATE_CHUNK
+ * Definition specifying how many bytes of disk space are reserved ahead of the
+ * highest offset written, to keep the output file contiguous.
+ */
+#define PREALLOCATE_CHUNK (64LL << 20)
+
+/**
+ * @def WRITER_IDLE_USEC
+ * Definition specifying how long the writer thread sleeps when it has nothing to write.
+ */
+#define WRITER_IDLE_USEC 50
+
+/**
+ * Writes length bytes at offset bytes into the data of a callback target. Returns 0 on
+ * success or -1 on error.
+ */
+typedef int (*WriteCallback)(void *context, const void *data, size_t length, unsigned long long int offset);
+
+/**
+ * @struct SpscQueue
+ * @brief Lock-free ring buffer with a single producer and a single consumer.
+ */
+typedef struct {
+    void **items;                 /**< Storage for the queued items. */
+    unsigned int mask;            /**< Capacity minus one; the capacity is a power of two. */
+    atomic_uint head;             /**< Index of the next item to pop, written by the consumer. */
+    atomic_uint tail;             /**< Index of the next free position, written by the producer. */
+} SpscQueue;
+
+/**
+ * @struct WriteSegment
+ * @brief Bytes of a buffer that must be written at a given offset of the file.
+ */
+typedef struct {
+    char *payload;                /**< Start of the bytes to write, inside the buffer. */
+    size_t length;                /**< Number of bytes to write. */
+    off_t offset;                 /**< Offset in the file where the bytes belong. */
+} WriteSegment;
+
+/**
+ * @struct WriteTarget
+ * @brief A destination file, memory buffer or callback written by a writer thread.
+ */
+typedef struct WriteTarget {
+    int fd;                                 /**< Destination file descriptor, -1 for a buffer or callback. */
+    char *memory;                           /**< Destination buffer, if the target is one. */
+    unsigned long long int capacity;        /**< Size of the destination buffer. */
+    WriteCallback write;                    /**< Destination callback, if the target is one. */
+    void *context;                          /**< Passed to the callback. */
+    struct WriteTarget *shared;             /**< Target this one was shared from, also credited with its bytes. */
+    off_t preallocatedEnd;                  /**< End of the disk space reserved so far. */
+    atomic_int pendingBuffers;              /**< Buffers submitted for this file and not written yet. */
+    atomic_int hasFailed;                   /**< errno of the first failed write, 0 while none failed. */
+    atomic_ullong bytesWritten;             /**< Total payload bytes written to the file. */
+    atomic_uint syncedTicket;               /**< Ticket of the latest sync of the file done by the writer. */
+} WriteTarget;
+
+/**
+ * @struct WriteBuffer
+ * @brief A packet buffer and the parts of it that must be written to a file.
+ */
+typedef struct {
+    char *data;                                  /**< Buffer the packets are received into. */
+    WriteSegment segments[MAX_WRITE_SEGMENTS];   /**< Payloads to write, in the order received. */
+    int segmentCount;                            /**< Number of segments recorded. */
+    WriteTarget *target;                         /**< File the segments are written to. */
+    unsigned int syncTicket;                     /**< Non-zero for a buffer asking to sync the file, stored once it is done. */
+} WriteBuffer;
+
+/**
+ * @struct AsyncWriter
+ * @brief Writer thread, buffer pool and the queues connecting it to the network thread.
+ */
+typedef struct {
+    pthread_t thread;                       /**< The writer thread. */
+    WriteBuffer *pool;                      /**< Descriptors of all packet buffers. */
+    int poolSize;                           /**< Number of packet buffers, a power of two. */
+    char *memory;                           /**< Memory backing all packet buffers. */
+    SpscQueue pending;                      /**< Buffers waiting to be written, network to writer. */
+    SpscQueue freeBuffers;                  /**< Buffers ready for reuse, writer to network. */
+    atomic_int isClosing;                   /**< Set when no more buffers will be submitted. */
+} AsyncWriter;
+
+/**
+ * @brief Allocates a lock-free queue.
+ *
+ * @param queue The queue to initialize.
+ * @param capacity The number of items the queue holds, a power of two.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initSpscQueue(SpscQueue *queue, unsigned int capacity) {
+    queue->items = calloc(capacity, sizeof(void *));
+    queue->mask = capacity - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return queue->items == NULL ? -1 : 0;
+}
+
+/**
+ * @brief Appends an item to a queue. Must only be called by the producer.
+ *
+ * @param queue The queue.
+ * @param item The item to append.
+ * @return int 0 on success, -1 if the queue is full.
+ */
+int spscPush(SpscQueue *queue, void *item) {
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) {
+        return -1;
+    }
+
+    queue->items[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Removes the oldest item from a queue. Must only be called by the consumer.
+ *
+ * @param queue The queue.
+ * @return void* The item, or NULL if the queue is empty.
+ */
+void *spscPop(SpscQueue *queue) {
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+
+    void *item = queue->items[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return item;
+}
+
+/**
+ * @brief Reserves disk space ahead of a write so the file grows in large contiguous chunks.
+ *
+ * The reservation does not change the visible file size, so a transfer that ends early
+ * still leaves a file of the right length. Writers that share a file each reserve
+ * space from the first byte they write, not from the start of the file.
+ *
+ * @param target The file being written.
+ * @param offset The offset of the bytes about to be written.
+ * @param end The offset just past the bytes about to be written.
+ */
+void preallocateAhead(WriteTarget *target, off_t offset, off_t end) {
+    if (target->fd < 0 || end <= target->preallocatedEnd) {
+        return;
+    }
+    off_t start = offset > target->preallocatedEnd ? offset : target->preallocatedEnd;
+    target->preallocatedEnd = end + PREALLOCATE_CHUNK;
+    fallocate(target->fd, FALLOC_FL_KEEP_SIZE, start, target->preallocatedEnd - start);
+}
+
+/**
+ * @brief Records that a write to a target failed, keeping the errno of the first failure.
+ *
+ * @param target The target.
+ * @param error The errno of the failure.
+ */
+void failWriteTarget(WriteTarget *target, int error) {
+    int none = 0;
+    atomic_compare_exchange_strong(&target->hasFailed, &none, error != 0 ? error : EIO);
+}
+
+/**
+ * @brief Credits a target, and the target it was shared from, with bytes written.
+ *
+ * @param target The target.
+ * @param length The number of bytes written.
+ */
+void countWritten(WriteTarget *target, unsigned long long int length) {
+    atomic_fetch_add(&target->bytesWritten, length);
+    if (target->shared != NULL) {
+        atomic_fetch_add(&target->shared->bytesWritten, length);
+    }
+}
+
+/**
+ * @brief Copies payloads into a buffer target or hands them to a callback target.
+ *
+ * A payload that does not fit in the buffer fails the target with ENOSPC.
+ *
+ * @param target The buffer or callback being written.
+ * @param iov The payloads, in order.
+ * @param count The number of payloads.
+ * @param offset The offset in the data of the first payload.
+ */
+void copySegments(WriteTarget *target, struct iovec *iov, int count, off_t offset) {
+    for (int i = 0; i < count; i++) {
+        if (target->memory != NULL) {
+            if ((unsigned long long int)offset + iov[i].iov_len > target->capacity) {
+                failWriteTarget(target, ENOSPC);
+                return;
+            }
+            memcpy(target->memory + offset, iov[i].iov_base, iov[i].iov_len);
+        } else {
+            errno = 0;
+            if (target->write(target->context, iov[i].iov_base, iov[i].iov_len, offset) < 0) {
+                failWriteTarget(target, errno);
+                return;
+            }
+        }
+        countWritten(target, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+}
+
+/**
+ * @brief Writes a run of payloads that are adjacent in the file, finishing short writes.
+ *
+ * @param target The file being written.
+ * @param iov The payloads, in file order; consumed by the call.
+ * @param count The number of payloads.
+ * @param offset The offset in the file of the first payload.
+ */
+void writeSegments(WriteTarget *target, struct iovec *iov, int count, off_t offset) {
+    if (target->fd < 0) {
+        copySegments(target, iov, count, offset);
+        return;
+    }
+    while (count > 0) {
+        ssize_t result = pwritev(target->fd, iov, count, offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            failWriteTarget(target, result < 0 ? errno : ENOSPC);
+            return;
+        }
+        countWritten(target, result);
+        offset += result;
+
+        while (count > 0 && (size_t)result >= iov->iov_len) {
+            result -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + result;
+            iov->iov_len -= result;
+        }
+    }
+}
+
+/**
+ * @brief Body of the writer thread: writes submitted buffers until the writer is closed.
+ *
+ * @param argument The AsyncWriter.
+ * @return void* Always NULL.
+ */
+void *writerThread(void *argument) {
+    AsyncWriter *writer = argument;
+
+    while (1) {
+        WriteBuffer *buffer = spscPop(&writer->pending);
+        if (buffer == NULL) {
+            if (atomic_load(&writer->isClosing) && (buffer = spscPop(&writer->pending)) == NULL) {
+                break;
+            }
+            if (buffer == NULL) {
+                struct timespec idle = {0, WRITER_IDLE_USEC * 1000};
+                nanosleep(&idle, NULL);
+                continue;
+            }
+        }
+
+        for (int i = 0; i < buffer->segmentCount; ) {
+            /*
+             * Write the run of segments that are adjacent in the file with one call.
+             */
+            struct iovec iov[MAX_WRITE_SEGMENTS];
+            WriteSegment *first = &buffer->segments[i];
+            size_t total = 0;
+            int count = 0;
+            while (i < buffer->segmentCount && buffer->segments[i].offset == first->offset + (off_t)total) {
+                iov[count].iov_base = buffer->segments[i].payload;
+                iov[count].iov_len = buffer->segments[i].length;
+                total += buffer->segments[i].length;
+                count++;
+                i++;
+            }
+
+            preallocateAhead(buffer->target, first->offset, first->offset + total);
+            writeSegments(buffer->target, iov, count, first->offset);
+        }
+        if (buffer->syncTicket != 0) {
+            if (buffer->target->fd >= 0 && fdatasync(buffer->target->fd) < 0) {
+                failWriteTarget(buffer->target, errno);
+            } else {
+                atomic_store(&buffer->target->syncedTicket, buffer->syncTicket);
+            }
+        }
+        buffer->segmentCount = 0;
+        buffer->syncTicket = 0;
+        atomic_fetch_sub(&buffer->target->pendingBuffers, 1);
+
+        spscPush(&writer->freeBuffers, buffer);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Allocates the buffer pool and starts the writer thread.
+ *
+ * @param writer The writer to initialize.
+ * @param bufferSize The size of each packet buffer.
+ * @param poolSize The number of packet buffers, a power of two.
+ * @return int 0 on success, -1 on failure (see errno), with nothing left allocated.
+ */
+int openAsyncWriter(AsyncWriter *writer, size_t bufferSize, int poolSize) {
+    memset(writer, 0, sizeof(*writer));
+    writer->poolSize = poolSize;
+    atomic_init(&writer->isClosing, 0);
+
+    writer->pool = calloc(poolSize, sizeof(WriteBuffer));
+    writer->memory = malloc((size_t)poolSize * bufferSize);
+    int result = writer->pool == NULL || writer->memory == NULL
+        || initSpscQueue(&writer->pending, poolSize) < 0
+        || initSpscQueue(&writer->freeBuffers, poolSize) < 0 ? -1 : 0;
+
+    for (int i = 0; result == 0 && i < poolSize; i++) {
+        writer->pool[i].data = writer->memory + (size_t)i * bufferSize;
+        spscPush(&writer->freeBuffers, &writer->pool[i]);
+    }
+
+    if (result == 0 && (errno = pthread_create(&writer->thread, NULL, writerThread, writer)) != 0) {
+        result = -1;
+    }
+    if (result < 0) {
+        free(writer->pending.items);
+        free(writer->freeBuffers.items);
+        free(writer->pool);
+        free(writer->memory);
+    }
+    return result;
+}
+
+/**
+ * @brief Initializes a target with nothing written yet.
+ *
+ * The destination fields other than the file descriptor are cleared; a buffer or
+ * callback target sets them afterwards.
+ *
+ * @param target The target to initialize.
+ * @param fd The destination file descriptor, or -1 for a buffer or callback.
+ */
+void initWriteTarget(WriteTarget *target, int fd) {
+    target->fd = fd;
+    target->memory = NULL;
+    target->capacity = 0;
+    target->write = NULL;
+    target->context = NULL;
+    target->shared = NULL;
+    target->preallocatedEnd = 0;
+    atomic_init(&target->pendingBuffers, 0);
+    atomic_init(&target->hasFailed, 0);
+    atomic_init(&target->bytesWritten, 0);
+    atomic_init(&target->syncedTicket, 0);
+}
+
+/**
+ * @brief Opens a destination file for a writer.
+ *
+ * @param target The target to initialize.
+ * @param path The path of the destination file, created if needed.
+ * @param truncate Non-zero to empty the file first. Otherwise its contents are kept, so
+ * several targets can fill one file.
+ * @return int 0 on success, -1 on failure (see errno).
+ */
+int openWriteTarget(WriteTarget *target, const char *path, int truncate) {
+    int fd = open(path, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    initWriteTarget(target, fd);
+    return 0;
+}
+
+/**
+ * @brief Opens a target writing to the same destination as another, for another writer.
+ *
+ * A file is shared through a duplicate of its descriptor, so each target closes its own.
+ * The bytes written through the new target are also credited to the shared one.
+ *
+ * @param target The target to initialize.
+ * @param shared The target to share; only its destination is read.
+ * @return int 0 on success, -1 on failure (see errno).
+ */
+int shareWriteTarget(WriteTarget *target, WriteTarget *shared) {
+    int fd = -1;
+    if (shared->fd >= 0 && (fd = dup(shared->fd)) < 0) {
+        return -1;
+    }
+    initWriteTarget(target, fd);
+    target->memory = shared->memory;
+    target->capacity = shared->capacity;
+    target->write = shared->write;
+    target->context = shared->context;
+    target->shared = shared;
+    return 0;
+}
+
+/**
+ * @brief Waits for every buffer submitted for a target to be written, then closes its file.
+ *
+ * @param target The target.
+ * @return int 0 if every write succeeded, -1 otherwise, with errno set to the first failure.
+ */
+int closeWriteTarget(WriteTarget *target) {
+    while (atomic_load(&target->pendingBuffers) > 0) {
+        struct timespec idle = {0, WRITER_IDLE_USEC * 1000};
+        nanosleep(&idle, NULL);
+    }
+
+    int result = 0;
+    if (target->fd >= 0 && close(target->fd) < 0) {
+        result = -1;
+    }
+    int error = atomic_load(&target->hasFailed);
+    if (error != 0) {
+        errno = error;
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief Waits for every buffer submitted for a target to be written, then syncs its file.
+ *
+ * @param target The target.
+ * @return int 0 if every write and the sync succeeded, -1 otherwise, with errno set.
+ */
+int syncWriteTarget(WriteTarget *target) {
+    while (atomic_load(&target->pendingBuffers) > 0) {
+        struct timespec idle = {0, WRITER_IDLE_USEC * 1000};
+        nanosleep(&idle, NULL);
+    }
+
+    int error = atomic_load(&target->hasFailed);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return target->fd >= 0 ? fdatasync(target->fd) : 0;
+}
+
+/**
+ * @brief Takes a free packet buffer from the pool. Called by the network thread.
+ *
+ * @param writer The writer.
+ * @return WriteBuffer* A free buffer, or NULL if every buffer is waiting to be written.
+ */
+WriteBuffer *acquireWriteBuffer(AsyncWriter *writer) {
+    return spscPop(&writer->freeBuffers);
+}
+
+/**
+ * @brief Records bytes of a buffer that must be written at a given offset of the file.
+ *
+ * @param buffer The buffer holding the bytes.
+ * @param payload The start of the bytes to write, inside the buffer.
+ * @param length The number of bytes to write.
+ * @param offset The offset in the file where the bytes belong.
+ * @return int 0 on success, -1 if the buffer already holds MAX_WRITE_SEGMENTS segments.
+ */
+int addWriteSegment(WriteBuffer *buffer, char *payload, size_t length, off_t offset) {
+    if (buffer->segmentCount == MAX_WRITE_SEGMENTS) {
+        return -1;
+    }
+    WriteSegment *segment = &buffer->segments[buffer->segmentCount++];
+    segment->payload = payload;
+    segment->length = length;
+    segment->offset = offset;
+    return 0;
+}
+
+/**
+ * @brief Hands a buffer and its segments to the writer thread. Called by the network thread.
+ *
+ * The pending queue holds every buffer of the pool, so submitting a buffer taken with
+ * acquireWriteBuffer never fails.
+ *
+ * @param writer The writer.
+ * @param buffer The buffer holding the data.
+ * @param target The file the segments of the buffer are written to.
+ */
+void submitWrite(AsyncWriter *writer, WriteBuffer *buffer, WriteTarget *target) {
+    buffer->target = target;
+    atomic_fetch_add(&target->pendingBuffers, 1);
+    spscPush(&writer->pending, buffer);
+}
+
+/**
+ * @brief Asks the writer thread to sync the file of a target once the buffers submitted
+ * before are written. Called by the network thread.
+ *
+ * The writer stores the ticket in the syncedTicket of the target when the sync is done;
+ * a failed sync fails the target instead.
+ *
+ * @param writer The writer.
+ * @param buffer A free buffer, carrying the request.
+ * @param target The file to sync.
+ * @param ticket A non-zero ticket identifying the request.
+ */
+void submitSync(AsyncWriter *writer, WriteBuffer *buffer, WriteTarget *target, unsigned int ticket) {
+    buffer->segmentCount = 0;
+    buffer->syncTicket = ticket;
+    submitWrite(writer, buffer, target);
+}
+
+/**
+ * @brief Waits for every submitted buffer to be written, then stops the thread.
+ *
+ * The targets stay open; each is closed with closeWriteTarget.
+ *
+ * @param writer The writer.
+ */
+void closeAsyncWriter(AsyncWriter *writer) {
+    atomic_store(&writer->isClosing, 1);
+    pthread_join(writer->thread, NULL);
+
+    free(writer->pending.items);
+    free(writer->freeBuffers.items);
+    free(writer->pool);
+    free(writer->memory);
+}
+
+#endif
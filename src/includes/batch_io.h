@@ -0,0 +1,591 @@
+/**
+*   @file batch_io.h
+*   @brief Batched datagram I/O built on sendmmsg and recvmmsg.
+*
+*   Sending or receiving each datagram with its own sendto/recvfrom call makes the
+*   system call overhead the bottleneck at high packet rates. A SendBatch collects
+*   outgoing datagrams, each described by a header and a payload buffer, and hands
+*   them to the kernel with a single sendmmsg call. A ReceiveBatch reads up to its
+*   capacity of datagrams with a single recvmmsg call. Both count the system calls
+*   and datagrams they handle in an IoStats structure. sendmmsg and recvmmsg are GNU
+*   extensions, so _GNU_SOURCE must be defined before the first system header.
+*
+*   Both sides can also use UDP segmentation offloads, when the kernel supports them.
+*   With generic segmentation offload (GSO) enabled, a run of queued datagrams of the
+*   same size to the same destination is handed to the kernel as a single message with
+*   a UDP_SEGMENT control message, and the kernel, or the NIC, splits it into datagrams.
+*   With generic receive offload (GRO) enabled, the kernel may deliver several datagrams
+*   of a flow as one buffer, and getBatchSegmentSize tells where each one starts. If a
+*   GSO send is refused, GSO is turned off and the datagrams are sent one by one.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "transfer_control.h"
+
+/**
+ * @def DEFAULT_BATCH_SIZE
+ * Definition specifying how many datagrams are sent or received per system call by default.
+ */
+#define DEFAULT_BATCH_SIZE 16
+
+/**
+ * @def MAX_BATCH_SIZE
+ * Definition specifying the largest supported batch size.
+ */
+#define MAX_BATCH_SIZE 64
+
+/**
+ * @def GSO_MAX_SEGMENTS
+ * Definition specifying the largest number of datagrams merged into one GSO send.
+ */
+#define GSO_MAX_SEGMENTS 64
+
+/**
+ * @def GSO_MAX_BYTES
+ * Definition specifying the largest GSO send in bytes, below the 64 KB limit of an IP packet.
+ */
+#define GSO_MAX_BYTES 65000
+
+/**
+ * @def CONTROL_SIZE
+ * Definition specifying the room for the UDP_SEGMENT or UDP_GRO control message of a message.
+ */
+#define CONTROL_SIZE CMSG_SPACE(sizeof(int))
+
+/**
+ * @def SEND_CONTROL_SIZE
+ * Definition specifying the room for the UDP_SEGMENT and SCM_TXTIME control messages of a sent message.
+ */
+#define SEND_CONTROL_SIZE (CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)))
+
+/**
+ * @struct IoStats
+ * @brief Counts of system calls and datagrams handled by the batch I/O layer.
+ */
+typedef struct {
+    unsigned long long sendCalls;          /**< Number of sendmmsg calls. */
+    unsigned long long datagramsSent;      /**< Number of datagrams sent. */
+    unsigned long long receiveCalls;       /**< Number of recvmmsg calls that returned data. */
+    unsigned long long datagramsReceived;  /**< Number of datagrams received. */
+} IoStats;
+
+/**
+ * @struct SendBatch
+ * @brief Datagrams queued for a single sendmmsg call.
+ *
+ * Each datagram is made of two iovecs, a header and a payload, so the payload can be
+ * sent from wherever it is stored without being copied behind the header first. The
+ * iovecs of consecutive datagrams are contiguous, so a GSO message simply covers the
+ * iovecs of several datagrams. Messages are built when the batch is flushed.
+ */
+typedef struct {
+    int sockDescriptor;               /**< Socket the batch is sent on. */
+    struct mmsghdr *messages;         /**< Messages built from the queued datagrams. */
+    struct iovec *iovecs;             /**< Two iovecs per datagram: header and payload. */
+    struct sockaddr_in *addresses;    /**< Destination of each datagram. */
+    int *messageFirst;                /**< Index of the first datagram of each message. */
+    int *messageSegments;             /**< Number of datagrams in each message. */
+    unsigned long long *txTimes;      /**< Departure time of each datagram in ns, 0 to send at once. */
+    char *controls;                   /**< SEND_CONTROL_SIZE bytes of control data per message. */
+    int capacity;                     /**< Maximum number of datagrams per call. */
+    int count;                        /**< Number of datagrams currently queued. */
+    size_t gsoSize;                   /**< Datagram size merged with GSO, 0 if GSO is off. */
+    IoStats *stats;                   /**< Statistics updated on every call. */
+    TransferControl *control;         /**< Transfer the batch belongs to, which prints its warnings. */
+    unsigned long long bytesSent;     /**< Total bytes handed to the kernel by this batch. */
+} SendBatch;
+
+/**
+ * @struct ReceiveBatch
+ * @brief Buffers filled by a single recvmmsg call.
+ */
+typedef struct {
+    struct mmsghdr *messages;         /**< One message per receive buffer. */
+    struct iovec *iovecs;             /**< One iovec per receive buffer. */
+    struct sockaddr_in *addresses;    /**< Source address of each received datagram. */
+    char *controls;                   /**< CONTROL_SIZE bytes of control data per buffer. */
+    char *buffers;                    /**< capacity contiguous buffers of bufferSize bytes, NULL if supplied by the caller. */
+    size_t bufferSize;                /**< Size of each receive buffer. */
+    int capacity;                     /**< Maximum number of datagrams per call. */
+    IoStats *stats;                   /**< Statistics updated on every call. */
+} ReceiveBatch;
+
+/**
+ * @brief Allocates a send batch.
+ *
+ * @param batch The batch to initialize.
+ * @param sockDescriptor The socket the batch is sent on.
+ * @param capacity The maximum number of datagrams per sendmmsg call.
+ * @param stats The statistics to update.
+ * @param control The transfer the batch belongs to.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initSendBatch(SendBatch *batch, int sockDescriptor, int capacity, IoStats *stats, TransferControl *control) {
+    batch->sockDescriptor = sockDescriptor;
+    batch->capacity = capacity;
+    batch->count = 0;
+    batch->gsoSize = 0;
+    batch->stats = stats;
+    batch->control = control;
+    batch->bytesSent = 0;
+    batch->messages = calloc(capacity, sizeof(struct mmsghdr));
+    batch->iovecs = calloc(2 * capacity, sizeof(struct iovec));
+    batch->addresses = calloc(capacity, sizeof(struct sockaddr_in));
+    batch->messageFirst = calloc(capacity, sizeof(int));
+    batch->messageSegments = calloc(capacity, sizeof(int));
+    batch->txTimes = calloc(capacity, sizeof(unsigned long long));
+    batch->controls = calloc(capacity, SEND_CONTROL_SIZE);
+    if (batch->messages == NULL || batch->iovecs == NULL || batch->addresses == NULL
+        || batch->messageFirst == NULL || batch->messageSegments == NULL
+        || batch->txTimes == NULL || batch->controls == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Turns on GSO for datagrams of the given size, if the kernel supports it.
+ *
+ * @param batch The batch.
+ * @param gsoSize The size of the datagrams to merge, normally the packet size.
+ * @return int 0 if GSO is on, -1 if the kernel does not support it.
+ */
+int enableGso(SendBatch *batch, size_t gsoSize) {
+    int off = 0;
+    if (setsockopt(batch->sockDescriptor, IPPROTO_UDP, UDP_SEGMENT, &off, sizeof(off)) < 0) {
+        return -1;
+    }
+    batch->gsoSize = gsoSize;
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by a send batch.
+ *
+ * @param batch The batch to free.
+ */
+void freeSendBatch(SendBatch *batch) {
+    free(batch->messages);
+    free(batch->iovecs);
+    free(batch->addresses);
+    free(batch->messageFirst);
+    free(batch->messageSegments);
+    free(batch->txTimes);
+    free(batch->controls);
+    batch->messages = NULL;
+    batch->iovecs = NULL;
+    batch->addresses = NULL;
+    batch->messageFirst = NULL;
+    batch->messageSegments = NULL;
+    batch->txTimes = NULL;
+    batch->controls = NULL;
+}
+
+/**
+ * @brief Returns the number of bytes of a queued datagram.
+ *
+ * @param batch The batch.
+ * @param index The index of the datagram.
+ * @return size_t The header and payload length.
+ */
+size_t getDatagramLength(SendBatch *batch, int index) {
+    return batch->iovecs[2 * index].iov_len + batch->iovecs[2 * index + 1].iov_len;
+}
+
+/**
+ * @brief Builds the messages for the queued datagrams from the given one onwards.
+ *
+ * Without GSO every datagram is its own message. With GSO, a datagram of exactly
+ * gsoSize bytes starts a run that takes the following datagrams to the same
+ * destination while they are gsoSize bytes long; a shorter datagram ends the run.
+ * A message leaves at the departure time of its first datagram, if it has one.
+ *
+ * @param batch The batch.
+ * @param first The index of the first datagram to build messages for.
+ * @return int The number of messages built.
+ */
+int buildMessages(SendBatch *batch, int first) {
+    int messageCount = 0;
+
+    for (int index = first; index < batch->count; messageCount++) {
+        int segments = 1;
+
+        if (batch->gsoSize > 0 && getDatagramLength(batch, index) == batch->gsoSize) {
+            while (index + segments < batch->count && segments < GSO_MAX_SEGMENTS
+                   && (segments + 1) * batch->gsoSize <= GSO_MAX_BYTES
+                   && batch->addresses[index + segments].sin_addr.s_addr == batch->addresses[index].sin_addr.s_addr
+                   && batch->addresses[index + segments].sin_port == batch->addresses[index].sin_port) {
+                size_t length = getDatagramLength(batch, index + segments);
+                if (length > batch->gsoSize) {
+                    break;
+                }
+                segments++;
+                if (length < batch->gsoSize) {
+                    break;
+                }
+            }
+        }
+
+        struct msghdr *message = &batch->messages[messageCount].msg_hdr;
+        memset(message, 0, sizeof(*message));
+        message->msg_name = &batch->addresses[index];
+        message->msg_namelen = sizeof(struct sockaddr_in);
+        message->msg_iov = &batch->iovecs[2 * index];
+        message->msg_iovlen = 2 * segments;
+
+        char *control = batch->controls + messageCount * SEND_CONTROL_SIZE;
+        message->msg_control = control;
+        if (segments > 1) {
+            struct cmsghdr *header = (struct cmsghdr *)(control + message->msg_controllen);
+            header->cmsg_level = IPPROTO_UDP;
+            header->cmsg_type = UDP_SEGMENT;
+            header->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t gsoSize = batch->gsoSize;
+            memcpy(CMSG_DATA(header), &gsoSize, sizeof(gsoSize));
+            message->msg_controllen += CMSG_SPACE(sizeof(uint16_t));
+        }
+        if (batch->txTimes[index] > 0) {
+            struct cmsghdr *header = (struct cmsghdr *)(control + message->msg_controllen);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_TXTIME;
+            header->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            uint64_t txTime = batch->txTimes[index];
+            memcpy(CMSG_DATA(header), &txTime, sizeof(txTime));
+            message->msg_controllen += CMSG_SPACE(sizeof(uint64_t));
+        }
+        if (message->msg_controllen == 0) {
+            message->msg_control = NULL;
+        }
+
+        batch->messageFirst[messageCount] = index;
+        batch->messageSegments[messageCount] = segments;
+        index += segments;
+    }
+    return messageCount;
+}
+
+/**
+ * @brief Sends every queued datagram, using as few sendmmsg calls as possible.
+ *
+ * Datagrams the kernel refuses are dropped, exactly like a failed sendto; the
+ * protocol retransmits them like any other lost packet. If the kernel or the device
+ * refuses a GSO message, GSO is turned off and its datagrams are sent one by one.
+ *
+ * @param batch The batch to flush.
+ * @return unsigned long long The number of bytes sent.
+ */
+unsigned long long flushSendBatch(SendBatch *batch) {
+    unsigned long long bytes = 0;
+    int next = 0;
+
+    while (next < batch->count) {
+        int messageCount = buildMessages(batch, next);
+        int sent = 0;
+
+        while (sent < messageCount) {
+            int result = sendmmsg(batch->sockDescriptor, batch->messages + sent, messageCount - sent, 0);
+            batch->stats->sendCalls++;
+
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (batch->messageSegments[sent] > 1 && (errno == EIO || errno == EINVAL || errno == EMSGSIZE || errno == EOPNOTSUPP)) {
+                    warnTransfer(batch->control, "GSO send refused, falling back to single datagrams");
+                    batch->gsoSize = 0;
+                    break;
+                }
+                warnTransfer(batch->control, "Error sending packets");
+                sent++;
+                continue;
+            }
+
+            for (int i = sent; i < sent + result; i++) {
+                bytes += batch->messages[i].msg_len;
+                batch->stats->datagramsSent += batch->messageSegments[i];
+            }
+            sent += result;
+        }
+
+        next = sent < messageCount ? batch->messageFirst[sent] : batch->count;
+    }
+
+    batch->count = 0;
+    batch->bytesSent += bytes;
+    return bytes;
+}
+
+/**
+ * @brief Queues a datagram to leave at a given time, flushing the batch when full.
+ *
+ * The header and payload buffers are referenced, not copied, so they must stay valid
+ * until the batch is flushed. The departure time is only honoured on a socket with
+ * SO_TXTIME enabled.
+ *
+ * @param batch The batch to queue the datagram in.
+ * @param destAddr The destination of the datagram.
+ * @param header The header bytes.
+ * @param headerLength The number of header bytes.
+ * @param payload The payload bytes, or NULL if the datagram has no payload.
+ * @param payloadLength The number of payload bytes.
+ * @param txTime The departure time in ns of CLOCK_MONOTONIC, or 0 to send at once.
+ */
+void queueTimedDatagram(SendBatch *batch, struct sockaddr_in *destAddr, void *header, size_t headerLength,
+                        void *payload, size_t payloadLength, unsigned long long txTime) {
+    int index = batch->count++;
+    batch->txTimes[index] = txTime;
+    struct iovec *iov = &batch->iovecs[2 * index];
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = headerLength;
+    iov[1].iov_base = payload;
+    iov[1].iov_len = payloadLength;
+    batch->addresses[index] = *destAddr;
+
+    if (batch->count == batch->capacity) {
+        flushSendBatch(batch);
+    }
+}
+
+/**
+ * @brief Queues a datagram made of a header and a payload, flushing the batch when full.
+ *
+ * The header and payload buffers are referenced, not copied, so they must stay valid
+ * until the batch is flushed.
+ *
+ * @param batch The batch to queue the datagram in.
+ * @param destAddr The destination of the datagram.
+ * @param header The header bytes.
+ * @param headerLength The number of header bytes.
+ * @param payload The payload bytes, or NULL if the datagram has no payload.
+ * @param payloadLength The number of payload bytes.
+ */
+void queueDatagram(SendBatch *batch, struct sockaddr_in *destAddr,
+                   void *header, size_t headerLength, void *payload, size_t payloadLength) {
+    queueTimedDatagram(batch, destAddr, header, headerLength, payload, payloadLength, 0);
+}
+
+/**
+ * @brief Sends a datagram made of a header and a payload at once, outside any batch.
+ *
+ * @param sockDescriptor The socket to send on.
+ * @param destAddr The destination of the datagram.
+ * @param header The header bytes.
+ * @param headerLength The number of header bytes.
+ * @param payload The payload bytes, or NULL if the datagram has no payload.
+ * @param payloadLength The number of payload bytes.
+ * @return ssize_t The number of bytes sent, or -1 on failure.
+ */
+ssize_t sendDatagram(int sockDescriptor, struct sockaddr_in *destAddr, const void *header, size_t headerLength,
+                     const void *payload, size_t payloadLength) {
+    struct iovec iov[2];
+    struct msghdr message;
+
+    iov[0].iov_base = (void *)header;
+    iov[0].iov_len = headerLength;
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = payloadLength;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = destAddr;
+    message.msg_namelen = sizeof(*destAddr);
+    message.msg_iov = iov;
+    message.msg_iovlen = 2;
+    return sendmsg(sockDescriptor, &message, 0);
+}
+
+/**
+ * @brief Allocates a receive batch.
+ *
+ * @param batch The batch to initialize.
+ * @param capacity The maximum number of datagrams per recvmmsg call.
+ * @param bufferSize The size of each receive buffer, or 0 if the caller supplies the
+ * buffers with setBatchBuffer before the first receive.
+ * @param stats The statistics to update.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initReceiveBatch(ReceiveBatch *batch, int capacity, size_t bufferSize, IoStats *stats) {
+    batch->capacity = capacity;
+    batch->bufferSize = bufferSize;
+    batch->stats = stats;
+    batch->messages = calloc(capacity, sizeof(struct mmsghdr));
+    batch->iovecs = calloc(capacity, sizeof(struct iovec));
+    batch->addresses = calloc(capacity, sizeof(struct sockaddr_in));
+    batch->controls = calloc(capacity, CONTROL_SIZE);
+    batch->buffers = bufferSize > 0 ? malloc(capacity * bufferSize) : NULL;
+    if (batch->messages == NULL || batch->iovecs == NULL || batch->addresses == NULL || batch->controls == NULL
+        || (bufferSize > 0 && batch->buffers == NULL)) {
+        return -1;
+    }
+
+    for (int i = 0; i < capacity; i++) {
+        batch->iovecs[i].iov_base = batch->buffers != NULL ? batch->buffers + i * bufferSize : NULL;
+        batch->iovecs[i].iov_len = bufferSize;
+        batch->messages[i].msg_hdr.msg_iov = &batch->iovecs[i];
+        batch->messages[i].msg_hdr.msg_iovlen = 1;
+        batch->messages[i].msg_hdr.msg_name = &batch->addresses[i];
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by a receive batch.
+ *
+ * @param batch The batch to free.
+ */
+void freeReceiveBatch(ReceiveBatch *batch) {
+    free(batch->messages);
+    free(batch->iovecs);
+    free(batch->addresses);
+    free(batch->controls);
+    free(batch->buffers);
+    batch->messages = NULL;
+    batch->iovecs = NULL;
+    batch->addresses = NULL;
+    batch->controls = NULL;
+    batch->buffers = NULL;
+}
+
+/**
+ * @brief Lets the kernel deliver several datagrams of a flow as one buffer, if it supports GRO.
+ *
+ * Receive buffers must then be large enough for a coalesced buffer, up to 64 KB.
+ *
+ * @param sockDescriptor The socket.
+ * @return int 0 if GRO is on, -1 if the kernel does not support it.
+ */
+int enableGro(int sockDescriptor) {
+    int on = 1;
+    return setsockopt(sockDescriptor, IPPROTO_UDP, UDP_GRO, &on, sizeof(on));
+}
+
+/**
+ * @brief Returns the size of the datagrams coalesced into a buffer of a receive batch.
+ *
+ * Every datagram in the buffer has this size except possibly the last one.
+ *
+ * @param batch The batch.
+ * @param index The index of the buffer.
+ * @return size_t The datagram size, or the buffer length if it holds a single datagram.
+ */
+size_t getBatchSegmentSize(ReceiveBatch *batch, int index) {
+    struct msghdr *message = &batch->messages[index].msg_hdr;
+    for (struct cmsghdr *control = CMSG_FIRSTHDR(message); control != NULL; control = CMSG_NXTHDR(message, control)) {
+        if (control->cmsg_level == IPPROTO_UDP && control->cmsg_type == UDP_GRO) {
+            int segmentSize;
+            memcpy(&segmentSize, CMSG_DATA(control), sizeof(segmentSize));
+            return segmentSize;
+        }
+    }
+    return batch->messages[index].msg_len;
+}
+
+/**
+ * @brief Receives up to a full batch of datagrams with one recvmmsg call.
+ *
+ * The call never blocks: it returns every datagram that is already queued, up to the
+ * batch capacity, and fails with EAGAIN when none is, so the caller waits in epoll for
+ * the socket. With GRO, each buffer may hold several datagrams, which are all counted.
+ *
+ * @param sockDescriptor The socket to receive from.
+ * @param batch The batch to fill.
+ * @return int The number of datagrams received, or -1 on error or if none was queued (see errno).
+ */
+int receiveBatch(int sockDescriptor, ReceiveBatch *batch) {
+    for (int i = 0; i < batch->capacity; i++) {
+        batch->messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->messages[i].msg_hdr.msg_control = batch->controls + i * CONTROL_SIZE;
+        batch->messages[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+        batch->messages[i].msg_hdr.msg_flags = 0;
+    }
+
+    int received = recvmmsg(sockDescriptor, batch->messages, batch->capacity, MSG_DONTWAIT, NULL);
+    if (received > 0) {
+        batch->stats->receiveCalls++;
+        for (int i = 0; i < received; i++) {
+            size_t segmentSize = getBatchSegmentSize(batch, i);
+            batch->stats->datagramsReceived += segmentSize > 0 ? (batch->messages[i].msg_len + segmentSize - 1) / segmentSize : 1;
+        }
+    }
+    return received;
+}
+
+/**
+ * @brief Returns the data of a datagram in a receive batch.
+ *
+ * @param batch The batch.
+ * @param index The index of the datagram.
+ * @return char* The received bytes.
+ */
+char *getBatchBuffer(ReceiveBatch *batch, int index) {
+    return batch->iovecs[index].iov_base;
+}
+
+/**
+ * @brief Makes a position of a receive batch receive into a buffer owned by the caller.
+ *
+ * This lets a received datagram be handed off without copying it, by swapping a fresh
+ * buffer into its position before the next receive.
+ *
+ * @param batch The batch.
+ * @param index The position to change.
+ * @param buffer The buffer the next datagram at this position is received into.
+ * @param bufferSize The size of the buffer.
+ */
+void setBatchBuffer(ReceiveBatch *batch, int index, char *buffer, size_t bufferSize) {
+    batch->iovecs[index].iov_base = buffer;
+    batch->iovecs[index].iov_len = bufferSize;
+}
+
+/**
+ * @brief Returns the length of a datagram in a receive batch.
+ *
+ * @param batch The batch.
+ * @param index The index of the datagram.
+ * @return ssize_t The number of bytes received.
+ */
+ssize_t getBatchLength(ReceiveBatch *batch, int index) {
+    return batch->messages[index].msg_len;
+}
+
+/**
+ * @brief Adds the statistics of one thread to a total.
+ *
+ * @param total The statistics to add to.
+ * @param stats The statistics to add.
+ */
+void addIoStats(IoStats *total, IoStats *stats) {
+    total->sendCalls += stats->sendCalls;
+    total->datagramsSent += stats->datagramsSent;
+    total->receiveCalls += stats->receiveCalls;
+    total->datagramsReceived += stats->datagramsReceived;
+}
+
+/**
+ * @brief Prints how many datagrams were handled per system call.
+ *
+ * @param stats The statistics to print.
+ */
+void displayIoStats(IoStats *stats) {
+    printf("Send syscalls: %llu for %llu datagrams (%.2f per call)\n", stats->sendCalls, stats->datagramsSent,
+           stats->sendCalls > 0 ? (double)stats->datagramsSent / stats->sendCalls : 0);
+    printf("Receive syscalls: %llu for %llu datagrams (%.2f per call)\n", stats->receiveCalls, stats->datagramsReceived,
+           stats->receiveCalls > 0 ? (double)stats->datagramsReceived / stats->receiveCalls : 0);
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+*   @file cc_aimd.h
+*   @brief Additive increase / multiplicative decrease congestion control.
+*
+*   Classic Reno style congestion control: the window grows by one packet per ACK in
+*   slow start and by one packet per RTT in congestion avoidance, is halved on loss
+*   and collapses to a single packet on a retransmission timeout. Since every flow
+*   backs off proportionally to its window, competing AIMD flows converge to a fair
+*   share of the link. This file is included by congestion_control.h.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef CC_AIMD_H
+#define CC_AIMD_H
+
+/**
+ * @def AIMD_DECREASE_FACTOR
+ * Definition specifying the factor applied to the window when a loss is detected.
+ */
+#define AIMD_DECREASE_FACTOR 0.5
+
+/**
+ * @brief Grows the window for newly acknowledged packets.
+ *
+ * @param cc The congestion controller.
+ * @param sample The ACK information reported by the sender.
+ */
+void aimdOnAck(CongestionControl *cc, const AckSample *sample) {
+    for (int i = 0; i < sample->ackedPackets; i++) {
+        if (cc->cwnd < cc->ssthresh) {
+            cc->cwnd += 1;
+        } else {
+            cc->cwnd += 1 / cc->cwnd;
+        }
+    }
+    updateWindowPacingRate(cc, sample->smoothedRttMs);
+}
+
+/**
+ * @brief Multiplicatively decreases the window after a loss.
+ *
+ * @param cc The congestion controller.
+ * @param nowMs The time of the loss in ms.
+ */
+void aimdOnLoss(CongestionControl *cc, double nowMs) {
+    (void)nowMs;
+    cc->ssthresh = cc->cwnd * AIMD_DECREASE_FACTOR;
+    if (cc->ssthresh < MIN_CWND) {
+        cc->ssthresh = MIN_CWND;
+    }
+    cc->cwnd = cc->ssthresh;
+}
+
+/**
+ * @brief Restarts slow start from a single packet after a timeout.
+ *
+ * @param cc The congestion controller.
+ * @param nowMs The time of the timeout in ms.
+ */
+void aimdOnTimeout(CongestionControl *cc, double nowMs) {
+    aimdOnLoss(cc, nowMs);
+    cc->cwnd = 1;
+}
+
+/**
+ * @brief Installs the AIMD callbacks in a congestion controller.
+ *
+ * @param cc The congestion controller.
+ * @return int Always 0.
+ */
+int initAimd(CongestionControl *cc) {
+    cc->name = "aimd";
+    cc->onAck = aimdOnAck;
+    cc->onLoss = aimdOnLoss;
+    cc->onTimeout = aimdOnTimeout;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,297 @@
+/**
+*   @file cc_bbr.h
+*   @brief Delivery rate based congestion control in the style of BBR.
+*
+*   Instead of reacting to loss, this controller builds a model of the path from
+*   two measurements: the bottleneck bandwidth (the highest delivery rate seen over
+*   the last few round trips) and the minimum RTT (the propagation delay). The
+*   congestion window is kept at a small multiple of their product, the
+*   bandwidth-delay product (BDP), and the pacing rate cycles around the bandwidth
+*   estimate to probe for more capacity and then drain any queue it created.
+*   The state machine follows BBR v1: STARTUP, DRAIN, PROBE_BW and PROBE_RTT.
+*   This file is included by congestion_control.h.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef CC_BBR_H
+#define CC_BBR_H
+
+#include <stdlib.h>
+
+/**
+ * @def BBR_BW_FILTER_ROUNDS
+ * Definition specifying over how many round trips the maximum delivery rate is kept.
+ */
+#define BBR_BW_FILTER_ROUNDS 10
+
+/**
+ * @def BBR_MIN_RTT_WINDOW_MS
+ * Definition specifying how long a minimum RTT sample stays valid before PROBE_RTT.
+ */
+#define BBR_MIN_RTT_WINDOW_MS 10000
+
+/**
+ * @def BBR_PROBE_RTT_DURATION_MS
+ * Definition specifying how long the window is kept small while in PROBE_RTT.
+ */
+#define BBR_PROBE_RTT_DURATION_MS 200
+
+/**
+ * @def BBR_HIGH_GAIN
+ * Definition specifying the gain used while searching for the bottleneck bandwidth (2/ln 2).
+ */
+#define BBR_HIGH_GAIN 2.885
+
+/**
+ * @def BBR_MIN_CWND
+ * Definition specifying the smallest window, in packets, that BBR uses.
+ */
+#define BBR_MIN_CWND 4
+
+/**
+ * @enum BbrMode
+ * @brief Phases of the BBR state machine.
+ */
+typedef enum {
+    BBR_STARTUP,
+    BBR_DRAIN,
+    BBR_PROBE_BW,
+    BBR_PROBE_RTT
+} BbrMode;
+
+/**
+ * @struct BbrState
+ * @brief Path model and state machine of the BBR controller.
+ */
+typedef struct {
+    BbrMode mode;                                  /**< Current phase of the state machine. */
+    double bandwidthSamples[BBR_BW_FILTER_ROUNDS]; /**< Highest delivery rate seen in each recent round. */
+    double bottleneckBandwidth;                    /**< Estimated bottleneck bandwidth in packets per second. */
+    double minRttMs;                               /**< Estimated propagation delay in ms, negative if unknown. */
+    double minRttStampMs;                          /**< Time at which minRttMs was measured. */
+    long long roundCount;                          /**< Number of round trips completed. */
+    long long nextRoundDelivered;                  /**< Delivered count that ends the current round. */
+    double fullBandwidth;                          /**< Bandwidth when it last grew by 25% in STARTUP. */
+    int fullBandwidthRounds;                       /**< Rounds since the bandwidth last grew by 25%. */
+    int filledPipe;                                /**< Non-zero once STARTUP found the bottleneck. */
+    int cycleIndex;                                /**< Position in the PROBE_BW gain cycle. */
+    double cycleStampMs;                           /**< Time at which the current gain phase started. */
+    double probeRttDoneMs;                         /**< Time at which PROBE_RTT ends. */
+    double pacingGain;                             /**< Multiplier applied to the bandwidth for pacing. */
+    double cwndGain;                               /**< Multiplier applied to the BDP for the window. */
+} BbrState;
+
+/**
+ * @brief Pacing gains cycled through in PROBE_BW: probe up, drain, then cruise.
+ */
+static const double bbrPacingGainCycle[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+/**
+ * @brief Returns the estimated bandwidth-delay product in packets.
+ *
+ * @param state The BBR state.
+ * @return double The BDP, or 0 while the model has no estimate.
+ */
+double bbrBdp(BbrState *state) {
+    if (state->minRttMs < 0) {
+        return 0;
+    }
+    return state->bottleneckBandwidth * state->minRttMs / 1000.0;
+}
+
+/**
+ * @brief Updates the round counter and the windowed maximum bandwidth filter.
+ *
+ * @param state The BBR state.
+ * @param sample The ACK information reported by the sender.
+ * @return int Non-zero if this ACK started a new round trip.
+ */
+int bbrUpdateBandwidth(BbrState *state, const AckSample *sample) {
+    int roundStart = 0;
+
+    if (sample->priorDelivered >= state->nextRoundDelivered) {
+        state->nextRoundDelivered = sample->delivered;
+        state->roundCount++;
+        state->bandwidthSamples[state->roundCount % BBR_BW_FILTER_ROUNDS] = 0;
+        roundStart = 1;
+    }
+
+    double *current = &state->bandwidthSamples[state->roundCount % BBR_BW_FILTER_ROUNDS];
+    if (sample->deliveryRate > *current) {
+        *current = sample->deliveryRate;
+    }
+
+    state->bottleneckBandwidth = 0;
+    for (int i = 0; i < BBR_BW_FILTER_ROUNDS; i++) {
+        if (state->bandwidthSamples[i] > state->bottleneckBandwidth) {
+            state->bottleneckBandwidth = state->bandwidthSamples[i];
+        }
+    }
+    return roundStart;
+}
+
+/**
+ * @brief Moves to the next phase of the BBR state machine when its exit condition holds.
+ *
+ * @param state The BBR state.
+ * @param sample The ACK information reported by the sender.
+ * @param roundStart Non-zero if this ACK started a new round trip.
+ * @param minRttExpired Non-zero if the minimum RTT was not refreshed for BBR_MIN_RTT_WINDOW_MS.
+ */
+void bbrUpdateMode(BbrState *state, const AckSample *sample, int roundStart, int minRttExpired) {
+    /*
+     * STARTUP ends once three rounds in a row failed to grow the bandwidth by 25%.
+     */
+    if (!state->filledPipe && roundStart && state->bottleneckBandwidth > 0) {
+        if (state->bottleneckBandwidth >= state->fullBandwidth * 1.25) {
+            state->fullBandwidth = state->bottleneckBandwidth;
+            state->fullBandwidthRounds = 0;
+        } else if (++state->fullBandwidthRounds >= 3) {
+            state->filledPipe = 1;
+        }
+    }
+
+    if (state->mode == BBR_STARTUP && state->filledPipe) {
+        state->mode = BBR_DRAIN;
+    }
+    if (state->mode == BBR_DRAIN && sample->packetsInFlight <= bbrBdp(state)) {
+        state->mode = BBR_PROBE_BW;
+        state->cycleIndex = 2;
+        state->cycleStampMs = sample->nowMs;
+    }
+    if (state->mode == BBR_PROBE_BW && sample->nowMs - state->cycleStampMs > state->minRttMs) {
+        state->cycleIndex = (state->cycleIndex + 1) % (int)(sizeof(bbrPacingGainCycle) / sizeof(bbrPacingGainCycle[0]));
+        state->cycleStampMs = sample->nowMs;
+    }
+
+    if (minRttExpired && state->mode != BBR_PROBE_RTT) {
+        state->mode = BBR_PROBE_RTT;
+        state->probeRttDoneMs = sample->nowMs + BBR_PROBE_RTT_DURATION_MS;
+    } else if (state->mode == BBR_PROBE_RTT && sample->nowMs >= state->probeRttDoneMs) {
+        state->minRttStampMs = sample->nowMs;
+        state->mode = state->filledPipe ? BBR_PROBE_BW : BBR_STARTUP;
+        state->cycleStampMs = sample->nowMs;
+    }
+
+    switch (state->mode) {
+        case BBR_STARTUP:
+            state->pacingGain = BBR_HIGH_GAIN;
+            state->cwndGain = BBR_HIGH_GAIN;
+            break;
+        case BBR_DRAIN:
+            state->pacingGain = 1 / BBR_HIGH_GAIN;
+            state->cwndGain = BBR_HIGH_GAIN;
+            break;
+        case BBR_PROBE_BW:
+            state->pacingGain = bbrPacingGainCycle[state->cycleIndex];
+            state->cwndGain = 2;
+            break;
+        case BBR_PROBE_RTT:
+            state->pacingGain = 1;
+            state->cwndGain = 1;
+            break;
+    }
+}
+
+/**
+ * @brief Updates the path model and derives the window and pacing rate from it.
+ *
+ * @param cc The congestion controller.
+ * @param sample The ACK information reported by the sender.
+ */
+void bbrOnAck(CongestionControl *cc, const AckSample *sample) {
+    BbrState *state = cc->state;
+
+    int roundStart = bbrUpdateBandwidth(state, sample);
+
+    int minRttExpired = state->minRttMs >= 0 && sample->nowMs - state->minRttStampMs > BBR_MIN_RTT_WINDOW_MS;
+    if (sample->rttMs >= 0 && (state->minRttMs < 0 || sample->rttMs <= state->minRttMs || minRttExpired)) {
+        state->minRttMs = sample->rttMs;
+        state->minRttStampMs = sample->nowMs;
+    }
+
+    bbrUpdateMode(state, sample, roundStart, minRttExpired);
+
+    /*
+     * Without a model yet, grow like slow start. Afterwards the window tracks a
+     * multiple of the BDP, growing by at most the acknowledged packets per ACK.
+     */
+    double target = state->cwndGain * bbrBdp(state);
+    if (target <= 0 || (!state->filledPipe && cc->cwnd < target)) {
+        cc->cwnd += sample->ackedPackets;
+    } else if (state->filledPipe) {
+        cc->cwnd = cc->cwnd + sample->ackedPackets < target ? cc->cwnd + sample->ackedPackets : target;
+    }
+    if (cc->cwnd < BBR_MIN_CWND) {
+        cc->cwnd = BBR_MIN_CWND;
+    }
+    if (state->mode == BBR_PROBE_RTT && cc->cwnd > BBR_MIN_CWND) {
+        cc->cwnd = BBR_MIN_CWND;
+    }
+
+    double rate = state->pacingGain * state->bottleneckBandwidth * cc->packetSize;
+    if (rate > 0 && (state->filledPipe || rate > cc->pacingRate)) {
+        cc->pacingRate = rate;
+    }
+}
+
+/**
+ * @brief Ignores isolated losses, since the model is driven by the delivery rate.
+ *
+ * @param cc The congestion controller.
+ * @param nowMs The time of the loss in ms.
+ */
+void bbrOnLoss(CongestionControl *cc, double nowMs) {
+    (void)cc;
+    (void)nowMs;
+}
+
+/**
+ * @brief Falls back to a single packet after a timeout until ACKs rebuild the window.
+ *
+ * @param cc The congestion controller.
+ * @param nowMs The time of the timeout in ms.
+ */
+void bbrOnTimeout(CongestionControl *cc, double nowMs) {
+    (void)nowMs;
+    cc->cwnd = 1;
+}
+
+/**
+ * @brief Releases the BBR state.
+ *
+ * @param cc The congestion controller.
+ */
+void bbrRelease(CongestionControl *cc) {
+    free(cc->state);
+    cc->state = NULL;
+}
+
+/**
+ * @brief Installs the BBR callbacks and state in a congestion controller.
+ *
+ * @param cc The congestion controller.
+ * @return int 0 on success, -1 if the state could not be allocated.
+ */
+int initBbr(CongestionControl *cc) {
+    BbrState *state = calloc(1, sizeof(BbrState));
+    if (state == NULL) {
+        return -1;
+    }
+    state->mode = BBR_STARTUP;
+    state->minRttMs = -1;
+    state->pacingGain = BBR_HIGH_GAIN;
+    state->cwndGain = BBR_HIGH_GAIN;
+
+    cc->name = "bbr";
+    cc->state = state;
+    cc->onAck = bbrOnAck;
+    cc->onLoss = bbrOnLoss;
+    cc->onTimeout = bbrOnTimeout;
+    cc->release = bbrRelease;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,165 @@
+/**
+*   @file cc_cubic.h
+*   @brief CUBIC congestion control.
+*
+*   CUBIC grows the window as a cubic function of the time elapsed since the last
+*   loss, centered on the window size at which that loss happened. The window climbs
+*   quickly towards the previous maximum, flattens out around it and then probes
+*   beyond it, which keeps utilization high on links with a large bandwidth-delay
+*   product. A Reno-friendly estimate keeps CUBIC at least as aggressive as AIMD on
+*   short paths, and fast convergence releases bandwidth to new flows. The constants
+*   follow RFC 9438. This file is included by congestion_control.h.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef CC_CUBIC_H
+#define CC_CUBIC_H
+
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * @def CUBIC_C
+ * Definition specifying the scaling constant of the cubic function.
+ */
+#define CUBIC_C 0.4
+
+/**
+ * @def CUBIC_BETA
+ * Definition specifying the factor applied to the window when a loss is detected.
+ */
+#define CUBIC_BETA 0.7
+
+/**
+ * @struct CubicState
+ * @brief State kept by CUBIC between congestion events.
+ */
+typedef struct {
+    double wMax;          /**< Window, in packets, right before the last reduction. */
+    double k;             /**< Time in seconds the cubic function takes to reach wMax. */
+    double origin;        /**< Window at the plateau of the cubic function. */
+    double wEst;          /**< Window an AIMD flow would have reached since the epoch. */
+    double epochStartMs;  /**< Start of the current congestion avoidance epoch, negative if none. */
+} CubicState;
+
+/**
+ * @brief Grows the window along the cubic function for newly acknowledged packets.
+ *
+ * @param cc The congestion controller.
+ * @param sample The ACK information reported by the sender.
+ */
+void cubicOnAck(CongestionControl *cc, const AckSample *sample) {
+    CubicState *state = cc->state;
+
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += sample->ackedPackets;
+        updateWindowPacingRate(cc, sample->smoothedRttMs);
+        return;
+    }
+
+    if (state->epochStartMs < 0) {
+        state->epochStartMs = sample->nowMs;
+        if (cc->cwnd < state->wMax) {
+            state->k = cbrt((state->wMax - cc->cwnd) / CUBIC_C);
+            state->origin = state->wMax;
+        } else {
+            state->k = 0;
+            state->origin = cc->cwnd;
+        }
+        state->wEst = cc->cwnd;
+    }
+
+    double t = (sample->nowMs - state->epochStartMs + sample->smoothedRttMs) / 1000.0;
+    double target = state->origin + CUBIC_C * pow(t - state->k, 3);
+    if (target < cc->cwnd) {
+        target = cc->cwnd;
+    } else if (target > 1.5 * cc->cwnd) {
+        target = 1.5 * cc->cwnd;
+    }
+
+    /*
+     * Reno-friendly region: never grow slower than an AIMD flow would.
+     */
+    double alpha = 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA);
+    state->wEst += alpha * sample->ackedPackets / cc->cwnd;
+    if (state->wEst > target) {
+        target = state->wEst;
+    }
+
+    cc->cwnd += (target - cc->cwnd) / cc->cwnd * sample->ackedPackets;
+    updateWindowPacingRate(cc, sample->smoothedRttMs);
+}
+
+/**
+ * @brief Reduces the window after a loss and starts a new epoch.
+ *
+ * @param cc The congestion controller.
+ * @param nowMs The time of the loss in ms.
+ */
+void cubicOnLoss(CongestionControl *cc, double nowMs) {
+    CubicState *state = cc->state;
+    (void)nowMs;
+
+    /*
+     * Fast convergence: a flow whose maximum keeps shrinking gives up extra bandwidth.
+     */
+    if (cc->cwnd < state->wMax) {
+        state->wMax = cc->cwnd * (1 + CUBIC_BETA) / 2;
+    } else {
+        state->wMax = cc->cwnd;
+    }
+
+    state->epochStartMs = -1;
+    cc->cwnd *= CUBIC_BETA;
+    if (cc->cwnd < MIN_CWND) {
+        cc->cwnd = MIN_CWND;
+    }
+    cc->ssthresh = cc->cwnd;
+}
+
+/**
+ * @brief Restarts slow start from a single packet after a timeout.
+ *
+ * @param cc The congestion controller.
+ * @param nowMs The time of the timeout in ms.
+ */
+void cubicOnTimeout(CongestionControl *cc, double nowMs) {
+    cubicOnLoss(cc, nowMs);
+    cc->cwnd = 1;
+}
+
+/**
+ * @brief Releases the CUBIC state.
+ *
+ * @param cc The congestion controller.
+ */
+void cubicRelease(CongestionControl *cc) {
+    free(cc->state);
+    cc->state = NULL;
+}
+
+/**
+ * @brief Installs the CUBIC callbacks and state in a congestion controller.
+ *
+ * @param cc The congestion controller.
+ * @return int 0 on success, -1 if the state could not be allocated.
+ */
+int initCubic(CongestionControl *cc) {
+    CubicState *state = calloc(1, sizeof(CubicState));
+    if (state == NULL) {
+        return -1;
+    }
+    state->epochStartMs = -1;
+
+    cc->name = "cubic";
+    cc->state = state;
+    cc->onAck = cubicOnAck;
+    cc->onLoss = cubicOnLoss;
+    cc->onTimeout = cubicOnTimeout;
+    cc->release = cubicRelease;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,364 @@
+/**
+*   @file compression.h
+*   @brief Fast LZ compression of packet payloads, with a bypass for data that does not shrink.
+*
+*   On a link whose bandwidth is the bottleneck, every byte saved is time saved, and text
+*   or logs often shrink to a fraction of their size. Each payload is compressed on its
+*   own, so a packet can be decompressed the moment it arrives, in any order, and a lost
+*   packet costs nothing more than itself. The codec is an LZ77 variant in the spirit of
+*   LZ4, built for speed rather than ratio: a payload is a series of sequences, each a
+*   token, a run of literal bytes, and a match that copies bytes already decoded. The
+*   upper half of the token holds the literal count and the lower half the match length
+*   minus COMPRESS_MIN_MATCH; a half of 15 is continued by bytes that are added to it,
+*   255 meaning that another byte follows. A match is a two-byte little-endian distance
+*   back into the decoded bytes. The last sequence only has literals.
+*
+*   Compressing data that is already compressed, such as video, is wasted work, so the
+*   Compressor of a stream gives up after COMPRESS_FAILURES payloads in a row that did not
+*   shrink by at least 1/COMPRESS_MIN_SAVING, and sends a growing number of payloads
+*   untouched before it tries again. The compressor also skips ahead faster the longer it
+*   goes without a match, so even the payloads it tries cost little on such data. A
+*   payload that did not shrink is always sent as it is.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+/**
+ * @def COMPRESS_HASH_BITS
+ * Definition specifying the number of bits of the hash table of recent positions.
+ */
+#define COMPRESS_HASH_BITS 12
+
+/**
+ * @def COMPRESS_MIN_MATCH
+ * Definition specifying the shortest match worth encoding.
+ */
+#define COMPRESS_MIN_MATCH 4
+
+/**
+ * @def COMPRESS_MAX_DISTANCE
+ * Definition specifying the farthest back a match may start; payloads never get near it.
+ */
+#define COMPRESS_MAX_DISTANCE 65535
+
+/**
+ * @def COMPRESS_MIN_SAVING
+ * Definition specifying the fraction, 1/COMPRESS_MIN_SAVING, of a payload compression
+ * must save for the payload to be sent compressed.
+ */
+#define COMPRESS_MIN_SAVING 16
+
+/**
+ * @def COMPRESS_FAILURES
+ * Definition specifying how many payloads in a row must fail to shrink before the
+ * compressor stops trying for a while.
+ */
+#define COMPRESS_FAILURES 4
+
+/**
+ * @def COMPRESS_MIN_BYPASS
+ * Definition specifying how many payloads are sent untouched the first time compression
+ * is given up.
+ */
+#define COMPRESS_MIN_BYPASS 16
+
+/**
+ * @def COMPRESS_MAX_BYPASS
+ * Definition specifying the most payloads sent untouched before compression is tried
+ * again; every give-up in a row doubles the count up to this.
+ */
+#define COMPRESS_MAX_BYPASS 1024
+
+/**
+ * @struct Compressor
+ * @brief Compression state of a stream: the bypass and what compression saved.
+ */
+typedef struct {
+    uint16_t table[1 << COMPRESS_HASH_BITS];    /**< Latest position of every hash of four bytes. */
+    int failures;                               /**< Payloads in a row that did not shrink. */
+    int bypassRemaining;                        /**< Payloads still to send untouched. */
+    int bypassLength;                           /**< Payloads to send untouched the next time compression is given up. */
+    unsigned long long int packets;             /**< Payloads offered. */
+    unsigned long long int compressedPackets;   /**< Payloads sent compressed. */
+    unsigned long long int inputBytes;          /**< Bytes of the payloads offered. */
+    unsigned long long int outputBytes;         /**< Bytes of the payloads as sent. */
+} Compressor;
+
+/**
+ * @brief Prepares a compressor that tries every payload.
+ *
+ * @param compressor The compressor to initialize.
+ * @return Void.
+ */
+void initCompressor(Compressor *compressor) {
+    memset(compressor, 0, sizeof(*compressor));
+    compressor->bypassLength = COMPRESS_MIN_BYPASS;
+}
+
+/**
+ * @brief Reads four bytes in the byte order of the machine.
+ *
+ * @param data The bytes.
+ * @return uint32_t The value.
+ */
+uint32_t readWord(const char *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Writes the continuation bytes of a length whose token half is 15.
+ *
+ * @param output The output buffer.
+ * @param position Position of the next byte, advanced.
+ * @param capacity Size of the output buffer.
+ * @param length The length minus 15.
+ * @return int 0 on success, -1 if the output is full.
+ */
+int putLength(char *output, size_t *position, size_t capacity, size_t length) {
+    while (1) {
+        if (*position == capacity) {
+            return -1;
+        }
+        unsigned char byte = length >= 255 ? 255 : length;
+        output[(*position)++] = byte;
+        if (byte < 255) {
+            return 0;
+        }
+        length -= 255;
+    }
+}
+
+/**
+ * @brief Writes one sequence: its token, its literals and, unless matchLength is 0, its match.
+ *
+ * @param output The output buffer.
+ * @param position Position of the next byte, advanced.
+ * @param capacity Size of the output buffer.
+ * @param literals The literal bytes.
+ * @param literalLength The number of literal bytes.
+ * @param distance How far back the match starts.
+ * @param matchLength The length of the match, 0 for the last sequence.
+ * @return int 0 on success, -1 if the output is full.
+ */
+int putSequence(char *output, size_t *position, size_t capacity, const char *literals, size_t literalLength,
+                size_t distance, size_t matchLength) {
+    size_t matchCode = matchLength > 0 ? matchLength - COMPRESS_MIN_MATCH : 0;
+    if (*position == capacity) {
+        return -1;
+    }
+    output[(*position)++] = (char)(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalLength >= 15 && putLength(output, position, capacity, literalLength - 15) < 0) {
+        return -1;
+    }
+    if (capacity - *position < literalLength) {
+        return -1;
+    }
+    memcpy(output + *position, literals, literalLength);
+    *position += literalLength;
+
+    if (matchLength == 0) {
+        return 0;
+    }
+    if (capacity - *position < 2) {
+        return -1;
+    }
+    output[(*position)++] = (char)(distance & 0xff);
+    output[(*position)++] = (char)(distance >> 8);
+    if (matchCode >= 15 && putLength(output, position, capacity, matchCode - 15) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Compresses a payload, if it fits in capacity bytes once compressed.
+ *
+ * Positions are kept as 16-bit values, so the payload must be shorter than 64 KB.
+ *
+ * @param table The hash table of the compressor, overwritten.
+ * @param input The payload.
+ * @param length The number of bytes of the payload.
+ * @param output Where the compressed payload goes.
+ * @param capacity The most bytes the compressed payload may take.
+ * @return size_t The size of the compressed payload, 0 if it does not fit.
+ */
+size_t compressBlock(uint16_t *table, const char *input, size_t length, char *output, size_t capacity) {
+    size_t position = 0;
+    size_t anchor = 0;
+    size_t written = 0;
+    unsigned int misses = 0;
+
+    if (length > COMPRESS_MAX_DISTANCE) {
+        return 0;
+    }
+    memset(table, 0, sizeof(uint16_t) << COMPRESS_HASH_BITS);
+
+    /*
+     * Look up every position, or every few once matches are scarce, in the table of the
+     * latest position with the same hash, and verify the candidate before using it.
+     */
+    while (length >= COMPRESS_MIN_MATCH && position <= length - COMPRESS_MIN_MATCH) {
+        uint32_t word = readWord(input + position);
+        uint32_t hash = (word * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+        size_t candidate = table[hash];
+        table[hash] = (uint16_t)position;
+
+        if (candidate >= position || readWord(input + candidate) != word) {
+            position += 1 + (misses++ >> 5);
+            continue;
+        }
+
+        size_t matchLength = COMPRESS_MIN_MATCH;
+        while (position + matchLength < length && input[candidate + matchLength] == input[position + matchLength]) {
+            matchLength++;
+        }
+        if (putSequence(output, &written, capacity, input + anchor, position - anchor, position - candidate, matchLength) < 0) {
+            return 0;
+        }
+        position += matchLength;
+        anchor = position;
+        misses = 0;
+    }
+
+    if (putSequence(output, &written, capacity, input + anchor, length - anchor, 0, 0) < 0) {
+        return 0;
+    }
+    return written;
+}
+
+/**
+ * @brief Reads the continuation bytes of a length whose token half is 15.
+ *
+ * @param input The compressed payload.
+ * @param position Position of the next byte, advanced.
+ * @param length The number of bytes of the compressed payload.
+ * @param value The length so far, increased.
+ * @return int 0 on success, -1 if the payload ends first.
+ */
+int getLength(const unsigned char *input, size_t *position, size_t length, size_t *value) {
+    unsigned char byte;
+    do {
+        if (*position == length) {
+            return -1;
+        }
+        byte = input[(*position)++];
+        *value += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/**
+ * @brief Decompresses a payload, checking every length and distance against its buffers.
+ *
+ * @param input The compressed payload.
+ * @param length The number of bytes of the compressed payload.
+ * @param output Where the payload goes.
+ * @param capacity The size of output.
+ * @return ssize_t The size of the payload, or -1 if the compressed payload is malformed
+ * or does not fit.
+ */
+ssize_t decompressBlock(const char *input, size_t length, char *output, size_t capacity) {
+    const unsigned char *bytes = (const unsigned char *)input;
+    size_t position = 0;
+    size_t written = 0;
+
+    while (position < length) {
+        unsigned char token = bytes[position++];
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && getLength(bytes, &position, length, &literalLength) < 0) {
+            return -1;
+        }
+        if (literalLength > length - position || literalLength > capacity - written) {
+            return -1;
+        }
+        memcpy(output + written, input + position, literalLength);
+        position += literalLength;
+        written += literalLength;
+
+        if (position == length) {
+            break;
+        }
+        if (length - position < 2) {
+            return -1;
+        }
+        size_t distance = bytes[position] | (bytes[position + 1] << 8);
+        position += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && getLength(bytes, &position, length, &matchLength) < 0) {
+            return -1;
+        }
+        matchLength += COMPRESS_MIN_MATCH;
+        if (distance == 0 || distance > written || matchLength > capacity - written) {
+            return -1;
+        }
+
+        /*
+         * A match may overlap the bytes it produces, which repeats them.
+         */
+        char *source = output + written - distance;
+        if (distance >= matchLength) {
+            memcpy(output + written, source, matchLength);
+        } else {
+            for (size_t i = 0; i < matchLength; i++) {
+                output[written + i] = source[i];
+            }
+        }
+        written += matchLength;
+    }
+    return written;
+}
+
+/**
+ * @brief Compresses a payload unless the compressor bypasses it, and counts the result.
+ *
+ * @param compressor The compressor of the stream.
+ * @param input The payload.
+ * @param length The number of bytes of the payload.
+ * @param output Where the compressed payload goes, at least length bytes.
+ * @return size_t The size of the compressed payload, or 0 to send the payload as it is.
+ */
+size_t compressPayload(Compressor *compressor, const char *input, size_t length, char *output) {
+    size_t compressed = 0;
+
+    compressor->packets++;
+    compressor->inputBytes += length;
+    if (compressor->bypassRemaining > 0) {
+        compressor->bypassRemaining--;
+    } else if (length > COMPRESS_MIN_SAVING) {
+        compressed = compressBlock(compressor->table, input, length, output, length - length / COMPRESS_MIN_SAVING);
+
+        /*
+         * Stop trying after a run of failures, for twice as long as the previous time if
+         * no payload shrank since.
+         */
+        if (compressed > 0) {
+            compressor->failures = 0;
+            compressor->bypassLength = COMPRESS_MIN_BYPASS;
+        } else if (++compressor->failures == COMPRESS_FAILURES) {
+            compressor->failures = 0;
+            compressor->bypassRemaining = compressor->bypassLength;
+            if (compressor->bypassLength < COMPRESS_MAX_BYPASS) {
+                compressor->bypassLength *= 2;
+            }
+        }
+    }
+
+    if (compressed > 0) {
+        compressor->compressedPackets++;
+    }
+    compressor->outputBytes += compressed > 0 ? compressed : length;
+    return compressed;
+}
+
+#endif
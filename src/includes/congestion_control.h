@@ -0,0 +1,146 @@
+/**
+*   @file congestion_control.h
+*   @brief Interface shared by the congestion control algorithms of the sender.
+*
+*   A congestion controller is a CongestionControl structure holding the algorithm's
+*   callbacks and state. The sender reports every acknowledgment, loss and timeout
+*   through the callbacks and asks the controller for its congestion window (in
+*   packets) and pacing rate (in bytes per second) before sending new data.
+*   The algorithms themselves live in cc_aimd.h, cc_cubic.h and cc_bbr.h, and
+*   initCongestionControl selects one of them by name.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef CONGESTION_CONTROL_H
+#define CONGESTION_CONTROL_H
+
+#include <string.h>
+
+/**
+ * @def INITIAL_CWND
+ * Definition specifying the congestion window, in packets, at the start of a transfer.
+ */
+#define INITIAL_CWND 4
+
+/**
+ * @def MIN_CWND
+ * Definition specifying the smallest congestion window, in packets, after a loss.
+ */
+#define MIN_CWND 2
+
+/**
+ * @struct AckSample
+ * @brief Information the sender reports to the congestion controller for each ACK.
+ */
+typedef struct {
+    double nowMs;                /**< Time of the ACK in ms since the start of the transfer. */
+    int ackedPackets;            /**< Number of packets newly acknowledged by this ACK. */
+    double rttMs;                /**< RTT sample in ms, or a negative value if the ACK gave none. */
+    double smoothedRttMs;        /**< Smoothed RTT currently used by the sender in ms. */
+    double deliveryRate;         /**< Delivery rate sample in packets per second, 0 if unknown. */
+    long long delivered;         /**< Total packets delivered so far, including this ACK. */
+    long long priorDelivered;    /**< Packets delivered when the acknowledged packet was sent. */
+    int packetsInFlight;         /**< Unacknowledged packets after processing the ACK. */
+} AckSample;
+
+/**
+ * @struct CongestionControl
+ * @brief Callbacks and state of a congestion control algorithm.
+ */
+typedef struct CongestionControl {
+    const char *name;       /**< Name used to select the algorithm on the command line. */
+    double cwnd;            /**< Congestion window in packets. */
+    double ssthresh;        /**< Slow start threshold in packets. */
+    double pacingRate;      /**< Pacing rate in bytes per second, 0 until known. */
+    int packetSize;         /**< Bytes sent per packet, used to derive the pacing rate. */
+    void *state;            /**< Algorithm specific state. */
+
+    /** Called for every ACK that acknowledges new data. */
+    void (*onAck)(struct CongestionControl *cc, const AckSample *sample);
+    /** Called once per loss episode when a packet is detected as lost. */
+    void (*onLoss)(struct CongestionControl *cc, double nowMs);
+    /** Called once per retransmission timeout. */
+    void (*onTimeout)(struct CongestionControl *cc, double nowMs);
+    /** Releases the algorithm specific state. */
+    void (*release)(struct CongestionControl *cc);
+} CongestionControl;
+
+/**
+ * @brief Returns the congestion window as a whole number of packets.
+ *
+ * @param cc The congestion controller.
+ * @return int The number of packets allowed in flight, at least 1.
+ */
+int getCongestionWindow(CongestionControl *cc) {
+    return cc->cwnd < 1 ? 1 : (int)cc->cwnd;
+}
+
+/**
+ * @brief Returns the rate at which the controller wants packets to be sent.
+ *
+ * @param cc The congestion controller.
+ * @return double The pacing rate in bytes per second, 0 if the controller has no estimate yet.
+ */
+double getPacingRate(CongestionControl *cc) {
+    return cc->pacingRate;
+}
+
+/**
+ * @brief Derives a pacing rate from the congestion window for window based algorithms.
+ *
+ * The window is spread over one smoothed RTT, with extra headroom while the window is
+ * still growing in slow start.
+ *
+ * @param cc The congestion controller.
+ * @param smoothedRttMs The smoothed RTT in ms.
+ */
+void updateWindowPacingRate(CongestionControl *cc, double smoothedRttMs) {
+    if (smoothedRttMs <= 0) {
+        return;
+    }
+    double gain = cc->cwnd < cc->ssthresh ? 2.0 : 1.25;
+    cc->pacingRate = gain * cc->cwnd * cc->packetSize / (smoothedRttMs / 1000.0);
+}
+
+#include "cc_aimd.h"
+#include "cc_cubic.h"
+#include "cc_bbr.h"
+
+/**
+ * @brief Initializes a congestion controller given the name of its algorithm.
+ *
+ * @param cc The congestion controller to initialize.
+ * @param name The algorithm name: "aimd", "cubic" or "bbr".
+ * @param packetSize The number of bytes sent per packet.
+ * @return int 0 on success, -1 if the name is unknown or the state could not be allocated.
+ */
+int initCongestionControl(CongestionControl *cc, const char *name, int packetSize) {
+    memset(cc, 0, sizeof(*cc));
+    cc->cwnd = INITIAL_CWND;
+    cc->ssthresh = 1e9;
+    cc->packetSize = packetSize;
+
+    if (strcmp(name, "aimd") == 0) {
+        return initAimd(cc);
+    } else if (strcmp(name, "cubic") == 0) {
+        return initCubic(cc);
+    } else if (strcmp(name, "bbr") == 0) {
+        return initBbr(cc);
+    }
+    return -1;
+}
+
+/**
+ * @brief Releases the state held by a congestion controller.
+ *
+ * @param cc The congestion controller.
+ */
+void freeCongestionControl(CongestionControl *cc) {
+    if (cc->release != NULL) {
+        cc->release(cc);
+    }
+}
+
+#endif
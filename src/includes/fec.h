@@ -0,0 +1,596 @@
+/**
+*   @file fec.h
+*   @brief Forward error correction with XOR and Reed-Solomon parity packets.
+*
+*   A lost packet normally costs the sender at least one round trip to notice and
+*   resend it. With forward error correction the sender splits the data packets of a
+*   stream into blocks of blockSize consecutive sequence numbers and follows each block
+*   with parityCount parity packets. The receiver rebuilds up to parityCount packets
+*   missing from a block as soon as enough parity arrived, without waiting for a
+*   retransmission. The code is a systematic Reed-Solomon code over GF(256) built from a
+*   Cauchy matrix, so any parityCount packets of a block can be rebuilt from the others.
+*   Every column of the matrix is scaled so that its first row is all ones: the first
+*   parity packet of a block is the XOR of its data packets, and a single parity packet
+*   per block is plain XOR parity.
+*
+*   The payloads of a block are treated as symbols padded with zeros to the longest one.
+*   Parity is accumulated as the data packets are sent, so the sender never keeps a
+*   block around. The receiver keeps a copy of the payloads of recent packets, and of
+*   the parity packets, in rings indexed by sequence number; a parity packet carries a
+*   FecInfo describing its block, from which the offset and length of every rebuilt
+*   packet follow, since all the packets of a block but its last one are full. A sender
+*   reading a stream of unknown length ends a block early at every short packet, so
+*   blocks may hold fewer than blockSize packets; a parity packet is only combined with
+*   parity of the same block, told apart by its offset.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "packet_header.h"
+#include "integrity.h"
+#include "batch_io.h"
+#include "pacing.h"
+
+/**
+ * @def FEC_MAX_BLOCK
+ * Definition specifying the largest number of data packets in a block.
+ */
+#define FEC_MAX_BLOCK 64
+
+/**
+ * @def FEC_MAX_PARITY
+ * Definition specifying the largest number of parity packets per block.
+ */
+#define FEC_MAX_PARITY 8
+
+/**
+ * @def FEC_HISTORY
+ * Definition specifying how many recent packets, and parity packets, the receiver keeps
+ * for rebuilding. It covers the largest window, so a block is never partly overwritten.
+ */
+#define FEC_HISTORY 256
+
+/**
+ * @def FEC_POLYNOMIAL
+ * Definition specifying the primitive polynomial x^8 + x^4 + x^3 + x^2 + 1 of GF(256).
+ */
+#define FEC_POLYNOMIAL 0x11d
+
+/**
+ * @struct FecInfo
+ * @brief Description of a block, sent after the header of each of its parity packets.
+ *
+ * The header of a parity packet carries the sequence number of the first data packet
+ * of the block and its file offset.
+ */
+typedef struct {
+    unsigned short blockPackets;    /**< Data packets in the block, fewer than blockSize at the end of a stream. */
+    unsigned char parityIndex;      /**< Row of the parity packet in the coding matrix. */
+    unsigned char parityCount;      /**< Parity packets sent for the block. */
+    unsigned int blockBytes;        /**< Payload bytes of all the data packets of the block. */
+} FecInfo;
+
+/**
+ * @struct ParityHeader
+ * @brief The header and block description of a parity packet, sent before its symbol.
+ */
+typedef struct {
+    WireHeader header;              /**< Header with the IS_PARITY flag set. */
+    FecInfo info;                   /**< Description of the block. */
+} ParityHeader;
+
+_Static_assert(sizeof(ParityHeader) == WIRE_HEADER_SIZE + sizeof(FecInfo), "the block description must follow the header");
+
+/**
+ * @struct FecEncoder
+ * @brief Parity of the block the sender is filling, and storage for parity packets in a send batch.
+ */
+typedef struct {
+    int blockSize;                  /**< Data packets per block. */
+    int parityCount;                /**< Parity packets per block. */
+    size_t symbolSize;              /**< Largest payload of a data packet. */
+    char *parity;                   /**< parityCount accumulated parity symbols. */
+    long long blockStart;           /**< Sequence number of the first packet of the block. */
+    long long blockOffset;          /**< File offset of the first packet of the block. */
+    int blockPackets;               /**< Data packets added to the block so far. */
+    unsigned int blockBytes;        /**< Payload bytes added to the block so far. */
+    size_t symbolLength;            /**< Longest payload in the block so far. */
+    ParityHeader *headers;          /**< Header of the parity packet at each position of the batch. */
+    char *symbols;                  /**< Symbol of the parity packet at each position of the batch. */
+    unsigned long long paritySent;  /**< Parity packets sent. */
+} FecEncoder;
+
+/**
+ * @struct FecSymbol
+ * @brief A data or parity packet kept by the receiver for rebuilding.
+ */
+typedef struct {
+    long long tag;                  /**< Sequence number of a data packet, first sequence number of the block plus the row of a parity packet, or -1. */
+    size_t length;                  /**< Bytes in data. */
+    long long offset;               /**< File offset of a data packet, or of the block of a parity packet. */
+    FecInfo info;                   /**< Description of the block of a parity packet. */
+    char *data;                     /**< Payload or parity symbol. */
+} FecSymbol;
+
+/**
+ * @struct FecDecoder
+ * @brief Recent packets of a stream and the packets rebuilt from them.
+ */
+typedef struct {
+    FecSymbol *packets;             /**< Ring of data packets, by sequence number; NULL until the stream uses FEC. */
+    FecSymbol *parity;              /**< Ring of parity packets, by tag. */
+    char *memory;                   /**< Memory backing the symbols of both rings. */
+    char *syndromes;                /**< FEC_MAX_PARITY work symbols. */
+    size_t symbolSize;              /**< Room for each symbol. */
+    FecSymbol *recovered[FEC_MAX_PARITY]; /**< Packets rebuilt by the latest parity packet. */
+    unsigned long long recoveredPackets; /**< Packets rebuilt so far. */
+} FecDecoder;
+
+/**
+ * @brief Powers of the generator of GF(256), repeated once so products need no reduction.
+ */
+static unsigned char gfExp[512];
+
+/**
+ * @brief Discrete logarithms of the non-zero elements of GF(256).
+ */
+static unsigned char gfLog[256];
+
+/**
+ * @brief Guards the construction of the tables, shared by every thread.
+ */
+static pthread_once_t gfTablesOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Fills the exponent and logarithm tables of GF(256).
+ */
+void buildGaloisTables() {
+    int value = 1;
+    for (int power = 0; power < 255; power++) {
+        gfExp[power] = value;
+        gfLog[value] = power;
+        value <<= 1;
+        if (value & 0x100) {
+            value ^= FEC_POLYNOMIAL;
+        }
+    }
+    for (int power = 255; power < 512; power++) {
+        gfExp[power] = gfExp[power - 255];
+    }
+}
+
+/**
+ * @brief Multiplies two elements of GF(256).
+ *
+ * @param a The first factor.
+ * @param b The second factor.
+ * @return unsigned char The product.
+ */
+unsigned char gfMultiply(unsigned char a, unsigned char b) {
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    return gfExp[gfLog[a] + gfLog[b]];
+}
+
+/**
+ * @brief Divides two elements of GF(256).
+ *
+ * @param a The dividend.
+ * @param b The divisor, non-zero.
+ * @return unsigned char The quotient.
+ */
+unsigned char gfDivide(unsigned char a, unsigned char b) {
+    if (a == 0) {
+        return 0;
+    }
+    return gfExp[gfLog[a] + 255 - gfLog[b]];
+}
+
+/**
+ * @brief Adds a multiple of a symbol to another: dst += factor * src, over GF(256).
+ *
+ * Addition is XOR, so a factor of 1 is a plain XOR. Other factors go through a table of
+ * the 256 products of the factor, built once per call.
+ *
+ * @param dst The symbol to add to.
+ * @param src The symbol to add.
+ * @param factor The factor.
+ * @param length The number of bytes of src.
+ */
+void gfMultiplyAdd(unsigned char *dst, const unsigned char *src, unsigned char factor, size_t length) {
+    if (factor == 0) {
+        return;
+    }
+    if (factor == 1) {
+        for (size_t i = 0; i < length; i++) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+
+    unsigned char products[256];
+    for (int value = 0; value < 256; value++) {
+        products[value] = gfMultiply(factor, value);
+    }
+    for (size_t i = 0; i < length; i++) {
+        dst[i] ^= products[src[i]];
+    }
+}
+
+/**
+ * @brief Returns the coefficient of a data packet in a parity packet.
+ *
+ * The coefficients form the Cauchy matrix 1 / (row + (parityCount + column)), with
+ * every column divided by its first row, so the first row is all ones. Every square
+ * submatrix of it is invertible, which makes the code able to rebuild any parityCount
+ * packets.
+ *
+ * @param row The row of the parity packet, below parityCount.
+ * @param column The position of the data packet in its block, below FEC_MAX_BLOCK.
+ * @param parityCount The number of parity packets per block.
+ * @return unsigned char The coefficient.
+ */
+unsigned char fecCoefficient(int row, int column, int parityCount) {
+    unsigned char y = parityCount + column;
+    return gfDivide(y, row ^ y);
+}
+
+/**
+ * @brief Inverts a square matrix over GF(256) by Gauss-Jordan elimination.
+ *
+ * @param matrix The matrix, size by size, replaced by its inverse.
+ * @param size The order of the matrix, at most FEC_MAX_PARITY.
+ * @return int 0 on success, -1 if the matrix is singular.
+ */
+int gfInvertMatrix(unsigned char matrix[FEC_MAX_PARITY][FEC_MAX_PARITY], int size) {
+    unsigned char inverse[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    memset(inverse, 0, sizeof(inverse));
+    for (int i = 0; i < size; i++) {
+        inverse[i][i] = 1;
+    }
+
+    for (int column = 0; column < size; column++) {
+        int pivot = column;
+        while (pivot < size && matrix[pivot][column] == 0) {
+            pivot++;
+        }
+        if (pivot == size) {
+            return -1;
+        }
+        for (int k = 0; k < size; k++) {
+            unsigned char swap = matrix[column][k];
+            matrix[column][k] = matrix[pivot][k];
+            matrix[pivot][k] = swap;
+            swap = inverse[column][k];
+            inverse[column][k] = inverse[pivot][k];
+            inverse[pivot][k] = swap;
+        }
+
+        unsigned char scale = matrix[column][column];
+        for (int k = 0; k < size; k++) {
+            matrix[column][k] = gfDivide(matrix[column][k], scale);
+            inverse[column][k] = gfDivide(inverse[column][k], scale);
+        }
+        for (int row = 0; row < size; row++) {
+            unsigned char factor = matrix[row][column];
+            if (row == column || factor == 0) {
+                continue;
+            }
+            for (int k = 0; k < size; k++) {
+                matrix[row][k] ^= gfMultiply(factor, matrix[column][k]);
+                inverse[row][k] ^= gfMultiply(factor, inverse[column][k]);
+            }
+        }
+    }
+
+    memcpy(matrix, inverse, sizeof(inverse));
+    return 0;
+}
+
+/**
+ * @brief Starts a new block in an encoder.
+ *
+ * @param encoder The encoder.
+ */
+void resetFecBlock(FecEncoder *encoder) {
+    memset(encoder->parity, 0, encoder->parityCount * encoder->symbolSize);
+    encoder->blockPackets = 0;
+    encoder->blockBytes = 0;
+    encoder->symbolLength = 0;
+}
+
+/**
+ * @brief Allocates an encoder.
+ *
+ * @param encoder The encoder to initialize.
+ * @param blockSize The number of data packets per block, 1 to FEC_MAX_BLOCK.
+ * @param parityCount The number of parity packets per block, 1 to FEC_MAX_PARITY.
+ * @param symbolSize The largest payload of a data packet.
+ * @param batchCapacity The capacity of the send batch the parity packets are queued in.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initFecEncoder(FecEncoder *encoder, int blockSize, int parityCount, size_t symbolSize, int batchCapacity) {
+    pthread_once(&gfTablesOnce, buildGaloisTables);
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->blockSize = blockSize;
+    encoder->parityCount = parityCount;
+    encoder->symbolSize = symbolSize;
+    encoder->parity = malloc(parityCount * symbolSize);
+    encoder->headers = calloc(batchCapacity, sizeof(ParityHeader));
+    encoder->symbols = malloc(batchCapacity * symbolSize);
+    if (encoder->parity == NULL || encoder->headers == NULL || encoder->symbols == NULL) {
+        return -1;
+    }
+    resetFecBlock(encoder);
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by an encoder.
+ *
+ * @param encoder The encoder to free.
+ */
+void freeFecEncoder(FecEncoder *encoder) {
+    free(encoder->parity);
+    free(encoder->headers);
+    free(encoder->symbols);
+    encoder->parity = NULL;
+    encoder->headers = NULL;
+    encoder->symbols = NULL;
+}
+
+/**
+ * @brief Adds a data packet to the parity of its block.
+ *
+ * Data packets must be added in sequence order, once each; a block holds the sequence
+ * numbers from a multiple of blockSize.
+ *
+ * @param encoder The encoder.
+ * @param header The header of the data packet.
+ * @param payload The payload of the data packet.
+ * @param length The number of bytes of the payload, at most symbolSize.
+ * @return int Non-zero once the block is full and its parity must be sent.
+ */
+int addFecPacket(FecEncoder *encoder, PacketHeader *header, const char *payload, size_t length) {
+    if (encoder->blockPackets == 0) {
+        encoder->blockStart = header->sequenceNumber;
+        encoder->blockOffset = header->offset;
+    }
+
+    int column = encoder->blockPackets++;
+    for (int row = 0; row < encoder->parityCount; row++) {
+        gfMultiplyAdd((unsigned char *)encoder->parity + row * encoder->symbolSize, (const unsigned char *)payload,
+                      fecCoefficient(row, column, encoder->parityCount), length);
+    }
+    encoder->blockBytes += length;
+    if (length > encoder->symbolLength) {
+        encoder->symbolLength = length;
+    }
+    return encoder->blockPackets == encoder->blockSize;
+}
+
+/**
+ * @brief Queues the parity packets of the current block and starts the next block.
+ *
+ * The parity packets are copied to the storage for their positions in the batch, so
+ * like the batch's other datagrams they stay valid until it is flushed. They are paced
+ * like data packets. Nothing is queued if the block is empty.
+ *
+ * @param encoder The encoder.
+ * @param batch The send batch.
+ * @param destAddr The destination of the parity packets.
+ * @param pacer The pacer of the socket.
+ * @param connectionId The connection ID of the transfer.
+ * @return int The number of parity packets queued.
+ */
+int queueFecParity(FecEncoder *encoder, SendBatch *batch, struct sockaddr_in *destAddr, Pacer *pacer,
+                   unsigned int connectionId) {
+    if (encoder->blockPackets == 0) {
+        return 0;
+    }
+
+    for (int row = 0; row < encoder->parityCount; row++) {
+        int index = batch->count;
+        ParityHeader *parity = &encoder->headers[index];
+        char *symbol = encoder->symbols + index * encoder->symbolSize;
+
+        PacketHeader header;
+        header.sequenceNumber = encoder->blockStart;
+        header.flags = setFlag(0, IS_PARITY);
+        header.timestamp = 0;
+        header.connectionId = connectionId;
+        header.offset = encoder->blockOffset;
+        header.checksum = 0;
+        encodePacketHeader(&header, &parity->header);
+        parity->info.blockPackets = encoder->blockPackets;
+        parity->info.parityIndex = row;
+        parity->info.parityCount = encoder->parityCount;
+        parity->info.blockBytes = encoder->blockBytes;
+        memcpy(symbol, encoder->parity + row * encoder->symbolSize, encoder->symbolLength);
+        setWireChecksum(&parity->header, crc32c(checksumPacket(&parity->header, &parity->info, sizeof(parity->info)),
+                                                symbol, encoder->symbolLength));
+
+        unsigned long long txTime = pacePacket(pacer, sizeof(*parity) + encoder->symbolLength);
+        queueTimedDatagram(batch, destAddr, parity, sizeof(*parity), symbol, encoder->symbolLength, txTime);
+    }
+    encoder->paritySent += encoder->parityCount;
+
+    int queued = encoder->parityCount;
+    resetFecBlock(encoder);
+    return queued;
+}
+
+/**
+ * @brief Allocates the rings of a decoder, the first time its stream shows it uses FEC.
+ *
+ * @param decoder The decoder, zeroed when the stream started.
+ * @param symbolSize The room for each symbol, the largest payload accepted.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initFecDecoder(FecDecoder *decoder, size_t symbolSize) {
+    pthread_once(&gfTablesOnce, buildGaloisTables);
+    decoder->symbolSize = symbolSize;
+    decoder->packets = calloc(FEC_HISTORY, sizeof(FecSymbol));
+    decoder->parity = calloc(FEC_HISTORY, sizeof(FecSymbol));
+    decoder->memory = malloc(2 * FEC_HISTORY * symbolSize);
+    decoder->syndromes = malloc(FEC_MAX_PARITY * symbolSize);
+    if (decoder->packets == NULL || decoder->parity == NULL || decoder->memory == NULL || decoder->syndromes == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < FEC_HISTORY; i++) {
+        decoder->packets[i].tag = -1;
+        decoder->packets[i].data = decoder->memory + i * symbolSize;
+        decoder->parity[i].tag = -1;
+        decoder->parity[i].data = decoder->memory + (FEC_HISTORY + i) * symbolSize;
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by a decoder.
+ *
+ * @param decoder The decoder to free.
+ */
+void freeFecDecoder(FecDecoder *decoder) {
+    free(decoder->packets);
+    free(decoder->parity);
+    free(decoder->memory);
+    free(decoder->syndromes);
+    decoder->packets = NULL;
+    decoder->parity = NULL;
+    decoder->memory = NULL;
+    decoder->syndromes = NULL;
+}
+
+/**
+ * @brief Keeps a copy of a data packet received for the first time.
+ *
+ * @param decoder The decoder.
+ * @param header The header of the packet.
+ * @param payload The payload of the packet.
+ * @param length The number of bytes of the payload.
+ */
+void storeFecPacket(FecDecoder *decoder, PacketHeader *header, const char *payload, size_t length) {
+    if (length > decoder->symbolSize) {
+        return;
+    }
+    FecSymbol *packet = &decoder->packets[header->sequenceNumber % FEC_HISTORY];
+    packet->tag = header->sequenceNumber;
+    packet->length = length;
+    packet->offset = header->offset;
+    memcpy(packet->data, payload, length);
+}
+
+/**
+ * @brief Keeps a parity packet and rebuilds the data packets of its block if it can.
+ *
+ * A block can be rebuilt once no more of its data packets are missing than of its
+ * parity packets arrived. The missing symbols are found by removing the packets present
+ * from the first parity symbols, which leaves a small linear system in the missing
+ * ones, solved by inverting its matrix. The packets rebuilt are stored like received
+ * ones and listed in recovered.
+ *
+ * @param decoder The decoder.
+ * @param header The header of the parity packet.
+ * @param info The description of its block.
+ * @param symbol The parity symbol.
+ * @param length The number of bytes of the symbol.
+ * @return int The number of packets rebuilt, listed in recovered.
+ */
+int addFecParity(FecDecoder *decoder, PacketHeader *header, FecInfo *info, const char *symbol, size_t length) {
+    long long blockStart = header->sequenceNumber;
+    if (length > decoder->symbolSize || length == 0 || info->parityCount == 0 || info->parityCount > FEC_MAX_PARITY
+        || info->parityIndex >= info->parityCount || info->blockPackets == 0 || info->blockPackets > FEC_MAX_BLOCK
+        || info->blockBytes > info->blockPackets * length || info->blockBytes <= (info->blockPackets - 1) * length) {
+        return 0;
+    }
+
+    FecSymbol *stored = &decoder->parity[(blockStart + info->parityIndex) % FEC_HISTORY];
+    stored->tag = blockStart + info->parityIndex;
+    stored->length = length;
+    stored->offset = header->offset;
+    stored->info = *info;
+    memcpy(stored->data, symbol, length);
+
+    /*
+     * Find the missing data packets and as many parity packets of the block.
+     */
+    int missing[FEC_MAX_PARITY];
+    int rows[FEC_MAX_PARITY];
+    int missingCount = 0;
+    int rowCount = 0;
+    for (int column = 0; column < info->blockPackets; column++) {
+        if (decoder->packets[(blockStart + column) % FEC_HISTORY].tag != blockStart + column) {
+            if (missingCount == info->parityCount) {
+                return 0;
+            }
+            missing[missingCount++] = column;
+        }
+    }
+    for (int row = 0; row < info->parityCount && rowCount < missingCount; row++) {
+        FecSymbol *candidate = &decoder->parity[(blockStart + row) % FEC_HISTORY];
+        if (candidate->tag == blockStart + row && candidate->length == length && candidate->offset == header->offset
+            && candidate->info.blockBytes == info->blockBytes && candidate->info.blockPackets == info->blockPackets) {
+            rows[rowCount++] = row;
+        }
+    }
+    if (missingCount == 0 || rowCount < missingCount) {
+        return 0;
+    }
+
+    /*
+     * Take the data packets present out of the parity symbols used.
+     */
+    unsigned char matrix[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    for (int r = 0; r < rowCount; r++) {
+        unsigned char *syndrome = (unsigned char *)decoder->syndromes + r * decoder->symbolSize;
+        memcpy(syndrome, decoder->parity[(blockStart + rows[r]) % FEC_HISTORY].data, length);
+
+        int next = 0;
+        for (int column = 0; column < info->blockPackets; column++) {
+            if (next < missingCount && missing[next] == column) {
+                matrix[r][next++] = fecCoefficient(rows[r], column, info->parityCount);
+                continue;
+            }
+            FecSymbol *packet = &decoder->packets[(blockStart + column) % FEC_HISTORY];
+            size_t packetLength = packet->length < length ? packet->length : length;
+            gfMultiplyAdd(syndrome, (unsigned char *)packet->data, fecCoefficient(rows[r], column, info->parityCount), packetLength);
+        }
+    }
+    if (gfInvertMatrix(matrix, missingCount) < 0) {
+        return 0;
+    }
+
+    /*
+     * Every packet of a block but its last one is as long as the symbol.
+     */
+    for (int m = 0; m < missingCount; m++) {
+        int column = missing[m];
+        FecSymbol *packet = &decoder->packets[(blockStart + column) % FEC_HISTORY];
+        memset(packet->data, 0, length);
+        for (int r = 0; r < rowCount; r++) {
+            gfMultiplyAdd((unsigned char *)packet->data, (unsigned char *)decoder->syndromes + r * decoder->symbolSize,
+                          matrix[m][r], length);
+        }
+
+        unsigned long long before = (unsigned long long)column * length;
+        packet->tag = blockStart + column;
+        packet->length = info->blockBytes - before < length ? info->blockBytes - before : length;
+        packet->offset = header->offset + before;
+        decoder->recovered[m] = packet;
+    }
+    decoder->recoveredPackets += missingCount;
+    return missingCount;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/**
+*   @file handshake.h
+*   @brief The handshake that opens a transfer and the parameters it negotiates.
+*
+*   Without a handshake, both ends have to be built with the same packet and window
+*   sizes and agree on every feature in advance. Instead, the sender opens every transfer
+*   with a handshake datagram offering the protocol version it speaks, the features it
+*   wants to use, the largest packet it will send, the window it wants per stream, its
+*   number of streams, the size of the data and its resume key, under the connection ID
+*   that identifies the session from then on. The receiver answers with the version of
+*   the session, the features both ends support, the largest packet and window it
+*   accepts, the longest it holds back an ACK, and for a resumable transfer the ranges
+*   it is missing; the sender sends no larger packets and keeps no more packets in
+*   flight than the receiver accepts, allows for the ACK delay in its retransmission
+*   timeout, and turns off what the receiver left out. A receiver that cannot serve the session, for
+*   instance because it speaks no common version or its sink is too small for the data,
+*   answers with why instead.
+*
+*   The handshake does not cost a round trip of its own: unless the transfer is resumed,
+*   the handshake datagram also carries the first bytes of the data, which the receiver
+*   writes before it answers. A transfer that fits in it is delivered by the handshake
+*   alone. The offer and the answer are in host byte order, unlike the header.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "packet_header.h"
+#include "resume.h"
+
+/**
+ * @def PROTOCOL_VERSION
+ * Definition specifying the newest version of the protocol spoken by this build.
+ */
+#define PROTOCOL_VERSION 1
+
+/**
+ * @def MIN_PROTOCOL_VERSION
+ * Definition specifying the oldest version of the protocol spoken by this build.
+ */
+#define MIN_PROTOCOL_VERSION 1
+
+/**
+ * @def FEATURE_SACK
+ * Feature bit of selective acknowledgments, which the sender needs.
+ */
+#define FEATURE_SACK (1u << 0)
+
+/**
+ * @def FEATURE_FEC
+ * Feature bit of forward error correction parity packets.
+ */
+#define FEATURE_FEC (1u << 1)
+
+/**
+ * @def FEATURE_COMPRESSION
+ * Feature bit of compressed payloads.
+ */
+#define FEATURE_COMPRESSION (1u << 2)
+
+/**
+ * @def FEATURE_RESUME
+ * Feature bit of resumable transfers, whose answer lists the ranges missing.
+ */
+#define FEATURE_RESUME (1u << 3)
+
+/**
+ * @def RECEIVER_FEATURES
+ * Definition specifying the features the receiver of this build supports.
+ */
+#define RECEIVER_FEATURES (FEATURE_SACK | FEATURE_FEC | FEATURE_COMPRESSION | FEATURE_RESUME)
+
+/**
+ * @def UNKNOWN_LENGTH
+ * Definition specifying the total length of a transfer whose size is not known, such
+ * as one read from a stream source.
+ */
+#define UNKNOWN_LENGTH (~0ULL)
+
+/**
+ * @def MAX_HANDSHAKE_ATTEMPTS
+ * Definition specifying how many times a sender sends its handshake before it gives up
+ * on the receiver.
+ */
+#define MAX_HANDSHAKE_ATTEMPTS 7
+
+/**
+ * @def HANDSHAKE_ACCEPTED
+ * Handshake status of a session the receiver serves.
+ */
+#define HANDSHAKE_ACCEPTED 0
+
+/**
+ * @def HANDSHAKE_VERSION
+ * Handshake status of a sender that speaks no version the receiver speaks.
+ */
+#define HANDSHAKE_VERSION 1
+
+/**
+ * @def HANDSHAKE_BUSY
+ * Handshake status of a receiver that serves no more sessions.
+ */
+#define HANDSHAKE_BUSY 2
+
+/**
+ * @def HANDSHAKE_TOO_LARGE
+ * Handshake status of a transfer larger than the sink of the receiver.
+ */
+#define HANDSHAKE_TOO_LARGE 3
+
+/**
+ * @def HANDSHAKE_FAILED
+ * Handshake status of a receiver that could not open the destination of the session.
+ */
+#define HANDSHAKE_FAILED 4
+
+/**
+ * @struct HandshakeOffer
+ * @brief Payload of the handshake of the sender, followed by dataLength bytes of data.
+ */
+typedef struct {
+    unsigned int version;                   /**< Newest protocol version the sender speaks. */
+    unsigned int features;                  /**< FEATURE bits the sender wants to use. */
+    unsigned int packetSize;                /**< Largest packet the sender will send, header included. */
+    unsigned int windowSize;                /**< Packets in flight the sender wants per stream. */
+    unsigned int streamCount;               /**< Number of streams of the transfer. */
+    unsigned int dataLength;                /**< Bytes of data after the offer, from offset 0. */
+    unsigned long long int totalLength;     /**< Size of the data, or UNKNOWN_LENGTH. */
+    unsigned long long int resumeKey;       /**< Resume key, with FEATURE_RESUME. */
+} HandshakeOffer;
+
+/**
+ * @struct HandshakeAnswer
+ * @brief Payload of the answer of the receiver; only the missing ranges it lists are sent.
+ */
+typedef struct {
+    int status;                             /**< HANDSHAKE_ACCEPTED, or why the session was refused. */
+    unsigned int version;                   /**< Protocol version of the session. */
+    unsigned int features;                  /**< Features both ends use. */
+    unsigned int packetSize;                /**< Largest packet the receiver accepts, header included. */
+    unsigned int windowSize;                /**< Largest window the receiver accepts per stream. */
+    unsigned int ackDelayMs;                /**< Longest time the receiver holds back an ACK, in ms. */
+    unsigned int dataLength;                /**< Bytes of the data of the offer the receiver wrote. */
+    MissingRanges resume;                   /**< With FEATURE_RESUME, the ranges to send. */
+} HandshakeAnswer;
+
+/**
+ * @def HANDSHAKE_SIZE
+ * Definition specifying the bytes of a handshake datagram before its data: the header
+ * with the IS_HANDSHAKE flag set and the connection ID of the session, then the offer.
+ */
+#define HANDSHAKE_SIZE (WIRE_HEADER_SIZE + sizeof(HandshakeOffer))
+
+/**
+ * @brief Returns the number of bytes of an answer, sent after the header of the
+ * handshake with IS_ACK set.
+ *
+ * @param rangeCount The number of missing ranges it holds.
+ * @return size_t The size of the answer.
+ */
+size_t handshakeAnswerSize(unsigned long long int rangeCount) {
+    return offsetof(HandshakeAnswer, resume.missing) + rangeCount * sizeof(ByteRange);
+}
+
+/**
+ * @brief Settles the parameters of a session from the offer of its sender and the limits
+ * of the receiver.
+ *
+ * The session speaks the newest version both ends speak, uses the features both ends
+ * support, and its packets and windows are the smaller of what each end wants. The data
+ * and resume parts of the answer are left to the session.
+ *
+ * @param offer The offer of the sender.
+ * @param maxPacketSize The largest packet the receiver accepts.
+ * @param maxWindowSize The largest window the receiver accepts.
+ * @param answer Filled with the parameters of the session.
+ * @return int HANDSHAKE_ACCEPTED, or HANDSHAKE_VERSION without a common version.
+ */
+int negotiateHandshake(const HandshakeOffer *offer, unsigned int maxPacketSize, unsigned int maxWindowSize,
+                       HandshakeAnswer *answer) {
+    memset(answer, 0, offsetof(HandshakeAnswer, resume.missing));
+    answer->version = offer->version < PROTOCOL_VERSION ? offer->version : PROTOCOL_VERSION;
+    answer->features = offer->features & RECEIVER_FEATURES;
+    answer->packetSize = offer->packetSize < maxPacketSize ? offer->packetSize : maxPacketSize;
+    answer->windowSize = offer->windowSize < maxWindowSize ? offer->windowSize : maxWindowSize;
+    answer->status = answer->version < MIN_PROTOCOL_VERSION ? HANDSHAKE_VERSION : HANDSHAKE_ACCEPTED;
+    return answer->status;
+}
+
+/**
+ * @brief Describes why a receiver refused a session.
+ *
+ * @param status The status of the answer.
+ * @return const char* The description.
+ */
+const char *describeHandshakeStatus(int status) {
+    switch (status) {
+        case HANDSHAKE_ACCEPTED:
+            return "accepted";
+        case HANDSHAKE_VERSION:
+            return "no common protocol version";
+        case HANDSHAKE_BUSY:
+            return "the receiver is busy with another transfer";
+        case HANDSHAKE_TOO_LARGE:
+            return "the data does not fit the receiver";
+        case HANDSHAKE_FAILED:
+            return "the receiver could not open its destination";
+        default:
+            return "unknown reason";
+    }
+}
+
+#endif
@@ -0,0 +1,443 @@
+/**
+*   @file integrity.h
+*   @brief CRC32C checksums of every packet and of the whole data of a transfer.
+*
+*   The UDP checksum is only 16 bits, is optional in IPv4, and a buggy NIC, switch or
+*   proxy may corrupt a datagram after computing it, so every packet carries a CRC32C
+*   (the Castagnoli polynomial of iSCSI, ext4 and SCTP) of its header and payload. The
+*   checksum covers the encoded header except the timestamp, which changes with
+*   every retransmission, so a packet is checksummed once however often it is sent; a
+*   corrupted timestamp can only spoil one RTT sample. A datagram whose checksum does
+*   not match is dropped as if it was lost, and the sender retransmits it.
+*
+*   On x86-64 processors with SSE4.2 and PCLMULQDQ, the CRC32 instruction computes the
+*   checksum eight bytes at a time. One instruction has a latency of three cycles but
+*   one can start every cycle, so a buffer is cut into three lanes computed side by side,
+*   and the checksums of the first two lanes are moved past the lanes after them with
+*   a carry-less multiplication by a power of x, then folded back by the CRC32
+*   instruction itself. Other processors use tables, eight bytes per step.
+*
+*   The data of a transfer is checked as a whole too. The receiver gets it out of order
+*   and, with parallel streams, on several threads, and a resumed transfer only sends
+*   part of it, so both ends add it up in a DataHash: a CRC is linear, and the CRC of
+*   every run of consecutive bytes, moved back to offset 0 by multiplying it by a negative
+*   power of x, can be combined in any order. The sender puts the sum of every stream in
+*   its closing packet, and the receiver compares the sum of what it got with the sums
+*   of the sender once every stream has finished. A sum of all the data converts back to
+*   its standard CRC32C.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef INTEGRITY_H
+#define INTEGRITY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CRC32C_HAS_HARDWARE 1
+#else
+#define CRC32C_HAS_HARDWARE 0
+#endif
+
+#include "packet_header.h"
+
+/**
+ * @def CRC32C_POLYNOMIAL
+ * Definition specifying the Castagnoli polynomial, bit-reflected.
+ */
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+/**
+ * @def CRC32C_ONE
+ * Definition specifying the polynomial 1, bit-reflected.
+ */
+#define CRC32C_ONE 0x80000000u
+
+/**
+ * @def CRC32C_LONG_LANE
+ * Definition specifying the bytes of each of the three lanes computed side by side in
+ * hardware, for the bulk of a buffer.
+ */
+#define CRC32C_LONG_LANE 256
+
+/**
+ * @def CRC32C_SHORT_LANE
+ * Definition specifying the bytes of each of the three lanes for what is left of a
+ * buffer after the long lanes.
+ */
+#define CRC32C_SHORT_LANE 32
+
+/**
+ * @struct DataHash
+ * @brief The data received so far, summed so it can arrive in any order.
+ */
+typedef struct {
+    unsigned int sum;               /**< Sum of the CRCs of the runs folded, each moved back to offset 0. */
+    unsigned int runCrc;            /**< CRC, without inversions, of the run of consecutive bytes in progress. */
+    unsigned long long int runEnd;  /**< Offset just past the run in progress. */
+    unsigned long long int bytes;   /**< Bytes added so far. */
+} DataHash;
+
+/**
+ * @brief Tables of the byte-wise CRC32C, for eight bytes per step.
+ */
+static uint32_t crc32cTable[8][256];
+
+/**
+ * @brief x to the power 8 * 2^k modulo the polynomial, for k from 0 to 63.
+ */
+static uint32_t crc32cShifts[64];
+
+/**
+ * @brief x to the power -8 * 2^k modulo the polynomial, for k from 0 to 63.
+ */
+static uint32_t crc32cUnshifts[64];
+
+/**
+ * @brief Multipliers moving a lane past one and two lanes after it, for the long and short lanes.
+ */
+static uint32_t crc32cLaneKeys[2][2];
+
+/**
+ * @brief Non-zero if the processor has SSE4.2 and PCLMULQDQ.
+ */
+static int crc32cHasHardware;
+
+/**
+ * @brief Guards the construction of the tables, shared by every thread.
+ */
+static pthread_once_t crc32cTablesOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Multiplies two bit-reflected polynomials modulo the Castagnoli polynomial.
+ *
+ * @param a The first factor.
+ * @param b The second factor.
+ * @return uint32_t The product.
+ */
+uint32_t multiplyCrc32c(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = CRC32C_ONE; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+    }
+    return product;
+}
+
+/**
+ * @brief Returns x to a power modulo the Castagnoli polynomial, one step at a time.
+ *
+ * @param power The power, which may be negative.
+ * @return uint32_t The bit-reflected remainder.
+ */
+uint32_t powerOfX(long power) {
+    uint32_t value = CRC32C_ONE;
+    for (; power > 0; power--) {
+        value = value & 1 ? (value >> 1) ^ CRC32C_POLYNOMIAL : value >> 1;
+    }
+    for (; power < 0; power++) {
+        value = value & CRC32C_ONE ? ((value ^ CRC32C_POLYNOMIAL) << 1) | 1 : value << 1;
+    }
+    return value;
+}
+
+/**
+ * @brief Fills the tables, the powers of x and the lane multipliers, and detects the hardware.
+ */
+void buildCrc32cTables() {
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        crc32cTable[0][byte] = crc;
+    }
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        for (int k = 1; k < 8; k++) {
+            crc32cTable[k][byte] = crc32cTable[0][crc32cTable[k - 1][byte] & 0xff] ^ (crc32cTable[k - 1][byte] >> 8);
+        }
+    }
+
+    crc32cShifts[0] = powerOfX(8);
+    crc32cUnshifts[0] = powerOfX(-8);
+    for (int k = 1; k < 64; k++) {
+        crc32cShifts[k] = multiplyCrc32c(crc32cShifts[k - 1], crc32cShifts[k - 1]);
+        crc32cUnshifts[k] = multiplyCrc32c(crc32cUnshifts[k - 1], crc32cUnshifts[k - 1]);
+    }
+
+    /*
+     * A carry-less product of two reflected 32-bit values is one power of x too high, and
+     * the CRC32 instruction that reduces it multiplies by x^32, so a lane of n bytes is
+     * moved past the bytes after it by x^(8n - 33).
+     */
+    size_t lanes[2] = {CRC32C_LONG_LANE, CRC32C_SHORT_LANE};
+    for (int i = 0; i < 2; i++) {
+        crc32cLaneKeys[i][0] = powerOfX(8 * lanes[i] - 33);
+        crc32cLaneKeys[i][1] = powerOfX(16 * lanes[i] - 33);
+    }
+
+#if CRC32C_HAS_HARDWARE
+    __builtin_cpu_init();
+    crc32cHasHardware = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+#endif
+}
+
+/**
+ * @brief Continues a CRC32C over a buffer with the tables, eight bytes per step.
+ *
+ * @param crc The CRC so far, without inversions.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @return uint32_t The CRC, without inversions.
+ */
+uint32_t updateCrc32cTables(uint32_t crc, const unsigned char *data, size_t length) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = crc32cTable[7][word & 0xff] ^ crc32cTable[6][(word >> 8) & 0xff]
+            ^ crc32cTable[5][(word >> 16) & 0xff] ^ crc32cTable[4][(word >> 24) & 0xff]
+            ^ crc32cTable[3][(word >> 32) & 0xff] ^ crc32cTable[2][(word >> 40) & 0xff]
+            ^ crc32cTable[1][(word >> 48) & 0xff] ^ crc32cTable[0][word >> 56];
+    }
+#endif
+    for (; length > 0; data++, length--) {
+        crc = crc32cTable[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if CRC32C_HAS_HARDWARE
+/**
+ * @brief Continues a CRC32C over every whole group of three lanes at the start of a buffer.
+ *
+ * The first lane continues the CRC and the other two start from zero. Their CRCs are
+ * combined by moving the first two past the lanes after them.
+ *
+ * @param crc The CRC so far, without inversions.
+ * @param data The bytes, advanced past the groups.
+ * @param length The number of bytes, decreased by the bytes of the groups.
+ * @param lane The bytes of a lane, a multiple of 8.
+ * @param keys The multipliers of the lane size.
+ * @return uint32_t The CRC, without inversions.
+ */
+__attribute__((target("sse4.2,pclmul")))
+uint32_t updateCrc32cLanes(uint32_t crc, const unsigned char **data, size_t *length, size_t lane, const uint32_t *keys) {
+    for (; *length >= 3 * lane; *data += 3 * lane, *length -= 3 * lane) {
+        const unsigned char *first = *data;
+        uint64_t crcs[3] = {crc, 0, 0};
+        for (size_t i = 0; i < lane; i += 8) {
+            uint64_t words[3];
+            memcpy(&words[0], first + i, 8);
+            memcpy(&words[1], first + lane + i, 8);
+            memcpy(&words[2], first + 2 * lane + i, 8);
+            crcs[0] = _mm_crc32_u64(crcs[0], words[0]);
+            crcs[1] = _mm_crc32_u64(crcs[1], words[1]);
+            crcs[2] = _mm_crc32_u64(crcs[2], words[2]);
+        }
+        __m128i first2 = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crcs[0]), _mm_cvtsi32_si128((int)keys[1]), 0);
+        __m128i second1 = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crcs[1]), _mm_cvtsi32_si128((int)keys[0]), 0);
+        crc = (uint32_t)(crcs[2] ^ _mm_crc32_u64(0, _mm_cvtsi128_si64(first2)) ^ _mm_crc32_u64(0, _mm_cvtsi128_si64(second1)));
+    }
+    return crc;
+}
+
+/**
+ * @brief Continues a CRC32C over a buffer with the CRC32 instruction.
+ *
+ * @param crc The CRC so far, without inversions.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @return uint32_t The CRC, without inversions.
+ */
+__attribute__((target("sse4.2,pclmul")))
+uint32_t updateCrc32cHardware(uint32_t crc, const unsigned char *data, size_t length) {
+    crc = updateCrc32cLanes(crc, &data, &length, CRC32C_LONG_LANE, crc32cLaneKeys[0]);
+    crc = updateCrc32cLanes(crc, &data, &length, CRC32C_SHORT_LANE, crc32cLaneKeys[1]);
+
+    uint64_t wide = crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t)wide;
+    for (; length > 0; data++, length--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * @brief Continues a CRC32C over a buffer, without the inversions of the standard CRC.
+ *
+ * @param crc The CRC so far, 0 for none.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @return uint32_t The CRC of the bytes so far, without inversions.
+ */
+uint32_t updateCrc32c(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&crc32cTablesOnce, buildCrc32cTables);
+#if CRC32C_HAS_HARDWARE
+    if (crc32cHasHardware) {
+        return updateCrc32cHardware(crc, data, length);
+    }
+#endif
+    return updateCrc32cTables(crc, data, length);
+}
+
+/**
+ * @brief Continues the standard CRC32C of a buffer, as computed by iSCSI or ext4.
+ *
+ * @param crc The CRC32C of the bytes before, 0 for none.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @return unsigned int The CRC32C of the bytes so far.
+ */
+unsigned int crc32c(unsigned int crc, const void *data, size_t length) {
+    return ~updateCrc32c(~crc, data, length);
+}
+
+/**
+ * @brief Moves a CRC without inversions past bytes, or back before them.
+ *
+ * @param crc The CRC.
+ * @param bytes The number of bytes.
+ * @param powers crc32cShifts to move it forward, crc32cUnshifts to move it back.
+ * @return uint32_t The CRC times x to the power of 8 bytes, or of -8 bytes.
+ */
+uint32_t shiftCrc32c(uint32_t crc, unsigned long long int bytes, const uint32_t *powers) {
+    pthread_once(&crc32cTablesOnce, buildCrc32cTables);
+    for (int k = 0; bytes > 0; k++, bytes >>= 1) {
+        if (bytes & 1) {
+            crc = multiplyCrc32c(crc, powers[k]);
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Computes the checksum of a packet: its encoded header up to the timestamp,
+ * followed by the rest of the datagram.
+ *
+ * @param wire The encoded header.
+ * @param body The bytes after the header, extensions included.
+ * @param length The number of bytes after the header.
+ * @return unsigned int The checksum.
+ */
+unsigned int checksumPacket(const WireHeader *wire, const void *body, size_t length) {
+    return crc32c(crc32c(0, wire->bytes, WIRE_SEALED_BYTES), body, length);
+}
+
+/**
+ * @brief Encodes a header, once every field but the timestamp is set, and stores its
+ * checksum in both forms.
+ *
+ * @param header The header.
+ * @param wire Filled with the encoded header.
+ * @param body The bytes after the header.
+ * @param length The number of bytes after the header.
+ * @return Void.
+ */
+void sealPacket(PacketHeader *header, WireHeader *wire, const void *body, size_t length) {
+    encodePacketHeader(header, wire);
+    header->checksum = checksumPacket(wire, body, length);
+    setWireChecksum(wire, header->checksum);
+}
+
+/**
+ * @brief Checks the checksum of a received datagram.
+ *
+ * @param packet The datagram.
+ * @param length The number of bytes of the datagram.
+ * @return int Non-zero if the datagram holds a header and its checksum matches.
+ */
+int isPacketIntact(const void *packet, size_t length) {
+    if (length < WIRE_HEADER_SIZE) {
+        return 0;
+    }
+    const WireHeader *wire = packet;
+    return getWireChecksum(wire) == checksumPacket(wire, wire->bytes + WIRE_HEADER_SIZE, length - WIRE_HEADER_SIZE);
+}
+
+/**
+ * @brief Prepares a hash with no data.
+ *
+ * @param hash The hash to initialize.
+ * @return Void.
+ */
+void initDataHash(DataHash *hash) {
+    memset(hash, 0, sizeof(*hash));
+}
+
+/**
+ * @brief Adds the run in progress to the sum, moved back to offset 0.
+ *
+ * @param hash The hash.
+ * @return Void.
+ */
+void foldDataRun(DataHash *hash) {
+    hash->sum ^= shiftCrc32c(hash->runCrc, hash->runEnd, crc32cUnshifts);
+    hash->runCrc = 0;
+}
+
+/**
+ * @brief Adds bytes received at any offset to a hash; each byte must be added once.
+ *
+ * Bytes that continue the run in progress only extend its CRC. Others fold the run
+ * into the sum first, which costs a few multiplications, so data mostly received in
+ * order is hashed at the speed of the CRC.
+ *
+ * @param hash The hash.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @param offset The offset of the bytes in the data.
+ * @return Void.
+ */
+void addDataHash(DataHash *hash, const void *data, size_t length, unsigned long long int offset) {
+    if (length == 0) {
+        return;
+    }
+    if (offset != hash->runEnd) {
+        foldDataRun(hash);
+        hash->runEnd = offset;
+    }
+    hash->runCrc = updateCrc32c(hash->runCrc, data, length);
+    hash->runEnd += length;
+    hash->bytes += length;
+}
+
+/**
+ * @brief Returns the sum of everything added to a hash.
+ *
+ * @param hash The hash.
+ * @return unsigned int The sum, which other sums of the same data combine with by XOR.
+ */
+unsigned int finishDataHash(DataHash *hash) {
+    foldDataRun(hash);
+    hash->runEnd = 0;
+    return hash->sum;
+}
+
+/**
+ * @brief Returns the standard CRC32C of the data from the sum of a DataHash holding all of it.
+ *
+ * @param sum The sum.
+ * @param length The number of bytes of the data.
+ * @return unsigned int The CRC32C of the data.
+ */
+unsigned int dataChecksum(unsigned int sum, unsigned long long int length) {
+    return ~shiftCrc32c(sum ^ 0xffffffff, length, crc32cShifts);
+}
+
+#endif
@@ -0,0 +1,129 @@
+/**
+*   @file multi_stream.h
+*   @brief Splitting one file transfer into parallel streams.
+*
+*   A single stream is driven by one thread on one socket, so it never uses more than
+*   one core on either end. The sender can instead split the file into contiguous byte
+*   ranges and send each range as an independent reliable stream, with its own socket,
+*   thread, sequence space, window and congestion controller. Every packet carries the
+*   offset of its payload in the file, so the receiver writes each stream where it
+*   belongs without knowing the ranges. The receiver binds one socket per thread to the
+*   same port with SO_REUSEPORT, and the kernel keeps every stream, which has its own
+*   source port, on one of them. The closing packet of every stream tells the receiver
+*   how many streams make up the transfer, so it knows when all of them have finished,
+*   and how many bytes the stream sent with the sum of their CRC32C, so it can check the
+*   whole data. A resumed transfer only sends the spans of the file the receiver is
+*   missing: the ranges are then cut from the missing bytes laid end to end, and a
+*   SpanCursor maps each position in them back to its offset in the file.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef MULTI_STREAM_H
+#define MULTI_STREAM_H
+
+#include "packet_header.h"
+
+/**
+ * @def MAX_STREAMS
+ * Definition specifying the largest number of parallel streams, and of receiver threads.
+ */
+#define MAX_STREAMS 16
+
+/**
+ * @struct ClosingInfo
+ * @brief Payload of the closing packet of a stream, sent after a header with the
+ * IS_LAST_PACKET flag set.
+ */
+typedef struct {
+    int streamCount;                    /**< Number of streams the transfer was split into. */
+    unsigned int checksum;              /**< Sum of the DataHash of the data the stream sent. */
+    unsigned long long int length;      /**< Number of bytes the stream sent. */
+} ClosingInfo;
+
+/**
+ * @struct ByteRange
+ * @brief The part of the file sent by one stream.
+ */
+typedef struct {
+    unsigned long long int start;    /**< Offset of the first byte of the range. */
+    unsigned long long int length;   /**< Number of bytes in the range. */
+} ByteRange;
+
+/**
+ * @struct SpanCursor
+ * @brief Position of a stream in the spans of the file a transfer sends.
+ */
+typedef struct {
+    const ByteRange *spans;             /**< The spans, sorted by offset. */
+    int spanCount;                      /**< Number of spans. */
+    int index;                          /**< Span holding the latest position looked up. */
+    unsigned long long int skipped;     /**< Bytes of the spans before that one. */
+} SpanCursor;
+
+/**
+ * @brief Splits a transfer into contiguous byte ranges of whole packets.
+ *
+ * The packets of the transfer are shared out as evenly as possible, so no packet
+ * straddles two streams and only the last range may end with a short packet.
+ *
+ * @param ranges The ranges to fill, one per stream.
+ * @param streamCount The number of streams.
+ * @param bytesToTransfer The size of the transfer.
+ * @param payloadSize The number of bytes of file data carried by a full packet.
+ */
+void splitByteRanges(ByteRange *ranges, int streamCount, unsigned long long int bytesToTransfer, int payloadSize) {
+    unsigned long long int packetCount = (bytesToTransfer + payloadSize - 1) / payloadSize;
+
+    for (int i = 0; i < streamCount; i++) {
+        unsigned long long int first = packetCount * i / streamCount * payloadSize;
+        unsigned long long int last = packetCount * (i + 1) / streamCount * payloadSize;
+        if (first > bytesToTransfer) {
+            first = bytesToTransfer;
+        }
+        if (last > bytesToTransfer) {
+            last = bytesToTransfer;
+        }
+        ranges[i].start = first;
+        ranges[i].length = last - first;
+    }
+}
+
+/**
+ * @brief Prepares a cursor over the spans of a transfer.
+ *
+ * @param cursor The cursor to initialize.
+ * @param spans The spans, sorted by offset.
+ * @param spanCount The number of spans.
+ */
+void initSpanCursor(SpanCursor *cursor, const ByteRange *spans, int spanCount) {
+    cursor->spans = spans;
+    cursor->spanCount = spanCount;
+    cursor->index = 0;
+    cursor->skipped = 0;
+}
+
+/**
+ * @brief Maps a position in the spans laid end to end to its offset in the file.
+ *
+ * Positions are looked up in increasing order, so the cursor only moves forward.
+ *
+ * @param cursor The cursor.
+ * @param position The position, less than the bytes of all the spans.
+ * @param contiguous Set to the bytes from the offset to the end of its span.
+ * @return unsigned long long int The offset in the file.
+ */
+unsigned long long int locateSpan(SpanCursor *cursor, unsigned long long int position,
+                                  unsigned long long int *contiguous) {
+    while (cursor->index < cursor->spanCount - 1
+           && position >= cursor->skipped + cursor->spans[cursor->index].length) {
+        cursor->skipped += cursor->spans[cursor->index].length;
+        cursor->index++;
+    }
+    const ByteRange *span = &cursor->spans[cursor->index];
+    *contiguous = span->length - (position - cursor->skipped);
+    return span->start + position - cursor->skipped;
+}
+
+#endif
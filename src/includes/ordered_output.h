@@ -0,0 +1,210 @@
+/**
+*   @file ordered_output.h
+*   @brief Writes received data in order to a descriptor that cannot seek, such as stdout.
+*
+*   Packets carry the offset of their payload and arrive in any order, which a file
+*   absorbs with pwrite but a pipe or a terminal cannot. An OrderedOutput writes every
+*   payload that continues the data already written at once, and keeps the payloads
+*   that arrive ahead of a gap in a list sorted by offset until the gap is filled. The
+*   list is bounded by ORDERED_MAX_PENDING bytes: a sender never has more than its window
+*   in flight, so only a receiver fed by several parallel streams comes near it, and
+*   going past it fails the write with ENOBUFS rather than growing without limit.
+*   writeOrdered has the signature of a WriteCallback, so an OrderedOutput plugs into a
+*   WriteTarget like any other callback sink.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef ORDERED_OUTPUT_H
+#define ORDERED_OUTPUT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+ * @def ORDERED_MAX_PENDING
+ * Definition specifying the most bytes kept waiting for a gap before them to be filled.
+ */
+#define ORDERED_MAX_PENDING (64 << 20)
+
+/**
+ * @struct OrderedChunk
+ * @brief A payload received ahead of the data written so far.
+ */
+typedef struct OrderedChunk {
+    unsigned long long int offset;  /**< Offset of the payload in the data. */
+    size_t length;                  /**< Number of bytes of the payload. */
+    struct OrderedChunk *next;      /**< The chunk with the next higher offset. */
+    char data[];                    /**< The payload. */
+} OrderedChunk;
+
+/**
+ * @struct OrderedOutput
+ * @brief A descriptor written in order and the payloads waiting to be written to it.
+ */
+typedef struct {
+    pthread_mutex_t lock;                   /**< Guards everything below; writers of several threads share it. */
+    int fd;                                 /**< The descriptor written. */
+    unsigned long long int nextOffset;      /**< Offset of the next byte to write. */
+    OrderedChunk *pending;                  /**< Payloads ahead of nextOffset, sorted by offset. */
+    OrderedChunk *last;                     /**< The pending payload with the highest offset. */
+    unsigned long long int pendingBytes;    /**< Bytes held by the pending payloads. */
+} OrderedOutput;
+
+/**
+ * @brief Prepares an output with nothing written yet.
+ *
+ * @param output The output to initialize.
+ * @param fd The descriptor to write; it is not closed.
+ * @return Void.
+ */
+void initOrderedOutput(OrderedOutput *output, int fd) {
+    pthread_mutex_init(&output->lock, NULL);
+    output->fd = fd;
+    output->nextOffset = 0;
+    output->pending = NULL;
+    output->last = NULL;
+    output->pendingBytes = 0;
+}
+
+/**
+ * @brief Writes a buffer whole, finishing short writes.
+ *
+ * @param fd The descriptor.
+ * @param data The bytes to write.
+ * @param length The number of bytes.
+ * @return int 0 on success, -1 on failure (see errno).
+ */
+int writeAll(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the part of a payload past nextOffset, if the payload reaches nextOffset.
+ *
+ * @param output The output, locked.
+ * @param data The payload.
+ * @param length The number of bytes of the payload.
+ * @param offset The offset of the payload in the data.
+ * @return int 0 on success, -1 on failure (see errno).
+ */
+int writeInOrder(OrderedOutput *output, const char *data, size_t length, unsigned long long int offset) {
+    if (offset + length <= output->nextOffset) {
+        return 0;
+    }
+    size_t skipped = output->nextOffset - offset;
+    if (writeAll(output->fd, data + skipped, length - skipped) < 0) {
+        return -1;
+    }
+    output->nextOffset = offset + length;
+    return 0;
+}
+
+/**
+ * @brief Writes a payload received at any offset, in order: at once if it continues the
+ * data written, followed by every pending payload it lets through, or later otherwise.
+ * Payloads received twice are written once.
+ *
+ * @param context The OrderedOutput.
+ * @param data The payload.
+ * @param length The number of bytes of the payload.
+ * @param offset The offset of the payload in the data.
+ * @return int 0 on success, -1 on failure (see errno), ENOBUFS if too much data is pending.
+ */
+int writeOrdered(void *context, const void *data, size_t length, unsigned long long int offset) {
+    OrderedOutput *output = context;
+    int result = 0;
+
+    pthread_mutex_lock(&output->lock);
+    if (offset <= output->nextOffset) {
+        result = writeInOrder(output, data, length, offset);
+        while (result == 0 && output->pending != NULL && output->pending->offset <= output->nextOffset) {
+            OrderedChunk *chunk = output->pending;
+            result = writeInOrder(output, chunk->data, chunk->length, chunk->offset);
+            output->pending = chunk->next;
+            output->pendingBytes -= chunk->length;
+            free(chunk);
+        }
+        if (output->pending == NULL) {
+            output->last = NULL;
+        }
+        pthread_mutex_unlock(&output->lock);
+        return result;
+    }
+
+    /*
+     * Keep the payload in offset order; payloads mostly arrive in order, so try the end
+     * of the list first.
+     */
+    OrderedChunk **link = &output->pending;
+    if (output->last != NULL && output->last->offset < offset) {
+        link = &output->last->next;
+    }
+    while (*link != NULL && (*link)->offset < offset) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL && (*link)->offset == offset) {
+        pthread_mutex_unlock(&output->lock);
+        return 0;
+    }
+
+    OrderedChunk *chunk = NULL;
+    if (output->pendingBytes + length > ORDERED_MAX_PENDING) {
+        errno = ENOBUFS;
+        result = -1;
+    } else if ((chunk = malloc(sizeof(OrderedChunk) + length)) == NULL) {
+        result = -1;
+    } else {
+        chunk->offset = offset;
+        chunk->length = length;
+        memcpy(chunk->data, data, length);
+        chunk->next = *link;
+        *link = chunk;
+        if (chunk->next == NULL) {
+            output->last = chunk;
+        }
+        output->pendingBytes += length;
+    }
+    pthread_mutex_unlock(&output->lock);
+    return result;
+}
+
+/**
+ * @brief Frees what an output still holds once nothing writes to it anymore.
+ *
+ * @param output The output.
+ * @return int 0 if every payload was written, -1 with errno set to EIO if some were still
+ * waiting for data that never arrived.
+ */
+int finishOrderedOutput(OrderedOutput *output) {
+    int result = output->pending != NULL ? -1 : 0;
+    while (output->pending != NULL) {
+        OrderedChunk *chunk = output->pending;
+        output->pending = chunk->next;
+        free(chunk);
+    }
+    output->last = NULL;
+    output->pendingBytes = 0;
+    pthread_mutex_destroy(&output->lock);
+    if (result < 0) {
+        errno = EIO;
+    }
+    return result;
+}
+
+#endif
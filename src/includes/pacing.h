@@ -0,0 +1,205 @@
+/**
+*   @file pacing.h
+*   @brief Spacing the sender's packets out at the pacing rate of the congestion controller.
+*
+*   A congestion window alone lets the sender emit a whole window of packets back to
+*   back whenever ACKs open it, and such a burst leaves at line rate and overflows the
+*   queue of a slower bottleneck. A Pacer spreads the packets over time at the pacing
+*   rate of the congestion controller instead, in one of two ways. In PACING_BUCKET
+*   mode a token bucket fills at the pacing rate and every packet takes its size in
+*   tokens; the sender holds new packets back while the bucket is empty and sleeps
+*   until enough tokens have accumulated. In PACING_TXTIME mode every packet is given a
+*   departure time with SO_TXTIME and the kernel holds it until then. This needs the fq
+*   queueing discipline on the outgoing interface (tc qdisc replace dev <dev> root fq),
+*   which ignores the departure times it cannot honour; without fq the packets go out
+*   at once. Until the controller has a rate, packets are not paced.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef PACING_H
+#define PACING_H
+
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+
+/**
+ * @def PACING_NONE
+ * Pacing mode sending packets as soon as the congestion window allows.
+ */
+#define PACING_NONE 0
+
+/**
+ * @def PACING_BUCKET
+ * Pacing mode holding packets back in the sender with a token bucket.
+ */
+#define PACING_BUCKET 1
+
+/**
+ * @def PACING_TXTIME
+ * Pacing mode handing every packet to the kernel with a departure time (SO_TXTIME).
+ */
+#define PACING_TXTIME 2
+
+/**
+ * @def PACING_BURST_USEC
+ * Definition specifying the depth of the token bucket as time at the pacing rate, in
+ * microseconds. It allows the sender to catch up after waking up late.
+ */
+#define PACING_BURST_USEC 1000
+
+/**
+ * @def PACING_MIN_BURST
+ * Definition specifying the smallest depth of the token bucket, in packets.
+ */
+#define PACING_MIN_BURST 2
+
+/**
+ * @brief Names of the pacing modes on the command line, indexed by mode.
+ */
+static const char *pacingModeNames[] = {"none", "bucket", "txtime"};
+
+/**
+ * @brief Finds a pacing mode by name.
+ *
+ * @param name The name: "none", "bucket" or "txtime".
+ * @return int The pacing mode, or -1 if the name is unknown.
+ */
+int parsePacingMode(const char *name) {
+    for (int mode = PACING_NONE; mode <= PACING_TXTIME; mode++) {
+        if (strcmp(name, pacingModeNames[mode]) == 0) {
+            return mode;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @struct Pacer
+ * @brief State of the pacing of one sender socket.
+ */
+typedef struct {
+    int mode;                           /**< PACING_NONE, PACING_BUCKET or PACING_TXTIME. */
+    int packetSize;                     /**< Size of a full packet in bytes. */
+    double rate;                        /**< Pacing rate in bytes per second, 0 if unknown. */
+    double tokens;                      /**< Bytes that may be sent now; may be negative. */
+    double burst;                       /**< Most tokens the bucket holds. */
+    unsigned long long lastRefill;      /**< Time the tokens were last topped up, in ns. */
+    unsigned long long nextDeparture;   /**< Earliest departure time of the next packet, in ns. */
+} Pacer;
+
+/**
+ * @brief Returns the current time of the monotonic clock, the clock SO_TXTIME uses.
+ *
+ * @return unsigned long long The time in ns.
+ */
+unsigned long long monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Initializes the pacing of a socket.
+ *
+ * @param pacer The pacer to initialize.
+ * @param mode The pacing mode.
+ * @param packetSize The size of a full packet in bytes.
+ * @param sockDescriptor The socket the packets are sent on.
+ * @return int 0 on success, -1 if the kernel does not support SO_TXTIME; the pacer
+ * then uses PACING_BUCKET.
+ */
+int initPacer(Pacer *pacer, int mode, int packetSize, int sockDescriptor) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->mode = mode;
+    pacer->packetSize = packetSize;
+    pacer->burst = PACING_MIN_BURST * packetSize;
+    pacer->tokens = pacer->burst;
+    pacer->lastRefill = monotonicNs();
+
+    if (mode == PACING_TXTIME) {
+        struct sock_txtime txTime;
+        memset(&txTime, 0, sizeof(txTime));
+        txTime.clockid = CLOCK_MONOTONIC;
+        if (setsockopt(sockDescriptor, SOL_SOCKET, SO_TXTIME, &txTime, sizeof(txTime)) < 0) {
+            pacer->mode = PACING_BUCKET;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the tokens earned at the pacing rate since the last refill.
+ *
+ * @param pacer The pacer.
+ */
+void refillTokens(Pacer *pacer) {
+    unsigned long long now = monotonicNs();
+    pacer->tokens += pacer->rate * (now - pacer->lastRefill) / 1e9;
+    if (pacer->tokens > pacer->burst) {
+        pacer->tokens = pacer->burst;
+    }
+    pacer->lastRefill = now;
+}
+
+/**
+ * @brief Changes the pacing rate, normally to the latest rate of the congestion controller.
+ *
+ * @param pacer The pacer.
+ * @param rate The pacing rate in bytes per second, 0 to stop pacing.
+ */
+void setPacingRate(Pacer *pacer, double rate) {
+    refillTokens(pacer);
+    pacer->rate = rate;
+    pacer->burst = rate * PACING_BURST_USEC / 1e6;
+    if (pacer->burst < PACING_MIN_BURST * pacer->packetSize) {
+        pacer->burst = PACING_MIN_BURST * pacer->packetSize;
+    }
+}
+
+/**
+ * @brief Returns how long the sender must wait before sending a packet.
+ *
+ * @param pacer The pacer.
+ * @param bytes The size of the packet.
+ * @return double The wait in ms, 0 if the packet may be sent now.
+ */
+double pacingDelayMs(Pacer *pacer, size_t bytes) {
+    if (pacer->mode != PACING_BUCKET || pacer->rate <= 0) {
+        return 0;
+    }
+    refillTokens(pacer);
+    if (pacer->tokens >= (double)bytes) {
+        return 0;
+    }
+    return (bytes - pacer->tokens) / pacer->rate * 1000.0;
+}
+
+/**
+ * @brief Accounts for a packet about to be sent.
+ *
+ * @param pacer The pacer.
+ * @param bytes The size of the packet.
+ * @return unsigned long long The departure time of the packet in ns for SO_TXTIME, or 0
+ * if it leaves at once.
+ */
+unsigned long long pacePacket(Pacer *pacer, size_t bytes) {
+    if (pacer->rate <= 0) {
+        return 0;
+    }
+    if (pacer->mode == PACING_BUCKET) {
+        pacer->tokens -= bytes;
+    } else if (pacer->mode == PACING_TXTIME) {
+        unsigned long long now = monotonicNs();
+        unsigned long long departure = pacer->nextDeparture > now ? pacer->nextDeparture : now;
+        pacer->nextDeparture = departure + (unsigned long long)(bytes / pacer->rate * 1e9);
+        return departure;
+    }
+    return 0;
+}
+
+#endif
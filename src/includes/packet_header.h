@@ -6,11 +6,38 @@
  * for setting and checking these flags within the PacketHeader structure.
  * These are used to manage and interpret the state of packets in a custom UDP protocol.
  * 
+ * A PacketHeader is only used in memory. On the wire, every datagram starts with the
+ * header encoded in WIRE_HEADER_SIZE bytes in network byte order, so both ends agree on
+ * it whatever their processors:
+ * 
+ *     byte  0      version of the wire format, WIRE_VERSION
+ *     byte  1      flags, one bit per flag
+ *     bytes 2-3    bytes of extensions after the header
+ *     bytes 4-7    connection ID
+ *     bytes 8-11   low 32 bits of the sequence number
+ *     bytes 12-19  offset
+ *     bytes 20-23  timestamp
+ *     bytes 24-27  checksum
+ * 
+ * Extensions are a list of a type byte, a length byte and that many bytes, which a
+ * receiver that does not know their type skips. Sequence numbers are 64 bits in memory,
+ * so a stream never runs out of them; only their low 32 bits are sent, and the receiver
+ * takes the sequence number closest to the one it expects, which is right as long as
+ * the two ends are less than 2^31 packets apart.
+ * 
  * @author Maddy Paulson (maddypaulson)
  * @author Leo Kamino (LeonardoKamino)
  * @bug No known bugs.
  */
 
+#ifndef PACKET_HEADER_H
+#define PACKET_HEADER_H
+
+#include <endian.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 /**
  * @def IS_LAST_PACKET
  * Flag to indicate the last packet in a sequence of UDP transmissions.
@@ -23,6 +50,58 @@
  */
 #define IS_ACK 1
 
+/**
+ * @def IS_PROBE
+ * Flag to indicate a path MTU probe, which the receiver acknowledges but never writes.
+ */
+#define IS_PROBE 2
+
+/**
+ * @def IS_PARITY
+ * Flag to indicate a forward error correction parity packet, which is never acknowledged.
+ */
+#define IS_PARITY 3
+
+/**
+ * @def HAS_PARITY
+ * Flag to indicate a data packet whose block is followed by parity packets.
+ */
+#define HAS_PARITY 4
+
+/**
+ * @def IS_COMPRESSED
+ * Flag to indicate a data packet whose payload was compressed on its own; its offset is
+ * that of the payload before compression.
+ */
+#define IS_COMPRESSED 5
+
+/**
+ * @def IS_HANDSHAKE
+ * Flag to indicate the handshake that opens a transfer, or with IS_ACK the receiver's
+ * answer to it.
+ */
+#define IS_HANDSHAKE 6
+
+/**
+ * @def WIRE_VERSION
+ * Definition specifying the version of the wire format of the header; a datagram of
+ * another version is dropped.
+ */
+#define WIRE_VERSION 1
+
+/**
+ * @def WIRE_HEADER_SIZE
+ * Definition specifying the bytes of an encoded header without extensions.
+ */
+#define WIRE_HEADER_SIZE 28
+
+/**
+ * @def WIRE_SEALED_BYTES
+ * Definition specifying the bytes at the start of an encoded header covered by the
+ * checksum; the timestamp and the checksum after them are not.
+ */
+#define WIRE_SEALED_BYTES 20
+
 /**
  * @struct PacketHeader
  * @brief Header structure for packets in the enhanced UDP protocol.
@@ -36,8 +115,9 @@ typedef struct {
      * 
      * This field indicates the sequence number of the packet. Each packet
      * sent in the protocol should have a unique sequence number assigned to it.
+     * Only its low 32 bits are sent, see expandSequenceNumber().
      */
-    int sequenceNumber;
+    long long sequenceNumber;
 
     /**
      * @brief Flags for control information.
@@ -49,8 +129,50 @@ typedef struct {
      * @see PACKET_ACKNOWLEDGMENT Indicates whether an acknowledgment is required for this packet.
      */
     int flags;
+
+    /**
+     * @brief Time at which the packet was sent, in microseconds.
+     * 
+     * The sender stamps every transmission of a data packet with getTimestamp() and
+     * the receiver copies the value into the matching ACK, so the sender can measure
+     * the RTT of that exact transmission even when the packet was retransmitted.
+     */
+    unsigned int timestamp;
+
+    /**
+     * @brief Identifier of the transfer the packet belongs to.
+     * 
+     * The sender picks a random non-zero connection ID for every transfer and puts it
+     * in every packet of every stream, so a receiver serving several senders on one
+     * port can tell their packets apart. ACKs echo it.
+     */
+    unsigned int connectionId;
+
+    /**
+     * @brief CRC32C of the packet, see integrity.h.
+     * 
+     * Covers every other field but the timestamp, and the rest of the datagram, so a
+     * receiver can drop a datagram corrupted on the way instead of writing it.
+     */
+    unsigned int checksum;
+
+    /**
+     * @brief Offset of the payload in the file, in bytes.
+     * 
+     * The receiver writes the payload at this offset, so it works with whatever
+     * payload size the sender chose and never has to know it in advance.
+     */
+    long long offset;
 } PacketHeader;
 
+/**
+ * @struct WireHeader
+ * @brief A PacketHeader encoded for the wire.
+ */
+typedef struct {
+    unsigned char bytes[WIRE_HEADER_SIZE];   /**< The encoded header, in network byte order. */
+} WireHeader;
+
 /**
  * @brief Sets the specified bit in the flags.
  * 
@@ -77,4 +199,162 @@ int setFlag(int flags, int bit) {
  */
 int isFlagSet(int flags, int bit) {
     return (flags & (1 << bit)) != 0;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Stores a 32-bit value in network byte order.
+ * 
+ * @param bytes Where the value goes.
+ * @param value The value.
+ * @return Void.
+ */
+void putWire32(unsigned char *bytes, uint32_t value) {
+    value = htobe32(value);
+    memcpy(bytes, &value, sizeof(value));
+}
+
+/**
+ * @brief Loads a 32-bit value in network byte order.
+ * 
+ * @param bytes Where the value is.
+ * @return uint32_t The value.
+ */
+uint32_t getWire32(const unsigned char *bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return be32toh(value);
+}
+
+/**
+ * @brief Encodes a header for the wire, with no extensions.
+ * 
+ * @param header The header.
+ * @param wire Filled with the encoded header.
+ * @return Void.
+ */
+void encodePacketHeader(const PacketHeader *header, WireHeader *wire) {
+    uint64_t offset = htobe64((uint64_t)header->offset);
+
+    wire->bytes[0] = WIRE_VERSION;
+    wire->bytes[1] = (unsigned char)header->flags;
+    wire->bytes[2] = 0;
+    wire->bytes[3] = 0;
+    putWire32(wire->bytes + 4, header->connectionId);
+    putWire32(wire->bytes + 8, (uint32_t)header->sequenceNumber);
+    memcpy(wire->bytes + 12, &offset, sizeof(offset));
+    putWire32(wire->bytes + 20, header->timestamp);
+    putWire32(wire->bytes + 24, header->checksum);
+}
+
+/**
+ * @brief Decodes the header at the start of a datagram.
+ * 
+ * The sequence number is left as the 32 bits sent, until expandSequenceNumber() places
+ * it in the stream.
+ * 
+ * @param datagram The datagram.
+ * @param length The number of bytes of the datagram.
+ * @param header Filled with the decoded header.
+ * @return size_t The bytes of the header with its extensions, where the body starts, or
+ * 0 if the datagram is too short, of another version or its extensions are malformed.
+ */
+size_t decodePacketHeader(const void *datagram, size_t length, PacketHeader *header) {
+    const unsigned char *bytes = datagram;
+    if (length < WIRE_HEADER_SIZE || bytes[0] != WIRE_VERSION) {
+        return 0;
+    }
+
+    size_t headerLength = WIRE_HEADER_SIZE + ((size_t)bytes[2] << 8 | bytes[3]);
+    if (headerLength > length) {
+        return 0;
+    }
+    for (size_t at = WIRE_HEADER_SIZE; at < headerLength; at += 2 + bytes[at + 1]) {
+        if (at + 2 > headerLength || at + 2 + bytes[at + 1] > headerLength) {
+            return 0;
+        }
+    }
+
+    uint64_t offset;
+    memcpy(&offset, bytes + 12, sizeof(offset));
+    header->flags = bytes[1];
+    header->connectionId = getWire32(bytes + 4);
+    header->sequenceNumber = getWire32(bytes + 8);
+    header->offset = (long long)be64toh(offset);
+    header->timestamp = getWire32(bytes + 20);
+    header->checksum = getWire32(bytes + 24);
+    return headerLength;
+}
+
+/**
+ * @brief Finds an extension of a decoded header.
+ * 
+ * @param datagram The datagram.
+ * @param headerLength The bytes of its header, as returned by decodePacketHeader().
+ * @param type The type of the extension.
+ * @param length Set to the number of bytes of the extension.
+ * @return const unsigned char* The bytes of the extension, or NULL if the header has none
+ * of that type.
+ */
+const unsigned char *findHeaderExtension(const void *datagram, size_t headerLength, int type, size_t *length) {
+    const unsigned char *bytes = datagram;
+    for (size_t at = WIRE_HEADER_SIZE; at + 2 <= headerLength; at += 2 + bytes[at + 1]) {
+        if (bytes[at] == type) {
+            *length = bytes[at + 1];
+            return bytes + at + 2;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Stamps an encoded header with the time of a transmission.
+ * 
+ * @param wire The encoded header.
+ * @param timestamp The timestamp.
+ * @return Void.
+ */
+void setWireTimestamp(WireHeader *wire, unsigned int timestamp) {
+    putWire32(wire->bytes + 20, timestamp);
+}
+
+/**
+ * @brief Stores the checksum of a packet in its encoded header.
+ * 
+ * @param wire The encoded header.
+ * @param checksum The checksum.
+ * @return Void.
+ */
+void setWireChecksum(WireHeader *wire, unsigned int checksum) {
+    putWire32(wire->bytes + 24, checksum);
+}
+
+/**
+ * @brief Returns the checksum stored in an encoded header.
+ * 
+ * @param wire The encoded header.
+ * @return unsigned int The checksum.
+ */
+unsigned int getWireChecksum(const WireHeader *wire) {
+    return getWire32(wire->bytes + 24);
+}
+
+/**
+ * @brief Rebuilds a whole sequence number from the 32 bits of it that were sent.
+ * 
+ * @param truncated The low 32 bits of the sequence number.
+ * @param expected The sequence number expected, such as the next one in order.
+ * @return long long The sequence number with those low bits closest to the expected one.
+ */
+long long expandSequenceNumber(long long truncated, long long expected) {
+    long long span = 1LL << 32;
+    long long candidate = (expected & ~(span - 1)) | (truncated & (span - 1));
+    if (candidate > expected + span / 2 && candidate >= span) {
+        return candidate - span;
+    }
+    if (candidate + span / 2 <= expected) {
+        return candidate + span;
+    }
+    return candidate;
+}
+
+#endif
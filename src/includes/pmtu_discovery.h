@@ -0,0 +1,176 @@
+/**
+*   @file pmtu_discovery.h
+*   @brief Packetization layer path MTU discovery (DPLPMTUD) for the sender.
+*
+*   A datagram larger than the path MTU is split into IP fragments, and losing any one
+*   fragment loses the whole datagram, so a 10 KB packet on a 1500 byte path is about
+*   seven times as likely to be lost as a single fragment. Before sending data, the
+*   sender sets the Don't Fragment bit on its socket and searches for the largest
+*   packet size that reaches the receiver without fragmentation, in the spirit of
+*   RFC 8899. Probes are padded packets flagged IS_PROBE; the receiver acknowledges
+*   them and discards them. Starting from BASE_PACKET_SIZE, which every path is assumed
+*   to carry, the sender probes the UDP payload sizes of common link MTUs in increasing
+*   order and stops at the first size that gets no ACK after MAX_PROBES attempts.
+*   Every attempt waits twice as long as the one before, and the ACK of any attempt
+*   of a size accepts it, so a path whose RTT exceeds the initial timeout is not taken
+*   for one that drops the probes. The ACKs of the probes also give the RTT estimator
+*   its first samples.
+*
+*   @bug A path MTU that shrinks during the transfer is only noticed through timeouts.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef PMTU_DISCOVERY_H
+#define PMTU_DISCOVERY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "packet_header.h"
+#include "integrity.h"
+#include "rtt_estimates.h"
+
+/**
+ * @def BASE_PACKET_SIZE
+ * Definition specifying the packet size, in bytes of UDP payload, assumed to work on any path.
+ */
+#define BASE_PACKET_SIZE 1200
+
+/**
+ * @def MIN_PACKET_SIZE
+ * Definition specifying the smallest packet size that may be configured.
+ */
+#define MIN_PACKET_SIZE 512
+
+/**
+ * @def MAX_PROBES
+ * Definition specifying how many unacknowledged probes of one size mean the size does not fit the path.
+ */
+#define MAX_PROBES 3
+
+/**
+ * @def MAX_FIRST_PROBES
+ * Definition specifying how many attempts a size gets while no RTT sample is known, so that
+ * an ACK returning after up to 31 times the initial timeout still counts.
+ */
+#define MAX_FIRST_PROBES 5
+
+/**
+ * @brief Probe sizes in increasing order: the UDP payload that fills IPv4 links with an
+ * MTU of 1280, 1400, 1480, 1500 and 9000 bytes (20 bytes of IP and 8 of UDP header).
+ */
+static const int probeSizes[] = {1252, 1372, 1452, 1472, 8972};
+
+/**
+ * @brief Sets the Don't Fragment bit on every datagram sent on a socket.
+ *
+ * IP_PMTUDISC_PROBE sets the bit but ignores the path MTU cached by the kernel, so
+ * probes larger than the current estimate can still be sent.
+ *
+ * @param sockDescriptor The socket.
+ * @return int 0 on success, -1 on failure.
+ */
+int setDontFragment(int sockDescriptor) {
+    int discover = IP_PMTUDISC_PROBE;
+    return setsockopt(sockDescriptor, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover));
+}
+
+/**
+ * @brief Sends probes of one size until one is acknowledged or MAX_PROBES went unanswered.
+ *
+ * The wait starts at the timeout of the estimator and doubles with every attempt, and
+ * the ACK of an earlier attempt of the same size, arriving late, is as good as that of
+ * the latest one: it echoes the timestamp of the attempt it answers, so it also gives
+ * a true RTT sample. Before the first RTT sample, MAX_FIRST_PROBES attempts are made.
+ *
+ * @param sockDescriptor The socket, with the Don't Fragment bit set.
+ * @param destAddr The address of the receiver.
+ * @param probe A buffer of at least probeSize bytes used to build the probe.
+ * @param probeSize The size of the probe in bytes.
+ * @param probeNumber A number identifying this probe size, sent as the sequence number.
+ * @param rtt The RTT estimator, updated from the ACK and used for the wait.
+ * @return int Non-zero if a probe of this size was acknowledged.
+ */
+int probePacketSize(int sockDescriptor, struct sockaddr_in *destAddr, char *probe, int probeSize,
+                    int probeNumber, RttEstimator *rtt) {
+    int attempts = rtt->samples == 0 ? MAX_FIRST_PROBES : MAX_PROBES;
+    double waitMs = timeoutToMs(&rtt->timeout);
+    for (int attempt = 0; attempt < attempts; attempt++, waitMs *= 2) {
+        PacketHeader header;
+        memset(&header, 0, sizeof(header));
+        header.sequenceNumber = probeNumber;
+        header.flags = setFlag(0, IS_PROBE);
+        header.timestamp = getTimestamp();
+        WireHeader wire;
+        sealPacket(&header, &wire, probe + WIRE_HEADER_SIZE, probeSize - WIRE_HEADER_SIZE);
+        memcpy(probe, &wire, WIRE_HEADER_SIZE);
+
+        if (sendto(sockDescriptor, probe, probeSize, 0, (struct sockaddr *)destAddr, sizeof(struct sockaddr_in)) < 0) {
+            if (errno == EMSGSIZE) {
+                return 0; // Larger than the MTU of the local interface.
+            }
+            continue;
+        }
+
+        struct timeval wait;
+        setTimeoutFromMs(&wait, waitMs);
+        setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+
+        /*
+         * Skip ACKs of smaller sizes until the ACK of any attempt of this one or the timeout.
+         */
+        char reply[WIRE_HEADER_SIZE];
+        ssize_t replySize;
+        PacketHeader ack;
+        while ((replySize = recvfrom(sockDescriptor, reply, sizeof(reply), 0, NULL, 0)) >= 0) {
+            if (isPacketIntact(reply, replySize) && decodePacketHeader(reply, replySize, &ack) > 0
+                && isFlagSet(ack.flags, IS_ACK) && isFlagSet(ack.flags, IS_PROBE)
+                && ack.sequenceNumber == probeNumber) {
+                updateTimeout(rtt, timestampToRTT(ack.timestamp));
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the largest packet size the path carries without fragmentation.
+ *
+ * @param sockDescriptor The socket, with the Don't Fragment bit set.
+ * @param destAddr The address of the receiver.
+ * @param maxPacketSize The largest packet size the sender and receiver support.
+ * @param rtt The RTT estimator, updated from the ACKs of the probes.
+ * @return int The packet size to use, in bytes of UDP payload.
+ */
+int discoverPacketSize(int sockDescriptor, struct sockaddr_in *destAddr, int maxPacketSize, RttEstimator *rtt) {
+    int packetSize = BASE_PACKET_SIZE;
+    int probeCount = sizeof(probeSizes) / sizeof(probeSizes[0]);
+    char *probe = calloc(1, maxPacketSize);
+    if (probe == NULL) {
+        return packetSize;
+    }
+
+    /*
+     * Probe each size of the table that fits in maxPacketSize, then maxPacketSize itself.
+     */
+    for (int i = 0; i <= probeCount; i++) {
+        int probeSize = i < probeCount ? probeSizes[i] : maxPacketSize;
+        if (probeSize <= packetSize || probeSize > maxPacketSize) {
+            continue;
+        }
+        if (!probePacketSize(sockDescriptor, destAddr, probe, probeSize, i, rtt)) {
+            break;
+        }
+        packetSize = probeSize;
+    }
+
+    free(probe);
+    return packetSize;
+}
+
+#endif
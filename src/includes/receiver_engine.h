@@ -0,0 +1,1096 @@
+/**
+*   @file receiver_engine.h
+*   @brief The receiving side of the protocol, shared by the receiver program and librudp.
+*
+*   A ReceiverTransfer binds one socket per receiving thread to a port, and each thread
+*   receives the streams that reach its socket with receiveStreams. The streams of a
+*   transfer are written to a file, or to the sink of a librudp session. The threads
+*   report to the TransferControl of the transfer, so the caller can wait for them,
+*   follow their progress or cancel them, and nothing here ever exits the process:
+*   every failure becomes a RUDP_ERROR status of the transfer.
+*
+*   @bug No known bugs.
+*   @author Maddy Paulson (maddypaulson)
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef RECEIVER_ENGINE_H
+#define RECEIVER_ENGINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "rudp.h"
+#include "transfer_control.h"
+#include "packet_header.h"
+#include "rtt_estimates.h"
+#include "sliding_window.h"
+#include "sack.h"
+#include "ack_policy.h"
+#include "batch_io.h"
+#include "async_writer.h"
+#include "ordered_output.h"
+#include "multi_stream.h"
+#include "session.h"
+#include "fec.h"
+#include "compression.h"
+#include "integrity.h"
+#include "resume.h"
+#include "handshake.h"
+#include "pmtu_discovery.h"
+
+
+/**
+ * @def BUFFER_SIZE
+ * Definition to indicate size of the buffer, which is also the largest packet accepted.
+ */
+#define BUFFER_SIZE 10000
+
+/**
+ * @def GRO_BUFFER_SIZE
+ * Definition specifying the size of a receive buffer with GRO, which holds up to 64 KB of coalesced packets.
+ */
+#define GRO_BUFFER_SIZE 65536
+
+/**
+ * @def GRO_POOL_SIZE
+ * Definition specifying the number of receive buffers with GRO, which are larger but hold more packets.
+ */
+#define GRO_POOL_SIZE 256
+
+/**
+ * @def RECEIVE_POLL_MS
+ * Definition specifying how often an idle receiver thread checks whether the transfer finished, in ms.
+ */
+#define RECEIVE_POLL_MS 100
+
+/**
+ * @def MAX_THREAD_STREAMS
+ * Definition specifying the largest number of streams one receiver thread tracks at once.
+ */
+#define MAX_THREAD_STREAMS 64
+
+/**
+ * @brief Sends a final acknowledgment (ACK) for the specified sequence number.
+ * 
+ * This function sends a final acknowledgment packet for the provided sequence number
+ * to the specified destination address using the given socket descriptor. The acknowledgment
+ * indicates the successful receipt of the last packet in the data transmission process.
+ * 
+ * @param sockDescriptor The socket descriptor for sending the acknowledgment.
+ * @param destAddr The destination address to send the acknowledgment.
+ * @param sequenceNumber The sequence number of the packet being acknowledged.
+ * @param timestamp The timestamp of the packet being acknowledged, echoed back to the sender.
+ * @param connectionId The connection ID of the transfer.
+ * @return Void.
+ */
+void sendFinalAck(int sockDescriptor, struct sockaddr_in *destAddr, long long sequenceNumber, unsigned int timestamp,
+                  unsigned int connectionId) {
+    PacketHeader ack;
+    WireHeader wire;
+    ack.sequenceNumber = sequenceNumber;
+    ack.timestamp = timestamp;
+    ack.connectionId = connectionId;
+    ack.offset = 0;
+    ack.flags = 0;
+    ack.flags = setFlag(ack.flags, IS_ACK);
+    ack.flags = setFlag(ack.flags, IS_LAST_PACKET);
+    sealPacket(&ack, &wire, NULL, 0);
+
+    sendto(sockDescriptor, &wire, sizeof(wire), 0, (struct sockaddr *)destAddr, sizeof(struct sockaddr_in));
+}
+
+/**
+ * @brief Acknowledges a path MTU probe.
+ * 
+ * The probe's sequence number and timestamp are echoed back so the sender can match
+ * the ACK to the probe size and take an RTT sample. The probe itself is discarded.
+ * 
+ * @param sockDescriptor The socket descriptor for sending the acknowledgment.
+ * @param destAddr The destination address to send the acknowledgment.
+ * @param probe The header of the probe.
+ * @return Void.
+ */
+void sendProbeAck(int sockDescriptor, struct sockaddr_in *destAddr, PacketHeader *probe) {
+    PacketHeader ack = *probe;
+    WireHeader wire;
+    ack.flags = setFlag(ack.flags, IS_ACK);
+    sealPacket(&ack, &wire, NULL, 0);
+
+    sendto(sockDescriptor, &wire, sizeof(wire), 0, (struct sockaddr *)destAddr, sizeof(struct sockaddr_in));
+}
+
+/**
+ * @brief Answers the handshake of a sender.
+ *
+ * The header of the handshake is echoed back with IS_ACK set, and only the missing
+ * ranges the answer holds are sent.
+ *
+ * @param sockDescriptor The socket descriptor for sending the answer.
+ * @param destAddr The destination address to send the answer.
+ * @param handshake The header of the handshake.
+ * @param answer The answer.
+ * @return Void.
+ */
+void sendHandshakeAnswer(int sockDescriptor, struct sockaddr_in *destAddr, PacketHeader *handshake,
+                         HandshakeAnswer *answer) {
+    PacketHeader header = *handshake;
+    WireHeader wire;
+    size_t size = handshakeAnswerSize(answer->resume.rangeCount);
+
+    header.flags = setFlag(header.flags, IS_ACK);
+    sealPacket(&header, &wire, answer, size);
+
+    sendDatagram(sockDescriptor, destAddr, &wire, sizeof(wire), answer, size);
+}
+
+/**
+ * @brief Queues an acknowledgment (ACK) for the packets waiting for one.
+ * 
+ * The ACK echoes the sequence number and timestamp of the latest packet recorded by
+ * the ACK policy, so the sender can measure the RTT of that exact transmission. Every
+ * ACK also carries a SACK block describing the whole receive window, so one ACK covers
+ * every packet received since the previous one, and the sender learns about every packet
+ * that arrived even if earlier ACKs were lost. The ACK is stored in acks, which holds
+ * one ACK per position of the batch, and is sent with the next flush of the batch.
+ * 
+ * @param batch The send batch the acknowledgment is queued in.
+ * @param acks Storage for the ACKs in the batch.
+ * @param policy The ACK policy holding the packet to echo; its pending packets are cleared.
+ * @param window The receive window reported in the SACK block.
+ * @param highestReceived The highest sequence number received so far.
+ * @param connectionId The connection ID of the transfer.
+ * @return Void.
+ */
+void sendAck(SendBatch *batch, AckPacket *acks, AckPolicy *policy, ReceiveWindow *window, long long highestReceived,
+             unsigned int connectionId) {
+    AckPacket *ack = &acks[batch->count];
+    PacketHeader header;
+    memset(ack, 0, sizeof(*ack));
+    header.sequenceNumber = policy->sequenceNumber;
+    header.timestamp = policy->timestamp;
+    header.connectionId = connectionId;
+    header.offset = 0;
+    header.flags = 0;
+    header.flags = setFlag(header.flags, IS_ACK);
+    buildSack(&ack->sack, window, highestReceived);
+    /*
+     * The checksum covers the whole SACK block, padding included.
+     */
+    sealPacket(&header, &ack->header, &ack->sack, sizeof(ack->sack));
+
+    queueDatagram(batch, &policy->destAddr, &ack->header, sizeof(ack->header), &ack->sack, sizeof(ack->sack));
+    ackSent(policy);
+}
+
+/**
+ * @struct ReceiverStream
+ * @brief Receive state of one stream, identified by its connection ID and the address it is sent from.
+ */
+typedef struct {
+    int isUsed;                     /**< Non-zero if the entry holds a stream. */
+    unsigned int connectionId;      /**< Connection ID of the transfer the stream belongs to. */
+    struct sockaddr_in senderAddr;  /**< Address and port the stream is sent from. */
+    Session *session;               /**< Session of the transfer. */
+    WriteTarget target;             /**< Output file of the session, opened for this stream. */
+    ReceiveWindow window;           /**< Packets received ahead of the next expected one. */
+    AckPolicy ackPolicy;            /**< Packets of the stream waiting for an ACK. */
+    long long highestReceived;      /**< Highest sequence number received so far. */
+    int isDone;                     /**< Non-zero once the closing packet of the stream arrived. */
+    struct timeval lastActivity;    /**< Arrival time of the latest packet of the stream. */
+    FecDecoder fec;                 /**< Recent packets kept to rebuild lost ones, if the stream uses FEC. */
+    DataHash hash;                  /**< The data of the stream received so far. */
+    int isCheckpointed;             /**< Non-zero if the stream moves the checkpoint of its session forward. */
+    RangeSet received;              /**< Ranges handed to the writer, if the stream is checkpointed. */
+    RangeSet syncing;               /**< Copy of received taken when the writer was last asked to sync. */
+    unsigned long long int syncedBytes; /**< Bytes of the stream received when that copy was taken. */
+    unsigned int syncTicket;        /**< Ticket of the latest sync asked of the writer. */
+    int isSyncing;                  /**< Non-zero until the writer has done that sync. */
+    struct timeval lastSync;        /**< Time the writer was last asked to sync. */
+} ReceiverStream;
+
+/**
+ * @struct ReceiverThread
+ * @brief A receiver thread: its socket, its settings, the streams it serves and its results.
+ */
+typedef struct {
+    int sockDescriptor;                     /**< Socket bound to the shared port. */
+    int batchSize;                          /**< Largest number of datagrams per system call. */
+    int ackFrequency;                       /**< In-order packets acknowledged by one ACK. */
+    int ackDelayMs;                         /**< Longest time an ACK may be held back. */
+    int useGro;                             /**< Non-zero if GRO is enabled on the socket. */
+    SessionTable *sessions;                 /**< Sessions shared by every thread. */
+    TransferControl *control;               /**< Completion and cancellation of the receiver. */
+    ReceiverStream streams[MAX_THREAD_STREAMS]; /**< Streams that reached this thread. */
+    unsigned long long int bytesWritten;    /**< Bytes written by the streams of this thread. */
+    unsigned long long int droppedPackets;  /**< Packets dropped while waiting for the disk. */
+    unsigned long long int recoveredPackets;/**< Packets rebuilt from FEC parity. */
+    unsigned long long int corruptPackets;  /**< Datagrams dropped because their checksum did not match. */
+    IoStats ioStats;                        /**< System calls and datagrams of this thread. */
+} ReceiverThread;
+
+/**
+ * @brief Finds the stream a packet belongs to, and starts tracking it if it is new.
+ *
+ * A new stream is attached to the session of its connection ID and opens the output
+ * file of the session, or shares its sink, for its own writes. Its receive window is
+ * the one the handshake of the session settled. The stream of a
+ * resumable session keeps its checkpoint going if the receiver keeps checkpoints.
+ *
+ * @param thread The receiver thread.
+ * @param connectionId The connection ID in the packet.
+ * @param senderAddr The address the packet was sent from.
+ * @return ReceiverStream* The stream, or NULL if it cannot be served.
+ */
+ReceiverStream *findStream(ReceiverThread *thread, unsigned int connectionId, struct sockaddr_in *senderAddr) {
+    ReceiverStream *freeEntry = NULL;
+    for (int i = 0; i < MAX_THREAD_STREAMS; i++) {
+        ReceiverStream *stream = &thread->streams[i];
+        if (!stream->isUsed) {
+            if (freeEntry == NULL) {
+                freeEntry = stream;
+            }
+        } else if (stream->connectionId == connectionId
+                   && stream->senderAddr.sin_addr.s_addr == senderAddr->sin_addr.s_addr
+                   && stream->senderAddr.sin_port == senderAddr->sin_port) {
+            return stream;
+        }
+    }
+
+    if (freeEntry == NULL) {
+        return NULL;
+    }
+    ReceiverStream *stream = freeEntry;
+    if ((stream->session = attachSession(thread->sessions, connectionId)) == NULL) {
+        return NULL;
+    }
+    SessionTable *sessions = thread->sessions;
+    if ((sessions->sink != NULL ? shareWriteTarget(&stream->target, sessions->sink)
+                                : openWriteTarget(&stream->target, stream->session->path, 0)) < 0) {
+        warnTransfer(thread->control, "Failed to open destination file for writing.");
+        detachSession(sessions, stream->session, connectionId, 0);
+        return NULL;
+    }
+    if (initReceiveWindow(&stream->window, stream->session->windowSize, 0) < 0) {
+        failTransfer(thread->control, RUDP_ERROR_SYSTEM);
+        closeWriteTarget(&stream->target);
+        detachSession(sessions, stream->session, connectionId, 0);
+        return NULL;
+    }
+    stream->isUsed = 1;
+    stream->connectionId = connectionId;
+    stream->senderAddr = *senderAddr;
+    stream->highestReceived = -1;
+    stream->isDone = 0;
+    memset(&stream->fec, 0, sizeof(stream->fec));
+    initDataHash(&stream->hash);
+    initAckPolicy(&stream->ackPolicy, thread->ackFrequency, thread->ackDelayMs);
+    stream->isCheckpointed = sessions->isCheckpointed && stream->session->key != 0 && stream->target.fd >= 0;
+    initRangeSet(&stream->received);
+    initRangeSet(&stream->syncing);
+    stream->syncedBytes = 0;
+    stream->syncTicket = 0;
+    stream->isSyncing = 0;
+    gettimeofday(&stream->lastSync, NULL);
+    return stream;
+}
+
+/**
+ * @brief Moves the checkpoint of a stream forward.
+ *
+ * Once the writer has synced the file past the ranges copied at the latest request,
+ * they go to the checkpoint of the session. Every CHECKPOINT_INTERVAL_MS, if the stream
+ * received anything since, the ranges are copied again and the writer asked to sync the
+ * file behind the writes already queued. Without a free buffer the request waits for
+ * the next call.
+ *
+ * @param thread The receiver thread.
+ * @param writer The writer of the thread.
+ * @param stream The stream, checkpointed.
+ * @param now The current time.
+ */
+void checkpointStream(ReceiverThread *thread, AsyncWriter *writer, ReceiverStream *stream, struct timeval *now) {
+    if (stream->isSyncing && atomic_load(&stream->target.syncedTicket) == stream->syncTicket) {
+        stream->isSyncing = 0;
+        if (checkpointSession(thread->sessions, stream->session, &stream->syncing) < 0) {
+            warnTransfer(thread->control, "Saving checkpoint failed");
+        }
+    }
+    if (stream->isSyncing || stream->hash.bytes == stream->syncedBytes
+        || calculateRTT(stream->lastSync, *now) < CHECKPOINT_INTERVAL_MS) {
+        return;
+    }
+
+    WriteBuffer *buffer;
+    if (copyRangeSet(&stream->syncing, &stream->received) < 0 || (buffer = acquireWriteBuffer(writer)) == NULL) {
+        return;
+    }
+    submitSync(writer, buffer, &stream->target, ++stream->syncTicket);
+    stream->syncedBytes = stream->hash.bytes;
+    stream->isSyncing = 1;
+    stream->lastSync = *now;
+}
+
+/**
+ * @brief Stops tracking a stream once its pending writes completed.
+ *
+ * A failed write fails the transfer, unless the receiver serves other transfers as a daemon.
+ * A checkpointed stream of an unfinished session syncs what it wrote and saves it in the
+ * checkpoint first, so a sender that went away can resume from there.
+ *
+ * @param thread The receiver thread.
+ * @param stream The stream.
+ */
+void forgetStream(ReceiverThread *thread, ReceiverStream *stream) {
+    if (stream->isCheckpointed && !isSessionFinished(stream->session) && syncWriteTarget(&stream->target) == 0
+        && checkpointSession(thread->sessions, stream->session, &stream->received) < 0) {
+        warnTransfer(thread->control, "Saving checkpoint failed");
+    }
+    freeRangeSet(&stream->received);
+    freeRangeSet(&stream->syncing);
+    if (closeWriteTarget(&stream->target) < 0) {
+        warnTransfer(thread->control, "Writing destination file failed");
+        if (!thread->sessions->isDaemon) {
+            failTransfer(thread->control, RUDP_ERROR_SINK);
+        }
+    }
+    unsigned long long int bytesWritten = atomic_load(&stream->target.bytesWritten);
+    thread->bytesWritten += bytesWritten;
+    detachSession(thread->sessions, stream->session, stream->connectionId, bytesWritten);
+    freeReceiveWindow(&stream->window);
+    freeFecDecoder(&stream->fec);
+    stream->isUsed = 0;
+}
+
+/**
+ * @brief Returns the FEC decoder of a stream, allocating it the first time the stream uses FEC.
+ *
+ * @param thread The receiver thread, failed if the decoder cannot be allocated.
+ * @param stream The stream.
+ * @return FecDecoder* The decoder, or NULL if it could not be allocated.
+ */
+FecDecoder *getFecDecoder(ReceiverThread *thread, ReceiverStream *stream) {
+    if (stream->fec.packets == NULL && initFecDecoder(&stream->fec, BUFFER_SIZE) < 0) {
+        freeFecDecoder(&stream->fec);
+        failTransfer(thread->control, RUDP_ERROR_SYSTEM);
+        return NULL;
+    }
+    return &stream->fec;
+}
+
+/**
+ * @brief Records a packet received for the first time in the receive window.
+ *
+ * The window slides past every packet that has now arrived in order.
+ *
+ * @param stream The stream.
+ * @param sequenceNumber The sequence number of the packet, inside the window.
+ * @return int Non-zero if the packet must be acknowledged at once: it was out of order or filled a gap.
+ */
+int markReceived(ReceiverStream *stream, long long sequenceNumber) {
+    ReceiveWindow *window = &stream->window;
+    getReceiveSlot(window, sequenceNumber)->isReceived = 1;
+    if (sequenceNumber > stream->highestReceived) {
+        stream->highestReceived = sequenceNumber;
+    }
+
+    int isInOrder = sequenceNumber == window->expectedSequenceNumber;
+    ReceiveSlot *slot;
+    while (slot = getReceiveSlot(window, window->expectedSequenceNumber), slot->isReceived) {
+        slot->isReceived = 0;
+        window->expectedSequenceNumber++;
+    }
+
+    /*
+     * Only an in-order packet that did not fill a gap may wait for its ACK.
+     */
+    return !isInOrder || window->expectedSequenceNumber > sequenceNumber + 1;
+}
+
+/**
+ * @brief Writes the packets of a stream rebuilt from parity and acknowledges them at once.
+ *
+ * Each packet is copied into a buffer of its own for the writer; without a free buffer
+ * it is dropped, and the sender retransmits it.
+ *
+ * @param thread The receiver thread.
+ * @param writer The writer of the thread.
+ * @param stream The stream.
+ * @param recoveredCount The number of packets the decoder of the stream just rebuilt.
+ * @param ackBatch The send batch the ACK is queued in.
+ * @param acks Storage for the ACKs in the batch.
+ * @param senderAddr The address of the sender.
+ */
+void acceptRecovered(ReceiverThread *thread, AsyncWriter *writer, ReceiverStream *stream, int recoveredCount,
+                     SendBatch *ackBatch, AckPacket *acks, struct sockaddr_in *senderAddr) {
+    int isAccepted = 0;
+
+    for (int m = 0; m < recoveredCount; m++) {
+        FecSymbol *packet = stream->fec.recovered[m];
+        if (!isInReceiveWindow(&stream->window, packet->tag) || getReceiveSlot(&stream->window, packet->tag)->isReceived) {
+            continue;
+        }
+
+        WriteBuffer *buffer = acquireWriteBuffer(writer);
+        if (buffer == NULL) {
+            thread->droppedPackets++;
+            continue;
+        }
+        memcpy(buffer->data, packet->data, packet->length);
+        addWriteSegment(buffer, buffer->data, packet->length, packet->offset);
+        submitWrite(writer, buffer, &stream->target);
+        addDataHash(&stream->hash, packet->data, packet->length, packet->offset);
+        if (stream->isCheckpointed) {
+            addRange(&stream->received, packet->offset, packet->length);
+        }
+
+        markReceived(stream, packet->tag);
+        recordPacket(&stream->ackPolicy, packet->tag, 0, senderAddr, 1);
+        thread->recoveredPackets++;
+        isAccepted = 1;
+    }
+
+    if (isAccepted) {
+        sendAck(ackBatch, acks, &stream->ackPolicy, &stream->window, stream->highestReceived, stream->connectionId);
+    }
+}
+
+/**
+ * @brief Checks whether the receiver is done: a single transfer finished, unless it runs as a
+ * daemon, or the receiver was cancelled or failed.
+ *
+ * @param thread The receiver thread.
+ * @return int Non-zero once the receiver must stop.
+ */
+int isReceiverDone(ReceiverThread *thread) {
+    SessionTable *sessions = thread->sessions;
+    return isTransferCancelled(thread->control)
+        || (!sessions->isDaemon && atomic_load(&sessions->sessionsFinished) > 0);
+}
+
+/**
+ * @brief Receives the streams that reach one socket, from one event loop.
+ *
+ * This is the body of a receiver thread. The socket is non-blocking: the thread reads
+ * every batch already queued and, when none is left, waits in epoll_wait for the socket
+ * to become readable or for the next delayed ACK to fall due. Packets are told apart by
+ * their connection ID and source address, and each stream is received with Selective
+ * Repeat in its own sequence space: the payload of every packet inside the stream's
+ * receive window is handed to this thread's writer, which writes it into the file of the
+ * stream's session at the offset given in its header, so packets of any size may be used
+ * and packets that arrive out of order are never copied or held back. The receive window
+ * only records which packets already arrived. ACKs carry a SACK block reporting every
+ * packet received in the window, which lets one ACK stand in for up to ackFrequency
+ * in-order packets or for the packets received within ackDelayMs. Packets that arrive
+ * out of order, duplicates and packets that fill a gap are acknowledged at once. Packets
+ * are received into buffers of the writer's pool, and ACKs are sent in batches of up to
+ * batchSize datagrams per system call. With GRO, one buffer may hold several packets of
+ * one stream coalesced by the kernel, which are split back into packets here. When the
+ * disk falls behind and the pool is empty, new packets are dropped unacknowledged and the
+ * sender retransmits them. When the sender adds FEC parity packets, the payloads of its
+ * data packets are also copied into the stream's decoder, and every parity packet may
+ * rebuild lost packets of its block, which are then written and acknowledged like
+ * received ones. A compressed payload is decompressed into a buffer of its own, which
+ * goes to the writer at once. Every datagram whose CRC32C does not match is dropped as
+ * if it was lost, and every payload accepted is added to the DataHash of its stream.
+ * Path MTU probes are acknowledged and discarded. A handshake starts or finds its
+ * session and is answered with the parameters of the session, or why it was refused;
+ * packets of a connection ID without a session are ignored. A checkpointed stream has
+ * the writer sync what it received now and then, then records it in the checkpoint of
+ * its session. The closing packet of a stream is acknowledged, again whenever it is
+ * retransmitted, and counted in its session with the checksum the sender computed and
+ * the hash of what arrived. A finished stream is forgotten after SESSION_LINGER_MS and
+ * a silent one after SESSION_IDLE_MS. The thread returns once a single transfer
+ * finished, or never as a daemon, or once the receiver was cancelled or failed: a
+ * failed write fails a single transfer at once. The thread reports how it ended to the
+ * TransferControl of the receiver.
+ *
+ * @param argument The ReceiverThread.
+ * @return void* Always NULL.
+ */
+void *receiveStreams(void *argument) {
+    ReceiverThread *thread = argument;
+    int sockDescriptor = thread->sockDescriptor;
+    int batchSize = thread->batchSize;
+    SessionTable *sessions = thread->sessions;
+    ssize_t receivedBytes;
+    AsyncWriter writer;
+    ReceiveBatch packetBatch;
+    WriteBuffer *batchBuffers[MAX_BATCH_SIZE];
+    SendBatch ackBatch;
+    AckPacket acks[MAX_BATCH_SIZE];
+    WriteBuffer *spareBuffer = NULL;
+    WriteBuffer *inflateBuffer = NULL;
+    struct timeval now;
+    int status = RUDP_OK;
+    int isWriterOpen = 0;
+    int epollDescriptor = -1;
+    struct epoll_event event;
+
+    memset(&packetBatch, 0, sizeof(packetBatch));
+    memset(&ackBatch, 0, sizeof(ackBatch));
+
+    /*
+     * Start the writer thread, which writes the files of every session of this thread.
+     * A failure stops the thread before its first packet.
+     */
+    size_t receiveBufferSize = thread->useGro ? GRO_BUFFER_SIZE : BUFFER_SIZE;
+
+    if (openAsyncWriter(&writer, receiveBufferSize, thread->useGro ? GRO_POOL_SIZE : WRITE_POOL_SIZE) < 0) {
+        status = RUDP_ERROR_SYSTEM;
+    } else {
+        isWriterOpen = 1;
+    }
+
+    memset(&thread->ioStats, 0, sizeof(thread->ioStats));
+    if (status == RUDP_OK && (initReceiveBatch(&packetBatch, batchSize, 0, &thread->ioStats) < 0
+                              || initSendBatch(&ackBatch, sockDescriptor, batchSize, &thread->ioStats, thread->control) < 0)) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+
+    /*
+     * Receive straight into buffers of the writer's pool, so a packet can be handed
+     * to the writer thread without copying its payload.
+     */
+    for (int i = 0; status == RUDP_OK && i < batchSize; i++) {
+        batchBuffers[i] = acquireWriteBuffer(&writer);
+        setBatchBuffer(&packetBatch, i, batchBuffers[i]->data, receiveBufferSize);
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = sockDescriptor;
+    if (status == RUDP_OK && ((epollDescriptor = epoll_create1(0)) < 0
+                              || epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, sockDescriptor, &event) < 0)) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+
+    while(status == RUDP_OK && !isReceiverDone(thread)){
+        int packetCount = receiveBatch(sockDescriptor, &packetBatch);
+
+        if(packetCount < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+            status = RUDP_ERROR_SYSTEM;
+            break;
+        }
+
+        if (packetCount < 0) {
+            /*
+             * Nothing is queued: sleep until a packet arrives or the next delayed ACK is
+             * due, and at most RECEIVE_POLL_MS to check on the sessions.
+             */
+            int waitMs = RECEIVE_POLL_MS;
+            for (int s = 0; s < MAX_THREAD_STREAMS; s++) {
+                ReceiverStream *stream = &thread->streams[s];
+                double remainingMs = stream->isUsed ? ackDelayRemaining(&stream->ackPolicy) : -1;
+                if (remainingMs >= 0 && remainingMs + 1 < waitMs) {
+                    waitMs = (int)remainingMs + 1;
+                }
+            }
+            if (epoll_wait(epollDescriptor, &event, 1, waitMs) < 0 && errno != EINTR) {
+                status = RUDP_ERROR_SYSTEM;
+                break;
+            }
+            packetCount = 0;
+        }
+
+        gettimeofday(&now, NULL);
+
+        for (int i = 0; i < packetCount; i++) {
+            char *buffer = getBatchBuffer(&packetBatch, i);
+            struct sockaddr_in *senderAddr = &packetBatch.addresses[i];
+            receivedBytes = getBatchLength(&packetBatch, i);
+            ssize_t segmentSize = getBatchSegmentSize(&packetBatch, i);
+            WriteTarget *bufferTarget = NULL;
+            int isDropped = 0;
+
+            /*
+             * With GRO the buffer may hold several packets of segmentSize bytes each.
+             */
+            for (ssize_t position = 0; position < receivedBytes; position += segmentSize) {
+                char *packet = buffer + position;
+                ssize_t packetSize = receivedBytes - position < segmentSize ? receivedBytes - position : segmentSize;
+
+                if (!isPacketIntact(packet, packetSize)) {
+                    thread->corruptPackets++;
+                    continue;
+                }
+
+                /*
+                 * Decode the packet header, and skip its extensions to the payload.
+                 */
+                PacketHeader header;
+                size_t headerSize = decodePacketHeader(packet, packetSize, &header);
+                if (headerSize == 0) {
+                    continue;
+                }
+                char *body = packet + headerSize;
+                ssize_t payloadSize = packetSize - headerSize;
+
+                if (isFlagSet(header.flags, IS_PROBE)) {
+                    sendProbeAck(sockDescriptor, senderAddr, &header);
+                    continue;
+                }
+                if (isFlagSet(header.flags, IS_HANDSHAKE)) {
+                    HandshakeOffer offer;
+                    HandshakeAnswer answer;
+                    if (payloadSize >= (ssize_t)sizeof(offer) && !isFlagSet(header.flags, IS_ACK)) {
+                        memcpy(&offer, body, sizeof(offer));
+                        if (offer.dataLength == payloadSize - sizeof(offer)) {
+                            acceptSession(sessions, header.connectionId, &offer, body + sizeof(offer), &answer);
+                            sendHandshakeAnswer(sockDescriptor, senderAddr, &header, &answer);
+                        }
+                    }
+                    continue;
+                }
+
+                ReceiverStream *stream = findStream(thread, header.connectionId, senderAddr);
+                if (stream == NULL) {
+                    continue;
+                }
+                ReceiveWindow *window = &stream->window;
+                stream->lastActivity = now;
+                header.sequenceNumber = expandSequenceNumber(header.sequenceNumber, window->expectedSequenceNumber);
+
+                if (isFlagSet(header.flags, IS_PARITY)) {
+                    FecDecoder *decoder;
+                    if (!stream->isDone && payloadSize > (ssize_t)sizeof(FecInfo)
+                        && (decoder = getFecDecoder(thread, stream)) != NULL) {
+                        FecInfo info;
+                        memcpy(&info, body, sizeof(info));
+                        int recoveredCount = addFecParity(decoder, &header, &info, body + sizeof(info),
+                                                          payloadSize - sizeof(info));
+                        acceptRecovered(thread, &writer, stream, recoveredCount, &ackBatch, acks, senderAddr);
+                    }
+                } else if (isFlagSet(header.flags, IS_LAST_PACKET)) {
+                    if (payloadSize != (ssize_t)sizeof(ClosingInfo)) {
+                        continue;
+                    }
+                    flushSendBatch(&ackBatch);
+                    sendFinalAck(sockDescriptor, senderAddr, header.sequenceNumber, header.timestamp, header.connectionId);
+                    if (stream->isDone) {
+                        continue;
+                    }
+                    stream->isDone = 1;
+
+                    ClosingInfo closing;
+                    memcpy(&closing, body, sizeof(closing));
+                    finishSessionStream(sessions, stream->session, &closing, finishDataHash(&stream->hash),
+                                        stream->hash.bytes);
+                } else if (stream->isDone || header.sequenceNumber >= window->expectedSequenceNumber + window->size) {
+                    continue;
+                } else {
+                    int isImmediate = 1;
+                    if (isInReceiveWindow(window, header.sequenceNumber)
+                        && !getReceiveSlot(window, header.sequenceNumber)->isReceived) {
+                        /*
+                         * The buffer goes to the writer once a free buffer can take its place
+                         * in the batch. Without one the packet is dropped and not acknowledged.
+                         * A buffer only ever holds packets of one flow, so of one file. An empty
+                         * packet, the keepalive of a sender waiting for its input, has nothing
+                         * to write and is only acknowledged.
+                         */
+                        char *payload = body;
+                        int isInflated = payloadSize > 0 && isFlagSet(header.flags, IS_COMPRESSED);
+                        if (isInflated) {
+                            /*
+                             * A compressed payload is expanded into a buffer of its own. A
+                             * malformed one is dropped, and the buffer kept for the next.
+                             */
+                            if (inflateBuffer == NULL && (inflateBuffer = acquireWriteBuffer(&writer)) == NULL) {
+                                thread->droppedPackets++;
+                                continue;
+                            }
+                            ssize_t dataSize = decompressBlock(payload, payloadSize, inflateBuffer->data, receiveBufferSize);
+                            if (dataSize <= 0) {
+                                thread->droppedPackets++;
+                                continue;
+                            }
+                            payload = inflateBuffer->data;
+                            payloadSize = dataSize;
+                            addWriteSegment(inflateBuffer, payload, payloadSize, header.offset);
+                        } else if (payloadSize > 0) {
+                            if (spareBuffer == NULL && !isDropped) {
+                                spareBuffer = acquireWriteBuffer(&writer);
+                                isDropped = spareBuffer == NULL;
+                            }
+                            if (isDropped || (bufferTarget != NULL && bufferTarget != &stream->target)
+                                || addWriteSegment(batchBuffers[i], body, payloadSize, header.offset) < 0) {
+                                thread->droppedPackets++;
+                                continue;
+                            }
+                            bufferTarget = &stream->target;
+                        }
+                        FecDecoder *decoder;
+                        if (isFlagSet(header.flags, HAS_PARITY) && (decoder = getFecDecoder(thread, stream)) != NULL) {
+                            storeFecPacket(decoder, &header, payload, payloadSize);
+                        }
+                        if (isInflated) {
+                            submitWrite(&writer, inflateBuffer, &stream->target);
+                            inflateBuffer = NULL;
+                        }
+                        addDataHash(&stream->hash, payload, payloadSize, header.offset);
+                        if (stream->isCheckpointed) {
+                            addRange(&stream->received, header.offset, payloadSize);
+                        }
+                        isImmediate = markReceived(stream, header.sequenceNumber);
+                    }
+
+                    if (recordPacket(&stream->ackPolicy, header.sequenceNumber, header.timestamp, senderAddr, isImmediate)) {
+                        sendAck(&ackBatch, acks, &stream->ackPolicy, window, stream->highestReceived, stream->connectionId);
+                    }
+                }
+            }
+
+            /*
+             * Hand the buffer to the writer if it holds payloads to write, and receive the
+             * next batch into the spare buffer taken for it.
+             */
+            if (bufferTarget != NULL) {
+                submitWrite(&writer, batchBuffers[i], bufferTarget);
+                batchBuffers[i] = spareBuffer;
+                spareBuffer = NULL;
+                setBatchBuffer(&packetBatch, i, batchBuffers[i]->data, receiveBufferSize);
+            }
+        }
+
+        /*
+         * Send the delayed ACKs that fell due and forget streams that finished long ago
+         * or went silent.
+         */
+        for (int s = 0; s < MAX_THREAD_STREAMS; s++) {
+            ReceiverStream *stream = &thread->streams[s];
+            if (!stream->isUsed) {
+                continue;
+            }
+            if (!stream->isDone && ackDelayRemaining(&stream->ackPolicy) == 0) {
+                sendAck(&ackBatch, acks, &stream->ackPolicy, &stream->window, stream->highestReceived, stream->connectionId);
+            }
+            if (!sessions->isDaemon && atomic_load(&stream->target.hasFailed)) {
+                failTransfer(thread->control, RUDP_ERROR_SINK);
+            }
+
+            if (stream->isCheckpointed) {
+                checkpointStream(thread, &writer, stream, &now);
+            }
+
+            double idleMs = calculateRTT(stream->lastActivity, now);
+            if ((isSessionFinished(stream->session) && idleMs > SESSION_LINGER_MS) || idleMs > SESSION_IDLE_MS) {
+                forgetStream(thread, stream);
+            }
+        }
+        flushSendBatch(&ackBatch);
+    }
+
+    if (status != RUDP_OK) {
+        failTransfer(thread->control, status);
+    }
+    for (int s = 0; s < MAX_THREAD_STREAMS; s++) {
+        if (thread->streams[s].isUsed) {
+            forgetStream(thread, &thread->streams[s]);
+        }
+    }
+    if (isWriterOpen) {
+        closeAsyncWriter(&writer);
+    }
+
+    if (epollDescriptor >= 0) {
+        close(epollDescriptor);
+    }
+    freeReceiveBatch(&packetBatch);
+    freeSendBatch(&ackBatch);
+    finishTransferThread(thread->control, status);
+    return NULL;
+}
+
+/**
+ * @struct ReceiverTransfer
+ * @brief A receiver bound to a port: its threads, their sessions and their results.
+ */
+typedef struct {
+    RudpOptions options;                    /**< Settings of the receiver. */
+    unsigned short int port;                /**< The UDP port the sockets are bound to. */
+    ReceiverThread threads[MAX_STREAMS];    /**< The receiving threads, one socket each. */
+    pthread_t threadIds[MAX_STREAMS];       /**< Thread of every receiving thread started. */
+    int startedThreads;                     /**< Number of receiving threads started. */
+    int useGro;                             /**< Non-zero if GRO is enabled on the sockets. */
+    SessionTable sessions;                  /**< Sessions shared by the threads. */
+    WriteTarget sink;                       /**< Destination of the single transfer instead of a path, if given. */
+    OrderedOutput ordered;                  /**< Output of a sink that must be written in order. */
+    int isOrdered;                          /**< Non-zero if the sink writes through ordered. */
+    TransferControl control;                /**< Completion and cancellation of the threads. */
+    struct timeval start;                   /**< Time the threads were started. */
+    struct timeval end;                     /**< Time the last thread finished, once joined. */
+    unsigned long long int bytesWritten;    /**< Bytes of the data on disk, once joined: those of the single transfer, or written by every thread as a daemon. */
+    unsigned long long int droppedPackets;  /**< Packets dropped while waiting for the disk, once joined. */
+    unsigned long long int recoveredPackets;/**< Packets rebuilt from FEC parity, once joined. */
+    unsigned long long int corruptPackets;  /**< Datagrams dropped because their checksum did not match, once joined. */
+    unsigned int checksum;                  /**< CRC32C of the data of the single transfer, once joined, unless resumed. */
+    unsigned long long int resumedBytes;    /**< Bytes of the single transfer its sender skipped, once joined. */
+    IoStats ioStats;                        /**< System calls and datagrams of every thread, once joined. */
+} ReceiverTransfer;
+
+/**
+ * @brief Checks the settings of a receiver.
+ *
+ * @param options The settings.
+ * @return int RUDP_OK, or RUDP_ERROR_ARGUMENT if any is out of range.
+ */
+int checkReceiverOptions(const RudpOptions *options) {
+    if (options->batchSize < 1 || options->batchSize > MAX_BATCH_SIZE
+        || options->ackFrequency < 1 || options->ackFrequency > MAX_ACK_FREQUENCY || options->ackDelayMs < 1
+        || options->streams < 1 || options->streams > MAX_STREAMS
+        || (options->packetSize != 0 && (options->packetSize < MIN_PACKET_SIZE || options->packetSize > BUFFER_SIZE))
+        || options->receiveWindow < 0 || options->receiveWindow > MAX_WINDOW_SIZE) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+    return RUDP_OK;
+}
+
+/**
+ * @brief Binds one non-blocking socket per receiving thread to a port.
+ *
+ * Every socket is bound with SO_REUSEPORT, and the kernel keeps all the packets of a
+ * stream on one socket, so a transfer split into parallel streams is received on several
+ * cores. Without GRO support, the sockets receive single datagrams. Whatever happens, the
+ * receiver must be closed with closeReceiverTransfer.
+ *
+ * @param transfer The receiver to initialize.
+ * @param port The local UDP port to bind.
+ * @param options The settings of the receiver, already checked.
+ * @param isVerbose Non-zero to print warnings to stderr.
+ * @return int RUDP_OK, or RUDP_ERROR_SYSTEM if a socket could not be bound.
+ */
+int openReceiverTransfer(ReceiverTransfer *transfer, unsigned short int port, const RudpOptions *options, int isVerbose) {
+    struct sockaddr_in myAddr;
+
+    memset(transfer, 0, sizeof(*transfer));
+    transfer->options = *options;
+    transfer->port = port;
+    transfer->useGro = options->useOffload;
+    initTransferControl(&transfer->control, isVerbose);
+    initSessionTable(&transfer->sessions, NULL, 0);
+    transfer->sessions.isCheckpointed = options->checkpoint;
+    transfer->sessions.maxPacketSize = options->packetSize > 0 ? options->packetSize : BUFFER_SIZE;
+    transfer->sessions.maxWindowSize = options->receiveWindow > 0 ? options->receiveWindow : MAX_WINDOW_SIZE;
+    transfer->sessions.ackDelayMs = options->ackDelayMs;
+    transfer->sessions.control = &transfer->control;
+    for (int t = 0; t < MAX_STREAMS; t++) {
+        transfer->threads[t].sockDescriptor = -1;
+    }
+
+    memset(&myAddr, 0, sizeof(myAddr));
+    myAddr.sin_family = AF_INET;
+    myAddr.sin_port = htons(port);
+    myAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    for (int t = 0; t < options->streams; t++) {
+        ReceiverThread *thread = &transfer->threads[t];
+        thread->batchSize = options->batchSize;
+        thread->ackFrequency = options->ackFrequency;
+        thread->ackDelayMs = options->ackDelayMs;
+        thread->sessions = &transfer->sessions;
+        thread->control = &transfer->control;
+
+        /*
+         * Create a non-blocking UDP socket; the thread waits for it in epoll.
+         */
+        int sockDescriptor = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if(sockDescriptor < 0){
+            return RUDP_ERROR_SYSTEM;
+        }
+        thread->sockDescriptor = sockDescriptor;
+
+        /*
+         * Let every thread bind its own socket to the port; the kernel spreads the
+         * streams over them by source address.
+         */
+        int reusePort = 1;
+        if (setsockopt(sockDescriptor, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) < 0) {
+            return RUDP_ERROR_SYSTEM;
+        }
+
+        /*
+         * Ask for a socket buffer that can hold a full window of packets, so a burst
+         * from the sender is not dropped by the kernel. The kernel may cap this value.
+         */
+        int socketBufferSize = MAX_WINDOW_SIZE * BUFFER_SIZE;
+        if (setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVBUF, &socketBufferSize, sizeof(socketBufferSize)) < 0) {
+            warnTransfer(&transfer->control, "Error setting socket buffer size");
+        }
+
+        /*
+         * Bind socket.
+         */
+        if(bind(sockDescriptor, (struct sockaddr *)&myAddr, sizeof(myAddr)) < 0) {
+            return RUDP_ERROR_SYSTEM;
+        }
+
+        if (transfer->useGro && enableGro(sockDescriptor) < 0) {
+            warnTransfer(&transfer->control, "GRO not supported, receiving single datagrams");
+            transfer->useGro = 0;
+        }
+    }
+    for (int t = 0; t < options->streams; t++) {
+        transfer->threads[t].useGro = transfer->useGro;
+    }
+    return RUDP_OK;
+}
+
+/**
+ * @brief Starts receiving, one thread per socket.
+ *
+ * Without isDaemon, the first transfer is written to destination, or to the sink if one
+ * is given, and packets of other transfers are ignored. With isDaemon, every transfer is
+ * written to destination followed by its connection ID, or by its resume key if it is
+ * resumable, until the receiver is cancelled.
+ * When a thread cannot be started the receiver fails, and the threads already started
+ * stop; they must be joined either way.
+ *
+ * @param transfer The receiver, opened.
+ * @param destination The path of the output file, or the prefix of the output files as a daemon.
+ * @param isDaemon Non-zero to serve any number of concurrent transfers, each to its own file.
+ * @param sink Where the single transfer is written instead of destination, or NULL.
+ * @return int RUDP_OK, or the error that stopped the receiver.
+ */
+int startReceiverTransfer(ReceiverTransfer *transfer, const char *destination, int isDaemon, const WriteTarget *sink) {
+    transfer->sessions.destination = destination;
+    transfer->sessions.isDaemon = isDaemon;
+    if (sink != NULL) {
+        initWriteTarget(&transfer->sink, sink->fd);
+        transfer->sink.memory = sink->memory;
+        transfer->sink.capacity = sink->capacity;
+        transfer->sink.write = sink->write;
+        transfer->sink.context = sink->context;
+        transfer->sessions.sink = &transfer->sink;
+    }
+
+    gettimeofday(&transfer->start, NULL);
+    for (int t = 0; t < transfer->options.streams; t++) {
+        startTransferThread(&transfer->control);
+        if (pthread_create(&transfer->threadIds[t], NULL, receiveStreams, &transfer->threads[t]) != 0) {
+            finishTransferThread(&transfer->control, RUDP_ERROR_SYSTEM);
+            return RUDP_ERROR_SYSTEM;
+        }
+        transfer->startedThreads++;
+    }
+    return RUDP_OK;
+}
+
+/**
+ * @brief Prepares a sink that writes the single transfer in order to a descriptor that
+ * cannot seek, such as a pipe or stdout, to pass to startReceiverTransfer.
+ *
+ * @param transfer The receiver, opened; it owns the ordered output until it is joined.
+ * @param sink The sink to fill.
+ * @param fd The descriptor to write; it is not closed.
+ * @return Void.
+ */
+void initOrderedSink(ReceiverTransfer *transfer, WriteTarget *sink, int fd) {
+    initOrderedOutput(&transfer->ordered, fd);
+    transfer->isOrdered = 1;
+    initWriteTarget(sink, -1);
+    sink->write = writeOrdered;
+    sink->context = &transfer->ordered;
+}
+
+/**
+ * @brief Reports how far a receiver got, while it runs or after it finished.
+ *
+ * The bytes written are only counted while they are written when the receiver has a sink.
+ *
+ * @param transfer The receiver.
+ * @param progress Filled with the progress.
+ * @return Void.
+ */
+void getReceiverProgress(ReceiverTransfer *transfer, RudpProgress *progress) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    memset(progress, 0, sizeof(*progress));
+    progress->completedBytes = transfer->sessions.sink != NULL ? atomic_load(&transfer->sink.bytesWritten)
+                                                               : transfer->bytesWritten;
+    if (transfer->startedThreads > 0) {
+        progress->elapsedSeconds = calculateRTT(transfer->start, transfer->end.tv_sec > 0 ? transfer->end : now) / 1000.0;
+    }
+}
+
+/**
+ * @brief Waits for every receiving thread and adds up their results. Must be called once.
+ *
+ * An ordered sink still holding data behind a gap fails the transfer with RUDP_ERROR_SINK,
+ * and a single transfer whose data does not match the checksums of the sender fails with
+ * RUDP_ERROR_CORRUPT.
+ *
+ * @param transfer The receiver.
+ * @return int RUDP_OK if the transfer was received, or the error of the receiver.
+ */
+int joinReceiverTransfer(ReceiverTransfer *transfer) {
+    for (int t = 0; t < transfer->startedThreads; t++) {
+        ReceiverThread *thread = &transfer->threads[t];
+        pthread_join(transfer->threadIds[t], NULL);
+        transfer->bytesWritten += thread->bytesWritten;
+        transfer->droppedPackets += thread->droppedPackets;
+        transfer->recoveredPackets += thread->recoveredPackets;
+        transfer->corruptPackets += thread->corruptPackets;
+        addIoStats(&transfer->ioStats, &thread->ioStats);
+    }
+    gettimeofday(&transfer->end, NULL);
+
+    /*
+     * Every stream has finished, so the hash of the single session holds all of its data,
+     * and its data is what its checkpoint held and what its latest run wrote, handshake
+     * included. The streams of a run that died are left out, since the resumed run wrote
+     * again what they wrote past the checkpoint.
+     */
+    if (!transfer->sessions.isDaemon) {
+        transfer->bytesWritten = 0;
+    }
+    for (int i = 0; i < MAX_SESSIONS && !transfer->sessions.isDaemon; i++) {
+        Session *session = &transfer->sessions.sessions[i];
+        if (session->connectionId == 0) {
+            continue;
+        }
+        transfer->bytesWritten += session->resumedBytes + session->bytesWritten;
+        if (!isSessionFinished(session)) {
+            continue;
+        }
+        transfer->resumedBytes = session->resumedBytes;
+        transfer->checksum = session->resumedBytes == 0 ? getSessionChecksum(session) : 0;
+        if (!isSessionIntact(session)) {
+            failTransfer(&transfer->control, RUDP_ERROR_CORRUPT);
+        }
+    }
+    if (transfer->isOrdered && finishOrderedOutput(&transfer->ordered) < 0) {
+        failTransfer(&transfer->control, RUDP_ERROR_SINK);
+    }
+    return getTransferStatus(&transfer->control);
+}
+
+/**
+ * @brief Closes the sockets of a joined receiver.
+ *
+ * @param transfer The receiver.
+ * @return Void.
+ */
+void closeReceiverTransfer(ReceiverTransfer *transfer) {
+    for (int t = 0; t < MAX_STREAMS; t++) {
+        if (transfer->threads[t].sockDescriptor >= 0) {
+            close(transfer->threads[t].sockDescriptor);
+        }
+    }
+    destroySessionTable(&transfer->sessions);
+    destroyTransferControl(&transfer->control);
+}
+
+#endif
@@ -0,0 +1,411 @@
+/**
+*   @file resume.h
+*   @brief Checkpoints of the data a receiver has on disk, and resuming transfers from them.
+*
+*   A transfer that stops part way, because either end died or the path went away,
+*   would otherwise start over from its first byte. A resumable transfer carries a key
+*   the sender derives from its data, such as the identity, size and modification time
+*   of the file, and gives it in its handshake (see handshake.h): the receiver answers
+*   with the byte ranges it is still missing, and the sender only sends those. Ranges the receiver
+*   wrote do not count until they are durable, so a receiver keeping checkpoints has
+*   every stream record the ranges it hands to its writer, and every
+*   CHECKPOINT_INTERVAL_MS asks the writer thread to sync the file behind the writes
+*   already queued. Once that sync is done, the ranges go to the checkpoint of the
+*   session, a small file next to the destination holding the key, the size of the
+*   transfer and the sorted ranges on disk, protected by a CRC32C. It is written to a
+*   temporary file renamed over the previous one, so a crash leaves one checkpoint or
+*   the other, never half of one, and it is deleted once the transfer completes.
+*
+*   An answer holds at most RESUME_MAX_RANGES missing ranges, so it fits in one datagram.
+*   When more are missing, the smallest runs of data on disk between them are sent
+*   again, which costs little.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef RESUME_H
+#define RESUME_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "multi_stream.h"
+#include "integrity.h"
+
+/**
+ * @def CHECKPOINT_MAGIC
+ * Definition specifying the first four bytes of a checkpoint file, "RCKP".
+ */
+#define CHECKPOINT_MAGIC 0x504b4352u
+
+/**
+ * @def CHECKPOINT_VERSION
+ * Definition specifying the version of the checkpoint format.
+ */
+#define CHECKPOINT_VERSION 1
+
+/**
+ * @def CHECKPOINT_INTERVAL_MS
+ * Definition specifying how often a stream syncs what it wrote and moves the checkpoint
+ * forward, in ms; a receiver that dies loses at most about this much of its progress.
+ */
+#define CHECKPOINT_INTERVAL_MS 1000
+
+/**
+ * @def RESUME_MAX_RANGES
+ * Definition specifying the most missing ranges in a resume reply.
+ */
+#define RESUME_MAX_RANGES 64
+
+/**
+ * @struct RangeSet
+ * @brief Sorted, disjoint byte ranges, merged as they are added.
+ */
+typedef struct {
+    ByteRange *ranges;      /**< The ranges, sorted by offset; adjacent ranges are merged. */
+    int count;              /**< Number of ranges. */
+    int capacity;           /**< Number of ranges allocated. */
+} RangeSet;
+
+/**
+ * @struct MissingRanges
+ * @brief The ranges of a resumable transfer the receiver is missing; only rangeCount are sent.
+ */
+typedef struct {
+    unsigned long long int presentBytes;        /**< Bytes the sender may skip. */
+    unsigned long long int rangeCount;          /**< Number of missing ranges. */
+    ByteRange missing[RESUME_MAX_RANGES];       /**< The ranges to send, sorted by offset. */
+} MissingRanges;
+
+/**
+ * @struct CheckpointHeader
+ * @brief Start of a checkpoint file, followed by rangeCount ByteRange, in host byte order.
+ */
+typedef struct {
+    unsigned int magic;                     /**< CHECKPOINT_MAGIC. */
+    unsigned int version;                   /**< CHECKPOINT_VERSION. */
+    unsigned long long int key;             /**< Key of the transfer. */
+    unsigned long long int totalLength;     /**< Size of the data of the transfer. */
+    unsigned int rangeCount;                /**< Number of ranges on disk. */
+    unsigned int checksum;                  /**< CRC32C of the header, with this field 0, and of the ranges. */
+} CheckpointHeader;
+
+/**
+ * @brief Prepares an empty range set.
+ *
+ * @param set The set to initialize.
+ * @return Void.
+ */
+void initRangeSet(RangeSet *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+/**
+ * @brief Frees the ranges of a set, leaving it empty.
+ *
+ * @param set The set.
+ * @return Void.
+ */
+void freeRangeSet(RangeSet *set) {
+    free(set->ranges);
+    initRangeSet(set);
+}
+
+/**
+ * @brief Returns the number of bytes the ranges of a set cover.
+ *
+ * @param set The set.
+ * @return unsigned long long int The number of bytes.
+ */
+unsigned long long int rangeSetBytes(const RangeSet *set) {
+    unsigned long long int bytes = 0;
+    for (int i = 0; i < set->count; i++) {
+        bytes += set->ranges[i].length;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Adds a range to a set, merging it with the ranges it touches.
+ *
+ * Ranges mostly arrive in order, so the end of the set is checked first.
+ *
+ * @param set The set.
+ * @param start The offset of the first byte of the range.
+ * @param length The number of bytes of the range.
+ * @return int 0 on success, -1 if the set could not grow; it is unchanged then.
+ */
+int addRange(RangeSet *set, unsigned long long int start, unsigned long long int length) {
+    unsigned long long int end = start + length;
+    if (length == 0) {
+        return 0;
+    }
+    if (set->count > 0) {
+        ByteRange *last = &set->ranges[set->count - 1];
+        if (start >= last->start && start <= last->start + last->length) {
+            if (end > last->start + last->length) {
+                last->length = end - last->start;
+            }
+            return 0;
+        }
+    }
+
+    /*
+     * Find the first range that ends at or after the start, and the first that starts
+     * after the end; every range between them merges with the new one.
+     */
+    int first = 0;
+    while (first < set->count && set->ranges[first].start + set->ranges[first].length < start) {
+        first++;
+    }
+    int last = first;
+    while (last < set->count && set->ranges[last].start <= end) {
+        last++;
+    }
+
+    if (first == last) {
+        if (set->count == set->capacity) {
+            int capacity = set->capacity > 0 ? 2 * set->capacity : 16;
+            ByteRange *ranges = realloc(set->ranges, capacity * sizeof(ByteRange));
+            if (ranges == NULL) {
+                return -1;
+            }
+            set->ranges = ranges;
+            set->capacity = capacity;
+        }
+        memmove(&set->ranges[first + 1], &set->ranges[first], (set->count - first) * sizeof(ByteRange));
+        set->ranges[first].start = start;
+        set->ranges[first].length = length;
+        set->count++;
+        return 0;
+    }
+
+    ByteRange *merged = &set->ranges[first];
+    unsigned long long int mergedEnd = set->ranges[last - 1].start + set->ranges[last - 1].length;
+    if (start < merged->start) {
+        merged->start = start;
+    }
+    merged->length = (end > mergedEnd ? end : mergedEnd) - merged->start;
+    memmove(&set->ranges[first + 1], &set->ranges[last], (set->count - last) * sizeof(ByteRange));
+    set->count -= last - first - 1;
+    return 0;
+}
+
+/**
+ * @brief Adds every range of a set to another.
+ *
+ * @param set The set added to.
+ * @param other The ranges to add.
+ * @return int 0 on success, -1 if the set could not grow; it holds part of other then.
+ */
+int mergeRangeSet(RangeSet *set, const RangeSet *other) {
+    for (int i = 0; i < other->count; i++) {
+        if (addRange(set, other->ranges[i].start, other->ranges[i].length) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Makes a set hold the same ranges as another.
+ *
+ * @param set The set overwritten.
+ * @param other The ranges to copy.
+ * @return int 0 on success, -1 if the set could not grow; it is unchanged then.
+ */
+int copyRangeSet(RangeSet *set, const RangeSet *other) {
+    if (other->count > set->capacity) {
+        ByteRange *ranges = realloc(set->ranges, other->count * sizeof(ByteRange));
+        if (ranges == NULL) {
+            return -1;
+        }
+        set->ranges = ranges;
+        set->capacity = other->count;
+    }
+    memcpy(set->ranges, other->ranges, other->count * sizeof(ByteRange));
+    set->count = other->count;
+    return 0;
+}
+
+/**
+ * @brief Lists the ranges of a transfer that a set does not cover, for a handshake answer.
+ *
+ * When more than RESUME_MAX_RANGES are missing, the two missing ranges closest to each
+ * other are merged, data between them included, until few enough are left.
+ *
+ * @param present The ranges on disk.
+ * @param totalLength The size of the data of the transfer.
+ * @param reply Filled with the missing ranges and the bytes that may be skipped.
+ * @return Void.
+ */
+void listMissingRanges(const RangeSet *present, unsigned long long int totalLength, MissingRanges *reply) {
+    ByteRange missing[RESUME_MAX_RANGES + 1];
+    unsigned long long int position = 0;
+    int count = 0;
+
+    for (int i = 0; i <= present->count; i++) {
+        unsigned long long int end = totalLength;
+        if (i < present->count && present->ranges[i].start < totalLength) {
+            end = present->ranges[i].start;
+        }
+        if (end > position) {
+            missing[count].start = position;
+            missing[count].length = end - position;
+            count++;
+        }
+        if (count > RESUME_MAX_RANGES) {
+            /*
+             * Make room by merging the two neighbours with the least data between them.
+             */
+            int closest = 0;
+            unsigned long long int closestGap = ~0ULL;
+            for (int r = 0; r < count - 1; r++) {
+                unsigned long long int gap = missing[r + 1].start - (missing[r].start + missing[r].length);
+                if (gap < closestGap) {
+                    closest = r;
+                    closestGap = gap;
+                }
+            }
+            missing[closest].length = missing[closest + 1].start + missing[closest + 1].length - missing[closest].start;
+            memmove(&missing[closest + 1], &missing[closest + 2], (count - closest - 2) * sizeof(ByteRange));
+            count--;
+        }
+        if (i < present->count) {
+            unsigned long long int presentEnd = present->ranges[i].start + present->ranges[i].length;
+            if (presentEnd > position) {
+                position = presentEnd < totalLength ? presentEnd : totalLength;
+            }
+        }
+    }
+
+    memcpy(reply->missing, missing, count * sizeof(ByteRange));
+    reply->rangeCount = count;
+    reply->presentBytes = totalLength;
+    for (int i = 0; i < count; i++) {
+        reply->presentBytes -= reply->missing[i].length;
+    }
+}
+
+/**
+ * @brief Builds the path of the checkpoint of a destination file.
+ *
+ * @param path Where the path goes.
+ * @param size The size of path.
+ * @param destination The destination file.
+ * @param suffix Appended after the checkpoint suffix, "" for the checkpoint itself.
+ * @return Void.
+ */
+void checkpointPath(char *path, size_t size, const char *destination, const char *suffix) {
+    snprintf(path, size, "%s.ckpt%s", destination, suffix);
+}
+
+/**
+ * @brief Computes the checksum of a checkpoint.
+ *
+ * @param header The header of the checkpoint; its checksum field is left out.
+ * @param ranges The ranges of the checkpoint.
+ * @return unsigned int The checksum.
+ */
+unsigned int checksumCheckpoint(const CheckpointHeader *header, const ByteRange *ranges) {
+    CheckpointHeader copy = *header;
+    copy.checksum = 0;
+    return crc32c(crc32c(0, &copy, sizeof(copy)), ranges, header->rangeCount * sizeof(ByteRange));
+}
+
+/**
+ * @brief Writes the checkpoint of a destination file, replacing the previous one at once.
+ *
+ * @param destination The destination file.
+ * @param key The key of the transfer.
+ * @param totalLength The size of the data of the transfer.
+ * @param set The ranges on disk.
+ * @return int 0 on success, -1 on failure (see errno), with the previous checkpoint kept.
+ */
+int saveCheckpoint(const char *destination, unsigned long long int key, unsigned long long int totalLength,
+                   const RangeSet *set) {
+    char path[PATH_MAX + 16];
+    char temporaryPath[PATH_MAX + 16];
+    CheckpointHeader header;
+    FILE *file;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.key = key;
+    header.totalLength = totalLength;
+    header.rangeCount = set->count;
+    header.checksum = checksumCheckpoint(&header, set->ranges);
+
+    checkpointPath(path, sizeof(path), destination, "");
+    checkpointPath(temporaryPath, sizeof(temporaryPath), destination, ".tmp");
+    if ((file = fopen(temporaryPath, "wb")) == NULL) {
+        return -1;
+    }
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1
+              || (set->count > 0 && fwrite(set->ranges, sizeof(ByteRange), set->count, file) != (size_t)set->count);
+    if (fclose(file) != 0 || failed || rename(temporaryPath, path) < 0) {
+        unlink(temporaryPath);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the checkpoint of a destination file, if it belongs to a transfer.
+ *
+ * @param destination The destination file.
+ * @param key The key of the transfer.
+ * @param totalLength The size of the data of the transfer.
+ * @param set Filled with the ranges on disk; left empty unless the checkpoint is used.
+ * @return int 0 if the checkpoint is intact and of this transfer, -1 otherwise.
+ */
+int loadCheckpoint(const char *destination, unsigned long long int key, unsigned long long int totalLength,
+                   RangeSet *set) {
+    char path[PATH_MAX + 16];
+    CheckpointHeader header;
+    ByteRange *ranges = NULL;
+    FILE *file;
+
+    checkpointPath(path, sizeof(path), destination, "");
+    if ((file = fopen(path, "rb")) == NULL) {
+        return -1;
+    }
+    int isValid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == CHECKPOINT_MAGIC
+               && header.version == CHECKPOINT_VERSION && header.key == key && header.totalLength == totalLength
+               && (ranges = malloc((header.rangeCount + 1) * sizeof(ByteRange))) != NULL
+               && fread(ranges, sizeof(ByteRange), header.rangeCount, file) == header.rangeCount
+               && checksumCheckpoint(&header, ranges) == header.checksum;
+    fclose(file);
+
+    set->count = 0;
+    for (unsigned int i = 0; isValid && i < header.rangeCount; i++) {
+        if (ranges[i].start + ranges[i].length > totalLength || addRange(set, ranges[i].start, ranges[i].length) < 0) {
+            isValid = 0;
+        }
+    }
+    free(ranges);
+    if (!isValid) {
+        set->count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Deletes the checkpoint of a destination file, if it has one.
+ *
+ * @param destination The destination file.
+ * @return Void.
+ */
+void removeCheckpoint(const char *destination) {
+    char path[PATH_MAX + 16];
+    checkpointPath(path, sizeof(path), destination, "");
+    unlink(path);
+}
+
+#endif
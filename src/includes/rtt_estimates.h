@@ -7,13 +7,58 @@
 *   via the function updateTimeout using the current sample RTT, estimated RTT and the deviation based on 
 *   Jacobson/Karels Algorithm. The timeout value is also doubled vis the function doubleTimeOut.
 *
+*   RTT samples are taken from the timestamp that every data packet carries and that the
+*   receiver echoes back in its ACK, so each sample is tied to the exact transmission being
+*   acknowledged. The smoothed RTT, RTT variation and minimum RTT are kept in an RttEstimator
+*   that the rest of the sender reads.
+*
 *   @bug No known bugs.
 *   @author Leo Kamino (LeonardoKamino)
 */
 
+#ifndef RTT_ESTIMATES_H
+#define RTT_ESTIMATES_H
+
 #include <math.h>
+#include <time.h>
 #include <sys/time.h>
 
+/**
+ * @def MIN_TIMEOUT_MS
+ * Definition specifying the smallest retransmission timeout in milliseconds.
+ */
+#define MIN_TIMEOUT_MS 5
+
+/**
+ * @def MAX_TIMEOUT_MS
+ * Definition specifying the largest retransmission timeout computed from RTT samples, in
+ * milliseconds. It only bounds paths of absurd RTT and stays well below GIVE_UP_MS, so the
+ * timeout of a long path is never cut under its RTT and a few backoffs fit before giving up.
+ */
+#define MAX_TIMEOUT_MS 10000
+
+/**
+ * @def TIMER_GRANULARITY_MS
+ * Definition specifying the smallest margin the timeout keeps over the smoothed RTT, in
+ * milliseconds: the clock granularity G of RFC 6298, which stops the timeout from
+ * collapsing onto the smoothed RTT on a steady path whose RTT variation approaches zero.
+ */
+#define TIMER_GRANULARITY_MS 4
+
+/**
+ * @struct RttEstimator
+ * @brief RTT statistics of a connection and the retransmission timeout derived from them.
+ */
+typedef struct {
+    double smoothedRtt;      /**< Smoothed RTT in ms, negative until the first sample. */
+    double rttVariation;     /**< Mean deviation of the RTT in ms. */
+    double minRtt;           /**< Smallest RTT sample seen in ms, negative until the first sample. */
+    double latestRtt;        /**< Most recent RTT sample in ms. */
+    unsigned long long samples; /**< Number of RTT samples taken. */
+    double maxAckDelay;      /**< Longest time the receiver holds back an ACK in ms, added to the timeout. */
+    struct timeval timeout;  /**< Current retransmission timeout. */
+} RttEstimator;
+
 /**
  * @brief Calculates the Round Trip Time (RTT) using the start and end time of a packet transmission.
  * 
@@ -31,9 +76,60 @@ double calculateRTT(struct timeval startTime, struct timeval endTime) {
  * @param timeout The timeout struct to be updated.
  * @param ms The time in milliseconds.
  */
-void setTimeoutFromMs(struct timeval *timeout, int ms) {
-    timeout->tv_sec = (ms / 1000); // Seconds part
-    timeout->tv_usec = ((ms - timeout->tv_sec * 1000) * 1000); // Microseconds part
+void setTimeoutFromMs(struct timeval *timeout, double ms) {
+    long usec = (long)(ms * 1000);
+    timeout->tv_sec = usec / 1000000; // Seconds part
+    timeout->tv_usec = usec % 1000000; // Microseconds part
+}
+
+/**
+ * @brief Helper function to convert a timeout value to milliseconds.
+ * 
+ * @param timeout The timeout struct to be converted.
+ * @return The timeout in milliseconds.
+ */
+double timeoutToMs(struct timeval *timeout) {
+    return timeout->tv_sec * 1000 + timeout->tv_usec / 1000.0;
+}
+
+/**
+ * @brief Returns the current time as a packet timestamp.
+ * 
+ * Timestamps count microseconds on a monotonic clock and wrap around every 71 minutes,
+ * which is harmless since only differences between recent timestamps are used.
+ * 
+ * @return unsigned int The current timestamp in microseconds.
+ */
+unsigned int getTimestamp(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned int)(now.tv_sec * 1000000ULL + now.tv_nsec / 1000);
+}
+
+/**
+ * @brief Calculates the RTT from a timestamp echoed back by the receiver.
+ * 
+ * @param timestamp The timestamp the packet was sent with, as echoed in its ACK.
+ * @return The time elapsed since that timestamp in milliseconds.
+ */
+double timestampToRTT(unsigned int timestamp) {
+    return (unsigned int)(getTimestamp() - timestamp) / 1000.0;
+}
+
+/**
+ * @brief Initializes an RTT estimator before any sample is available.
+ * 
+ * @param estimator The estimator to initialize.
+ * @param initialTimeoutMs The timeout to use until the first RTT sample in ms.
+ */
+void initRttEstimator(RttEstimator *estimator, int initialTimeoutMs) {
+    estimator->smoothedRtt = -1;
+    estimator->rttVariation = 0;
+    estimator->minRtt = -1;
+    estimator->latestRtt = -1;
+    estimator->samples = 0;
+    estimator->maxAckDelay = 0;
+    setTimeoutFromMs(&estimator->timeout, initialTimeoutMs);
 }
 
 /**
@@ -41,26 +137,42 @@ void setTimeoutFromMs(struct timeval *timeout, int ms) {
  * 
  * This function updates the timeout value using the current sample RTT, estimated RTT, and deviation.
  * The logic behind these calculations is based on the Jacobson/Karels Algorithm to decide when to timeout
- * and retransmit a packet. We added a constraint on the minimum timeout value of 5ms to avoid extreme cases.
+ * and retransmit a packet. The first sample initializes the estimates as in RFC 6298, and as there the
+ * variation term is at least TIMER_GRANULARITY_MS. The longest time the receiver holds back an ACK is
+ * added on top, so a delayed ACK is never mistaken for a loss. We added a constraint on the minimum
+ * timeout value of 5ms to avoid extreme cases; the upper bound MAX_TIMEOUT_MS is far above any real
+ * RTT, since a timeout below the RTT would expire for every packet. A new sample also resets any
+ * backoff applied by doubleTimeOut.
  * 
- * @param estimatedRTT The estimated RTT value in ms.
- * @param deviation The deviation value in ms.
+ * @param estimator The estimator holding the estimated RTT, deviation and timeout.
  * @param sampleRTT The current sample RTT value in ms.
- * @param timeout The timeout struct to be updated.
  */
-void updateTimeout(double *estimatedRTT, double *deviation, double sampleRTT, struct timeval *timeout) {
+void updateTimeout(RttEstimator *estimator, double sampleRTT) {
     double alpha = 0.125;
     double beta = 0.25;
 
-    double difference = sampleRTT - *estimatedRTT;
-    *estimatedRTT = *estimatedRTT * (1-alpha) + alpha * sampleRTT;
-    *deviation = *deviation * (1-beta) + beta * (fabs(difference));
+    if (estimator->smoothedRtt < 0) {
+        estimator->smoothedRtt = sampleRTT;
+        estimator->rttVariation = sampleRTT / 2;
+    } else {
+        double difference = sampleRTT - estimator->smoothedRtt;
+        estimator->smoothedRtt = estimator->smoothedRtt * (1-alpha) + alpha * sampleRTT;
+        estimator->rttVariation = estimator->rttVariation * (1-beta) + beta * (fabs(difference));
+    }
 
-    double timeout_msec = *estimatedRTT  + 4 * *deviation;
-    timeout_msec = timeout_msec < 5 ? 5 : timeout_msec;
-    timeout_msec = timeout_msec > 300 ? 300 : timeout_msec;
+    if (estimator->minRtt < 0 || sampleRTT < estimator->minRtt) {
+        estimator->minRtt = sampleRTT;
+    }
+    estimator->latestRtt = sampleRTT;
+    estimator->samples++;
 
-    setTimeoutFromMs(timeout, timeout_msec);
+    double variation = 4 * estimator->rttVariation;
+    variation = variation < TIMER_GRANULARITY_MS ? TIMER_GRANULARITY_MS : variation;
+    double timeout_msec = estimator->smoothedRtt + variation + estimator->maxAckDelay;
+    timeout_msec = timeout_msec < MIN_TIMEOUT_MS ? MIN_TIMEOUT_MS : timeout_msec;
+    timeout_msec = timeout_msec > MAX_TIMEOUT_MS ? MAX_TIMEOUT_MS : timeout_msec;
+
+    setTimeoutFromMs(&estimator->timeout, timeout_msec);
 }
 
 
@@ -72,8 +184,10 @@ void updateTimeout(double *estimatedRTT, double *deviation, double sampleRTT, st
  * @param timeout The timeout struct to be updated.
  */
 void doubleTimeOut(struct timeval *timeout){
-    double timeout_msec = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+    double timeout_msec = timeoutToMs(timeout);
     timeout_msec *= 2;
 
     setTimeoutFromMs(timeout, timeout_msec);
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,371 @@
+/**
+*   @file rudp.h
+*   @brief Public interface of librudp, the enhanced UDP protocol as a library.
+*
+*   librudp sends data to and receives data from the sender and receiver programs, or
+*   from another program linked with it, without ever exiting the process. A transfer
+*   runs on threads of its own: a session is opened, started with rudpSend or
+*   rudpReceive, polled for progress with rudpPoll until it completes, and closed
+*   with rudpClose, which cancels it if it is still running. Every function reports
+*   failures with one of the RUDP_ERROR codes, and RUDP_ERROR_SYSTEM leaves the cause
+*   in errno.
+*
+*   The sender reads its data from a RudpSource: a memory buffer, sent without copying,
+*   a file descriptor read with pread, a callback, or a stream such as a pipe or a
+*   socket, read until its producer closes it. The receiver hands the data to a
+*   RudpSink: a memory buffer, a file descriptor written with pwrite, a callback, or a
+*   stream written in order. Packets carry the offset of their payload, so the other
+*   sinks are written at arbitrary offsets in any order, and with several streams
+*   callbacks are called from several threads at once. Every packet carries a CRC32C,
+*   and the receiver also checks the CRC32C of the whole data once it is complete: a
+*   transfer whose data does not match fails with RUDP_ERROR_CORRUPT. A sender given a
+*   resume key only sends what a receiver keeping checkpoints is missing from an
+*   earlier run with the same key. Every transfer opens with a handshake that settles
+*   its packet size, window and features between the options of both ends; a receiver
+*   that cannot serve it refuses it, and the sender fails with RUDP_ERROR_REFUSED.
+*
+*   This header only declares the interface; link with librudp.a.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef RUDP_H
+#define RUDP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @def RUDP_OK
+ * Status of a transfer that completed, or of a call that succeeded.
+ */
+#define RUDP_OK 0
+
+/**
+ * @def RUDP_IN_PROGRESS
+ * Status of a transfer that is still running.
+ */
+#define RUDP_IN_PROGRESS 1
+
+/**
+ * @def RUDP_ERROR_ARGUMENT
+ * Error returned for an invalid argument or option.
+ */
+#define RUDP_ERROR_ARGUMENT -1
+
+/**
+ * @def RUDP_ERROR_ADDRESS
+ * Error returned when the hostname of the receiver cannot be resolved.
+ */
+#define RUDP_ERROR_ADDRESS -2
+
+/**
+ * @def RUDP_ERROR_SYSTEM
+ * Error returned when a system call or an allocation failed; errno holds the cause.
+ */
+#define RUDP_ERROR_SYSTEM -3
+
+/**
+ * @def RUDP_ERROR_SOURCE
+ * Error returned when reading the source failed or it ended early.
+ */
+#define RUDP_ERROR_SOURCE -4
+
+/**
+ * @def RUDP_ERROR_SINK
+ * Error returned when writing to the sink failed or it is too small.
+ */
+#define RUDP_ERROR_SINK -5
+
+/**
+ * @def RUDP_ERROR_TIMEOUT
+ * Error returned when the receiver stopped acknowledging packets.
+ */
+#define RUDP_ERROR_TIMEOUT -6
+
+/**
+ * @def RUDP_ERROR_CANCELLED
+ * Error returned for a transfer closed before it completed.
+ */
+#define RUDP_ERROR_CANCELLED -7
+
+/**
+ * @def RUDP_ERROR_STATE
+ * Error returned when a session cannot do what is asked in its current state.
+ */
+#define RUDP_ERROR_STATE -8
+
+/**
+ * @def RUDP_ERROR_CORRUPT
+ * Error returned when the data received does not match the checksums of the sender.
+ */
+#define RUDP_ERROR_CORRUPT -9
+
+/**
+ * @def RUDP_ERROR_REFUSED
+ * Error returned when the receiver refused the handshake of the transfer.
+ */
+#define RUDP_ERROR_REFUSED -10
+
+/**
+ * @def RUDP_SOURCE_MEMORY
+ * Source type reading from a memory buffer.
+ */
+#define RUDP_SOURCE_MEMORY 0
+
+/**
+ * @def RUDP_SOURCE_FILE
+ * Source type reading from a file descriptor at given offsets.
+ */
+#define RUDP_SOURCE_FILE 1
+
+/**
+ * @def RUDP_SOURCE_CALLBACK
+ * Source type reading through a callback.
+ */
+#define RUDP_SOURCE_CALLBACK 2
+
+/**
+ * @def RUDP_SOURCE_STREAM
+ * Source type reading a descriptor of unknown length, such as a pipe, until it ends.
+ */
+#define RUDP_SOURCE_STREAM 3
+
+/**
+ * @def RUDP_SINK_MEMORY
+ * Sink type writing into a memory buffer.
+ */
+#define RUDP_SINK_MEMORY 0
+
+/**
+ * @def RUDP_SINK_FILE
+ * Sink type writing to a file descriptor at given offsets.
+ */
+#define RUDP_SINK_FILE 1
+
+/**
+ * @def RUDP_SINK_CALLBACK
+ * Sink type writing through a callback.
+ */
+#define RUDP_SINK_CALLBACK 2
+
+/**
+ * @def RUDP_SINK_STREAM
+ * Sink type writing the data in order to a descriptor that cannot seek, such as a pipe.
+ */
+#define RUDP_SINK_STREAM 3
+
+/**
+ * Reads length bytes of the data, starting offset bytes into it, into buffer. Returns
+ * the number of bytes read, which is only short at the end of the data, or -1 on error.
+ */
+typedef ssize_t (*RudpReadCallback)(void *context, void *buffer, size_t length, unsigned long long int offset);
+
+/**
+ * Writes length bytes received at offset bytes into the data. Returns 0 on success or
+ * -1 on error, which fails the transfer.
+ */
+typedef int (*RudpWriteCallback)(void *context, const void *data, size_t length, unsigned long long int offset);
+
+/**
+ * @struct RudpSource
+ * @brief Where a sender reads its data; built by rudpMemorySource, rudpFileSource,
+ * rudpCallbackSource or rudpStreamSource.
+ */
+typedef struct {
+    int type;                       /**< RUDP_SOURCE_MEMORY, RUDP_SOURCE_FILE, RUDP_SOURCE_CALLBACK or RUDP_SOURCE_STREAM. */
+    const void *memory;             /**< The data of a memory source. */
+    int fileDescriptor;             /**< The file of a file source, or the descriptor of a stream source. */
+    unsigned long long int offset;  /**< Offset of the data in the file of a file source. */
+    RudpReadCallback read;          /**< The callback of a callback source. */
+    void *context;                  /**< Passed to the callback. */
+    unsigned long long int length;  /**< Number of bytes to send; for a stream, the most to send or 0 for no limit. */
+} RudpSource;
+
+/**
+ * @struct RudpSink
+ * @brief Where a receiver writes its data; built by rudpMemorySink, rudpFileSink,
+ * rudpCallbackSink or rudpStreamSink.
+ */
+typedef struct {
+    int type;                       /**< RUDP_SINK_MEMORY, RUDP_SINK_FILE, RUDP_SINK_CALLBACK or RUDP_SINK_STREAM. */
+    void *memory;                   /**< The buffer of a memory sink. */
+    unsigned long long int capacity;/**< Size of the buffer of a memory sink. */
+    int fileDescriptor;             /**< The file of a file sink, or the descriptor of a stream sink. */
+    RudpWriteCallback write;        /**< The callback of a callback sink. */
+    void *context;                  /**< Passed to the callback. */
+} RudpSink;
+
+/**
+ * @struct RudpOptions
+ * @brief Settings of a session; rudpDefaultOptions gives the defaults of the programs.
+ */
+typedef struct {
+    int windowSize;                 /**< Sender: packets in flight per stream. */
+    const char *congestionControl;  /**< Sender: "aimd", "cubic" or "bbr". */
+    const char *pacing;             /**< Sender: "none", "bucket" or "txtime". */
+    int packetSize;                 /**< Sender: bytes per packet, header included, or 0 to discover the path MTU. Receiver: largest packet accepted, or 0 for any. */
+    int streams;                    /**< Sender: parallel streams. Receiver: receiving threads. */
+    int batchSize;                  /**< Datagrams per system call. */
+    int useOffload;                 /**< Non-zero for UDP GSO on the sender and GRO on the receiver. */
+    int fecBlock;                   /**< Sender: data packets per FEC block. */
+    int fecParity;                  /**< Sender: parity packets per FEC block, 0 without FEC. */
+    int compression;                /**< Sender: non-zero to compress the payloads that shrink. */
+    unsigned long long int resumeKey;   /**< Sender: non-zero to send only what the receiver of an earlier run with this key is missing; not for stream sources. */
+    int ackFrequency;               /**< Receiver: in-order packets per ACK. */
+    int ackDelayMs;                 /**< Receiver: longest time an ACK is held back. */
+    int checkpoint;                 /**< Receiver: non-zero to checkpoint resumable transfers written to files. */
+    int receiveWindow;              /**< Receiver: largest window a sender may use per stream, or 0 for any. */
+    int verbose;                    /**< Non-zero to print warnings to stderr. */
+} RudpOptions;
+
+/**
+ * @struct RudpProgress
+ * @brief How far a transfer got.
+ */
+typedef struct {
+    unsigned long long int totalBytes;      /**< Bytes to send, or read so far from a stream source; 0 on a receiver. */
+    unsigned long long int completedBytes;  /**< Bytes acknowledged by the receiver, or written to the sink. */
+    unsigned long long int retransmissions; /**< Packets retransmitted, 0 on a receiver. */
+    double elapsedSeconds;                  /**< Time since the transfer started. */
+} RudpProgress;
+
+/**
+ * An open session, sending or receiving one transfer.
+ */
+typedef struct RudpSession RudpSession;
+
+/**
+ * @brief Fills options with the defaults of the sender and receiver programs.
+ * @param options The options to fill.
+ */
+void rudpDefaultOptions(RudpOptions *options);
+
+/**
+ * @brief Describes a memory buffer as a source. The buffer must stay valid until the session is closed.
+ * @param data The data to send.
+ * @param length The number of bytes to send.
+ * @return RudpSource The source.
+ */
+RudpSource rudpMemorySource(const void *data, unsigned long long int length);
+
+/**
+ * @brief Describes part of a file as a source. The file must support pread.
+ * @param fileDescriptor The open file.
+ * @param offset The offset of the first byte to send.
+ * @param length The number of bytes to send.
+ * @return RudpSource The source.
+ */
+RudpSource rudpFileSource(int fileDescriptor, unsigned long long int offset, unsigned long long int length);
+
+/**
+ * @brief Describes a read callback as a source.
+ * @param read The callback, called from the stream threads.
+ * @param context Passed to the callback.
+ * @param length The number of bytes to send.
+ * @return RudpSource The source.
+ */
+RudpSource rudpCallbackSource(RudpReadCallback read, void *context, unsigned long long int length);
+
+/**
+ * @brief Describes a descriptor of unknown length, such as a pipe, a socket or a terminal,
+ * as a source. It is read into a bounded buffer and sent as data arrives, until it ends
+ * or length bytes were read. A stream source is sent as a single stream.
+ * @param fileDescriptor The descriptor, which is not closed by the session.
+ * @param length The most bytes to send, or 0 to send until the descriptor ends.
+ * @return RudpSource The source.
+ */
+RudpSource rudpStreamSource(int fileDescriptor, unsigned long long int length);
+
+/**
+ * @brief Describes a memory buffer as a sink. Receiving more than capacity bytes fails the transfer.
+ * @param buffer The buffer to write into.
+ * @param capacity The size of the buffer.
+ * @return RudpSink The sink.
+ */
+RudpSink rudpMemorySink(void *buffer, unsigned long long int capacity);
+
+/**
+ * @brief Describes a file as a sink. The file must support pwrite.
+ * @param fileDescriptor The open file, which is not closed by the session.
+ * @return RudpSink The sink.
+ */
+RudpSink rudpFileSink(int fileDescriptor);
+
+/**
+ * @brief Describes a write callback as a sink.
+ * @param write The callback, called from the writer threads.
+ * @param context Passed to the callback.
+ * @return RudpSink The sink.
+ */
+RudpSink rudpCallbackSink(RudpWriteCallback write, void *context);
+
+/**
+ * @brief Describes a descriptor that cannot seek, such as a pipe or a terminal, as a sink.
+ * The data is written in order; what arrives ahead of a gap waits in a bounded buffer,
+ * and overflowing it fails the transfer.
+ * @param fileDescriptor The descriptor, which is not closed by the session.
+ * @return RudpSink The sink.
+ */
+RudpSink rudpStreamSink(int fileDescriptor);
+
+/**
+ * @brief Opens a session that sends to a receiver.
+ * @param hostname The hostname or IP address of the receiver.
+ * @param port The UDP port of the receiver.
+ * @param options The settings of the session, or NULL for the defaults.
+ * @param error Set to the error when NULL is returned; may be NULL.
+ * @return RudpSession* The session, or NULL on failure.
+ */
+RudpSession *rudpOpenSender(const char *hostname, unsigned short int port, const RudpOptions *options, int *error);
+
+/**
+ * @brief Opens a session that receives one transfer on a UDP port, binding the port at once.
+ * @param port The UDP port to listen on.
+ * @param options The settings of the session, or NULL for the defaults.
+ * @param error Set to the error when NULL is returned; may be NULL.
+ * @return RudpSession* The session, or NULL on failure.
+ */
+RudpSession *rudpOpenReceiver(unsigned short int port, const RudpOptions *options, int *error);
+
+/**
+ * @brief Starts sending a source on a sender session. Returns once the stream threads run.
+ * @param session The sender session.
+ * @param source The data to send.
+ * @return int RUDP_OK, or an error.
+ */
+int rudpSend(RudpSession *session, const RudpSource *source);
+
+/**
+ * @brief Starts receiving into a sink on a receiver session. Returns once the receiving threads run.
+ * @param session The receiver session.
+ * @param sink Where the data goes.
+ * @return int RUDP_OK, or an error.
+ */
+int rudpReceive(RudpSession *session, const RudpSink *sink);
+
+/**
+ * @brief Waits for the transfer of a session to complete, at most timeoutMs, and reports its progress.
+ * @param session The session.
+ * @param timeoutMs The longest wait in ms, 0 to return at once or -1 to wait for the end.
+ * @param progress Filled with the progress of the transfer; may be NULL.
+ * @return int RUDP_IN_PROGRESS while the transfer runs, then RUDP_OK or its error.
+ */
+int rudpPoll(RudpSession *session, int timeoutMs, RudpProgress *progress);
+
+/**
+ * @brief Closes a session, cancelling its transfer if it is still running, and frees it.
+ * @param session The session.
+ * @return int The final status of the transfer: RUDP_OK, an error, or RUDP_ERROR_CANCELLED.
+ */
+int rudpClose(RudpSession *session);
+
+/**
+ * @brief Describes a status code.
+ * @param status The status.
+ * @return const char* A static description.
+ */
+const char *rudpErrorString(int status);
+
+#endif
@@ -0,0 +1,96 @@
+/**
+*   @file sack.h
+*   @brief Selective acknowledgments (SACK) sent by the receiver.
+*
+*   An ACK that names a single sequence number tells the sender nothing about the other
+*   packets in its window, so a lost ACK or several losses in one window leave the
+*   sender waiting for timers. Every ACK therefore carries a SackInfo block: a
+*   cumulative ACK, the first sequence number not yet received, and a bitmap of the
+*   packets received after it. One ACK is enough for the sender to learn the state of
+*   the whole receive window and retransmit only the real holes.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef SACK_H
+#define SACK_H
+
+#include <string.h>
+
+#include "packet_header.h"
+#include "sliding_window.h"
+
+/**
+ * @def SACK_BITMAP_BYTES
+ * Definition specifying the size of the SACK bitmap, one bit per packet of the largest window.
+ */
+#define SACK_BITMAP_BYTES (MAX_WINDOW_SIZE / 8)
+
+/**
+ * @struct SackInfo
+ * @brief State of the receive window as reported in an ACK.
+ *
+ * Bit k of the bitmap (bit k % 8 of byte k / 8) is set when packet cumulativeAck + k
+ * was received. Bit 0 is never set, since cumulativeAck is the first missing packet.
+ */
+typedef struct {
+    long long cumulativeAck;                   /**< Every packet below this sequence number was received. */
+    unsigned char bitmap[SACK_BITMAP_BYTES];   /**< Packets received at or after cumulativeAck. */
+} SackInfo;
+
+/**
+ * @struct AckPacket
+ * @brief An ACK datagram: the header of the packet that triggered it and the SACK block,
+ * sent as two iovecs.
+ *
+ * The header echoes the sequence number and timestamp of the packet being acknowledged,
+ * so the sender can still take an RTT sample for that transmission.
+ */
+typedef struct {
+    WireHeader header;        /**< Header with the IS_ACK flag set. */
+    SackInfo sack;            /**< Receive window state when the ACK was sent. */
+} AckPacket;
+
+/**
+ * @brief Describes the receive window in a SACK block.
+ *
+ * @param sack The SACK block to fill.
+ * @param window The receive window.
+ * @param highestReceived The highest sequence number received so far; no packet after
+ * it needs to be looked at.
+ */
+void buildSack(SackInfo *sack, ReceiveWindow *window, long long highestReceived) {
+    sack->cumulativeAck = window->expectedSequenceNumber;
+    memset(sack->bitmap, 0, sizeof(sack->bitmap));
+
+    long long last = highestReceived - window->expectedSequenceNumber;
+    if (last >= window->size) {
+        last = window->size - 1;
+    }
+    for (int k = 1; k <= last; k++) {
+        if (getReceiveSlot(window, window->expectedSequenceNumber + k)->isReceived) {
+            sack->bitmap[k / 8] |= 1 << (k % 8);
+        }
+    }
+}
+
+/**
+ * @brief Checks whether a SACK block reports a packet as received.
+ *
+ * @param sack The SACK block.
+ * @param sequenceNumber The sequence number of the packet.
+ * @return int Non-zero if the packet is below the cumulative ACK or its bit is set.
+ */
+int isSacked(const SackInfo *sack, long long sequenceNumber) {
+    long long k = sequenceNumber - sack->cumulativeAck;
+    if (k < 0) {
+        return 1;
+    }
+    if (k >= SACK_BITMAP_BYTES * 8) {
+        return 0;
+    }
+    return (sack->bitmap[k / 8] >> (k % 8)) & 1;
+}
+
+#endif
@@ -0,0 +1,1417 @@
+/**
+*   @file sender_engine.h
+*   @brief The sending side of the protocol, shared by the sender program and librudp.
+*
+*   A SenderTransfer sends one source to a receiver. startSenderTransfer discovers the
+*   packet size unless it is given, shakes hands with the receiver to settle the
+*   parameters of the transfer, splits the data into one byte range per stream and
+*   starts a thread per stream, which sends its range with sendStream as an independent
+*   reliable stream. The threads report to the TransferControl of the transfer, so the
+*   caller can wait for them, follow their progress or cancel them, and nothing here
+*   ever exits the process: every failure becomes a RUDP_ERROR status of the transfer.
+*
+*   @bug No known bugs.
+*   @author Maddy Paulson (maddypaulson)
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef SENDER_ENGINE_H
+#define SENDER_ENGINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+
+#include "rudp.h"
+#include "transfer_control.h"
+#include "packet_header.h"
+#include "rtt_estimates.h"
+#include "sliding_window.h"
+#include "sack.h"
+#include "congestion_control.h"
+#include "batch_io.h"
+#include "pmtu_discovery.h"
+#include "multi_stream.h"
+#include "pacing.h"
+#include "fec.h"
+#include "telemetry.h"
+#include "stream_source.h"
+#include "compression.h"
+#include "integrity.h"
+#include "resume.h"
+#include "handshake.h"
+#include "timer_wheel.h"
+
+/**
+ * @def BUFFER_SIZE
+ * Definition to indicate size of the buffer, which is also the largest packet sent.
+ */
+#define BUFFER_SIZE 10000
+
+/**
+* @def EXPECTED_RTT 
+* Definition specifying the expected Round Trip Time (RTT) in milliseconds.
+*/
+#define EXPECTED_RTT 20
+
+/**
+ * @def GIVE_UP_MS
+ * Definition specifying how long in ms a stream keeps retransmitting without receiving
+ * any ACK before it gives up on the receiver.
+ */
+#define GIVE_UP_MS 30000
+
+/**
+ * @def MAX_FINAL_PKT_RESEND_ATTEMPTS
+ * Definition specifying the maximum number of resend attempts for a packet
+ * if the acknowledgment (ACK) is not received within the timeout period.
+ */
+#define MAX_FINAL_PKT_RESEND_ATTEMPTS 5
+
+/**
+ * @def DUP_ACK_THRESHOLD
+ * Definition specifying how many later packets must be acknowledged before an
+ * unacknowledged packet is declared lost and retransmitted without waiting for its timer.
+ */
+#define DUP_ACK_THRESHOLD 3
+
+/**
+ * @def DEFAULT_CONGESTION_CONTROL
+ * Definition specifying the congestion control algorithm used when none is given.
+ */
+#define DEFAULT_CONGESTION_CONTROL "cubic"
+
+/**
+ * @brief Sends a closing packet to the specified destination address.
+ * 
+ * This function sends a closing packet containing the provided sequence number
+ * to the specified destination address using the given socket descriptor. The
+ * closing packet indicates the end of the data transmission. It retransmits the
+ * closing packet up to a maximum number of times defined by MAX_FINAL_PKT_RESEND_ATTEMPTS
+ * until an acknowledgment packet is received or the maximum attempts are
+ * exhausted. Late acknowledgments of data packets, and corrupted ones, are discarded
+ * without counting as a failed attempt. The closing packet also tells the receiver how
+ * many streams make up the transfer, and how many bytes the stream sent with their sum.
+ * 
+ * @param sockDescriptor The socket descriptor for sending the closing packet.
+ * @param destAddr The destination address to send the closing packet.
+ * @param sequenceNumber The sequence number of the closing packet.
+ * @param connectionId The connection ID of the transfer.
+ * @param info The description of the transfer and of the stream.
+ * @param control The transfer the stream belongs to, which prints its warnings.
+ * @return Void.
+ */
+void sendClosingPacket(int sockDescriptor, struct sockaddr_in *destAddr, long long sequenceNumber, unsigned int connectionId,
+                       const ClosingInfo *info, TransferControl *control) {
+    int resendAttempts = 0;
+    int sentBytes;
+
+    PacketHeader lastPacket;
+    WireHeader wire;
+    lastPacket.sequenceNumber = sequenceNumber;
+    lastPacket.flags = 0;
+    lastPacket.flags = setFlag(lastPacket.flags, IS_LAST_PACKET);
+    lastPacket.timestamp = getTimestamp();
+    lastPacket.connectionId = connectionId;
+    lastPacket.offset = 0;
+    sealPacket(&lastPacket, &wire, info, sizeof(*info));
+
+    do {
+        sentBytes = sendDatagram(sockDescriptor, destAddr, &wire, sizeof(wire), info, sizeof(*info));
+        if(sentBytes < 0) {
+            warnTransfer(control, "Error sending closing packet");
+            break;
+        }
+
+        char reply[WIRE_HEADER_SIZE];
+        PacketHeader ack;
+        ssize_t ackSize;
+        do {
+            ackSize = recvfrom(sockDescriptor, reply, sizeof(reply), 0, NULL, 0);
+        } while (ackSize > 0 && (!isPacketIntact(reply, ackSize) || decodePacketHeader(reply, ackSize, &ack) == 0
+                                 || !isFlagSet(ack.flags, IS_LAST_PACKET)));
+
+        if (ackSize > 0 && isFlagSet(ack.flags, IS_ACK)
+            && expandSequenceNumber(ack.sequenceNumber, sequenceNumber) == sequenceNumber){
+            break; // Exit the resend loop
+        } else {
+            resendAttempts++;
+        }
+
+    } while(resendAttempts < MAX_FINAL_PKT_RESEND_ATTEMPTS);
+}
+
+/**
+ * @brief Queues the packet held in a window slot for sending and records the time it was sent.
+ * 
+ * The packet goes out with the next flush of the send batch, which happens before the
+ * sender waits for ACKs. Every transmission is stamped with a fresh timestamp, which
+ * the receiver echoes in its ACK; the checksum of the packet leaves the timestamp out,
+ * so it is only computed once. The delivery count at the time of sending is stored in
+ * the slot so that the ACK for this transmission yields a delivery rate sample. The
+ * packet is accounted for by the pacer, which may give it a departure time.
+ * 
+ * @param batch The send batch the packet is queued in.
+ * @param pacer The pacer of the socket.
+ * @param destAddr The destination address to send the packet.
+ * @param slot The window slot holding the packet.
+ * @param delivered The number of packets delivered so far.
+ * @param deliveredTime The time of the latest delivery.
+ * @return Void.
+ */
+void transmitSlot(SendBatch *batch, Pacer *pacer, struct sockaddr_in *destAddr, SendSlot *slot,
+                  long long delivered, struct timeval *deliveredTime) {
+    slot->header.timestamp = getTimestamp();
+    setWireTimestamp(&slot->wire, slot->header.timestamp);
+
+    unsigned long long txTime = pacePacket(pacer, sizeof(slot->wire) + slot->payloadLength);
+    queueTimedDatagram(batch, destAddr, &slot->wire, sizeof(slot->wire), slot->payload, slot->payloadLength, txTime);
+    gettimeofday(&slot->sendTime, NULL);
+    slot->transmissions++;
+    slot->delivered = delivered;
+    slot->deliveredTime = *deliveredTime;
+}
+
+/**
+ * @brief Picks a random connection ID for a transfer.
+ * 
+ * @return unsigned int A non-zero connection ID.
+ */
+unsigned int newConnectionId() {
+    unsigned int connectionId = 0;
+    while (connectionId == 0) {
+        if (getrandom(&connectionId, sizeof(connectionId), 0) != sizeof(connectionId)) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            connectionId = (unsigned int)(now.tv_sec ^ now.tv_usec ^ getpid());
+        }
+    }
+    return connectionId;
+}
+
+/**
+ * @brief Sets the socket receive timeout used while waiting for ACKs.
+ * 
+ * @param sockDescriptor The socket descriptor to update.
+ * @param waitMs The time to wait for an ACK in milliseconds. Values below 1 ms are
+ * rounded up, since a zero timeout would block forever.
+ * @return int 0 on success, -1 on failure.
+ */
+int setAckWait(int sockDescriptor, double waitMs) {
+    struct timeval wait;
+    long waitUsec = waitMs < 1 ? 1000 : (long)(waitMs * 1000);
+
+    wait.tv_sec = waitUsec / 1000000;
+    wait.tv_usec = waitUsec % 1000000;
+    return setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+}
+
+
+/**
+ * @struct SenderStream
+ * @brief One reliable stream of a transfer: the byte range it sends, its settings and its results.
+ */
+typedef struct {
+    int index;                              /**< Number of the stream, from 0. */
+    int streamCount;                        /**< Number of streams in the transfer. */
+    unsigned int connectionId;              /**< Connection ID of the transfer, shared by its streams. */
+    struct sockaddr_in destAddr;            /**< Address of the receiver. */
+    RudpSource source;                      /**< Where the data of the transfer is read. */
+    StreamReader *reader;                   /**< Buffer of a stream source, NULL for other sources. */
+    ByteRange range;                        /**< Part of the data sent by this stream. */
+    int windowSize;                         /**< Largest number of packets in flight. */
+    const char *congestionControl;          /**< Name of the congestion control algorithm. */
+    int batchSize;                          /**< Largest number of datagrams per system call. */
+    int packetSize;                         /**< Size of every packet, header included. */
+    int useGso;                             /**< Non-zero to send runs of packets with UDP GSO. */
+    int pacing;                             /**< Pacing mode, PACING_NONE, PACING_BUCKET or PACING_TXTIME. */
+    int dontFragment;                       /**< Non-zero to send with the Don't Fragment bit set. */
+    int fecBlock;                           /**< Data packets per FEC block. */
+    int fecParity;                          /**< Parity packets per FEC block, 0 without FEC. */
+    int compress;                           /**< Non-zero to compress every payload that shrinks. */
+    Compressor compressor;                  /**< Compression state and savings of the stream. */
+    SpanCursor spans;                       /**< Where the range lies in the file, NULL spans for a stream source. */
+    DataHash hash;                          /**< The data of the range sent so far. */
+    unsigned int checksum;                  /**< Sum of the DataHash of the range, once the stream ended. */
+    RttEstimator rtt;                       /**< RTT estimator, seeded by path MTU discovery. */
+    Telemetry telemetry;                    /**< Counters, RTT histogram and trace of the stream. */
+    unsigned long long int bytesSent;       /**< Bytes handed to the kernel by the stream, and by the handshake for the first stream. */
+    unsigned long long int parityPackets;   /**< FEC parity packets sent by the stream. */
+    IoStats ioStats;                        /**< System calls and datagrams of the stream. */
+    atomic_ullong acknowledgedBytes;        /**< Payload bytes acknowledged so far, read by other threads. */
+    atomic_ullong retransmittedPackets;     /**< Packets retransmitted so far, read by other threads. */
+    TransferControl *control;               /**< Completion and cancellation of the transfer. */
+} SenderStream;
+
+/**
+ * @brief Describes a memory buffer as a source.
+ *
+ * @param source The source to fill.
+ * @param data The data to send.
+ * @param length The number of bytes to send.
+ * @return Void.
+ */
+void initMemorySource(RudpSource *source, const void *data, unsigned long long int length) {
+    memset(source, 0, sizeof(*source));
+    source->type = RUDP_SOURCE_MEMORY;
+    source->memory = data;
+    source->fileDescriptor = -1;
+    source->length = length;
+}
+
+/**
+ * @brief Describes part of a file as a source.
+ *
+ * @param source The source to fill.
+ * @param fileDescriptor The open file.
+ * @param offset The offset of the first byte to send.
+ * @param length The number of bytes to send.
+ * @return Void.
+ */
+void initFileSource(RudpSource *source, int fileDescriptor, unsigned long long int offset, unsigned long long int length) {
+    memset(source, 0, sizeof(*source));
+    source->type = RUDP_SOURCE_FILE;
+    source->fileDescriptor = fileDescriptor;
+    source->offset = offset;
+    source->length = length;
+}
+
+/**
+ * @brief Describes a descriptor of unknown length, such as a pipe or stdin, as a source.
+ *
+ * @param source The source to fill.
+ * @param fileDescriptor The descriptor.
+ * @param limit The most bytes to send, 0 to send until the descriptor ends.
+ * @return Void.
+ */
+void initStreamSource(RudpSource *source, int fileDescriptor, unsigned long long int limit) {
+    memset(source, 0, sizeof(*source));
+    source->type = RUDP_SOURCE_STREAM;
+    source->fileDescriptor = fileDescriptor;
+    source->length = limit;
+}
+
+/**
+ * @brief Reads part of the range of a stream from a file or callback source.
+ * 
+ * @param source The source.
+ * @param buffer Where the bytes go.
+ * @param length The number of bytes to read.
+ * @param offset The offset of the bytes in the data.
+ * @return int 0 once every byte was read, -1 if the source failed or ended early.
+ */
+int readSource(RudpSource *source, char *buffer, size_t length, unsigned long long int offset) {
+    while (length > 0) {
+        ssize_t readBytes;
+        if (source->type == RUDP_SOURCE_FILE) {
+            readBytes = pread(source->fileDescriptor, buffer, length, source->offset + offset);
+        } else {
+            readBytes = source->read(source->context, buffer, length, offset);
+        }
+        if (readBytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (readBytes <= 0) {
+            return -1;
+        }
+        buffer += readBytes;
+        length -= readBytes;
+        offset += readBytes;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the current state of a stream to its trace, if the trace interval has passed.
+ * 
+ * When the trace cannot grow, the stream stops tracing.
+ * 
+ * @param stream The SenderStream being sent.
+ * @param nowMs The time since the stream started in ms.
+ * @param congestionWindow The congestion window in packets.
+ * @param packetsInFlight The packets sent and not acknowledged.
+ * @param rtt The RTT estimator of the stream.
+ * @param pacer The pacer of the stream.
+ * @param force Non-zero to add the point even if the interval has not passed.
+ * @return Void.
+ */
+void traceStream(SenderStream *stream, double nowMs, int congestionWindow, int packetsInFlight,
+                 RttEstimator *rtt, Pacer *pacer, int force) {
+    TracePoint point;
+    point.timeMs = nowMs;
+    point.stream = stream->index;
+    point.congestionWindow = congestionWindow;
+    point.packetsInFlight = packetsInFlight;
+    point.smoothedRttMs = rtt->smoothedRtt;
+    point.timeoutMs = timeoutToMs(&rtt->timeout);
+    point.pacingRate = pacer->rate;
+    if (traceTelemetry(&stream->telemetry, &point, force) < 0) {
+        warnTransfer(stream->control, "Growing the telemetry trace failed");
+        stream->telemetry.traceIntervalMs = 0;
+    }
+}
+
+/**
+ * @brief Sends one byte range of the data as an independent reliable stream.
+ * 
+ * This is the body of a stream thread. The stream has its own socket, sequence space,
+ * window and congestion controller, and reads its range from the source of the
+ * transfer at the offsets of its packets, or sends it straight from the memory of a
+ * memory source. Packets are pipelined using
+ * Selective Repeat: up to windowSize packets may be in flight at once, every ACK
+ * reports all packets received through its SACK block, and each packet is retransmitted
+ * on its own when its timer expires or when DUP_ACK_THRESHOLD later packets were
+ * acknowledged before it. The number of packets in flight is further limited by the
+ * congestion window of the selected congestion control algorithm, which is informed of
+ * every ACK, loss and timeout. Packets are sent and ACKs are received in batches of up
+ * to batchSize datagrams per system call, and with useGso set runs of full packets in
+ * a batch go to the kernel as single GSO sends. Every packet carries the offset of its
+ * payload in the file. With fecParity set, every block of fecBlock data packets is
+ * followed by fecParity parity packets, from which the receiver rebuilds lost packets,
+ * and a packet is only declared lost early once packets sent after the parity of its
+ * block were acknowledged, so the receiver gets the chance to rebuild it. The stream
+ * ends with a closing packet that tells the receiver how many streams make up the
+ * transfer, and its results are stored in the stream.
+ * A stream source has no range: packets are taken from its StreamReader as the producer
+ * writes, an empty keepalive packet is sent every STREAM_KEEPALIVE_MS while it is quiet,
+ * and the stream ends once the producer closed it and every byte was acknowledged.
+ * The stream runs as an event loop: every packet in flight has a timer in the
+ * TimerWheel of the stream, started with the timeout when the packet is sent and
+ * stopped by its ACK, next to the deadline of the pacer and the next poll of a quiet
+ * stream source. ACKs are read until none is queued, then the thread sleeps in
+ * epoll_wait until the socket is readable or the timerfd of the wheel goes off.
+ * With compress set, every payload that shrinks enough is sent compressed, and the
+ * Compressor of the stream stops trying for a while on data that does not shrink.
+ * Every packet carries a CRC32C of itself, and ACKs whose own does not match are
+ * dropped. The stream also adds up its range in a DataHash as it reads it and sends the
+ * sum in its closing packet, which a stream source sends with the range it ended up with;
+ * the hash of the first stream starts with the data the handshake delivered.
+ * The range of a resumed transfer is a part of the spans the receiver is missing, laid
+ * end to end, and every packet stays within one span.
+ * Every transmission, ACK, RTT sample and timeout change is counted in the telemetry of
+ * the stream, which also traces the congestion window and packets in flight over time.
+ * The stream never exits the process: it stops when the transfer is cancelled, when no
+ * ACK arrived for GIVE_UP_MS, or on an error, which fails the whole transfer, and
+ * reports how it finished to the TransferControl of the transfer.
+ * 
+ * @param argument The SenderStream to send.
+ * @return void* Always NULL.
+ */
+void *sendStream(void *argument) {
+    SenderStream *stream = argument;
+    int sockDescriptor;
+    struct sockaddr_in destAddr = stream->destAddr;
+    ssize_t readBytes;
+    RudpSource *source = &stream->source;
+    int zeroCopy = source->type == RUDP_SOURCE_MEMORY;
+    int status = RUDP_OK;
+    unsigned long long int bytesToTransfer = stream->range.length;
+    int packetSize = stream->packetSize;
+    int payloadSize = packetSize - WIRE_HEADER_SIZE - (stream->fecParity > 0 ? sizeof(FecInfo) : 0);
+    SendWindow window;
+    CongestionControl cc;
+    SendBatch sendBatch;
+    ReceiveBatch ackBatch;
+    Pacer pacer;
+    FecEncoder fec;
+    Telemetry *telemetry = &stream->telemetry;
+    char *compressBuffer = NULL;
+    TimerWheel wheel;
+    WheelTimer pacingTimer;
+    WheelTimer pollTimer;
+    SendSlot *expiredSlots[MAX_WINDOW_SIZE];
+    int epollDescriptor = -1;
+    struct epoll_event events[2];
+
+    unsigned long long int totalBytesRead = 0;
+    int endOfFile = 0;
+    int isWaitingForInput = 0;
+
+    /*
+    * Initialize variables for Timeout calculation
+    */
+    RttEstimator rtt = stream->rtt;
+    struct timeval now;
+
+    /*
+    * Initialize variables for congestion control and loss detection
+    */
+    int outstanding = 0;
+    long long highestAcked = -1;
+    long long recoveryPoint = 0;
+    double lastTimeoutMs = -1;
+    long long delivered = 0;
+    struct timeval deliveredTime;
+
+    memset(&window, 0, sizeof(window));
+    memset(&cc, 0, sizeof(cc));
+    memset(&sendBatch, 0, sizeof(sendBatch));
+    memset(&ackBatch, 0, sizeof(ackBatch));
+    memset(&fec, 0, sizeof(fec));
+    memset(&pacingTimer, 0, sizeof(pacingTimer));
+    memset(&pollTimer, 0, sizeof(pollTimer));
+    wheel.timerDescriptor = -1;
+
+    /*
+     * Create UDP socket and allocate the state of the stream. A failure stops the stream
+     * before its first packet.
+     */
+    sockDescriptor = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sockDescriptor < 0){
+        status = RUDP_ERROR_SYSTEM;
+    }
+    if (status == RUDP_OK && stream->dontFragment && setDontFragment(sockDescriptor) < 0) {
+        warnTransfer(stream->control, "Error setting Don't Fragment");
+    }
+
+    /*
+     * A compressed payload needs a copy of its own, even from a memory source.
+     */
+    size_t slotBytes = zeroCopy && !stream->compress ? 0 : BUFFER_SIZE - WIRE_HEADER_SIZE;
+    if (status == RUDP_OK && initSendWindow(&window, stream->windowSize, slotBytes) < 0) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+    initCompressor(&stream->compressor);
+    if (status == RUDP_OK && stream->compress && (compressBuffer = malloc(payloadSize)) == NULL) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+
+    if (status == RUDP_OK && initCongestionControl(&cc, stream->congestionControl, packetSize) < 0) {
+        status = RUDP_ERROR_ARGUMENT;
+    }
+
+    memset(&stream->ioStats, 0, sizeof(stream->ioStats));
+    if (status == RUDP_OK && (initSendBatch(&sendBatch, sockDescriptor, stream->batchSize, &stream->ioStats, stream->control) < 0
+                              || initReceiveBatch(&ackBatch, stream->batchSize, WIRE_HEADER_SIZE + sizeof(SackInfo), &stream->ioStats) < 0)) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+    if (status == RUDP_OK && stream->fecParity > 0
+        && initFecEncoder(&fec, stream->fecBlock, stream->fecParity, payloadSize, stream->batchSize) < 0) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+    if (status == RUDP_OK && stream->useGso && enableGso(&sendBatch, WIRE_HEADER_SIZE + payloadSize) < 0
+        && stream->index == 0) {
+        warnTransfer(stream->control, "GSO not supported, sending single datagrams");
+    }
+    if (status == RUDP_OK && initPacer(&pacer, stream->pacing, packetSize, sockDescriptor) < 0 && stream->index == 0) {
+        warnTransfer(stream->control, "SO_TXTIME not supported, pacing in the sender");
+    }
+
+    /*
+     * Wait for ACKs and for the timers of the stream in one epoll set.
+     */
+    if (status == RUDP_OK && (initTimerWheel(&wheel) < 0 || (epollDescriptor = epoll_create1(0)) < 0)) {
+        status = RUDP_ERROR_SYSTEM;
+    }
+    for (int i = 0; status == RUDP_OK && i < 2; i++) {
+        memset(&events[i], 0, sizeof(events[i]));
+        events[i].events = EPOLLIN;
+        events[i].data.fd = i == 0 ? sockDescriptor : wheel.timerDescriptor;
+        if (epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, events[i].data.fd, &events[i]) < 0) {
+            status = RUDP_ERROR_SYSTEM;
+        }
+    }
+
+    /*
+    * Start timing for the congestion controller
+    */
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    deliveredTime = start;
+    struct timeval lastAckTime = start;
+    struct timeval lastPacketTime = start;
+    recordTimeout(telemetry, timeoutToMs(&rtt.timeout));
+
+    /*
+     * Continue sending file in chunks (packets) until all bytes are transferred and
+     * acknowledged, the transfer is cancelled or the stream fails.
+     */
+    while (status == RUDP_OK && (!endOfFile || packetsInFlight(&window) > 0)) {
+        if (isTransferCancelled(stream->control)) {
+            status = RUDP_ERROR_CANCELLED;
+            break;
+        }
+
+        /*
+         * Fill the window with new packets read from the file, as far as the congestion window
+         * and the pacing rate allow.
+         */
+        double pacingWaitMs = 0;
+        isWaitingForInput = 0;
+        while (!endOfFile && packetsInFlight(&window) < window.size && outstanding < getCongestionWindow(&cc)) {
+            if ((pacingWaitMs = pacingDelayMs(&pacer, packetSize)) > 0) {
+                break;
+            }
+
+            SendSlot *slot = getSendSlot(&window, window.nextSequenceNumber);
+            unsigned long long int chunkSize = payloadSize;
+            int isKeepalive = 0;
+            if (stream->reader != NULL) {
+                /*
+                 * A stream source sends what its producer wrote so far. While it waits for
+                 * more, an empty packet now and then keeps the receiver from giving up on it.
+                 */
+                if (atomic_load(&stream->reader->error) != 0) {
+                    errno = atomic_load(&stream->reader->error);
+                    status = RUDP_ERROR_SOURCE;
+                    break;
+                }
+                gettimeofday(&now, NULL);
+                chunkSize = streamChunkSize(stream->reader, payloadSize);
+                isWaitingForInput = chunkSize == 0 && !isStreamFinished(stream->reader);
+                isKeepalive = isWaitingForInput && calculateRTT(lastPacketTime, now) >= STREAM_KEEPALIVE_MS;
+            } else if (bytesToTransfer - totalBytesRead < chunkSize) {
+                chunkSize = bytesToTransfer - totalBytesRead;
+            }
+
+            if (chunkSize == 0 && !isKeepalive) {
+                endOfFile = !isWaitingForInput;
+                break;
+            }
+
+            /*
+             * A packet never crosses the end of a span, so its payload is contiguous in the file.
+             */
+            unsigned long long int offset = totalBytesRead;
+            unsigned long long int contiguous = chunkSize;
+            if (stream->reader == NULL) {
+                offset = locateSpan(&stream->spans, stream->range.start + totalBytesRead, &contiguous);
+                if (contiguous < chunkSize) {
+                    chunkSize = contiguous;
+                }
+            }
+            readBytes = chunkSize;
+            if (zeroCopy) {
+                slot->payload = (char *)source->memory + offset;
+            } else {
+                slot->payload = slot->buffer;
+                if (stream->reader != NULL) {
+                    takeStreamData(stream->reader, slot->buffer, chunkSize);
+                } else if (readSource(source, slot->buffer, chunkSize, offset) < 0) {
+                    status = RUDP_ERROR_SOURCE;
+                    break;
+                }
+            }
+            totalBytesRead += readBytes;
+            addDataHash(&stream->hash, slot->payload, readBytes, offset);
+
+            /*
+             * A keepalive carries no data, so it ends the FEC block in progress and is left
+             * out of the next one. The silence before it does not count against the receiver.
+             */
+            if (stream->reader != NULL) {
+                if (isKeepalive && stream->fecParity > 0) {
+                    queueFecParity(&fec, &sendBatch, &destAddr, &pacer, stream->connectionId);
+                }
+                if (packetsInFlight(&window) == 0) {
+                    lastAckTime = now;
+                }
+                lastPacketTime = now;
+            }
+
+            slot->header.sequenceNumber = window.nextSequenceNumber;
+            slot->header.flags = stream->fecParity > 0 && !isKeepalive ? setFlag(0, HAS_PARITY) : 0;
+            slot->header.timestamp = 0;
+            slot->header.connectionId = stream->connectionId;
+            slot->header.offset = offset;
+            slot->payloadLength = readBytes;
+            slot->dataLength = readBytes;
+            slot->isAcked = 0;
+            slot->transmissions = 0;
+            slot->isLost = 0;
+            window.nextSequenceNumber++;
+            outstanding++;
+
+            /*
+             * Follow every full block, and the last packet of the range, with its parity. A
+             * short packet from a stream source ends its block too, since only the last packet
+             * of a block may be short, and so does the last packet of a span, since a block
+             * must be contiguous in the file. Parity covers the payloads before compression,
+             * which the receiver rebuilds as they were read.
+             */
+            int isBlockEnd = stream->fecParity > 0 && !isKeepalive
+                             && (addFecPacket(&fec, &slot->header, slot->payload, readBytes)
+                                 || totalBytesRead == bytesToTransfer || readBytes < payloadSize
+                                 || (stream->reader == NULL && (unsigned long long int)readBytes == contiguous));
+
+            /*
+             * Send the payload compressed when that saves enough; retransmissions reuse it.
+             */
+            size_t compressedBytes;
+            if (stream->compress && readBytes > 0
+                && (compressedBytes = compressPayload(&stream->compressor, slot->payload, readBytes, compressBuffer)) > 0) {
+                memcpy(slot->buffer, compressBuffer, compressedBytes);
+                slot->payload = slot->buffer;
+                slot->payloadLength = compressedBytes;
+                slot->header.flags = setFlag(slot->header.flags, IS_COMPRESSED);
+            }
+            sealPacket(&slot->header, &slot->wire, slot->payload, slot->payloadLength);
+
+            transmitSlot(&sendBatch, &pacer, &destAddr, slot, delivered, &deliveredTime);
+            startTimer(&wheel, &slot->timer, timeoutToMs(&rtt.timeout));
+            telemetry->packetsSent++;
+
+            if (isBlockEnd) {
+                queueFecParity(&fec, &sendBatch, &destAddr, &pacer, stream->connectionId);
+            }
+        }
+
+        /*
+         * The last block of a stream source only ends when its producer closes it.
+         */
+        if (endOfFile && stream->reader != NULL && stream->fecParity > 0) {
+            queueFecParity(&fec, &sendBatch, &destAddr, &pacer, stream->connectionId);
+        }
+
+        if (status != RUDP_OK || (packetsInFlight(&window) == 0 && endOfFile)) {
+            break;
+        }
+
+        /*
+         * Wake up for the next packet the pacer lets out if it held one back, and soon
+         * again to look for more input from a quiet stream source.
+         */
+        if (pacingWaitMs > 0) {
+            startTimer(&wheel, &pacingTimer, pacingWaitMs);
+        }
+        if (isWaitingForInput) {
+            startTimer(&wheel, &pollTimer, STREAM_POLL_MS);
+        }
+
+        flushSendBatch(&sendBatch);
+
+        int ackCount = receiveBatch(sockDescriptor, &ackBatch);
+        if (ackCount < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            status = RUDP_ERROR_SYSTEM;
+            break;
+        }
+
+        if (ackCount < 0) {
+            /*
+             * No ACK is queued: sleep until one arrives or the next timer is due.
+             */
+            if (armTimerWheel(&wheel) < 0) {
+                status = RUDP_ERROR_SYSTEM;
+                break;
+            }
+            int eventCount = epoll_wait(epollDescriptor, events, 2, -1);
+            if (eventCount < 0 && errno != EINTR) {
+                status = RUDP_ERROR_SYSTEM;
+                break;
+            }
+            for (int i = 0; i < eventCount; i++) {
+                if (events[i].data.fd == wheel.timerDescriptor) {
+                    clearTimerWheelAlarm(&wheel);
+                }
+            }
+
+            /*
+             * Read the ACKs that woke the thread before any timer is taken, so no packet
+             * they acknowledge is retransmitted.
+             */
+            ackCount = receiveBatch(sockDescriptor, &ackBatch);
+            if (ackCount < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                status = RUDP_ERROR_SYSTEM;
+                break;
+            }
+            if (ackCount < 0) {
+                ackCount = 0;
+            }
+        }
+
+        /*
+        * Mark every packet an ACK reports as received, through its cumulative ACK or its
+        * SACK bitmap, stop its timer, update the timeout and slide the window.
+        */
+        for (int i = 0; i < ackCount; i++) {
+            char *datagram = getBatchBuffer(&ackBatch, i);
+            ssize_t datagramSize = getBatchLength(&ackBatch, i);
+            PacketHeader header;
+            SackInfo sack;
+            if (!isPacketIntact(datagram, datagramSize)) {
+                telemetry->corruptPackets++;
+                continue;
+            }
+            size_t headerSize = decodePacketHeader(datagram, datagramSize, &header);
+            if (headerSize == 0 || datagramSize - headerSize != sizeof(sack)) {
+                continue;
+            }
+            memcpy(&sack, datagram + headerSize, sizeof(sack));
+            header.sequenceNumber = expandSequenceNumber(header.sequenceNumber, window.base);
+
+            if (!isFlagSet(header.flags, IS_ACK) || isFlagSet(header.flags, IS_LAST_PACKET)) {
+                continue;
+            }
+
+            gettimeofday(&now, NULL);
+            telemetry->acks++;
+            double rttSample = -1;
+            int ackedPackets = 0;
+            SendSlot *rateSlot = NULL;
+
+            for (long long seq = window.base; seq < window.nextSequenceNumber; seq++) {
+                SendSlot *slot = getSendSlot(&window, seq);
+                if (slot->isAcked || !isSacked(&sack, seq)) {
+                    continue;
+                }
+
+                slot->isAcked = 1;
+                stopTimer(&wheel, &slot->timer);
+                outstanding--;
+                delivered++;
+                ackedPackets++;
+                telemetry->goodputBytes += slot->dataLength;
+
+                /*
+                * Only sample the RTT for the packet that triggered the ACK, and only when the
+                * ACK echoes the timestamp of its latest transmission, so an ACK for an earlier
+                * copy of a retransmitted packet never skews the estimate.
+                */
+                if (seq == header.sequenceNumber && header.timestamp == slot->header.timestamp) {
+                    rttSample = timestampToRTT(header.timestamp);
+                    updateTimeout(&rtt, rttSample);
+                    recordRtt(telemetry, rttSample);
+                    recordTimeout(telemetry, timeoutToMs(&rtt.timeout));
+                }
+
+                if (seq > highestAcked) {
+                    highestAcked = seq;
+                }
+
+                /*
+                * The delivery rate is sampled from the most recently sent packet acknowledged.
+                */
+                if (rateSlot == NULL || slot->delivered >= rateSlot->delivered) {
+                    rateSlot = slot;
+                }
+            }
+
+            if (ackedPackets == 0) {
+                telemetry->duplicateAcks++;
+                continue;
+            }
+            deliveredTime = now;
+            lastAckTime = now;
+            atomic_store(&stream->acknowledgedBytes, telemetry->goodputBytes);
+            atomic_store(&stream->retransmittedPackets, telemetry->retransmissions);
+
+            /*
+            * Report the ACK to the congestion controller with a delivery rate sample:
+            * packets delivered since that packet was sent, over the time that took.
+            */
+            double intervalMs = calculateRTT(rateSlot->deliveredTime, now);
+            AckSample sample;
+            sample.nowMs = calculateRTT(start, now);
+            sample.ackedPackets = ackedPackets;
+            sample.rttMs = rttSample;
+            sample.smoothedRttMs = rtt.smoothedRtt;
+            sample.deliveryRate = intervalMs > 0 ? (delivered - rateSlot->delivered) / (intervalMs / 1000.0) : 0;
+            sample.delivered = delivered;
+            sample.priorDelivered = rateSlot->delivered;
+            sample.packetsInFlight = outstanding;
+            cc.onAck(&cc, &sample);
+            setPacingRate(&pacer, getPacingRate(&cc));
+
+            /*
+            * Any hole DUP_ACK_THRESHOLD or more sequence numbers behind the highest packet
+            * received is considered lost and retransmitted right away. Only the first loss of
+            * each window of data is reported to the congestion controller. With FEC, a hole
+            * in a block is left to the receiver until packets sent after the block's parity
+            * were acknowledged.
+            */
+            for (long long seq = window.base; seq <= highestAcked - DUP_ACK_THRESHOLD; seq++) {
+                if (stream->fecParity > 0 && (seq / stream->fecBlock + 1) * stream->fecBlock > highestAcked) {
+                    break;
+                }
+                SendSlot *lostSlot = getSendSlot(&window, seq);
+                if (lostSlot->isAcked || lostSlot->isLost) {
+                    continue;
+                }
+
+                lostSlot->isLost = 1;
+                transmitSlot(&sendBatch, &pacer, &destAddr, lostSlot, delivered, &deliveredTime);
+                startTimer(&wheel, &lostSlot->timer, timeoutToMs(&rtt.timeout));
+                telemetry->packetsSent++;
+                telemetry->retransmissions++;
+                telemetry->fastRetransmissions++;
+
+                if (seq >= recoveryPoint) {
+                    cc.onLoss(&cc, sample.nowMs);
+                    recoveryPoint = window.nextSequenceNumber;
+                }
+            }
+
+            advanceSendWindow(&window);
+        }
+
+        /*
+         * Take every timer that expired. The pacing and poll timers only had to wake the
+         * thread, which fills the window again. A packet is retransmitted once the current
+         * timeout passed since its latest transmission, and the first one doubles the
+         * timeout: a packet sent with it, or before the timeout was backed off, has its
+         * timer started again for the rest of the doubled timeout. No timer runs past the
+         * time the stream gives up at, so a silent receiver is given up on then.
+         */
+        advanceTimerWheel(&wheel);
+        gettimeofday(&now, NULL);
+        double giveUpMs = GIVE_UP_MS - calculateRTT(lastAckTime, now) + 1;
+        int expiredCount = 0;
+        WheelTimer *timer;
+        while ((timer = takeExpiredTimer(&wheel)) != NULL) {
+            if (timer == &pacingTimer || timer == &pollTimer) {
+                continue;
+            }
+            SendSlot *slot = (SendSlot *)((char *)timer - offsetof(SendSlot, timer));
+            double timeoutMs = timeoutToMs(&rtt.timeout);
+            double remainingMs = timeoutMs - calculateRTT(slot->sendTime, now);
+            if (remainingMs > 0 && giveUpMs > 0) {
+                startTimer(&wheel, &slot->timer, remainingMs < giveUpMs ? remainingMs : giveUpMs);
+                continue;
+            }
+            expiredSlots[expiredCount++] = slot;
+            if (expiredCount > 1) {
+                continue;
+            }
+
+            /*
+            * If an ACK timeout occurs, double current timeout. The congestion controller
+            * hears about at most one timeout per timeout period.
+            */
+            double nowMs = calculateRTT(start, now);
+            if (lastTimeoutMs < 0 || nowMs - lastTimeoutMs >= timeoutMs) {
+                cc.onTimeout(&cc, nowMs);
+                lastTimeoutMs = nowMs;
+                recoveryPoint = window.nextSequenceNumber;
+            }
+            doubleTimeOut(&rtt.timeout);
+            telemetry->timeouts++;
+            recordTimeout(telemetry, timeoutToMs(&rtt.timeout));
+        }
+
+        if (expiredCount > 0 && calculateRTT(lastAckTime, now) > GIVE_UP_MS) {
+            status = RUDP_ERROR_TIMEOUT;
+            break;
+        }
+
+        double retryMs = timeoutToMs(&rtt.timeout);
+        if (giveUpMs < retryMs) {
+            retryMs = giveUpMs;
+        }
+        for (int i = 0; i < expiredCount; i++) {
+            transmitSlot(&sendBatch, &pacer, &destAddr, expiredSlots[i], delivered, &deliveredTime);
+            startTimer(&wheel, &expiredSlots[i]->timer, retryMs);
+            telemetry->packetsSent++;
+            telemetry->retransmissions++;
+            telemetry->timeoutRetransmissions++;
+        }
+
+        traceStream(stream, calculateRTT(start, now), getCongestionWindow(&cc), outstanding, &rtt, &pacer, 0);
+    }
+
+    /*
+     * Only a stream that delivered its whole range tells the receiver it is done. The
+     * range of a stream source is what its producer wrote.
+     */
+    if (stream->reader != NULL) {
+        stream->range.length = totalBytesRead;
+    }
+    stream->checksum = finishDataHash(&stream->hash);
+    if (status == RUDP_OK) {
+        ClosingInfo info;
+        info.streamCount = stream->streamCount;
+        info.checksum = stream->checksum;
+        info.length = stream->hash.bytes;
+        gettimeofday(&now, NULL);
+        traceStream(stream, calculateRTT(start, now), getCongestionWindow(&cc), outstanding, &rtt, &pacer, 1);
+        if (setAckWait(sockDescriptor, timeoutToMs(&rtt.timeout)) < 0) {
+            warnTransfer(stream->control, "Error setting socket timeout");
+        }
+        sendClosingPacket(sockDescriptor, &destAddr, window.nextSequenceNumber, stream->connectionId, &info, stream->control);
+    }
+
+    stream->rtt = rtt;
+    stream->bytesSent += sendBatch.bytesSent;
+    telemetry->wireBytes = stream->bytesSent;
+    stream->parityPackets = fec.paritySent;
+
+    free(compressBuffer);
+    freeFecEncoder(&fec);
+    freeSendBatch(&sendBatch);
+    freeReceiveBatch(&ackBatch);
+    freeCongestionControl(&cc);
+    freeSendWindow(&window);
+    freeTimerWheel(&wheel);
+    if (epollDescriptor >= 0) {
+        close(epollDescriptor);
+    }
+    if (sockDescriptor >= 0) {
+        close(sockDescriptor);
+    }
+    finishTransferThread(stream->control, status);
+    return NULL;
+}
+
+
+/**
+ * @struct SenderTransfer
+ * @brief A transfer sent as parallel streams: its settings, its streams and their results.
+ */
+typedef struct {
+    struct sockaddr_in destAddr;            /**< Address of the receiver. */
+    RudpOptions options;                    /**< Settings of the transfer. */
+    unsigned int connectionId;              /**< Connection ID shared by the streams. */
+    int packetSize;                         /**< Size of every packet, discovered unless the options give it. */
+    unsigned long long int totalBytes;      /**< Bytes to send, or read from a stream source once joined. */
+    unsigned int checksum;                  /**< CRC32C of the data, once joined, unless the transfer was resumed. */
+    ByteRange spans[RESUME_MAX_RANGES];     /**< Parts of the data to send, all of it unless resumed. */
+    int spanCount;                          /**< Number of spans, 0 for a stream source. */
+    unsigned long long int resumedBytes;    /**< Bytes the receiver of a resumed transfer already had. */
+    unsigned long long int handshakeBytes;  /**< Bytes of data the handshake delivered. */
+    unsigned long long int handshakeWireBytes; /**< Bytes of every handshake datagram sent. */
+    int handshakeStatus;                    /**< Status of the answer to the handshake, HANDSHAKE_ACCEPTED once accepted. */
+    StreamReader reader;                    /**< Buffer of a stream source. */
+    RttEstimator rtt;                       /**< RTT estimator the streams start from. */
+    SenderStream streams[MAX_STREAMS];      /**< The streams. */
+    pthread_t threads[MAX_STREAMS];         /**< Thread of every stream started. */
+    int startedStreams;                     /**< Number of stream threads started. */
+    TransferControl control;                /**< Completion and cancellation of the streams. */
+    struct timeval start;                   /**< Time the handshake, which carries the first data, was sent. */
+    struct timeval end;                     /**< Time the last stream finished, once joined. */
+} SenderTransfer;
+
+/**
+ * @brief Resolves the hostname of the receiver.
+ * 
+ * @param hostname The hostname or IP address of the receiver.
+ * @param port The UDP port of the receiver.
+ * @param destAddr Set to the address of the receiver.
+ * @return int RUDP_OK, or RUDP_ERROR_ADDRESS if the hostname could not be resolved.
+ */
+int resolveReceiver(const char *hostname, unsigned short int port, struct sockaddr_in *destAddr) {
+    struct addrinfo hints, *servinfo;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if (getaddrinfo(hostname, NULL, &hints, &servinfo) != 0) {
+        return RUDP_ERROR_ADDRESS;
+    }
+
+    memset(destAddr, 0, sizeof(*destAddr));
+    destAddr->sin_family = AF_INET;
+    destAddr->sin_port = htons(port);
+    memcpy(&destAddr->sin_addr, &((struct sockaddr_in *)servinfo->ai_addr)->sin_addr, sizeof(struct in_addr));
+    freeaddrinfo(servinfo);
+    return RUDP_OK;
+}
+
+/**
+ * @brief Checks the settings of a sender.
+ * 
+ * @param options The settings.
+ * @return int RUDP_OK, or RUDP_ERROR_ARGUMENT if any is out of range or unknown.
+ */
+int checkSenderOptions(const RudpOptions *options) {
+    CongestionControl cc;
+    if (options->congestionControl == NULL || initCongestionControl(&cc, options->congestionControl, BUFFER_SIZE) < 0) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+    freeCongestionControl(&cc);
+
+    if (options->windowSize < 1 || options->windowSize > MAX_WINDOW_SIZE
+        || options->batchSize < 1 || options->batchSize > MAX_BATCH_SIZE
+        || (options->packetSize != 0 && (options->packetSize < MIN_PACKET_SIZE || options->packetSize > BUFFER_SIZE))
+        || options->streams < 1 || options->streams > MAX_STREAMS
+        || options->pacing == NULL || parsePacingMode(options->pacing) < 0
+        || options->fecParity < 0 || options->fecParity > FEC_MAX_PARITY
+        || (options->fecParity > 0 && (options->fecBlock < options->fecParity || options->fecBlock > FEC_MAX_BLOCK
+                                       || 2 * options->fecBlock > options->windowSize))) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+    return RUDP_OK;
+}
+
+/**
+ * @brief Prepares a transfer to a receiver, with a new connection ID.
+ * 
+ * @param transfer The transfer to initialize.
+ * @param destAddr The address of the receiver.
+ * @param options The settings of the transfer, already checked.
+ * @param isVerbose Non-zero to print warnings to stderr.
+ * @return Void.
+ */
+void initSenderTransfer(SenderTransfer *transfer, struct sockaddr_in *destAddr, const RudpOptions *options, int isVerbose) {
+    memset(transfer, 0, sizeof(*transfer));
+    transfer->destAddr = *destAddr;
+    transfer->options = *options;
+    transfer->connectionId = newConnectionId();
+    transfer->packetSize = options->packetSize;
+    initRttEstimator(&transfer->rtt, 2 * EXPECTED_RTT);
+    initTransferControl(&transfer->control, isVerbose);
+}
+
+/**
+ * @brief Checks that a datagram is the answer of the receiver to the handshake of a transfer.
+ *
+ * @param transfer The transfer.
+ * @param packet The datagram.
+ * @param size The size of the datagram.
+ * @param header Filled with the header of the datagram.
+ * @param answer Filled with the answer it holds.
+ * @return int Non-zero if it is an intact answer for this transfer, with sorted ranges inside the data.
+ */
+int isHandshakeAnswer(SenderTransfer *transfer, const char *packet, ssize_t size, PacketHeader *header,
+                      HandshakeAnswer *answer) {
+    size_t headerSize;
+    if (!isPacketIntact(packet, size) || (headerSize = decodePacketHeader(packet, size, header)) == 0
+        || size - headerSize < handshakeAnswerSize(0) || size - headerSize > sizeof(*answer)
+        || !isFlagSet(header->flags, IS_HANDSHAKE) || !isFlagSet(header->flags, IS_ACK)
+        || header->connectionId != transfer->connectionId) {
+        return 0;
+    }
+    memcpy(answer, packet + headerSize, size - headerSize);
+    if (answer->resume.rangeCount > RESUME_MAX_RANGES
+        || size - headerSize != handshakeAnswerSize(answer->resume.rangeCount)) {
+        return 0;
+    }
+    unsigned long long int end = 0;
+    for (unsigned long long int i = 0; i < answer->resume.rangeCount; i++) {
+        ByteRange *range = &answer->resume.missing[i];
+        if (range->length == 0 || range->start < end || range->start + range->length > transfer->totalBytes) {
+            return 0;
+        }
+        end = range->start + range->length;
+    }
+    return 1;
+}
+
+/**
+ * @brief Opens a transfer with a handshake, and adopts the parameters the receiver accepts.
+ *
+ * The handshake offers the settings of the transfer and carries its first bytes of
+ * data. It is sent again, waiting twice as long every time, up to MAX_HANDSHAKE_ATTEMPTS
+ * times, until the receiver answers. The transfer then sends no larger packets and
+ * keeps no more packets in flight than the receiver accepts, shrinking the FEC blocks
+ * to fit the window, and drops the features the receiver left out. A resumed transfer
+ * only sends the spans the receiver is missing. The answer is also the first RTT sample.
+ *
+ * @param transfer The transfer, with its size known and spans covering all of its data.
+ * @param data The first bytes of the data.
+ * @param dataLength The number of bytes of data, 0 to send none.
+ * @return int RUDP_OK, RUDP_ERROR_REFUSED if the receiver refused the transfer or accepted
+ * parameters it cannot be sent with, RUDP_ERROR_TIMEOUT if it never answered, or RUDP_ERROR_SYSTEM.
+ */
+int shakeHands(SenderTransfer *transfer, const char *data, unsigned int dataLength) {
+    RudpOptions *options = &transfer->options;
+    char datagram[BUFFER_SIZE];
+    char reply[WIRE_HEADER_SIZE + sizeof(HandshakeAnswer)];
+    WireHeader *wire = (WireHeader *)datagram;
+    PacketHeader header;
+    HandshakeOffer offer;
+    PacketHeader answerHeader;
+    HandshakeAnswer accepted;
+    HandshakeAnswer *answer = &accepted;
+    int status = RUDP_ERROR_TIMEOUT;
+
+    int sockDescriptor = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockDescriptor < 0) {
+        return RUDP_ERROR_SYSTEM;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memset(&offer, 0, sizeof(offer));
+    header.flags = setFlag(0, IS_HANDSHAKE);
+    header.connectionId = transfer->connectionId;
+    offer.version = PROTOCOL_VERSION;
+    offer.features = FEATURE_SACK | (options->fecParity > 0 ? FEATURE_FEC : 0)
+                   | (options->compression ? FEATURE_COMPRESSION : 0)
+                   | (options->resumeKey != 0 ? FEATURE_RESUME : 0);
+    offer.packetSize = transfer->packetSize;
+    offer.windowSize = options->windowSize;
+    offer.streamCount = options->streams;
+    offer.dataLength = dataLength;
+    offer.totalLength = transfer->spanCount > 0 ? transfer->totalBytes : UNKNOWN_LENGTH;
+    offer.resumeKey = options->resumeKey;
+    memcpy(datagram + WIRE_HEADER_SIZE, &offer, sizeof(offer));
+    memcpy(datagram + HANDSHAKE_SIZE, data, dataLength);
+    sealPacket(&header, wire, datagram + WIRE_HEADER_SIZE, sizeof(offer) + dataLength);
+
+    double waitMs = timeoutToMs(&transfer->rtt.timeout);
+    for (int attempt = 0; attempt < MAX_HANDSHAKE_ATTEMPTS && status == RUDP_ERROR_TIMEOUT; attempt++, waitMs *= 2) {
+        setWireTimestamp(wire, getTimestamp());
+        if (setAckWait(sockDescriptor, waitMs) < 0
+            || sendto(sockDescriptor, datagram, HANDSHAKE_SIZE + dataLength, 0,
+                      (struct sockaddr *)&transfer->destAddr, sizeof(struct sockaddr_in)) < 0) {
+            status = RUDP_ERROR_SYSTEM;
+            break;
+        }
+        transfer->handshakeWireBytes += HANDSHAKE_SIZE + dataLength;
+
+        /*
+         * Skip stray datagrams until the answer arrives or the wait runs out.
+         */
+        ssize_t size;
+        while ((size = recv(sockDescriptor, reply, sizeof(reply), 0)) >= 0) {
+            if (isHandshakeAnswer(transfer, reply, size, &answerHeader, answer)) {
+                status = RUDP_OK;
+                break;
+            }
+        }
+        if (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            status = RUDP_ERROR_SYSTEM;
+        }
+    }
+    close(sockDescriptor);
+    if (status != RUDP_OK) {
+        return status;
+    }
+
+    transfer->handshakeStatus = answer->status;
+    if (answer->status == HANDSHAKE_ACCEPTED
+        && (answer->version < MIN_PROTOCOL_VERSION || answer->version > PROTOCOL_VERSION
+            || !(answer->features & FEATURE_SACK) || answer->packetSize < MIN_PACKET_SIZE || answer->windowSize < 1)) {
+        transfer->handshakeStatus = HANDSHAKE_VERSION;
+    }
+    if (transfer->handshakeStatus != HANDSHAKE_ACCEPTED) {
+        return RUDP_ERROR_REFUSED;
+    }
+    transfer->rtt.maxAckDelay = answer->ackDelayMs;
+    updateTimeout(&transfer->rtt, timestampToRTT(answerHeader.timestamp));
+
+    if ((int)answer->packetSize < transfer->packetSize) {
+        transfer->packetSize = answer->packetSize;
+    }
+    if ((int)answer->windowSize < options->windowSize) {
+        options->windowSize = answer->windowSize;
+    }
+    if (!(answer->features & FEATURE_FEC)) {
+        options->fecParity = 0;
+    } else if (2 * options->fecBlock > options->windowSize) {
+        options->fecBlock = options->windowSize / 2;
+        if (options->fecBlock < options->fecParity) {
+            options->fecParity = 0;
+        }
+    }
+    if (!(answer->features & FEATURE_COMPRESSION)) {
+        options->compression = 0;
+    }
+    if (answer->features & FEATURE_RESUME) {
+        transfer->spanCount = answer->resume.rangeCount;
+        transfer->resumedBytes = transfer->totalBytes;
+        for (int i = 0; i < transfer->spanCount; i++) {
+            transfer->spans[i] = answer->resume.missing[i];
+            transfer->resumedBytes -= transfer->spans[i].length;
+        }
+    }
+    transfer->handshakeBytes = answer->dataLength == dataLength ? dataLength : 0;
+    return RUDP_OK;
+}
+
+/**
+ * @brief Starts sending a source, one thread per stream.
+ * 
+ * Unless the packet size is given, every packet is sent with the Don't Fragment bit set
+ * and the largest packet size that crosses the path unfragmented is discovered first.
+ * The handshake then settles the parameters of the transfer with the receiver, and
+ * delivers the first bytes of the data; the rest is split into one byte range of whole
+ * packets per stream. The transfer is timed from the handshake, whose datagrams count
+ * among the bytes sent by the first stream. A stream source has no length to split, so it is sent as a single
+ * stream, fed by a StreamReader, and its handshake carries no data. With a resume key,
+ * the handshake carries no data either: the receiver answers with what it is missing,
+ * and only that is split and sent; a stream source cannot be resumed. When a thread
+ * cannot be started the transfer fails, and the streams already started stop; they
+ * must be joined either way.
+ * 
+ * @param transfer The transfer.
+ * @param source The data to send.
+ * @param traceIntervalMs The time between trace points of every stream in ms, 0 without a trace.
+ * @return int RUDP_OK, or the error that stopped the transfer.
+ */
+int startSenderTransfer(SenderTransfer *transfer, const RudpSource *source, double traceIntervalMs) {
+    RudpOptions *options = &transfer->options;
+    int dontFragment = transfer->packetSize == 0;
+    int isStream = source->type == RUDP_SOURCE_STREAM;
+    ByteRange ranges[MAX_STREAMS];
+
+    if (isStream && (options->streams != 1 || options->resumeKey != 0)) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+
+    /*
+     * Find the largest packet that fits the path, on a socket used only for the probes.
+     */
+    if (transfer->packetSize == 0) {
+        int probeSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (probeSocket < 0) {
+            return RUDP_ERROR_SYSTEM;
+        }
+        if (setDontFragment(probeSocket) < 0) {
+            warnTransfer(&transfer->control, "Error setting Don't Fragment");
+        }
+        transfer->packetSize = discoverPacketSize(probeSocket, &transfer->destAddr, BUFFER_SIZE, &transfer->rtt);
+        close(probeSocket);
+    }
+
+    transfer->totalBytes = isStream ? 0 : source->length;
+    transfer->spans[0].start = 0;
+    transfer->spans[0].length = transfer->totalBytes;
+    transfer->spanCount = isStream ? 0 : 1;
+
+    /*
+     * Unless the transfer is resumed, the handshake carries as much of the start of the
+     * data as fits in one packet.
+     */
+    char firstData[BUFFER_SIZE];
+    unsigned long long int firstLength = 0;
+    if (!isStream && options->resumeKey == 0) {
+        firstLength = transfer->packetSize - HANDSHAKE_SIZE;
+        if (firstLength > transfer->totalBytes) {
+            firstLength = transfer->totalBytes;
+        }
+        RudpSource firstSource = *source;
+        if (source->type == RUDP_SOURCE_MEMORY) {
+            memcpy(firstData, source->memory, firstLength);
+        } else if (readSource(&firstSource, firstData, firstLength, 0) < 0) {
+            return RUDP_ERROR_SOURCE;
+        }
+    }
+    gettimeofday(&transfer->start, NULL);
+    int status = shakeHands(transfer, firstData, firstLength);
+    if (status != RUDP_OK) {
+        return status;
+    }
+    transfer->spans[0].start += transfer->handshakeBytes;
+    transfer->spans[0].length -= transfer->handshakeBytes;
+
+    int fecParity = options->fecParity;
+    int payloadSize = transfer->packetSize - WIRE_HEADER_SIZE - (fecParity > 0 ? sizeof(FecInfo) : 0);
+    unsigned long long int spanBytes = 0;
+    for (int i = 0; i < transfer->spanCount; i++) {
+        spanBytes += transfer->spans[i].length;
+    }
+    splitByteRanges(ranges, options->streams, spanBytes, payloadSize);
+    if (isStream && openStreamReader(&transfer->reader, source->fileDescriptor, source->length) < 0) {
+        return RUDP_ERROR_SYSTEM;
+    }
+
+    for (int i = 0; i < options->streams; i++) {
+        SenderStream *stream = &transfer->streams[i];
+        stream->index = i;
+        stream->streamCount = options->streams;
+        stream->connectionId = transfer->connectionId;
+        stream->destAddr = transfer->destAddr;
+        stream->source = *source;
+        stream->reader = isStream ? &transfer->reader : NULL;
+        stream->range = ranges[i];
+        initSpanCursor(&stream->spans, transfer->spans, transfer->spanCount);
+        initDataHash(&stream->hash);
+        stream->bytesSent = 0;
+        if (i == 0) {
+            addDataHash(&stream->hash, firstData, transfer->handshakeBytes, 0);
+            stream->bytesSent = transfer->handshakeWireBytes;
+        }
+        stream->windowSize = options->windowSize;
+        stream->congestionControl = options->congestionControl;
+        stream->batchSize = options->batchSize;
+        stream->packetSize = transfer->packetSize;
+        stream->useGso = options->useOffload;
+        stream->pacing = parsePacingMode(options->pacing);
+        stream->dontFragment = dontFragment;
+        stream->fecBlock = options->fecBlock;
+        stream->fecParity = fecParity;
+        stream->compress = options->compression;
+        stream->rtt = transfer->rtt;
+        stream->control = &transfer->control;
+        atomic_init(&stream->acknowledgedBytes, 0);
+        atomic_init(&stream->retransmittedPackets, 0);
+        initTelemetry(&stream->telemetry, traceIntervalMs);
+
+        startTransferThread(&transfer->control);
+        if (pthread_create(&transfer->threads[i], NULL, sendStream, stream) != 0) {
+            finishTransferThread(&transfer->control, RUDP_ERROR_SYSTEM);
+            return RUDP_ERROR_SYSTEM;
+        }
+        transfer->startedStreams++;
+    }
+    return RUDP_OK;
+}
+
+/**
+ * @brief Reports how far a transfer got, while it runs or after it finished.
+ * 
+ * @param transfer The transfer.
+ * @param progress Filled with the progress.
+ * @return Void.
+ */
+void getSenderProgress(SenderTransfer *transfer, RudpProgress *progress) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    memset(progress, 0, sizeof(*progress));
+    progress->totalBytes = transfer->totalBytes;
+    progress->completedBytes = transfer->resumedBytes + transfer->handshakeBytes;
+    if (transfer->reader.buffer != NULL) {
+        progress->totalBytes = atomic_load(&transfer->reader.produced);
+    }
+    for (int i = 0; i < transfer->startedStreams; i++) {
+        progress->completedBytes += atomic_load(&transfer->streams[i].acknowledgedBytes);
+        progress->retransmissions += atomic_load(&transfer->streams[i].retransmittedPackets);
+    }
+    if (transfer->startedStreams > 0) {
+        progress->elapsedSeconds = calculateRTT(transfer->start, transfer->end.tv_sec > 0 ? transfer->end : now) / 1000.0;
+    }
+}
+
+/**
+ * @brief Waits for every stream thread of a transfer and records when the last one finished.
+ * 
+ * The reader of a stream source is stopped too, and the bytes it read become the total.
+ * The CRC32C of the whole data is put together from the sums of the ranges, unless the
+ * transfer was resumed and part of the data was never sent.
+ * 
+ * @param transfer The transfer.
+ * @return int RUDP_OK if every stream delivered its range, or the error of the transfer.
+ */
+int joinSenderTransfer(SenderTransfer *transfer) {
+    unsigned int sum = 0;
+    for (int i = 0; i < transfer->startedStreams; i++) {
+        SenderStream *stream = &transfer->streams[i];
+        pthread_join(transfer->threads[i], NULL);
+        sum ^= stream->checksum;
+    }
+    gettimeofday(&transfer->end, NULL);
+    if (transfer->reader.buffer != NULL) {
+        transfer->totalBytes = atomic_load(&transfer->reader.consumed);
+        closeStreamReader(&transfer->reader);
+    }
+    transfer->checksum = transfer->resumedBytes == 0 ? dataChecksum(sum, transfer->totalBytes) : 0;
+    return getTransferStatus(&transfer->control);
+}
+
+/**
+ * @brief Frees what a joined transfer still holds.
+ * 
+ * @param transfer The transfer.
+ * @return Void.
+ */
+void destroySenderTransfer(SenderTransfer *transfer) {
+    closeStreamReader(&transfer->reader);
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        freeTelemetry(&transfer->streams[i].telemetry);
+    }
+    destroyTransferControl(&transfer->control);
+}
+
+#endif
@@ -0,0 +1,500 @@
+/**
+*   @file session.h
+*   @brief Table of the transfers a receiver is serving, identified by connection ID.
+*
+*   Every packet carries the connection ID the sender picked for its transfer, so a
+*   receiver can serve several senders on one port at once without mixing up their
+*   packets. A Session is the receiver's view of one transfer: the file it is written
+*   to, the parameters its handshake settled and how many of its streams have finished.
+*   A session is started by the handshake of its sender (see handshake.h), and streams
+*   of a connection ID that never shook hands are ignored. The receiver threads share
+*   one SessionTable; they only take its lock for a handshake or when a stream is first
+*   seen or forgotten, never per packet. A receiver that serves a single transfer writes
+*   it to the destination path and refuses every other connection ID. A receiver running
+*   as a daemon writes each session to the destination path followed by the connection
+*   ID in hexadecimal, and serves sessions until it is stopped. A receiver given a sink,
+*   such as the memory buffer or callback of a librudp session, writes its single
+*   transfer there instead of to a path. Every stream adds the sum of the data it got,
+*   and the sum of the checksum its sender computed, to its session, and a finished
+*   session is intact when both sums and their byte counts agree.
+*
+*   A resumable transfer, one whose sender names it with a resume key, can outlive
+*   the run of its sender: its session is found by key when the handshake of a new run
+*   asks what is missing, and it then takes the connection ID of that run. As a daemon,
+*   the file of a resumable session is named after its key, so every run finds the same
+*   file. The session keeps the ranges known to be on disk and, when the receiver keeps
+*   checkpoints, saves them next to the file as resume.h describes.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "async_writer.h"
+#include "multi_stream.h"
+#include "integrity.h"
+#include "resume.h"
+#include "handshake.h"
+#include "transfer_control.h"
+
+/**
+ * @def MAX_SESSIONS
+ * Definition specifying the largest number of sessions served at once.
+ */
+#define MAX_SESSIONS 64
+
+/**
+ * @def SESSION_LINGER_MS
+ * Definition specifying how long a finished stream is remembered, in ms, so a
+ * retransmitted closing packet is acknowledged instead of starting a new session.
+ * It must exceed the time the sender keeps retransmitting its closing packet.
+ */
+#define SESSION_LINGER_MS 5000
+
+/**
+ * @def SESSION_IDLE_MS
+ * Definition specifying how long a stream may stay silent, in ms, before the receiver
+ * gives up on it and closes its file.
+ */
+#define SESSION_IDLE_MS 30000
+
+/**
+ * @struct Session
+ * @brief A transfer served by the receiver.
+ */
+typedef struct {
+    unsigned int connectionId;          /**< Connection ID of the transfer, 0 if the entry is free. */
+    char path[PATH_MAX];                /**< File the transfer is written to. */
+    atomic_int finishedStreams;         /**< Streams whose closing packet arrived. */
+    atomic_int expectedStreams;         /**< Streams in the transfer, 0 until a closing packet tells. */
+    int references;                     /**< Receiver streams attached to the session. */
+    unsigned long long int bytesWritten;/**< Bytes written by the streams of the latest run already detached. */
+    atomic_uint receivedHash;           /**< Sum of the DataHash of every finished stream. */
+    atomic_uint expectedHash;           /**< Sum of the DataHash of every finished stream, from the closing packets of the sender. */
+    atomic_ullong receivedBytes;        /**< Bytes received by every finished stream. */
+    atomic_ullong expectedBytes;        /**< Bytes sent by every finished stream. */
+    unsigned long long int key;         /**< Resume key of the transfer, 0 if it cannot be resumed. */
+    unsigned long long int totalLength; /**< Size of the data, or UNKNOWN_LENGTH. */
+    unsigned int windowSize;            /**< Largest window of the streams, settled by the handshake. */
+    unsigned long long int handshakeBytes;/**< Bytes of data the handshake carried and were written. */
+    RangeSet durable;                   /**< Ranges of a resumable transfer known to be on disk. */
+    unsigned long long int resumedBytes;/**< Bytes the latest run of the sender skipped. */
+    int isPending;                      /**< Set from a handshake until the first stream of its run attaches. */
+    time_t pendingSince;                /**< Time of that handshake. */
+} Session;
+
+/**
+ * @struct SessionTable
+ * @brief Sessions shared by the receiver threads.
+ */
+typedef struct {
+    pthread_mutex_t lock;               /**< Guards the entries, their references and byte counts. */
+    Session sessions[MAX_SESSIONS];     /**< The sessions. */
+    const char *destination;            /**< Destination path, or prefix of the paths as a daemon. */
+    WriteTarget *sink;                  /**< Destination of the single session instead of a path, or NULL. */
+    int isDaemon;                       /**< Non-zero to serve any number of sessions. */
+    int isCheckpointed;                 /**< Non-zero to keep checkpoints of resumable sessions. */
+    unsigned int maxPacketSize;         /**< Largest packet a session may use, header included. */
+    unsigned int maxWindowSize;         /**< Largest window a stream may use. */
+    unsigned int ackDelayMs;            /**< Longest time a stream holds back an ACK, told to every sender. */
+    TransferControl *control;           /**< Receiver the sessions belong to, which prints their warnings. */
+    int sessionsOpened;                 /**< Sessions started so far. */
+    atomic_int sessionsFinished;        /**< Sessions whose every stream finished. */
+} SessionTable;
+
+/**
+ * @brief Initializes an empty session table.
+ *
+ * @param table The table to initialize.
+ * @param destination The path of the output file, or the prefix of the output files as a daemon.
+ * @param isDaemon Non-zero to serve any number of sessions, zero to serve a single one.
+ */
+void initSessionTable(SessionTable *table, const char *destination, int isDaemon) {
+    memset(table, 0, sizeof(*table));
+    pthread_mutex_init(&table->lock, NULL);
+    table->destination = destination;
+    table->isDaemon = isDaemon;
+    atomic_init(&table->sessionsFinished, 0);
+}
+
+/**
+ * @brief Destroys a session table, freeing what its sessions hold.
+ *
+ * @param table The table.
+ */
+void destroySessionTable(SessionTable *table) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        freeRangeSet(&table->sessions[i].durable);
+    }
+    pthread_mutex_destroy(&table->lock);
+}
+
+/**
+ * @brief Starts a session in a free entry, creating its file. Called with the lock held.
+ *
+ * The file is emptied, unless the transfer is resumable and the receiver keeps a
+ * checkpoint of it; a checkpoint that does not belong to the transfer is deleted with
+ * the data it described. When the size of the data is known, the disk space for all of
+ * it is reserved at once. With a sink, no file is created.
+ *
+ * @param table The table.
+ * @param session The free entry.
+ * @param connectionId The connection ID of the transfer.
+ * @param key The resume key of the transfer, 0 if it cannot be resumed.
+ * @param totalLength The size of the data, or UNKNOWN_LENGTH.
+ * @return int 0 on success, -1 if the file could not be opened.
+ */
+int openSession(SessionTable *table, Session *session, unsigned int connectionId, unsigned long long int key,
+                unsigned long long int totalLength) {
+    session->durable.count = 0;
+    if (table->sink == NULL) {
+        if (table->isDaemon && key != 0) {
+            snprintf(session->path, sizeof(session->path), "%s.%016llx", table->destination, key);
+        } else if (table->isDaemon) {
+            snprintf(session->path, sizeof(session->path), "%s.%08x", table->destination, connectionId);
+        } else {
+            snprintf(session->path, sizeof(session->path), "%s", table->destination);
+        }
+
+        int fileDescriptor = open(session->path, O_WRONLY | O_CREAT, 0644);
+        if (fileDescriptor < 0) {
+            warnTransfer(table->control, "Failed to open destination file for writing.");
+            return -1;
+        }
+        if (key == 0 || !table->isCheckpointed || loadCheckpoint(session->path, key, totalLength, &session->durable) < 0) {
+            removeCheckpoint(session->path);
+            if (ftruncate(fileDescriptor, 0) < 0) {
+                warnTransfer(table->control, "Failed to open destination file for writing.");
+                close(fileDescriptor);
+                return -1;
+            }
+        }
+        if (totalLength != UNKNOWN_LENGTH && totalLength > 0) {
+            fallocate(fileDescriptor, FALLOC_FL_KEEP_SIZE, 0, totalLength);
+        }
+        close(fileDescriptor);
+    }
+
+    session->connectionId = connectionId;
+    atomic_init(&session->finishedStreams, 0);
+    atomic_init(&session->expectedStreams, 0);
+    atomic_init(&session->receivedHash, 0);
+    atomic_init(&session->expectedHash, 0);
+    atomic_init(&session->receivedBytes, 0);
+    atomic_init(&session->expectedBytes, 0);
+    session->bytesWritten = 0;
+    session->key = key;
+    session->totalLength = totalLength;
+    session->handshakeBytes = 0;
+    session->resumedBytes = 0;
+    session->isPending = 0;
+    table->sessionsOpened++;
+    return 0;
+}
+
+/**
+ * @brief Checks whether a session is in use: it has streams, or its handshake was answered
+ * less than SESSION_IDLE_MS ago.
+ *
+ * @param session The session.
+ * @param now The current time.
+ * @return int Non-zero if the session is in use, zero if its entry may be reused.
+ */
+int isSessionActive(Session *session, time_t now) {
+    return session->references > 0
+        || (session->isPending && (now - session->pendingSince) * 1000 < SESSION_IDLE_MS);
+}
+
+/**
+ * @brief Attaches a new receiver stream to the session its handshake started.
+ *
+ * @param table The table.
+ * @param connectionId The connection ID of the stream.
+ * @return Session* The session, or NULL if the connection ID has none.
+ */
+Session *attachSession(SessionTable *table, unsigned int connectionId) {
+    Session *session = NULL;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&table->lock);
+    for (int i = 0; i < MAX_SESSIONS && session == NULL; i++) {
+        Session *entry = &table->sessions[i];
+        if (entry->connectionId == connectionId && isSessionActive(entry, now)) {
+            session = entry;
+        }
+    }
+    if (session != NULL) {
+        session->isPending = 0;
+        session->references++;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return session;
+}
+
+/**
+ * @brief Writes the data a handshake carried to a new session and adds it to its sums.
+ * Called with the lock held.
+ *
+ * @param table The table.
+ * @param session The session, just started.
+ * @param data The data, from offset 0.
+ * @param length The number of bytes of data.
+ * @return int 0 on success, -1 if it could not be written.
+ */
+int writeHandshakeData(SessionTable *table, Session *session, const char *data, size_t length) {
+    WriteTarget target;
+    struct iovec iov;
+    DataHash hash;
+
+    if ((table->sink != NULL ? shareWriteTarget(&target, table->sink) : openWriteTarget(&target, session->path, 0)) < 0) {
+        return -1;
+    }
+    iov.iov_base = (char *)data;
+    iov.iov_len = length;
+    writeSegments(&target, &iov, 1, 0);
+    if (closeWriteTarget(&target) < 0) {
+        return -1;
+    }
+
+    initDataHash(&hash);
+    addDataHash(&hash, data, length, 0);
+    atomic_fetch_xor(&session->receivedHash, finishDataHash(&hash));
+    atomic_fetch_add(&session->receivedBytes, length);
+    session->bytesWritten += length;
+    session->handshakeBytes = length;
+    return 0;
+}
+
+/**
+ * @brief Answers the handshake of a sender, starting or continuing its session.
+ *
+ * The parameters of the session are negotiated first. A handshake the sender repeats
+ * because the answer was lost finds the session of its connection ID and gets the same
+ * answer. A resumable transfer continues the session of its key still in the table,
+ * whichever connection ID its earlier runs used; the streams of a run that died are
+ * simply left to expire, and a run with a new connection ID starts with the counts and
+ * sums of the closing packets cleared. Any other handshake starts a new session, which
+ * a receiver that is not a daemon only does once. The data a handshake carries is
+ * written when it starts a session that is not resumed.
+ *
+ * @param table The table.
+ * @param connectionId The connection ID of the handshake.
+ * @param offer The offer of the sender.
+ * @param data The data after the offer, offer->dataLength bytes.
+ * @param answer Filled with the answer to send.
+ * @return Session* The session, or NULL if it was refused, with the reason in the answer.
+ */
+Session *acceptSession(SessionTable *table, unsigned int connectionId, const HandshakeOffer *offer, const char *data,
+                       HandshakeAnswer *answer) {
+    Session *session = NULL;
+    Session *freeEntry = NULL;
+    int isRepeated = 0;
+    int isNew = 0;
+    time_t now = time(NULL);
+    unsigned long long int key = 0;
+
+    if (negotiateHandshake(offer, table->maxPacketSize, table->maxWindowSize, answer) != HANDSHAKE_ACCEPTED) {
+        return NULL;
+    }
+    answer->ackDelayMs = table->ackDelayMs;
+    if (table->sink != NULL && table->sink->memory != NULL && offer->totalLength != UNKNOWN_LENGTH
+        && offer->totalLength > table->sink->capacity) {
+        answer->status = HANDSHAKE_TOO_LARGE;
+        return NULL;
+    }
+    if ((answer->features & FEATURE_RESUME) && offer->resumeKey != 0 && offer->totalLength != UNKNOWN_LENGTH) {
+        key = offer->resumeKey;
+    } else {
+        answer->features &= ~FEATURE_RESUME;
+    }
+
+    pthread_mutex_lock(&table->lock);
+    for (int i = 0; i < MAX_SESSIONS && session == NULL; i++) {
+        Session *entry = &table->sessions[i];
+        if (entry->connectionId == connectionId && isSessionActive(entry, now)) {
+            session = entry;
+            isRepeated = 1;
+        } else if (key != 0 && entry->connectionId != 0 && entry->key == key
+                   && (isSessionActive(entry, now) || !table->isDaemon)) {
+            session = entry;
+        } else if (!isSessionActive(entry, now) && freeEntry == NULL) {
+            freeEntry = entry;
+        }
+    }
+
+    if (session == NULL) {
+        if (freeEntry == NULL || (!table->isDaemon && table->sessionsOpened > 0)) {
+            answer->status = HANDSHAKE_BUSY;
+        } else if (openSession(table, freeEntry, connectionId, key, offer->totalLength) < 0) {
+            answer->status = HANDSHAKE_FAILED;
+        } else {
+            session = freeEntry;
+            isNew = 1;
+            if (table->isDaemon) {
+                printf("Session %08x %s, writing to %s\n", connectionId,
+                       session->durable.count > 0 ? "resumed" : "started", session->path);
+                fflush(stdout);
+            }
+        }
+    } else if (!isRepeated) {
+        if (session->totalLength != offer->totalLength) {
+            session->durable.count = 0;
+            session->totalLength = offer->totalLength;
+        }
+        session->connectionId = connectionId;
+        atomic_store(&session->finishedStreams, 0);
+        atomic_store(&session->expectedStreams, 0);
+        atomic_store(&session->receivedHash, 0);
+        atomic_store(&session->expectedHash, 0);
+        atomic_store(&session->receivedBytes, 0);
+        atomic_store(&session->expectedBytes, 0);
+    }
+
+    if (session != NULL) {
+        if (!isRepeated) {
+            session->windowSize = answer->windowSize;
+            session->isPending = 1;
+            session->pendingSince = now;
+        }
+        if (key != 0) {
+            listMissingRanges(&session->durable, session->totalLength, &answer->resume);
+            session->resumedBytes = answer->resume.presentBytes;
+            if (!isRepeated) {
+                session->bytesWritten = 0;
+            }
+        } else if (isNew && offer->dataLength > 0) {
+            writeHandshakeData(table, session, data, offer->dataLength);
+        }
+        answer->dataLength = session->handshakeBytes;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return session;
+}
+
+/**
+ * @brief Checks whether the closing packet of every stream of a session arrived.
+ *
+ * @param session The session.
+ * @return int Non-zero once every stream has finished.
+ */
+int isSessionFinished(Session *session) {
+    int expectedStreams = atomic_load(&session->expectedStreams);
+    return expectedStreams > 0 && atomic_load(&session->finishedStreams) >= expectedStreams;
+}
+
+/**
+ * @brief Checks whether the data of a finished session matches the checksums of its sender.
+ *
+ * @param session The session, finished.
+ * @return int Non-zero if every byte sent arrived as it was sent.
+ */
+int isSessionIntact(Session *session) {
+    return atomic_load(&session->receivedHash) == atomic_load(&session->expectedHash)
+        && atomic_load(&session->receivedBytes) == atomic_load(&session->expectedBytes);
+}
+
+/**
+ * @brief Returns the CRC32C of the data of a finished session.
+ *
+ * @param session The session, finished.
+ * @return unsigned int The CRC32C of the data received.
+ */
+unsigned int getSessionChecksum(Session *session) {
+    return dataChecksum(atomic_load(&session->receivedHash), atomic_load(&session->receivedBytes));
+}
+
+/**
+ * @brief Records that the closing packet of one stream of a session arrived, with what
+ * the stream sent and what it received.
+ *
+ * The sums are added before the stream is counted, so the stream that finishes the
+ * session sees those of every other stream. A finished session needs no checkpoint.
+ *
+ * @param table The table.
+ * @param session The session.
+ * @param info The payload of the closing packet.
+ * @param receivedHash The sum of the DataHash of the stream.
+ * @param receivedBytes The bytes the stream received.
+ */
+void finishSessionStream(SessionTable *table, Session *session, const ClosingInfo *info, unsigned int receivedHash,
+                         unsigned long long int receivedBytes) {
+    atomic_fetch_xor(&session->receivedHash, receivedHash);
+    atomic_fetch_xor(&session->expectedHash, info->checksum);
+    atomic_fetch_add(&session->receivedBytes, receivedBytes);
+    atomic_fetch_add(&session->expectedBytes, info->length);
+
+    int unknown = 0;
+    atomic_compare_exchange_strong(&session->expectedStreams, &unknown, info->streamCount);
+    if (atomic_fetch_add(&session->finishedStreams, 1) + 1 == atomic_load(&session->expectedStreams)) {
+        if (session->key != 0 && table->sink == NULL) {
+            pthread_mutex_lock(&table->lock);
+            removeCheckpoint(session->path);
+            pthread_mutex_unlock(&table->lock);
+        }
+        atomic_fetch_add(&table->sessionsFinished, 1);
+    }
+}
+
+/**
+ * @brief Adds ranges a stream knows are on disk to its session and saves its checkpoint.
+ *
+ * A finished session is left alone, since its checkpoint was deleted.
+ *
+ * @param table The table.
+ * @param session The session, resumable.
+ * @param ranges The ranges synced to disk.
+ * @return int 0 on success or if the receiver keeps no checkpoints, -1 if saving failed (see errno).
+ */
+int checkpointSession(SessionTable *table, Session *session, const RangeSet *ranges) {
+    int result = 0;
+    pthread_mutex_lock(&table->lock);
+    if (table->isCheckpointed && table->sink == NULL && !isSessionFinished(session)) {
+        if (mergeRangeSet(&session->durable, ranges) < 0
+            || saveCheckpoint(session->path, session->key, session->totalLength, &session->durable) < 0) {
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+    return result;
+}
+
+/**
+ * @brief Detaches a receiver stream from its session, ending the session with its last stream.
+ *
+ * Only the bytes of the latest run of the session are counted: a stream of a run that
+ * died may have written ranges its checkpoint does not hold, which a resumed run writes
+ * again.
+ *
+ * @param table The table.
+ * @param session The session.
+ * @param connectionId The connection ID of the stream.
+ * @param bytesWritten The number of bytes the stream wrote.
+ */
+void detachSession(SessionTable *table, Session *session, unsigned int connectionId, unsigned long long int bytesWritten) {
+    pthread_mutex_lock(&table->lock);
+    if (connectionId == session->connectionId) {
+        session->bytesWritten += bytesWritten;
+    }
+    if (--session->references == 0 && table->isDaemon) {
+        int isFinished = isSessionFinished(session);
+        printf("Session %08x %s: %llu bytes written to %s\n", session->connectionId,
+               !isFinished ? "abandoned" : isSessionIntact(session) ? "complete" : "corrupt",
+               session->resumedBytes + session->bytesWritten, session->path);
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&table->lock);
+}
+
+#endif
@@ -0,0 +1,252 @@
+/**
+*   @file sliding_window.h
+*   @brief Data structures and helpers for the Selective Repeat sliding window.
+*
+*   This file contains the send and receive windows used by the Selective Repeat
+*   pipelining of the enhanced UDP protocol. The sender keeps a copy of every
+*   in-flight packet so that each one can be retransmitted individually, while the
+*   receiver records which packets ahead of the next expected one already arrived.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef SLIDING_WINDOW_H
+#define SLIDING_WINDOW_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "packet_header.h"
+#include "timer_wheel.h"
+
+/**
+ * @def DEFAULT_WINDOW_SIZE
+ * Definition specifying the number of in-flight packets the sender allows by default.
+ */
+#define DEFAULT_WINDOW_SIZE 32
+
+/**
+ * @def MAX_WINDOW_SIZE
+ * Definition specifying the largest window supported. The receiver always accepts
+ * this many packets ahead of the next in-order one, so any sender window up to this
+ * value works.
+ */
+#define MAX_WINDOW_SIZE 256
+
+/**
+ * @struct SendSlot
+ * @brief A packet held by the sender until it is acknowledged.
+ *
+ * The header and the payload are kept apart and sent as two iovecs. The payload either
+ * lives in the slot's own buffer or, when the file is memory-mapped, points straight
+ * into the mapping, so a retransmission never needs to read or copy the data again.
+ */
+typedef struct {
+    PacketHeader header;      /**< Header of the packet. */
+    WireHeader wire;          /**< The header as sent, stamped again at every transmission. */
+    char *buffer;             /**< Payload storage owned by the slot, NULL when the payload is mapped. */
+    char *payload;            /**< Payload of the packet, in buffer or in the file mapping. */
+    size_t payloadLength;     /**< Number of bytes in payload. */
+    size_t dataLength;        /**< Number of bytes of data the payload carries, before compression. */
+    int isAcked;              /**< Non-zero once the receiver acknowledged the packet. */
+    int transmissions;        /**< Number of times the packet has been sent. */
+    struct timeval sendTime;  /**< Time of the latest transmission. */
+    int isLost;               /**< Non-zero once the packet was declared lost and retransmitted early. */
+    long long delivered;      /**< Packets delivered when the packet was last sent, for rate sampling. */
+    struct timeval deliveredTime; /**< Time of the latest delivery when the packet was last sent. */
+    WheelTimer timer;         /**< Retransmission timer, running until the packet is acknowledged. */
+} SendSlot;
+
+/**
+ * @struct SendWindow
+ * @brief Window of in-flight packets on the sender side.
+ *
+ * Slots are indexed by sequence number modulo the window size. Every sequence number
+ * in [base, nextSequenceNumber) has a slot holding its packet.
+ */
+typedef struct {
+    SendSlot *slots;          /**< Ring of slots, one per in-flight packet. */
+    int size;                 /**< Maximum number of in-flight packets. */
+    long long base;           /**< Oldest unacknowledged sequence number. */
+    long long nextSequenceNumber; /**< Sequence number the next new packet will use. */
+} SendWindow;
+
+/**
+ * @struct ReceiveSlot
+ * @brief A packet the receiver accepts ahead of the next in-order packet.
+ *
+ * Payloads are written straight to their offset in the file, so only the arrival is
+ * recorded. The data buffer is only allocated when a caller asks for slot buffers.
+ */
+typedef struct {
+    char *data;               /**< Payload of the packet, without the header, or NULL if not buffered. */
+    ssize_t length;           /**< Number of bytes in data. */
+    int isReceived;           /**< Non-zero if the packet arrived but the window has not moved past it. */
+} ReceiveSlot;
+
+/**
+ * @struct ReceiveWindow
+ * @brief Window of packets the receiver accepts ahead of the next in-order packet.
+ */
+typedef struct {
+    ReceiveSlot *slots;          /**< Ring of slots indexed by sequence number modulo size. */
+    int size;                    /**< Number of packets accepted ahead of the next in-order one. */
+    long long expectedSequenceNumber; /**< Next sequence number to be delivered in order. */
+} ReceiveWindow;
+
+/**
+ * @brief Allocates the slots of a send window.
+ *
+ * @param window The window to initialize.
+ * @param size The maximum number of in-flight packets.
+ * @param slotBytes The size of the payload buffer allocated for each packet, or 0 if
+ * payloads are not copied into the slots.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initSendWindow(SendWindow *window, int size, size_t slotBytes) {
+    window->size = size;
+    window->base = 0;
+    window->nextSequenceNumber = 0;
+    window->slots = calloc(size, sizeof(SendSlot));
+    if (window->slots == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; slotBytes > 0 && i < size; i++) {
+        window->slots[i].buffer = malloc(slotBytes);
+        if (window->slots[i].buffer == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by a send window.
+ *
+ * @param window The window to free.
+ */
+void freeSendWindow(SendWindow *window) {
+    if (window->slots == NULL) {
+        return;
+    }
+    for (int i = 0; i < window->size; i++) {
+        free(window->slots[i].buffer);
+    }
+    free(window->slots);
+    window->slots = NULL;
+}
+
+/**
+ * @brief Returns the slot that holds the given sequence number.
+ *
+ * @param window The send window.
+ * @param sequenceNumber The sequence number of the packet.
+ * @return SendSlot* The slot for that sequence number.
+ */
+SendSlot *getSendSlot(SendWindow *window, long long sequenceNumber) {
+    return &window->slots[sequenceNumber % window->size];
+}
+
+/**
+ * @brief Checks whether a sequence number is currently in flight.
+ *
+ * @param window The send window.
+ * @param sequenceNumber The sequence number to check.
+ * @return int Non-zero if the sequence number is in [base, nextSequenceNumber).
+ */
+int isInSendWindow(SendWindow *window, long long sequenceNumber) {
+    return sequenceNumber >= window->base && sequenceNumber < window->nextSequenceNumber;
+}
+
+/**
+ * @brief Returns the number of packets sent but not yet released from the window.
+ *
+ * @param window The send window.
+ * @return int The number of packets in [base, nextSequenceNumber).
+ */
+int packetsInFlight(SendWindow *window) {
+    return window->nextSequenceNumber - window->base;
+}
+
+/**
+ * @brief Slides the window past every acknowledged packet at its base.
+ *
+ * @param window The send window.
+ */
+void advanceSendWindow(SendWindow *window) {
+    while (window->base < window->nextSequenceNumber && getSendSlot(window, window->base)->isAcked) {
+        window->base++;
+    }
+}
+
+/**
+ * @brief Allocates the slots of a receive window.
+ *
+ * @param window The window to initialize.
+ * @param size The number of packets accepted ahead of the next in-order packet.
+ * @param slotBytes The size of the buffer allocated for each payload, or 0 if payloads
+ * are not buffered in the slots.
+ * @return int 0 on success, -1 if the memory could not be allocated.
+ */
+int initReceiveWindow(ReceiveWindow *window, int size, size_t slotBytes) {
+    window->size = size;
+    window->expectedSequenceNumber = 0;
+    window->slots = calloc(size, sizeof(ReceiveSlot));
+    if (window->slots == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; slotBytes > 0 && i < size; i++) {
+        window->slots[i].data = malloc(slotBytes);
+        if (window->slots[i].data == NULL) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Releases the memory held by a receive window.
+ *
+ * @param window The window to free.
+ */
+void freeReceiveWindow(ReceiveWindow *window) {
+    if (window->slots == NULL) {
+        return;
+    }
+    for (int i = 0; i < window->size; i++) {
+        free(window->slots[i].data);
+    }
+    free(window->slots);
+    window->slots = NULL;
+}
+
+/**
+ * @brief Returns the slot that buffers the given sequence number.
+ *
+ * @param window The receive window.
+ * @param sequenceNumber The sequence number of the packet.
+ * @return ReceiveSlot* The slot for that sequence number.
+ */
+ReceiveSlot *getReceiveSlot(ReceiveWindow *window, long long sequenceNumber) {
+    return &window->slots[sequenceNumber % window->size];
+}
+
+/**
+ * @brief Checks whether a sequence number can be accepted by the receiver.
+ *
+ * @param window The receive window.
+ * @param sequenceNumber The sequence number to check.
+ * @return int Non-zero if the sequence number is in [expected, expected + size).
+ */
+int isInReceiveWindow(ReceiveWindow *window, long long sequenceNumber) {
+    return sequenceNumber >= window->expectedSequenceNumber
+        && sequenceNumber < window->expectedSequenceNumber + window->size;
+}
+
+#endif
@@ -0,0 +1,262 @@
+/**
+*   @file stream_source.h
+*   @brief Bounded buffer that feeds a sender from a pipe, socket or terminal of unknown length.
+*
+*   A stream cannot be read with pread and its length is unknown until its producer
+*   closes it, so it cannot be split into byte ranges or mapped. A StreamReader owns a
+*   reader thread that reads the descriptor into a ring buffer of STREAM_BUFFER_SIZE
+*   bytes, and the stream thread of the sender takes its packets from the ring as data
+*   arrives. The ring is a single-producer single-consumer buffer like the queues of
+*   async_writer.h: the reader thread only advances the bytes produced and the sender
+*   only the bytes consumed, so neither side takes a lock. A full ring makes the reader
+*   wait, which in turn stalls the producer of the stream, so memory stays bounded
+*   however far the network falls behind.
+*
+*   The sender sends a full packet as soon as one is buffered. When the producer pauses,
+*   what is buffered is sent as a shorter packet after STREAM_FLUSH_MS, so interactive
+*   or slow producers are not held back for a full packet.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef STREAM_SOURCE_H
+#define STREAM_SOURCE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+
+/**
+ * @def STREAM_BUFFER_SIZE
+ * Definition specifying the size of the ring buffer between the reader thread and the sender.
+ */
+#define STREAM_BUFFER_SIZE (8 << 20)
+
+/**
+ * @def STREAM_FLUSH_MS
+ * Definition specifying how long buffered data shorter than a packet waits for more, in ms.
+ */
+#define STREAM_FLUSH_MS 2
+
+/**
+ * @def STREAM_POLL_MS
+ * Definition specifying how often a sender waiting for input checks the ring, in ms.
+ */
+#define STREAM_POLL_MS 1
+
+/**
+ * @def STREAM_KEEPALIVE_MS
+ * Definition specifying how long a sender waiting for input stays silent, in ms, before it
+ * sends an empty packet so the receiver does not abandon the stream. It must be well
+ * below SESSION_IDLE_MS.
+ */
+#define STREAM_KEEPALIVE_MS 5000
+
+/**
+ * @def STREAM_STOP_POLL_MS
+ * Definition specifying how long the reader thread waits for input before it checks
+ * whether it must stop, in ms.
+ */
+#define STREAM_STOP_POLL_MS 100
+
+/**
+ * @def STREAM_IDLE_USEC
+ * Definition specifying how long the reader thread sleeps while the ring is full.
+ */
+#define STREAM_IDLE_USEC 200
+
+/**
+ * @struct StreamReader
+ * @brief A reader thread and the ring buffer it fills from a descriptor.
+ */
+typedef struct {
+    int fd;                         /**< The descriptor read. */
+    unsigned long long int limit;   /**< Most bytes to read, 0 to read until the end. */
+    char *buffer;                   /**< The ring buffer. */
+    size_t capacity;                /**< Size of the ring buffer. */
+    pthread_t thread;               /**< The reader thread. */
+    atomic_ullong produced;         /**< Bytes read into the ring, written by the reader thread. */
+    atomic_ullong consumed;         /**< Bytes taken from the ring, written by the sender. */
+    atomic_llong lastReadMs;        /**< Monotonic time of the latest read, in ms. */
+    atomic_int isEnded;             /**< Set once the descriptor ended, failed or reached the limit. */
+    atomic_int isStopping;          /**< Set when the reader thread must stop before the end. */
+    atomic_int error;               /**< errno of a failed read, 0 if none failed. */
+} StreamReader;
+
+/**
+ * @brief Returns the current monotonic time.
+ *
+ * @return long long int The time in ms.
+ */
+long long int monotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long int)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Body of the reader thread: fills the ring until the descriptor ends.
+ *
+ * @param argument The StreamReader.
+ * @return void* Always NULL.
+ */
+void *streamReaderThread(void *argument) {
+    StreamReader *reader = argument;
+    struct pollfd input = {reader->fd, POLLIN, 0};
+
+    while (!atomic_load(&reader->isStopping)) {
+        unsigned long long int produced = atomic_load_explicit(&reader->produced, memory_order_relaxed);
+        unsigned long long int consumed = atomic_load_explicit(&reader->consumed, memory_order_acquire);
+        if (reader->limit > 0 && produced == reader->limit) {
+            break;
+        }
+
+        /*
+         * Read into the free space up to the end of the ring, or wait for the sender to free some.
+         */
+        size_t position = produced % reader->capacity;
+        size_t space = reader->capacity - (produced - consumed);
+        if (space > reader->capacity - position) {
+            space = reader->capacity - position;
+        }
+        if (reader->limit > 0 && space > reader->limit - produced) {
+            space = reader->limit - produced;
+        }
+        if (space == 0) {
+            struct timespec idle = {0, STREAM_IDLE_USEC * 1000};
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        /*
+         * Wait for input in short steps, so a transfer that is cancelled does not leave the
+         * thread blocked on a producer that never writes again.
+         */
+        int ready = poll(&input, 1, STREAM_STOP_POLL_MS);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) {
+            continue;
+        }
+        ssize_t readBytes = ready < 0 ? -1 : read(reader->fd, reader->buffer + position, space);
+        if (readBytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (readBytes < 0) {
+            atomic_store(&reader->error, errno);
+        }
+        if (readBytes <= 0) {
+            break;
+        }
+        atomic_store(&reader->lastReadMs, monotonicMs());
+        atomic_store_explicit(&reader->produced, produced + readBytes, memory_order_release);
+    }
+
+    atomic_store(&reader->isEnded, 1);
+    return NULL;
+}
+
+/**
+ * @brief Allocates the ring and starts the reader thread.
+ *
+ * @param reader The reader to initialize.
+ * @param fd The descriptor to read; it is not closed.
+ * @param limit The most bytes to read, 0 to read until the descriptor ends.
+ * @return int 0 on success, -1 on failure (see errno), with nothing left allocated.
+ */
+int openStreamReader(StreamReader *reader, int fd, unsigned long long int limit) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+    reader->limit = limit;
+    reader->capacity = STREAM_BUFFER_SIZE;
+    atomic_init(&reader->produced, 0);
+    atomic_init(&reader->consumed, 0);
+    atomic_init(&reader->lastReadMs, monotonicMs());
+    atomic_init(&reader->isEnded, 0);
+    atomic_init(&reader->isStopping, 0);
+    atomic_init(&reader->error, 0);
+
+    if ((reader->buffer = malloc(reader->capacity)) == NULL) {
+        return -1;
+    }
+    if ((errno = pthread_create(&reader->thread, NULL, streamReaderThread, reader)) != 0) {
+        free(reader->buffer);
+        reader->buffer = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Decides how many bytes the next packet of a stream takes.
+ *
+ * A packet takes a full payload as soon as one is buffered, what is left once the
+ * descriptor ended, and what is buffered once nothing more arrived for STREAM_FLUSH_MS.
+ *
+ * @param reader The reader.
+ * @param payloadSize The payload of a full packet.
+ * @return size_t The number of bytes to take, 0 if the packet must wait or the stream is over.
+ */
+size_t streamChunkSize(StreamReader *reader, size_t payloadSize) {
+    int isEnded = atomic_load(&reader->isEnded);
+    unsigned long long int available = atomic_load_explicit(&reader->produced, memory_order_acquire)
+                                     - atomic_load_explicit(&reader->consumed, memory_order_relaxed);
+    if (available >= payloadSize) {
+        return payloadSize;
+    }
+    if (available > 0 && (isEnded || monotonicMs() - atomic_load(&reader->lastReadMs) >= STREAM_FLUSH_MS)) {
+        return available;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies bytes out of the ring and frees their space for the reader thread.
+ *
+ * @param reader The reader.
+ * @param destination Where the bytes go.
+ * @param length The number of bytes, as returned by streamChunkSize.
+ * @return Void.
+ */
+void takeStreamData(StreamReader *reader, char *destination, size_t length) {
+    unsigned long long int consumed = atomic_load_explicit(&reader->consumed, memory_order_relaxed);
+    size_t position = consumed % reader->capacity;
+    size_t first = reader->capacity - position < length ? reader->capacity - position : length;
+
+    memcpy(destination, reader->buffer + position, first);
+    memcpy(destination + first, reader->buffer, length - first);
+    atomic_store_explicit(&reader->consumed, consumed + length, memory_order_release);
+}
+
+/**
+ * @brief Checks whether every byte of the stream was taken and nothing more will come.
+ *
+ * @param reader The reader.
+ * @return int Non-zero once the stream is over.
+ */
+int isStreamFinished(StreamReader *reader) {
+    return atomic_load(&reader->isEnded)
+        && atomic_load(&reader->produced) == atomic_load(&reader->consumed);
+}
+
+/**
+ * @brief Stops the reader thread, even if it is waiting for input, and frees the ring.
+ *
+ * @param reader The reader.
+ * @return Void.
+ */
+void closeStreamReader(StreamReader *reader) {
+    if (reader->buffer == NULL) {
+        return;
+    }
+    atomic_store(&reader->isStopping, 1);
+    pthread_join(reader->thread, NULL);
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+#endif
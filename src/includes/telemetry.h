@@ -0,0 +1,485 @@
+/**
+*   @file telemetry.h
+*   @brief Counters, an RTT histogram and a time-series trace of a transfer.
+*
+*   Every stream of the sender keeps a Telemetry record of what happened during its
+*   transfer: the packets and bytes sent, the payload bytes the receiver acknowledged
+*   (goodput), retransmissions split by their cause, timeouts, duplicate ACKs and
+*   changes of the retransmission timeout. RTT samples go into a log-linear histogram
+*   with TELEMETRY_SUB_BUCKETS buckets per power of two microseconds, which bounds the
+*   error of its percentiles to a fraction of the value. With a trace interval set, the
+*   stream also records a TracePoint at most once per interval with its congestion
+*   window, packets in flight, RTT, timeout and pacing rate, and the cumulative counters.
+*
+*   At the end of the transfer the records of the streams are merged and written as a
+*   JSON summary, and their trace points as CSV or as a binary file made of a
+*   TraceFileHeader followed by TracePoint records in host byte order.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @def TELEMETRY_SUB_BUCKETS
+ * Definition specifying the number of RTT histogram buckets per power of two.
+ */
+#define TELEMETRY_SUB_BUCKETS 4
+
+/**
+ * @def TELEMETRY_BUCKETS
+ * Definition specifying the number of RTT histogram buckets, covering 1 us to over two hours.
+ */
+#define TELEMETRY_BUCKETS (32 * TELEMETRY_SUB_BUCKETS)
+
+/**
+ * @def TRACE_MAGIC
+ * Definition specifying the first four bytes of a binary trace file.
+ */
+#define TRACE_MAGIC "RTRC"
+
+/**
+ * @def TRACE_VERSION
+ * Definition specifying the version of the binary trace format.
+ */
+#define TRACE_VERSION 1
+
+/**
+ * @def TRACE_CSV
+ * Trace format writing one line of comma separated values per trace point.
+ */
+#define TRACE_CSV 0
+
+/**
+ * @def TRACE_BINARY
+ * Trace format writing a TraceFileHeader followed by the raw TracePoint records.
+ */
+#define TRACE_BINARY 1
+
+/**
+ * @def DEFAULT_TRACE_INTERVAL_MS
+ * Definition specifying the time between trace points when none is given, in milliseconds.
+ */
+#define DEFAULT_TRACE_INTERVAL_MS 100
+
+/**
+ * @struct TelemetryOptions
+ * @brief What the sender reports about a transfer and where.
+ */
+typedef struct {
+    double linkCapacity;     /**< Capacity of the link in bits per second, for the bandwidth utilization. */
+    char *prefix;            /**< Prefix of the summary and trace files, or NULL to write none. */
+    double traceIntervalMs;  /**< Time between trace points in ms, 0 to write no trace. */
+    int traceFormat;         /**< TRACE_CSV or TRACE_BINARY. */
+} TelemetryOptions;
+
+/**
+ * @struct TracePoint
+ * @brief State of a stream at one moment of the transfer.
+ */
+typedef struct {
+    double timeMs;                          /**< Time since the stream started in ms. */
+    int stream;                             /**< Number of the stream. */
+    int congestionWindow;                   /**< Congestion window in packets. */
+    int packetsInFlight;                    /**< Packets sent and not acknowledged. */
+    int reserved;                           /**< Always 0, keeps the record aligned. */
+    double smoothedRttMs;                   /**< Smoothed RTT in ms, negative before the first sample. */
+    double timeoutMs;                       /**< Retransmission timeout in ms. */
+    double pacingRate;                      /**< Pacing rate in bytes per second, 0 if unknown. */
+    unsigned long long int packetsSent;     /**< Data packets sent so far, retransmissions included. */
+    unsigned long long int retransmissions; /**< Packets retransmitted so far. */
+    unsigned long long int goodputBytes;    /**< Payload bytes acknowledged so far. */
+} TracePoint;
+
+/**
+ * @struct TraceFileHeader
+ * @brief First record of a binary trace file.
+ */
+typedef struct {
+    char magic[4];            /**< TRACE_MAGIC. */
+    unsigned int version;     /**< TRACE_VERSION. */
+    unsigned int recordSize;  /**< Size of every TracePoint that follows. */
+    unsigned int records;     /**< Number of TracePoint records that follow. */
+} TraceFileHeader;
+
+/**
+ * @struct Telemetry
+ * @brief Counters, RTT histogram and trace of one stream, or of a whole transfer.
+ */
+typedef struct {
+    unsigned long long int packetsSent;          /**< Data packets sent, retransmissions included. */
+    unsigned long long int retransmissions;      /**< Data packets sent again. */
+    unsigned long long int timeoutRetransmissions; /**< Retransmissions of packets whose timer expired. */
+    unsigned long long int fastRetransmissions;  /**< Retransmissions of packets reported lost by later ACKs. */
+    unsigned long long int timeouts;             /**< Rounds in which at least one timer expired. */
+    unsigned long long int acks;                 /**< ACKs received. */
+    unsigned long long int duplicateAcks;        /**< ACKs that acknowledged no new packet. */
+    unsigned long long int corruptPackets;       /**< ACKs dropped because their checksum did not match. */
+    unsigned long long int goodputBytes;         /**< Payload bytes acknowledged for the first time. */
+    unsigned long long int wireBytes;            /**< Bytes handed to the kernel, headers and parity included. */
+    unsigned long long int rtoChanges;           /**< Times the retransmission timeout changed. */
+    double timeoutMs;                            /**< Latest retransmission timeout in ms, 0 before the first. */
+    double minTimeoutMs;                         /**< Smallest retransmission timeout in ms. */
+    double maxTimeoutMs;                         /**< Largest retransmission timeout in ms. */
+    unsigned long long int rttSamples;           /**< RTT samples taken. */
+    double rttSumMs;                             /**< Sum of the RTT samples in ms. */
+    double minRttMs;                             /**< Smallest RTT sample in ms. */
+    double maxRttMs;                             /**< Largest RTT sample in ms. */
+    unsigned long long int rttBuckets[TELEMETRY_BUCKETS]; /**< RTT histogram, see rttBucket. */
+    double traceIntervalMs;                      /**< Time between trace points in ms, 0 without a trace. */
+    double nextTraceMs;                          /**< Time of the next trace point in ms. */
+    TracePoint *trace;                           /**< Trace points, or NULL. */
+    int traceLength;                             /**< Number of trace points. */
+    int traceCapacity;                           /**< Number of trace points allocated. */
+} Telemetry;
+
+/**
+ * @brief Initializes the telemetry of a stream.
+ *
+ * @param telemetry The Telemetry to initialize.
+ * @param traceIntervalMs The time between trace points in ms, or 0 to record no trace.
+ * @return Void.
+ */
+void initTelemetry(Telemetry *telemetry, double traceIntervalMs) {
+    memset(telemetry, 0, sizeof(*telemetry));
+    telemetry->traceIntervalMs = traceIntervalMs > 0 ? traceIntervalMs : 0;
+}
+
+/**
+ * @brief Frees the trace of a Telemetry.
+ *
+ * @param telemetry The Telemetry to free.
+ * @return Void.
+ */
+void freeTelemetry(Telemetry *telemetry) {
+    free(telemetry->trace);
+    telemetry->trace = NULL;
+    telemetry->traceLength = 0;
+    telemetry->traceCapacity = 0;
+}
+
+/**
+ * @brief Returns the histogram bucket of an RTT.
+ *
+ * Values below 2^k microseconds, with 2^k = TELEMETRY_SUB_BUCKETS, have a bucket each;
+ * above that, every power of two is split into TELEMETRY_SUB_BUCKETS equal buckets.
+ *
+ * @param rttMs The RTT in ms.
+ * @return int The index of the bucket.
+ */
+int rttBucket(double rttMs) {
+    unsigned long long int micros = rttMs > 0 ? (unsigned long long int)(rttMs * 1000.0) : 0;
+    if (micros < TELEMETRY_SUB_BUCKETS) {
+        return (int)micros;
+    }
+
+    int exponent = 63 - __builtin_clzll(micros);
+    int shift = exponent - __builtin_ctz(TELEMETRY_SUB_BUCKETS);
+    int bucket = (shift + 1) * TELEMETRY_SUB_BUCKETS + (int)((micros >> shift) - TELEMETRY_SUB_BUCKETS);
+    return bucket < TELEMETRY_BUCKETS ? bucket : TELEMETRY_BUCKETS - 1;
+}
+
+/**
+ * @brief Returns the smallest RTT that falls in a histogram bucket.
+ *
+ * @param bucket The index of the bucket.
+ * @return double The lower bound of the bucket in ms.
+ */
+double rttBucketStartMs(int bucket) {
+    if (bucket < TELEMETRY_SUB_BUCKETS) {
+        return bucket / 1000.0;
+    }
+
+    int shift = bucket / TELEMETRY_SUB_BUCKETS - 1;
+    unsigned long long int micros = (unsigned long long int)(TELEMETRY_SUB_BUCKETS + bucket % TELEMETRY_SUB_BUCKETS) << shift;
+    return micros / 1000.0;
+}
+
+/**
+ * @brief Records an RTT sample.
+ *
+ * @param telemetry The Telemetry of the stream.
+ * @param rttMs The RTT sample in ms.
+ * @return Void.
+ */
+void recordRtt(Telemetry *telemetry, double rttMs) {
+    if (telemetry->rttSamples == 0 || rttMs < telemetry->minRttMs) {
+        telemetry->minRttMs = rttMs;
+    }
+    if (telemetry->rttSamples == 0 || rttMs > telemetry->maxRttMs) {
+        telemetry->maxRttMs = rttMs;
+    }
+    telemetry->rttSamples++;
+    telemetry->rttSumMs += rttMs;
+    telemetry->rttBuckets[rttBucket(rttMs)]++;
+}
+
+/**
+ * @brief Records the current retransmission timeout, counting it when it changed.
+ *
+ * @param telemetry The Telemetry of the stream.
+ * @param timeoutMs The retransmission timeout in ms.
+ * @return Void.
+ */
+void recordTimeout(Telemetry *telemetry, double timeoutMs) {
+    if (telemetry->timeoutMs == timeoutMs) {
+        return;
+    }
+    if (telemetry->timeoutMs > 0) {
+        telemetry->rtoChanges++;
+    }
+    if (telemetry->minTimeoutMs == 0 || timeoutMs < telemetry->minTimeoutMs) {
+        telemetry->minTimeoutMs = timeoutMs;
+    }
+    if (timeoutMs > telemetry->maxTimeoutMs) {
+        telemetry->maxTimeoutMs = timeoutMs;
+    }
+    telemetry->timeoutMs = timeoutMs;
+}
+
+/**
+ * @brief Adds a trace point when the trace interval has passed since the last one.
+ *
+ * The cumulative counters of the point are filled in from the Telemetry.
+ *
+ * @param telemetry The Telemetry of the stream.
+ * @param point The state of the stream, with its time set.
+ * @param force Non-zero to add the point even if the interval has not passed.
+ * @return int 0 on success, -1 if the trace could not grow.
+ */
+int traceTelemetry(Telemetry *telemetry, TracePoint *point, int force) {
+    if (telemetry->traceIntervalMs <= 0 || (!force && point->timeMs < telemetry->nextTraceMs)) {
+        return 0;
+    }
+
+    if (telemetry->traceLength == telemetry->traceCapacity) {
+        int capacity = telemetry->traceCapacity > 0 ? 2 * telemetry->traceCapacity : 256;
+        TracePoint *trace = realloc(telemetry->trace, capacity * sizeof(TracePoint));
+        if (trace == NULL) {
+            return -1;
+        }
+        telemetry->trace = trace;
+        telemetry->traceCapacity = capacity;
+    }
+
+    point->reserved = 0;
+    point->packetsSent = telemetry->packetsSent;
+    point->retransmissions = telemetry->retransmissions;
+    point->goodputBytes = telemetry->goodputBytes;
+    telemetry->trace[telemetry->traceLength++] = *point;
+    telemetry->nextTraceMs = point->timeMs + telemetry->traceIntervalMs;
+    return 0;
+}
+
+/**
+ * @brief Adds the counters and RTT histogram of a stream to those of the whole transfer.
+ *
+ * The trace is not merged; writeTelemetryTrace writes the traces of the streams.
+ *
+ * @param total The Telemetry of the transfer.
+ * @param stream The Telemetry of the stream.
+ * @return Void.
+ */
+void mergeTelemetry(Telemetry *total, Telemetry *stream) {
+    if (stream->rttSamples > 0) {
+        if (total->rttSamples == 0 || stream->minRttMs < total->minRttMs) {
+            total->minRttMs = stream->minRttMs;
+        }
+        if (total->rttSamples == 0 || stream->maxRttMs > total->maxRttMs) {
+            total->maxRttMs = stream->maxRttMs;
+        }
+    }
+    if (stream->minTimeoutMs > 0 && (total->minTimeoutMs == 0 || stream->minTimeoutMs < total->minTimeoutMs)) {
+        total->minTimeoutMs = stream->minTimeoutMs;
+    }
+    if (stream->maxTimeoutMs > total->maxTimeoutMs) {
+        total->maxTimeoutMs = stream->maxTimeoutMs;
+    }
+
+    total->packetsSent += stream->packetsSent;
+    total->retransmissions += stream->retransmissions;
+    total->timeoutRetransmissions += stream->timeoutRetransmissions;
+    total->fastRetransmissions += stream->fastRetransmissions;
+    total->timeouts += stream->timeouts;
+    total->acks += stream->acks;
+    total->duplicateAcks += stream->duplicateAcks;
+    total->corruptPackets += stream->corruptPackets;
+    total->goodputBytes += stream->goodputBytes;
+    total->wireBytes += stream->wireBytes;
+    total->rtoChanges += stream->rtoChanges;
+    total->timeoutMs = stream->timeoutMs;
+    total->rttSamples += stream->rttSamples;
+    total->rttSumMs += stream->rttSumMs;
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) {
+        total->rttBuckets[i] += stream->rttBuckets[i];
+    }
+}
+
+/**
+ * @brief Returns a percentile of the RTT samples from the histogram.
+ *
+ * The result is the middle of the bucket holding the sample of that rank, clamped to the
+ * smallest and largest samples.
+ *
+ * @param telemetry The Telemetry holding the samples.
+ * @param percentile The percentile, 0 to 100.
+ * @return double The RTT in ms, or 0 without samples.
+ */
+double rttPercentile(Telemetry *telemetry, double percentile) {
+    if (telemetry->rttSamples == 0) {
+        return 0;
+    }
+
+    unsigned long long int rank = (unsigned long long int)ceil(percentile / 100.0 * telemetry->rttSamples);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    unsigned long long int seen = 0;
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) {
+        seen += telemetry->rttBuckets[i];
+        if (seen >= rank) {
+            double end = i + 1 < TELEMETRY_BUCKETS ? rttBucketStartMs(i + 1) : telemetry->maxRttMs;
+            double value = (rttBucketStartMs(i) + end) / 2;
+            return value < telemetry->minRttMs ? telemetry->minRttMs
+                 : value > telemetry->maxRttMs ? telemetry->maxRttMs : value;
+        }
+    }
+    return telemetry->maxRttMs;
+}
+
+/**
+ * @brief Writes the counters of a Telemetry as the members of a JSON object.
+ *
+ * @param out The stream to write to.
+ * @param telemetry The Telemetry to write.
+ * @param indent The indentation of the members.
+ * @return Void.
+ */
+void writeTelemetryCounters(FILE *out, Telemetry *telemetry, const char *indent) {
+    fprintf(out, "%s\"packets_sent\": %llu,\n", indent, telemetry->packetsSent);
+    fprintf(out, "%s\"retransmissions\": %llu,\n", indent, telemetry->retransmissions);
+    fprintf(out, "%s\"timeout_retransmissions\": %llu,\n", indent, telemetry->timeoutRetransmissions);
+    fprintf(out, "%s\"fast_retransmissions\": %llu,\n", indent, telemetry->fastRetransmissions);
+    fprintf(out, "%s\"retransmission_ratio\": %.6f,\n", indent,
+            telemetry->packetsSent > 0 ? (double)telemetry->retransmissions / telemetry->packetsSent : 0.0);
+    fprintf(out, "%s\"timeouts\": %llu,\n", indent, telemetry->timeouts);
+    fprintf(out, "%s\"acks\": %llu,\n", indent, telemetry->acks);
+    fprintf(out, "%s\"duplicate_acks\": %llu,\n", indent, telemetry->duplicateAcks);
+    fprintf(out, "%s\"corrupt_packets\": %llu,\n", indent, telemetry->corruptPackets);
+    fprintf(out, "%s\"goodput_bytes\": %llu,\n", indent, telemetry->goodputBytes);
+    fprintf(out, "%s\"wire_bytes\": %llu,\n", indent, telemetry->wireBytes);
+    fprintf(out, "%s\"rto_changes\": %llu,\n", indent, telemetry->rtoChanges);
+    fprintf(out, "%s\"rto_ms\": {\"min\": %.3f, \"max\": %.3f, \"final\": %.3f},\n", indent,
+            telemetry->minTimeoutMs, telemetry->maxTimeoutMs, telemetry->timeoutMs);
+    fprintf(out, "%s\"rtt_ms\": {\"samples\": %llu, \"min\": %.3f, \"mean\": %.3f, \"max\": %.3f, "
+            "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f}", indent, telemetry->rttSamples,
+            telemetry->minRttMs, telemetry->rttSamples > 0 ? telemetry->rttSumMs / telemetry->rttSamples : 0.0,
+            telemetry->maxRttMs, rttPercentile(telemetry, 50), rttPercentile(telemetry, 90),
+            rttPercentile(telemetry, 99));
+}
+
+/**
+ * @brief Writes the JSON summary of a transfer.
+ *
+ * The summary holds the rates of the transfer, the merged counters and RTT histogram of
+ * its streams, and the counters of every stream.
+ *
+ * @param out The stream to write to.
+ * @param streams The Telemetry of every stream.
+ * @param streamCount The number of streams.
+ * @param fileBytes The size of the file transferred.
+ * @param duration The duration of the transfer in seconds.
+ * @param linkCapacity The capacity of the link in bits per second.
+ * @return Void.
+ */
+void writeTelemetryJson(FILE *out, Telemetry *streams, int streamCount, unsigned long long int fileBytes,
+                        double duration, double linkCapacity) {
+    Telemetry total;
+    initTelemetry(&total, 0);
+    for (int i = 0; i < streamCount; i++) {
+        mergeTelemetry(&total, &streams[i]);
+    }
+
+    double throughput = duration > 0 ? total.wireBytes * 8 / duration : 0;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"duration_s\": %.6f,\n", duration);
+    fprintf(out, "  \"streams\": %d,\n", streamCount);
+    fprintf(out, "  \"file_bytes\": %llu,\n", fileBytes);
+    fprintf(out, "  \"throughput_mbps\": %.3f,\n", throughput / 1000000.0);
+    fprintf(out, "  \"goodput_mbps\": %.3f,\n", duration > 0 ? fileBytes * 8 / duration / 1000000.0 : 0.0);
+    fprintf(out, "  \"link_capacity_mbps\": %.3f,\n", linkCapacity / 1000000.0);
+    fprintf(out, "  \"bandwidth_utilization\": %.4f,\n", linkCapacity > 0 ? throughput / linkCapacity : 0.0);
+    writeTelemetryCounters(out, &total, "  ");
+    fprintf(out, ",\n  \"rtt_histogram\": [");
+
+    int first = 1;
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) {
+        if (total.rttBuckets[i] == 0) {
+            continue;
+        }
+        fprintf(out, "%s\n    {\"from_ms\": %.3f, \"to_ms\": %.3f, \"count\": %llu}", first ? "" : ",",
+                rttBucketStartMs(i), rttBucketStartMs(i + 1), total.rttBuckets[i]);
+        first = 0;
+    }
+
+    fprintf(out, "\n  ],\n  \"per_stream\": [");
+    for (int i = 0; i < streamCount; i++) {
+        fprintf(out, "%s\n    {\n      \"stream\": %d,\n", i > 0 ? "," : "", i);
+        writeTelemetryCounters(out, &streams[i], "      ");
+        fprintf(out, "\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+/**
+ * @brief Writes the trace points of every stream, stream after stream.
+ *
+ * @param out The stream to write to, opened in binary mode for TRACE_BINARY.
+ * @param streams The Telemetry of every stream.
+ * @param streamCount The number of streams.
+ * @param format TRACE_CSV or TRACE_BINARY.
+ * @return int 0 on success, -1 if writing failed.
+ */
+int writeTelemetryTrace(FILE *out, Telemetry *streams, int streamCount, int format) {
+    if (format == TRACE_BINARY) {
+        TraceFileHeader header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.recordSize = sizeof(TracePoint);
+        header.records = 0;
+        for (int i = 0; i < streamCount; i++) {
+            header.records += streams[i].traceLength;
+        }
+        if (fwrite(&header, sizeof(header), 1, out) != 1) {
+            return -1;
+        }
+        for (int i = 0; i < streamCount; i++) {
+            if ((int)fwrite(streams[i].trace, sizeof(TracePoint), streams[i].traceLength, out) != streams[i].traceLength) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    fprintf(out, "time_ms,stream,cwnd_packets,in_flight_packets,srtt_ms,rto_ms,pacing_rate_bps,"
+            "packets_sent,retransmissions,goodput_bytes\n");
+    for (int i = 0; i < streamCount; i++) {
+        for (int j = 0; j < streams[i].traceLength; j++) {
+            TracePoint *point = &streams[i].trace[j];
+            fprintf(out, "%.3f,%d,%d,%d,%.3f,%.3f,%.0f,%llu,%llu,%llu\n", point->timeMs, point->stream,
+                    point->congestionWindow, point->packetsInFlight, point->smoothedRttMs, point->timeoutMs,
+                    point->pacingRate * 8, point->packetsSent, point->retransmissions, point->goodputBytes);
+        }
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+#endif
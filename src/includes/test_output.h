@@ -6,13 +6,16 @@
 *   @author Leo Kamino (LeonardoKamino)
 */
 
+#ifndef TEST_OUTPUT_H
+#define TEST_OUTPUT_H
+
 #include <stdio.h>
 #include <sys/time.h>
 
 /**
  * @def LINK_CAPACITY
- * Definition that represents the network link capacity that the sender will assume
- * for calculating bandwidth utilization
+ * Definition that represents the network link capacity, in bits per second, that the
+ * sender assumes for calculating bandwidth utilization unless it is given one.
  * 
  */
 #define LINK_CAPACITY 20971520
@@ -20,20 +23,29 @@
 /**
 * @brief Display performance test results
 * 
-* This function displays the performance test results including throughput, bandwidth utilization,
-* and transfer duration.
+* This function displays the performance test results including throughput, goodput,
+* bandwidth utilization and transfer duration. Throughput counts every byte handed to
+* the network, headers, retransmissions and parity included, and is what the bandwidth
+* utilization compares with the link capacity; goodput only counts the bytes of the file.
 * @param start The start time of the transfer
 * @param end The end time of the transfer
+* @param fileBytes The number of bytes of the file transferred
 * @param totalBytesSent The total number of bytes sent
+* @param linkCapacity The capacity of the link in bits per second
 * @return Void.
 */
-void displayPerformance(struct timeval *start, struct timeval *end, unsigned long long int totalBytesSent){
+void displayPerformance(struct timeval *start, struct timeval *end, unsigned long long int fileBytes,
+                        unsigned long long int totalBytesSent, double linkCapacity){
     double duration = (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec) / 1000000.0;
     double throughput = (totalBytesSent * 8) / duration;
-    double bandwidthUtilization =  (throughput / LINK_CAPACITY) * 100;
+    double goodput = (fileBytes * 8) / duration;
+    double bandwidthUtilization =  (throughput / linkCapacity) * 100;
     
     printf("Throughput: %.2f Mb/s\n", throughput/1000000.0);
-    printf("Bandwidth Utilization: %.2f%%\n", bandwidthUtilization);
+    printf("Goodput: %.2f Mb/s\n", goodput/1000000.0);
+    printf("Bandwidth Utilization: %.2f%% of %.2f Mb/s\n", bandwidthUtilization, linkCapacity/1000000.0);
     printf("Transfer duration:  %.2f s\n", duration);
     printf("Total Bytes Sent: %llu\n", totalBytesSent);
 }
+
+#endif
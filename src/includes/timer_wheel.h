@@ -0,0 +1,416 @@
+/**
+*   @file timer_wheel.h
+*   @brief A hierarchical timer wheel, and the timerfd that wakes its owner for it.
+*
+*   A sender keeps a retransmission timer for every packet in flight, and a few more
+*   for pacing and delayed work. Scanning every packet for the earliest deadline costs
+*   a pass over the window each time the sender waits, and a socket receive timeout
+*   holds only one deadline and costs a system call to change. A timer wheel starts,
+*   stops and expires a timer in constant time instead.
+*
+*   Time is cut into ticks of WHEEL_TICK_USEC. Each of the WHEEL_LEVELS levels is a
+*   ring of WHEEL_SLOTS lists, and a slot of level l spans WHEEL_SLOTS^l ticks, so the
+*   first level holds the timers of the next WHEEL_SLOTS ticks one tick per slot, the
+*   next level the timers up to WHEEL_SLOTS^2 ticks away, and so on. Timers further
+*   away than the last level wait in its furthest slot. Whenever the first level wraps,
+*   the next slot of the level above is cascaded: its timers move to the lower levels,
+*   now that they are closer. Every level has a bitmap of its slots holding timers, so
+*   the wheel skips empty slots instead of visiting every tick, and finds its next
+*   deadline with a few bit operations.
+*
+*   The wheel arms a timerfd for its next deadline, which its owner waits on with
+*   epoll next to its sockets. The timerfd is only armed again when a timer falls due
+*   before the deadline it is armed for, or once it went off: stopping the earliest
+*   timer, which an ACK does all the time, costs no system call, and at worst wakes the
+*   owner once for nothing.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+/**
+ * @def WHEEL_TICK_USEC
+ * Definition specifying the length of a tick, the precision of the timers, in microseconds.
+ */
+#define WHEEL_TICK_USEC 64
+
+/**
+ * @def WHEEL_SLOT_BITS
+ * Definition specifying the bits of a tick number that index one level.
+ */
+#define WHEEL_SLOT_BITS 6
+
+/**
+ * @def WHEEL_SLOTS
+ * Definition specifying the number of slots of each level.
+ */
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+
+/**
+ * @def WHEEL_LEVELS
+ * Definition specifying the number of levels, which with 64 us ticks reach 17 minutes.
+ */
+#define WHEEL_LEVELS 4
+
+/**
+ * @struct WheelTimer
+ * @brief A timer, kept in the list of its slot; its owner embeds it in its own state.
+ */
+typedef struct WheelTimer {
+    struct WheelTimer *next;        /**< Next timer of the list, NULL if the timer is stopped. */
+    struct WheelTimer *prev;        /**< Previous timer of the list. */
+    unsigned long long deadline;    /**< Tick at which the timer expires. */
+} WheelTimer;
+
+/**
+ * @struct TimerWheel
+ * @brief The timers of one thread and the timerfd that wakes it for them.
+ */
+typedef struct {
+    WheelTimer slots[WHEEL_LEVELS][WHEEL_SLOTS]; /**< Heads of the circular lists of the slots. */
+    unsigned long long occupied[WHEEL_LEVELS];   /**< Bit s is set while slot s of the level holds timers. */
+    WheelTimer expired;             /**< Head of the list of timers expired, until they are taken. */
+    unsigned long long now;         /**< Next tick to expire; every earlier tick has been. */
+    unsigned long long startNs;     /**< Time of tick 0 on CLOCK_MONOTONIC, in ns. */
+    unsigned long long armedTick;   /**< Tick the timerfd is armed for, or 0 if it is not. */
+    int timerDescriptor;            /**< The timerfd, readable once the armed tick has passed. */
+} TimerWheel;
+
+/**
+ * @brief Empties a list.
+ *
+ * @param head The head of the list.
+ * @return Void.
+ */
+void initTimerList(WheelTimer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+/**
+ * @brief Returns the current time of CLOCK_MONOTONIC.
+ *
+ * @return unsigned long long The time in ns.
+ */
+unsigned long long wheelClockNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Starts an empty wheel at the current time, with its timerfd.
+ *
+ * @param wheel The wheel to initialize.
+ * @return int 0 on success, -1 if the timerfd could not be created.
+ */
+int initTimerWheel(TimerWheel *wheel) {
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            initTimerList(&wheel->slots[level][slot]);
+        }
+        wheel->occupied[level] = 0;
+    }
+    initTimerList(&wheel->expired);
+    wheel->now = 1;
+    wheel->startNs = wheelClockNs() - WHEEL_TICK_USEC * 1000ULL;
+    wheel->armedTick = 0;
+    wheel->timerDescriptor = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return wheel->timerDescriptor < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Closes the timerfd of a wheel; its timers are simply forgotten.
+ *
+ * @param wheel The wheel.
+ * @return Void.
+ */
+void freeTimerWheel(TimerWheel *wheel) {
+    if (wheel->timerDescriptor >= 0) {
+        close(wheel->timerDescriptor);
+        wheel->timerDescriptor = -1;
+    }
+}
+
+/**
+ * @brief Converts a time in ms from now to the first tick not before it.
+ *
+ * @param wheel The wheel.
+ * @param delayMs The delay.
+ * @return unsigned long long The tick.
+ */
+unsigned long long wheelTickAfter(TimerWheel *wheel, double delayMs) {
+    unsigned long long tickNs = WHEEL_TICK_USEC * 1000ULL;
+    unsigned long long delayNs = delayMs > 0 ? (unsigned long long)(delayMs * 1e6) : 0;
+    unsigned long long tick = (wheelClockNs() + delayNs - wheel->startNs + tickNs - 1) / tickNs;
+    return tick < wheel->now ? wheel->now : tick;
+}
+
+/**
+ * @brief Checks whether a timer is running.
+ *
+ * @param timer The timer.
+ * @return int Non-zero if the timer is in a slot or expired and not taken yet.
+ */
+int isTimerRunning(const WheelTimer *timer) {
+    return timer->next != NULL;
+}
+
+/**
+ * @brief Puts a timer in the slot of its deadline.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer, in no list.
+ * @return Void.
+ */
+void placeTimer(TimerWheel *wheel, WheelTimer *timer) {
+    unsigned long long deadline = timer->deadline < wheel->now ? wheel->now : timer->deadline;
+    unsigned long long delta = deadline - wheel->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >> ((level + 1) * WHEEL_SLOT_BITS) != 0) {
+        level++;
+    }
+
+    /*
+     * A deadline past the last level waits in its furthest slot and is placed again
+     * when that slot is cascaded.
+     */
+    unsigned long long reach = 1ULL << (WHEEL_LEVELS * WHEEL_SLOT_BITS);
+    if (delta >= reach) {
+        deadline = wheel->now + reach - 1;
+    }
+    int slot = (deadline >> (level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+
+    WheelTimer *head = &wheel->slots[level][slot];
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+/**
+ * @brief Stops a timer, wherever it is; a stopped timer is left alone.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer.
+ * @return Void.
+ */
+void stopTimer(TimerWheel *wheel, WheelTimer *timer) {
+    if (!isTimerRunning(timer)) {
+        return;
+    }
+    WheelTimer *prev = timer->prev;
+    WheelTimer *next = timer->next;
+    prev->next = next;
+    next->prev = prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+
+    /*
+     * A list left with its head alone is empty; the head tells which slot it is.
+     */
+    if (prev == next && prev != &wheel->expired) {
+        ptrdiff_t index = prev - &wheel->slots[0][0];
+        wheel->occupied[index / WHEEL_SLOTS] &= ~(1ULL << (index % WHEEL_SLOTS));
+    }
+}
+
+/**
+ * @brief Starts a timer, or moves it if it is running.
+ *
+ * @param wheel The wheel.
+ * @param timer The timer, zeroed or stopped before its first start.
+ * @param delayMs The time from now after which it expires, in ms.
+ * @return Void.
+ */
+void startTimer(TimerWheel *wheel, WheelTimer *timer, double delayMs) {
+    stopTimer(wheel, timer);
+    timer->deadline = wheelTickAfter(wheel, delayMs);
+    placeTimer(wheel, timer);
+}
+
+/**
+ * @brief Moves every timer of a list to the end of another.
+ *
+ * @param from The head of the list emptied.
+ * @param to The head of the list extended.
+ * @return Void.
+ */
+void moveTimerList(WheelTimer *from, WheelTimer *to) {
+    if (from->next == from) {
+        return;
+    }
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    initTimerList(from);
+}
+
+/**
+ * @brief Moves the timers of the current slot of a level to the levels below.
+ *
+ * @param wheel The wheel.
+ * @param level The level, from 1.
+ * @return Void.
+ */
+void cascadeTimers(TimerWheel *wheel, int level) {
+    int slot = (wheel->now >> (level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1);
+    WheelTimer list;
+    initTimerList(&list);
+    moveTimerList(&wheel->slots[level][slot], &list);
+    wheel->occupied[level] &= ~(1ULL << slot);
+
+    while (list.next != &list) {
+        WheelTimer *timer = list.next;
+        list.next = timer->next;
+        timer->next->prev = &list;
+        placeTimer(wheel, timer);
+    }
+}
+
+/**
+ * @brief Expires every timer due at the current time; they wait to be taken with
+ * takeExpiredTimer().
+ *
+ * Empty slots of the first level are skipped up to the next slot holding timers or
+ * the next cascade, so a long wait costs no more than a short one.
+ *
+ * @param wheel The wheel.
+ * @return Void.
+ */
+void advanceTimerWheel(TimerWheel *wheel) {
+    unsigned long long tickNs = WHEEL_TICK_USEC * 1000ULL;
+    unsigned long long target = (wheelClockNs() - wheel->startNs) / tickNs;
+
+    while (wheel->now <= target) {
+        int slot = wheel->now & (WHEEL_SLOTS - 1);
+        if (slot == 0) {
+            for (int level = 1; level < WHEEL_LEVELS; level++) {
+                cascadeTimers(wheel, level);
+                if (((wheel->now >> (level * WHEEL_SLOT_BITS)) & (WHEEL_SLOTS - 1)) != 0) {
+                    break;
+                }
+            }
+        }
+
+        if (wheel->occupied[0] & (1ULL << slot)) {
+            moveTimerList(&wheel->slots[0][slot], &wheel->expired);
+            wheel->occupied[0] &= ~(1ULL << slot);
+        }
+
+        /*
+         * Jump to the next slot holding timers, or to the next cascade.
+         */
+        unsigned long long later = slot == WHEEL_SLOTS - 1 ? 0 : wheel->occupied[0] >> (slot + 1);
+        unsigned long long skip = later != 0 ? (unsigned long long)__builtin_ctzll(later) + 1
+                                             : (unsigned long long)(WHEEL_SLOTS - slot);
+        wheel->now = wheel->now + skip <= target + 1 ? wheel->now + skip : target + 1;
+    }
+}
+
+/**
+ * @brief Takes the next expired timer, which is stopped.
+ *
+ * @param wheel The wheel.
+ * @return WheelTimer* The timer, or NULL once every expired timer was taken.
+ */
+WheelTimer *takeExpiredTimer(TimerWheel *wheel) {
+    WheelTimer *timer = wheel->expired.next;
+    if (timer == &wheel->expired) {
+        return NULL;
+    }
+    stopTimer(wheel, timer);
+    return timer;
+}
+
+/**
+ * @brief Returns the first tick at which the wheel has work: a timer expires, or a
+ * slot of a higher level must be cascaded.
+ *
+ * @param wheel The wheel.
+ * @return unsigned long long The tick, or 0 if the wheel holds no timer.
+ */
+unsigned long long nextWheelTick(TimerWheel *wheel) {
+    unsigned long long next = 0;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        unsigned long long bits = wheel->occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+        int shift = level * WHEEL_SLOT_BITS;
+        int current = (wheel->now >> shift) & (WHEEL_SLOTS - 1);
+        unsigned long long rotated = current == 0 ? bits : (bits >> current) | (bits << (WHEEL_SLOTS - current));
+
+        /*
+         * The current slot of a level is due now if the wheel has not reached it yet,
+         * which it has for a higher level past the first tick of the slot: its timers
+         * are then a whole turn away.
+         */
+        unsigned long long turns;
+        if ((wheel->now & ((1ULL << shift) - 1)) == 0) {
+            turns = __builtin_ctzll(rotated);
+        } else {
+            turns = (rotated >> 1) != 0 ? (unsigned long long)__builtin_ctzll(rotated >> 1) + 1 : WHEEL_SLOTS;
+        }
+        unsigned long long tick = ((wheel->now >> shift) + turns) << shift;
+        if (level == 0) {
+            tick = wheel->now + turns;
+        }
+        if (next == 0 || tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Arms the timerfd of the wheel for its next tick with work, unless it is already
+ * armed for that tick or an earlier one.
+ *
+ * @param wheel The wheel.
+ * @return int 0 on success, -1 if the timerfd could not be armed.
+ */
+int armTimerWheel(TimerWheel *wheel) {
+    unsigned long long tick = nextWheelTick(wheel);
+    if (tick == 0 || (wheel->armedTick != 0 && wheel->armedTick <= tick)) {
+        return 0;
+    }
+
+    struct itimerspec spec;
+    unsigned long long deadlineNs = wheel->startNs + tick * (WHEEL_TICK_USEC * 1000ULL);
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadlineNs / 1000000000ULL;
+    spec.it_value.tv_nsec = deadlineNs % 1000000000ULL;
+    if (timerfd_settime(wheel->timerDescriptor, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        return -1;
+    }
+    wheel->armedTick = tick;
+    return 0;
+}
+
+/**
+ * @brief Acknowledges the timerfd once epoll reported it readable, so it is armed again.
+ *
+ * @param wheel The wheel.
+ * @return Void.
+ */
+void clearTimerWheelAlarm(TimerWheel *wheel) {
+    unsigned long long expirations;
+    if (read(wheel->timerDescriptor, &expirations, sizeof(expirations)) < 0) {
+        return;
+    }
+    wheel->armedTick = 0;
+}
+
+#endif
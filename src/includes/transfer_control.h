@@ -0,0 +1,242 @@
+/**
+*   @file transfer_control.h
+*   @brief Completion, errors and cancellation shared by the threads of one transfer.
+*
+*   A transfer runs on several threads: the stream threads of the sender, or the
+*   receiving threads of the receiver. Their TransferControl counts the threads still
+*   running, keeps the first error any of them met, and lets any thread, or the code
+*   that started them, cancel the transfer. The threads check isTransferCancelled in
+*   their loops, and a thread that fails cancels the others, since the transfer cannot
+*   complete anymore. waitTransfer sleeps until every thread finished or a timeout.
+*   Warnings that do not stop the transfer are only printed when the transfer is verbose,
+*   so a program linking librudp decides what reaches its stderr.
+*
+*   @bug No known bugs.
+*   @author Leo Kamino (LeonardoKamino)
+*/
+
+#ifndef TRANSFER_CONTROL_H
+#define TRANSFER_CONTROL_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "rudp.h"
+
+/**
+ * @struct TransferControl
+ * @brief Running threads, status and cancellation of a transfer.
+ */
+typedef struct {
+    pthread_mutex_t lock;       /**< Guards running, status and systemError. */
+    pthread_cond_t changed;     /**< Signalled whenever a thread finishes. */
+    int running;                /**< Threads of the transfer still running. */
+    int status;                 /**< RUDP_OK, or the first error of the transfer. */
+    int systemError;            /**< errno of the first error, if it is RUDP_ERROR_SYSTEM. */
+    atomic_int isCancelled;     /**< Set when the threads must stop. */
+    int isVerbose;              /**< Non-zero to print warnings. */
+} TransferControl;
+
+/**
+ * @brief Initializes the control of a transfer with no thread running.
+ *
+ * @param control The control to initialize.
+ * @param isVerbose Non-zero to print warnings to stderr.
+ * @return Void.
+ */
+void initTransferControl(TransferControl *control, int isVerbose) {
+    pthread_mutex_init(&control->lock, NULL);
+    pthread_cond_init(&control->changed, NULL);
+    control->running = 0;
+    control->status = RUDP_OK;
+    control->systemError = 0;
+    atomic_init(&control->isCancelled, 0);
+    control->isVerbose = isVerbose;
+}
+
+/**
+ * @brief Releases the lock and condition of a control.
+ *
+ * @param control The control.
+ * @return Void.
+ */
+void destroyTransferControl(TransferControl *control) {
+    pthread_cond_destroy(&control->changed);
+    pthread_mutex_destroy(&control->lock);
+}
+
+/**
+ * @brief Fails a transfer: records the error unless one was recorded first, and cancels it.
+ *
+ * With RUDP_ERROR_SYSTEM, the current errno is kept with the error.
+ *
+ * @param control The control.
+ * @param status The error, RUDP_ERROR_CANCELLED to cancel the transfer.
+ * @return Void.
+ */
+void failTransfer(TransferControl *control, int status) {
+    int error = errno;
+    pthread_mutex_lock(&control->lock);
+    if (control->status == RUDP_OK) {
+        control->status = status;
+        control->systemError = error;
+    }
+    atomic_store(&control->isCancelled, 1);
+    pthread_mutex_unlock(&control->lock);
+}
+
+/**
+ * @brief Cancels a transfer. Only a transfer that still has threads running fails with
+ * RUDP_ERROR_CANCELLED; one that already completed keeps its status.
+ *
+ * @param control The control.
+ * @return Void.
+ */
+void cancelTransfer(TransferControl *control) {
+    pthread_mutex_lock(&control->lock);
+    if (control->status == RUDP_OK && control->running > 0) {
+        control->status = RUDP_ERROR_CANCELLED;
+    }
+    atomic_store(&control->isCancelled, 1);
+    pthread_mutex_unlock(&control->lock);
+}
+
+/**
+ * @brief Checks whether the threads of a transfer must stop.
+ *
+ * @param control The control.
+ * @return int Non-zero once the transfer was cancelled or failed.
+ */
+int isTransferCancelled(TransferControl *control) {
+    return atomic_load(&control->isCancelled);
+}
+
+/**
+ * @brief Records that a thread of the transfer started.
+ *
+ * @param control The control.
+ * @return Void.
+ */
+void startTransferThread(TransferControl *control) {
+    pthread_mutex_lock(&control->lock);
+    control->running++;
+    pthread_mutex_unlock(&control->lock);
+}
+
+/**
+ * @brief Records that a thread of the transfer finished, failing the transfer with its error.
+ *
+ * @param control The control.
+ * @param status RUDP_OK, or the error the thread stopped on.
+ * @return Void.
+ */
+void finishTransferThread(TransferControl *control, int status) {
+    if (status != RUDP_OK) {
+        failTransfer(control, status);
+    }
+    pthread_mutex_lock(&control->lock);
+    control->running--;
+    pthread_cond_broadcast(&control->changed);
+    pthread_mutex_unlock(&control->lock);
+}
+
+/**
+ * @brief Waits until every thread of the transfer finished.
+ *
+ * @param control The control.
+ * @param timeoutMs The longest wait in ms, 0 not to wait or negative to wait without limit.
+ * @return int Non-zero if no thread is running anymore.
+ */
+int waitTransfer(TransferControl *control, int timeoutMs) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&control->lock);
+    while (control->running > 0 && timeoutMs != 0) {
+        if (timeoutMs < 0) {
+            pthread_cond_wait(&control->changed, &control->lock);
+        } else if (pthread_cond_timedwait(&control->changed, &control->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int isFinished = control->running == 0;
+    pthread_mutex_unlock(&control->lock);
+    return isFinished;
+}
+
+/**
+ * @brief Returns the status of a transfer, restoring errno for RUDP_ERROR_SYSTEM.
+ *
+ * @param control The control.
+ * @return int RUDP_OK, or the first error of the transfer.
+ */
+int getTransferStatus(TransferControl *control) {
+    pthread_mutex_lock(&control->lock);
+    int status = control->status;
+    if (status == RUDP_ERROR_SYSTEM) {
+        errno = control->systemError;
+    }
+    pthread_mutex_unlock(&control->lock);
+    return status;
+}
+
+/**
+ * @brief Describes the status of a transfer.
+ *
+ * @param status The status.
+ * @return const char* A static description.
+ */
+const char *describeTransferStatus(int status) {
+    switch (status) {
+        case RUDP_OK:
+            return "Success";
+        case RUDP_IN_PROGRESS:
+            return "Transfer in progress";
+        case RUDP_ERROR_ARGUMENT:
+            return "Invalid argument";
+        case RUDP_ERROR_ADDRESS:
+            return "Address translation failed";
+        case RUDP_ERROR_SYSTEM:
+            return "System call failed";
+        case RUDP_ERROR_SOURCE:
+            return "Reading the source failed";
+        case RUDP_ERROR_SINK:
+            return "Writing to the sink failed";
+        case RUDP_ERROR_TIMEOUT:
+            return "The receiver stopped responding";
+        case RUDP_ERROR_CANCELLED:
+            return "Transfer cancelled";
+        case RUDP_ERROR_STATE:
+            return "Not allowed in the state of the session";
+        case RUDP_ERROR_CORRUPT:
+            return "The data received does not match the checksum of the sender";
+        case RUDP_ERROR_REFUSED:
+            return "The receiver refused the transfer";
+        default:
+            return "Unknown error";
+    }
+}
+
+/**
+ * @brief Prints a warning with the description of errno, if the transfer is verbose.
+ *
+ * @param control The control.
+ * @param message The warning.
+ * @return Void.
+ */
+void warnTransfer(TransferControl *control, const char *message) {
+    if (control->isVerbose) {
+        perror(message);
+    }
+}
+
+#endif
@@ -0,0 +1,342 @@
+/**
+ * @file librudp.c
+ * @brief The enhanced UDP protocol as a library, implementing rudp.h.
+ *
+ * A RudpSession wraps the SenderTransfer of sender_engine.h or the ReceiverTransfer of
+ * receiver_engine.h, the same engines the sender and receiver programs run, and keeps
+ * track of where the session is in its life: open, running, or finished and joined.
+ * Nothing here prints unless the options ask for it, and nothing exits the process.
+ *
+ * @author Leo Kamino (LeonardoKamino)
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "includes/rudp.h"
+#include "includes/sender_engine.h"
+#include "includes/receiver_engine.h"
+
+/**
+ * @def SESSION_OPEN
+ * State of a session whose transfer has not started.
+ */
+#define SESSION_OPEN 0
+
+/**
+ * @def SESSION_RUNNING
+ * State of a session whose transfer threads may still run.
+ */
+#define SESSION_RUNNING 1
+
+/**
+ * @def SESSION_JOINED
+ * State of a session whose transfer threads were joined.
+ */
+#define SESSION_JOINED 2
+
+/**
+ * @struct RudpSession
+ * @brief A sender or receiver session and the state of its transfer.
+ */
+struct RudpSession {
+    int isSender;                   /**< Non-zero for a sender session. */
+    int state;                      /**< SESSION_OPEN, SESSION_RUNNING or SESSION_JOINED. */
+    int status;                     /**< Final status of the transfer, once joined. */
+    SenderTransfer *sender;         /**< The transfer of a sender session. */
+    ReceiverTransfer *receiver;     /**< The receiver of a receiver session. */
+};
+
+void rudpDefaultOptions(RudpOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->windowSize = DEFAULT_WINDOW_SIZE;
+    options->congestionControl = DEFAULT_CONGESTION_CONTROL;
+    options->pacing = "bucket";
+    options->packetSize = 0;
+    options->streams = 1;
+    options->batchSize = DEFAULT_BATCH_SIZE;
+    options->ackFrequency = DEFAULT_ACK_FREQUENCY;
+    options->ackDelayMs = DEFAULT_ACK_DELAY_MS;
+}
+
+RudpSource rudpMemorySource(const void *data, unsigned long long int length) {
+    RudpSource source;
+    initMemorySource(&source, data, length);
+    return source;
+}
+
+RudpSource rudpFileSource(int fileDescriptor, unsigned long long int offset, unsigned long long int length) {
+    RudpSource source;
+    initFileSource(&source, fileDescriptor, offset, length);
+    return source;
+}
+
+RudpSource rudpCallbackSource(RudpReadCallback read, void *context, unsigned long long int length) {
+    RudpSource source;
+    memset(&source, 0, sizeof(source));
+    source.type = RUDP_SOURCE_CALLBACK;
+    source.fileDescriptor = -1;
+    source.read = read;
+    source.context = context;
+    source.length = length;
+    return source;
+}
+
+RudpSource rudpStreamSource(int fileDescriptor, unsigned long long int length) {
+    RudpSource source;
+    initStreamSource(&source, fileDescriptor, length);
+    return source;
+}
+
+RudpSink rudpMemorySink(void *buffer, unsigned long long int capacity) {
+    RudpSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.type = RUDP_SINK_MEMORY;
+    sink.memory = buffer;
+    sink.capacity = capacity;
+    sink.fileDescriptor = -1;
+    return sink;
+}
+
+RudpSink rudpFileSink(int fileDescriptor) {
+    RudpSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.type = RUDP_SINK_FILE;
+    sink.fileDescriptor = fileDescriptor;
+    return sink;
+}
+
+RudpSink rudpCallbackSink(RudpWriteCallback write, void *context) {
+    RudpSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.type = RUDP_SINK_CALLBACK;
+    sink.fileDescriptor = -1;
+    sink.write = write;
+    sink.context = context;
+    return sink;
+}
+
+/**
+ * @brief Reports an error of an open function and returns NULL.
+ *
+ * @param error Where the error goes, or NULL.
+ * @param status The error.
+ * @return RudpSession* Always NULL.
+ */
+static RudpSession *failOpen(int *error, int status) {
+    if (error != NULL) {
+        *error = status;
+    }
+    return NULL;
+}
+
+RudpSession *rudpOpenSender(const char *hostname, unsigned short int port, const RudpOptions *options, int *error) {
+    RudpOptions defaults;
+    struct sockaddr_in destAddr;
+    RudpSession *session;
+
+    if (options == NULL) {
+        rudpDefaultOptions(&defaults);
+        options = &defaults;
+    }
+    if (hostname == NULL || checkSenderOptions(options) != RUDP_OK) {
+        return failOpen(error, RUDP_ERROR_ARGUMENT);
+    }
+    if (resolveReceiver(hostname, port, &destAddr) != RUDP_OK) {
+        return failOpen(error, RUDP_ERROR_ADDRESS);
+    }
+
+    if ((session = calloc(1, sizeof(RudpSession))) == NULL
+        || (session->sender = malloc(sizeof(SenderTransfer))) == NULL) {
+        free(session);
+        return failOpen(error, RUDP_ERROR_SYSTEM);
+    }
+    session->isSender = 1;
+    initSenderTransfer(session->sender, &destAddr, options, options->verbose);
+    return session;
+}
+
+RudpSession *rudpOpenReceiver(unsigned short int port, const RudpOptions *options, int *error) {
+    RudpOptions defaults;
+    RudpSession *session;
+
+    if (options == NULL) {
+        rudpDefaultOptions(&defaults);
+        options = &defaults;
+    }
+    if (checkReceiverOptions(options) != RUDP_OK) {
+        return failOpen(error, RUDP_ERROR_ARGUMENT);
+    }
+
+    if ((session = calloc(1, sizeof(RudpSession))) == NULL
+        || (session->receiver = malloc(sizeof(ReceiverTransfer))) == NULL) {
+        free(session);
+        return failOpen(error, RUDP_ERROR_SYSTEM);
+    }
+
+    int status = openReceiverTransfer(session->receiver, port, options, options->verbose);
+    if (status != RUDP_OK) {
+        int systemError = errno;
+        closeReceiverTransfer(session->receiver);
+        free(session->receiver);
+        free(session);
+        errno = systemError;
+        return failOpen(error, status);
+    }
+    return session;
+}
+
+/**
+ * @brief Returns the control of the transfer of a session.
+ *
+ * @param session The session.
+ * @return TransferControl* The control.
+ */
+static TransferControl *getSessionControl(RudpSession *session) {
+    return session->isSender ? &session->sender->control : &session->receiver->control;
+}
+
+/**
+ * @brief Waits for the threads of a running session and records the final status of its transfer.
+ *
+ * @param session The running session.
+ * @return int The final status.
+ */
+static int joinSession(RudpSession *session) {
+    session->status = session->isSender ? joinSenderTransfer(session->sender) : joinReceiverTransfer(session->receiver);
+    session->state = SESSION_JOINED;
+    return session->status;
+}
+
+/**
+ * @brief Marks a session as running after it tried to start, joining it at once if starting failed.
+ *
+ * @param session The session.
+ * @param status The result of starting the transfer.
+ * @return int RUDP_OK, or the error that stopped the transfer.
+ */
+static int startSession(RudpSession *session, int status) {
+    session->state = SESSION_RUNNING;
+    if (status != RUDP_OK) {
+        int systemError = errno;
+        joinSession(session);
+        session->status = status;
+        errno = systemError;
+    }
+    return status;
+}
+
+int rudpSend(RudpSession *session, const RudpSource *source) {
+    if (session == NULL || source == NULL) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+    if (!session->isSender || session->state != SESSION_OPEN) {
+        return RUDP_ERROR_STATE;
+    }
+    if ((source->type == RUDP_SOURCE_MEMORY && source->memory == NULL && source->length > 0)
+        || ((source->type == RUDP_SOURCE_FILE || source->type == RUDP_SOURCE_STREAM) && source->fileDescriptor < 0)
+        || (source->type == RUDP_SOURCE_CALLBACK && source->read == NULL)
+        || source->type < RUDP_SOURCE_MEMORY || source->type > RUDP_SOURCE_STREAM) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+
+    return startSession(session, startSenderTransfer(session->sender, source, 0));
+}
+
+int rudpReceive(RudpSession *session, const RudpSink *sink) {
+    WriteTarget target;
+
+    if (session == NULL || sink == NULL) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+    if (session->isSender || session->state != SESSION_OPEN) {
+        return RUDP_ERROR_STATE;
+    }
+    if ((sink->type == RUDP_SINK_MEMORY && sink->memory == NULL && sink->capacity > 0)
+        || ((sink->type == RUDP_SINK_FILE || sink->type == RUDP_SINK_STREAM) && sink->fileDescriptor < 0)
+        || (sink->type == RUDP_SINK_CALLBACK && sink->write == NULL)
+        || sink->type < RUDP_SINK_MEMORY || sink->type > RUDP_SINK_STREAM) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+
+    /*
+     * Every receiving thread writes through its own target sharing this one.
+     */
+    initWriteTarget(&target, sink->type == RUDP_SINK_FILE ? sink->fileDescriptor : -1);
+    if (sink->type == RUDP_SINK_MEMORY) {
+        target.memory = sink->memory;
+        target.capacity = sink->capacity;
+    } else if (sink->type == RUDP_SINK_CALLBACK) {
+        target.write = sink->write;
+        target.context = sink->context;
+    } else if (sink->type == RUDP_SINK_STREAM) {
+        initOrderedSink(session->receiver, &target, sink->fileDescriptor);
+    }
+
+    return startSession(session, startReceiverTransfer(session->receiver, NULL, 0, &target));
+}
+
+RudpSink rudpStreamSink(int fileDescriptor) {
+    RudpSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.type = RUDP_SINK_STREAM;
+    sink.fileDescriptor = fileDescriptor;
+    return sink;
+}
+
+int rudpPoll(RudpSession *session, int timeoutMs, RudpProgress *progress) {
+    if (session == NULL) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+    if (session->state == SESSION_OPEN) {
+        return RUDP_ERROR_STATE;
+    }
+
+    int status = RUDP_IN_PROGRESS;
+    if (session->state == SESSION_JOINED) {
+        status = session->status;
+    } else if (waitTransfer(getSessionControl(session), timeoutMs)) {
+        status = joinSession(session);
+    }
+
+    if (progress != NULL) {
+        if (session->isSender) {
+            getSenderProgress(session->sender, progress);
+        } else {
+            getReceiverProgress(session->receiver, progress);
+        }
+    }
+    return status;
+}
+
+int rudpClose(RudpSession *session) {
+    if (session == NULL) {
+        return RUDP_ERROR_ARGUMENT;
+    }
+
+    int status = RUDP_ERROR_CANCELLED;
+    if (session->state == SESSION_RUNNING) {
+        cancelTransfer(getSessionControl(session));
+        status = joinSession(session);
+    } else if (session->state == SESSION_JOINED) {
+        status = session->status;
+    }
+
+    if (session->isSender) {
+        destroySenderTransfer(session->sender);
+        free(session->sender);
+    } else {
+        closeReceiverTransfer(session->receiver);
+        free(session->receiver);
+    }
+    free(session);
+    return status;
+}
+
+const char *rudpErrorString(int status) {
+    return describeTransferStatus(status);
+}
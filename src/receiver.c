@@ -2,16 +2,17 @@
  * @file receiver.c
  * @brief Functions for receiving data over an enhanced UDP protocol.
  * 
- * This file contains the implementation of functions
- * responsible for receiving data over the enhanced UDP 
- * protocol. It includes key functions for setting up a server socket,
- * handling incoming packets, and assembling them into a complete file.
+ * This file contains the receiver program. Its key function rrecv receives
+ * files with the receiving engine of receiver_engine.h, which sets up the server
+ * sockets, handles incoming packets and assembles them into a complete file,
+ * and reports the results of the transfer.
  * 
  * @author Maddy Paulson (maddypaulson)
  * @author Leo Kamino (LeoKamino)
  * @bug No known bugs.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,18 +21,14 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <pthread.h>
 #include <errno.h>
 
-#include "includes/packet_header.h"
-
-/**
- * @def BUFFER_SIZE
- * Definition to indicate size of the buffer.
- */
-#define BUFFER_SIZE 10000
+#include "includes/receiver_engine.h"
 
 /**
  * @brief Prints the contents of the buffer.
@@ -52,138 +49,116 @@ void printBufferContents(const char *buffer, ssize_t length) {
 }
 
 /**
- * @brief Sends a final acknowledgment (ACK) for the specified sequence number.
- * 
- * This function sends a final acknowledgment packet for the provided sequence number
- * to the specified destination address using the given socket descriptor. The acknowledgment
- * indicates the successful receipt of the last packet in the data transmission process.
- * 
- * @param sockDescriptor The socket descriptor for sending the acknowledgment.
- * @param destAddr The destination address to send the acknowledgment.
- * @param sequenceNumber The sequence number of the packet being acknowledged.
- * @return Void.
- */
-void sendFinalAck(int sockDescriptor, struct sockaddr_in *destAddr, int sequenceNumber) {
-    PacketHeader ack;
-    ack.sequenceNumber = sequenceNumber;
-    ack.flags = 0;
-    ack.flags = setFlag(ack.flags, IS_ACK);
-    ack.flags = setFlag(ack.flags, IS_LAST_PACKET);
-
-    sendto(sockDescriptor, &ack, sizeof(ack), 0, (struct sockaddr *)destAddr, sizeof(struct sockaddr_in));
-}
-
-/**
- * @brief Receives a file over a network using a reliable UDP protocol.
- * 
- * This function sets up a UDP socket for the specified port, then enters a loop to receive packets.
- * Each packet is expected to have a header that the function checks to determine if it is the last packet.
- * Packet data, excluding the header, is written to the destination file specified.
- * For each received packet, an acknowledgment is sent back to the sender.
- * The function continues to receive packets until the last packet flag is encountered.
- * 
+ * @brief Receives files over a network using a reliable UDP protocol.
+ *
+ * This function opens a ReceiverTransfer, which binds one non-blocking UDP socket per
+ * receiver thread to the specified port with SO_REUSEPORT, and runs receiveStreams on
+ * each of them in its own thread. The kernel keeps all the packets of a stream on one
+ * socket, so a transfer the sender split into parallel streams is received on several
+ * cores, and every thread writes its streams into the file of their session at the
+ * offsets given in their packets. A thread serves any number of streams, told apart by
+ * connection ID and source address. Without isDaemon, the first transfer is written to
+ * destinationFile, packets of other transfers are ignored, and the function returns once
+ * the closing packet of every stream arrived and every pending write completed. With
+ * isDaemon, every transfer is written to destinationFile followed by its connection ID,
+ * and the function serves transfers until the process is stopped. A destinationFile of
+ * "-" writes the transfer to standard output in order, which works with pipes, and moves
+ * the messages of the receiver to standard error. The transfer is only reported complete
+ * once its data matched the CRC32C the sender computed. With checkpoint in the options,
+ * the receiver keeps a checkpoint of every resumable transfer next to its file, so a
+ * sender that resumes it only sends what is missing; as a daemon, a resumable transfer
+ * is written to destinationFile followed by its resume key. Every sender opens its
+ * transfer with a handshake, which caps its packets and window at the packet size and
+ * receive window in the options. It exits the program if the receiver fails, or if the
+ * data does not match.
+ *
  * @param myUDPport The local UDP port to bind for listening to incoming packets.
- * @param destinationFile The path to the file where the incoming data should be written.
+ * @param destinationFile The path to the file where the incoming data should be written,
+ * "-" for standard output, or the prefix of the files as a daemon.
  * @param writeRate The rate at which the data should be written to the file.
- * 
+ * @param options The settings of the receiver: batch size, ACK policy, GRO, threads, checkpoints and the
+ * largest packet and window accepted.
+ * @param isDaemon Non-zero to serve any number of concurrent transfers, each to its own file.
+ *
  * @return Void.
  */
-void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long long int writeRate) {
-    
-    int sockDescriptor;
-    struct sockaddr_in myAddr, senderAddr;
-    char buffer[BUFFER_SIZE];
-    ssize_t receivedBytes;
-    FILE *file;
-    unsigned long long int bytesWritten = 0;
-    int expectedSequenceNumber = 0;
-
-    /*
-     * Create UDP socket.
-     */
-    sockDescriptor = socket(AF_INET, SOCK_DGRAM, 0);
-    if(sockDescriptor < 0){
-        perror("Socket creation failed");
+void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long long int writeRate,
+           RudpOptions *options, int isDaemon) {
+    ReceiverTransfer *transfer;
+    int isStdout = strcmp(destinationFile, "-") == 0;
+    int outputFd = -1;
+
+    if ((transfer = malloc(sizeof(ReceiverTransfer))) == NULL) {
+        perror("Allocating receiver failed");
         exit(EXIT_FAILURE);
     }
 
-    memset(&myAddr, 0, sizeof(myAddr));
-    myAddr.sin_family = AF_INET;
-    myAddr.sin_port = htons(myUDPport);
-    myAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-
     /*
-     * Bind socket.
+     * Keep standard output for the data, and print everything else to standard error.
      */
-    if(bind(sockDescriptor, (struct sockaddr *)&myAddr, sizeof(myAddr)) < 0) {
-        perror("Bind failed");
-        close(sockDescriptor);
+    if (isStdout && ((outputFd = dup(STDOUT_FILENO)) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)) {
+        perror("Redirecting standard output failed");
         exit(EXIT_FAILURE);
     }
 
-    printf("Server is listening on port %d\n", myUDPport);
-
+    int status = openReceiverTransfer(transfer, myUDPport, options, 1);
+    if (status == RUDP_OK) {
+        if (options->streams > 1) {
+            printf("Server is listening on port %d with %d threads\n", myUDPport, options->streams);
+        } else {
+            printf("Server is listening on port %d\n", myUDPport);
+        }
+        if (isDaemon) {
+            printf("Writing every session to %s.<connection id>%s\n", destinationFile,
+                   options->checkpoint ? ", or to .<resume key> if it is resumable" : "");
+        }
+        fflush(stdout);
+        if (isStdout) {
+            WriteTarget sink;
+            initOrderedSink(transfer, &sink, outputFd);
+            status = startReceiverTransfer(transfer, NULL, 0, &sink);
+        } else {
+            status = startReceiverTransfer(transfer, destinationFile, isDaemon, NULL);
+        }
+    }
 
     /*
-     * Open destination file for writing.
+     * Wait for every thread and add up their results.
      */
-    file = fopen(destinationFile, "wb");
-    if(file == NULL){
-        perror("Failed to open destination file for writing.");
-        close(sockDescriptor);
+    int joinStatus = joinReceiverTransfer(transfer);
+    if (status == RUDP_OK) {
+        status = joinStatus;
+    }
+    if (status != RUDP_OK) {
+        fprintf(stderr, "Receiving failed: %s%s%s\n", describeTransferStatus(status),
+                status == RUDP_ERROR_SYSTEM ? ": " : "", status == RUDP_ERROR_SYSTEM ? strerror(errno) : "");
         exit(EXIT_FAILURE);
     }
 
-    while(1){
-        socklen_t senderAddrLen = sizeof(senderAddr);
-        receivedBytes = recvfrom(sockDescriptor, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&senderAddr, &senderAddrLen);
-
-        if(receivedBytes < 0){
-            perror("recvfrom failed");
-            break;
-        }
-        
-        /*
-         * Extract the packet header from the received packet.
-         */
-        PacketHeader header;
-        memcpy(&header, buffer, sizeof(header));
-
-        if (isFlagSet(header.flags, IS_LAST_PACKET)) {
-            sendFinalAck(sockDescriptor, &senderAddr, header.sequenceNumber);
-            break;
-        } else if (header.sequenceNumber == expectedSequenceNumber) {
-            /*
-             * Write the received payload without the header to the file.
-             */
-            ssize_t payloadSize = receivedBytes - sizeof(PacketHeader);
-            fwrite(buffer + sizeof(PacketHeader), 1, payloadSize, file);
-
-            bytesWritten += payloadSize;
-
-            /*
-             * Prepare the acknowledgement packet to send.
-             */
-            PacketHeader ack;
-            ack.sequenceNumber = header.sequenceNumber;
-            ack.flags = 0;
-            ack.flags = setFlag(ack.flags, IS_ACK);
-
-            sendto(sockDescriptor, &ack, sizeof(ack), 0, (struct sockaddr *)&senderAddr, sizeof(senderAddr));
-
-            expectedSequenceNumber++;
-        }else if(header.sequenceNumber < expectedSequenceNumber){
-            PacketHeader ack;
-            ack.sequenceNumber = header.sequenceNumber;
-            ack.flags = 0;
-            ack.flags = setFlag(ack.flags, IS_ACK);
-            sendto(sockDescriptor, &ack, sizeof(ack), 0, (struct sockaddr *)&senderAddr, sizeof(senderAddr));
-        }
+    printf("File transfer complete. %llu bytes written to %s\n", transfer->bytesWritten,
+           isStdout ? "standard output" : destinationFile);
+    if (transfer->resumedBytes == 0) {
+        printf("CRC32C of the data: %08x, matches the sender\n", transfer->checksum);
+    } else {
+        printf("Resumed: %llu bytes were already on disk, the data received matches the sender\n",
+               transfer->resumedBytes);
+    }
+    if (transfer->corruptPackets > 0) {
+        printf("Corrupted packets dropped: %llu\n", transfer->corruptPackets);
+    }
+    if (transfer->droppedPackets > 0) {
+        printf("Packets dropped while waiting for the disk: %llu\n", transfer->droppedPackets);
     }
+    if (transfer->recoveredPackets > 0) {
+        printf("Packets rebuilt from FEC parity: %llu\n", transfer->recoveredPackets);
+    }
+    displayIoStats(&transfer->ioStats);
 
-    fclose(file);
-    close(sockDescriptor);
-    printf("File transfer complete. %llu bytes written to %s\n", bytesWritten, destinationFile);
+    closeReceiverTransfer(transfer);
+    free(transfer);
+    if (outputFd >= 0) {
+        close(outputFd);
+    }
 }
 
 /**
@@ -191,7 +166,14 @@ void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long lo
  * 
  * This function parses command line arguments and initiates the file reception process
  * by calling the rrecv function. The program expects exactly two arguments:
- * the UDP port to listen on, and the filename to which the incoming data will be written.
+ * the UDP port to listen on, and the filename to which the incoming data will be written,
+ * or "-" to write it to standard output.
+ * The number of datagrams per system call can be changed with the optional -b flag, and
+ * the ACK policy with the optional -a (packets per ACK) and -d (ACK delay) flags. The
+ * optional -g flag turns on UDP GRO, and the optional -n flag receives parallel streams on
+ * several threads. The optional -D flag keeps the receiver running as a daemon that serves
+ * any number of concurrent transfers, each written to its own file, and the optional -R
+ * flag keeps checkpoints so that interrupted transfers can be resumed.
  * 
  * @param argc The number of command line arguments.
  * @param argv The array of command line arguments.
@@ -200,14 +182,69 @@ void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long lo
 int main(int argc, char** argv) {
     unsigned short int udpPort;
     char* filename = NULL;
+    RudpOptions options;
+    int isDaemon = 0;
+    int option;
+
+    memset(&options, 0, sizeof(options));
+    options.batchSize = DEFAULT_BATCH_SIZE;
+    options.ackFrequency = DEFAULT_ACK_FREQUENCY;
+    options.ackDelayMs = DEFAULT_ACK_DELAY_MS;
+    options.streams = 1;
+    options.verbose = 1;
+
+    while ((option = getopt(argc, argv, "b:a:d:gn:DRw:s:")) != -1) {
+        switch (option) {
+            case 'b':
+                options.batchSize = atoi(optarg);
+                break;
+            case 'a':
+                options.ackFrequency = atoi(optarg);
+                break;
+            case 'd':
+                options.ackDelayMs = atoi(optarg);
+                break;
+            case 'g':
+                options.useOffload = 1;
+                break;
+            case 'n':
+                options.streams = atoi(optarg);
+                break;
+            case 'D':
+                isDaemon = 1;
+                break;
+            case 'R':
+                options.checkpoint = 1;
+                break;
+            case 'w':
+                options.receiveWindow = atoi(optarg);
+                break;
+            case 's':
+                options.packetSize = atoi(optarg);
+                break;
+            default:
+                options.batchSize = -1;
+        }
+    }
 
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s UDP_port filename_to_write\n\n", argv[0]);
+    if (argc - optind != 2 || checkReceiverOptions(&options) != RUDP_OK
+        || ((isDaemon || options.checkpoint) && strcmp(argv[optind + 1], "-") == 0)) {
+        fprintf(stderr, "usage: %s UDP_port filename_to_write [-b batch_size] [-a ack_frequency] [-d ack_delay_ms] [-g] [-n threads] [-D] [-R] [-w window_size] [-s packet_size]\n\n", argv[0]);
+        fprintf(stderr, "  filename_to_write is - to write the transfer to standard output, without -D or -R\n");
+        fprintf(stderr, "  -b batch_size     datagrams per system call, 1 to %d (default %d)\n", MAX_BATCH_SIZE, DEFAULT_BATCH_SIZE);
+        fprintf(stderr, "  -a ack_frequency  in-order packets per ACK, 1 to %d (default %d)\n", MAX_ACK_FREQUENCY, DEFAULT_ACK_FREQUENCY);
+        fprintf(stderr, "  -d ack_delay_ms   longest time an ACK is held back (default %d)\n", DEFAULT_ACK_DELAY_MS);
+        fprintf(stderr, "  -g                receive datagrams coalesced by the kernel (UDP GRO)\n");
+        fprintf(stderr, "  -n threads        receiver threads, each with its own socket, 1 to %d (default 1)\n", MAX_STREAMS);
+        fprintf(stderr, "  -D                serve concurrent transfers until stopped, each to filename.<connection id>\n");
+        fprintf(stderr, "  -R                checkpoint transfers to filename.ckpt so a sender run with -R can resume them\n");
+        fprintf(stderr, "  -w window_size    largest window a sender may use per stream, 1 to %d (default %d)\n", MAX_WINDOW_SIZE, MAX_WINDOW_SIZE);
+        fprintf(stderr, "  -s packet_size    largest packet a sender may send, %d to %d bytes (default %d)\n\n", MIN_PACKET_SIZE, BUFFER_SIZE, BUFFER_SIZE);
         exit(1);
     }
 
-    udpPort = (unsigned short int) atoi(argv[1]);
-    filename = argv[2];
+    udpPort = (unsigned short int) atoi(argv[optind]);
+    filename = argv[optind + 1];
 
-    rrecv(udpPort, filename, 0);
+    rrecv(udpPort, filename, 0, &options, isDaemon);
 }
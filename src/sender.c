@@ -2,262 +2,374 @@
  * @file sender.c
  * @brief Functions for sending data over an enhanced UDP protocol.
  * 
- * This file contains the implementation of functions
- * responsible for sending data over the enhanced UDP 
- * protocol. It includes a key function rsend which 
- * handles sending packets and handling acknowledgments. 
+ * This file contains the sender program. Its key function rsend sends a file
+ * with the sending engine of sender_engine.h, which handles sending packets and
+ * handling acknowledgments, and reports the results of the transfer.
  * 
  * @author Maddy Paulson (maddypaulson)
  * @author Leo Kamino (LeonardoKamino)
  * @bug No known bugs.
  */
 
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <netdb.h>
 #include <sys/types.h>
-#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/time.h>
 
-#include "includes/packet_header.h"
-#include "includes/rtt_estimates.h"
+#include "includes/sender_engine.h"
 #include "includes/test_output.h"
 
 /**
- * @def BUFFER_SIZE
- * Definition to indicate size of the buffer.
+ * @brief Limits the number of bytes to transfer to the size of the file.
+ * 
+ * @param file The open file.
+ * @param bytesToTransfer The number of bytes to transfer. It is reduced to the file size
+ * if the file is shorter.
+ * @return int 0 on success, -1 if the file size could not be read.
  */
-#define BUFFER_SIZE 10000
+int getTransferSize(FILE *file, unsigned long long int *bytesToTransfer) {
+    struct stat fileStat;
+    if (fstat(fileno(file), &fileStat) < 0) {
+        perror("Reading file size failed");
+        return -1;
+    }
+
+    if ((unsigned long long int)fileStat.st_size < *bytesToTransfer) {
+        *bytesToTransfer = fileStat.st_size;
+    }
+    return 0;
+}
 
 /**
-* @def EXPECTED_RTT 
-* Definition specifying the expected Round Trip Time (RTT) in milliseconds.
-*/
-#define EXPECTED_RTT 20
+ * @brief Memory-maps the part of a file that will be transferred.
+ * 
+ * Packets sent from the mapping reference the page cache directly, so the payload is
+ * never copied in user space, neither when it is first sent nor when it is retransmitted.
+ * 
+ * @param file The open file to map.
+ * @param bytesToTransfer The number of bytes to transfer. It is reduced to the file size
+ * if the file is shorter.
+ * @return char* The start of the mapping, or NULL if the file could not be mapped.
+ */
+char *mapSourceFile(FILE *file, unsigned long long int *bytesToTransfer) {
+    if (getTransferSize(file, bytesToTransfer) < 0) {
+        return NULL;
+    }
+    if (*bytesToTransfer == 0) {
+        return NULL;
+    }
 
-#define TIMEOUT_ACK 30000
+    char *mapping = mmap(NULL, *bytesToTransfer, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (mapping == MAP_FAILED) {
+        perror("Mapping file failed");
+        return NULL;
+    }
+    madvise(mapping, *bytesToTransfer, MADV_SEQUENTIAL | MADV_WILLNEED);
+    return mapping;
+}
 
 /**
- * @def MAX_FINAL_PKT_RESEND_ATTEMPTS
- * Definition specifying the maximum number of resend attempts for a packet
- * if the acknowledgment (ACK) is not received within the timeout period.
+ * @brief Derives the resume key of a file transfer.
+ * 
+ * The key covers the identity, size and modification time of the file and the number
+ * of bytes sent, so only a later run sending the same unchanged data resumes a transfer.
+ * 
+ * @param file The open file.
+ * @param bytesToTransfer The number of bytes to transfer.
+ * @return unsigned long long int The key, never 0, or 0 if the file could not be examined.
  */
-#define MAX_FINAL_PKT_RESEND_ATTEMPTS 5
+unsigned long long int fileResumeKey(FILE *file, unsigned long long int bytesToTransfer) {
+    struct stat fileStat;
+    unsigned long long int fields[6];
+
+    if (fstat(fileno(file), &fileStat) < 0) {
+        perror("Reading file status failed");
+        return 0;
+    }
+    fields[0] = fileStat.st_dev;
+    fields[1] = fileStat.st_ino;
+    fields[2] = fileStat.st_size;
+    fields[3] = fileStat.st_mtim.tv_sec;
+    fields[4] = fileStat.st_mtim.tv_nsec;
+    fields[5] = bytesToTransfer;
+
+    unsigned long long int key = (unsigned long long int)crc32c(0x9e3779b9, fields, sizeof(fields)) << 32
+                               | crc32c(0, fields, sizeof(fields));
+    return key != 0 ? key : 1;
+}
 
 /**
- * @brief Sends a closing packet to the specified destination address.
+ * @brief Writes the JSON summary of a transfer and, if one was recorded, its trace.
  * 
- * This function sends a closing packet containing the provided sequence number
- * to the specified destination address using the given socket descriptor. The
- * closing packet indicates the end of the data transmission. It retransmits the
- * closing packet up to a maximum number of times defined by MAX_FINAL_PKT_RESEND_ATTEMPTS
- * until an acknowledgment packet is received or the maximum attempts are
- * exhausted.
+ * Failing to write them is reported but does not fail the transfer.
  * 
- * @param sockDescriptor The socket descriptor for sending the closing packet.
- * @param destAddr The destination address to send the closing packet.
- * @param sequenceNumber The sequence number of the closing packet.
+ * @param options Where to write the telemetry and the link capacity to report against.
+ * @param telemetry The Telemetry of every stream.
+ * @param streamCount The number of streams.
+ * @param fileBytes The size of the file transferred.
+ * @param duration The duration of the transfer in seconds.
  * @return Void.
  */
-void sendClosingPacket(int sockDescriptor, struct sockaddr_in *destAddr, int sequenceNumber) {
-    int resendAttempts = 0;
-    int sentBytes;
-
-    PacketHeader lastPacketHeader;
-    lastPacketHeader.sequenceNumber = sequenceNumber;
-    lastPacketHeader.flags = 0;
-    lastPacketHeader.flags = setFlag(lastPacketHeader.flags, IS_LAST_PACKET);
-
-    do {
-        sentBytes = sendto(sockDescriptor, &lastPacketHeader, sizeof(lastPacketHeader), 0, (struct sockaddr *)destAddr, sizeof(struct sockaddr_in));
-        if(sentBytes < 0) {
-            perror("Error sending closing packet");
-            break;
-        }
-       
-
-        PacketHeader ack;
-        ssize_t ackSize = recvfrom(sockDescriptor, &ack, sizeof(ack), 0, NULL, 0);
-        if (ackSize > 0 && isFlagSet(ack.flags, IS_ACK) && isFlagSet(ack.flags, IS_LAST_PACKET) && ack.sequenceNumber == sequenceNumber){
-            break; // Exit the resend loop
-        } else {
-            resendAttempts++;
-        }
+void writeTelemetryFiles(TelemetryOptions *options, Telemetry *telemetry, int streamCount,
+                         unsigned long long int fileBytes, double duration) {
+    char path[PATH_MAX];
+    FILE *out;
+
+    snprintf(path, sizeof(path), "%s.json", options->prefix);
+    if ((out = fopen(path, "w")) == NULL) {
+        perror("Opening telemetry summary failed");
+        return;
+    }
+    writeTelemetryJson(out, telemetry, streamCount, fileBytes, duration, options->linkCapacity);
+    if (fclose(out) != 0) {
+        perror("Writing telemetry summary failed");
+    }
 
-    } while(resendAttempts < MAX_FINAL_PKT_RESEND_ATTEMPTS);
+    if (options->traceIntervalMs <= 0) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s.%s", options->prefix, options->traceFormat == TRACE_BINARY ? "bin" : "csv");
+    if ((out = fopen(path, options->traceFormat == TRACE_BINARY ? "wb" : "w")) == NULL) {
+        perror("Opening telemetry trace failed");
+        return;
+    }
+    int failed = writeTelemetryTrace(out, telemetry, streamCount, options->traceFormat) < 0;
+    if (fclose(out) != 0 || failed) {
+        perror("Writing telemetry trace failed");
+    }
 }
 
 /**
  * @brief Sends a file over UDP to the specified destination.
  * 
  * This function sends a file over User Datagram Protocol (UDP) to the specified
- * destination hostname and port. It reads the file specified by the filename and
- * sends it in chunks (packets) until all bytes are transferred or until an error
- * occurs. It uses acknowledgments (ACKs) to ensure reliable delivery of packets
- * and handles retransmissions in case of timeouts or errors. The function also
- * measures the bandwidth during the transmission process.
+ * destination hostname and port with a SenderTransfer. Unless the options give a packet
+ * size, the largest packet size that crosses the path unfragmented is discovered first.
+ * A handshake then settles the packet size, window and features with the receiver and
+ * delivers the first bytes of the file. The rest of the file is then split into one
+ * byte range of whole packets per stream, and each range is sent by sendStream as an
+ * independent reliable stream on its own thread and socket, so a large file can use
+ * several cores on both ends. Every packet of every stream carries the same random
+ * connection ID, which lets the receiver serve several transfers on one port. With
+ * zeroCopy set, the file is memory-mapped once and every stream sends its packets
+ * straight from the mapping; otherwise the streams read their packets from the file
+ * with pread. With FEC parity in the options, the payload of every packet is shortened
+ * by a FecInfo. The function also measures the bandwidth of the whole transfer and
+ * reports the results of the streams together, and with a telemetry prefix writes their
+ * merged telemetry to <prefix>.json and their traces to <prefix>.csv or <prefix>.bin. A
+ * filename of "-" streams standard input instead: it is sent as a single stream as data
+ * arrives, until the producer closes it or bytesToTransfer bytes were read. With
+ * isResumable set, the transfer gets a resume key derived from the file, and only the
+ * parts the receiver is missing from an earlier run with the same key are sent. It
+ * exits the program if the transfer fails.
  * 
  * @param hostname The hostname or IP address of the destination.
- * @param hostUDPport The hostname or IP address of the destination.
- * @param filename The name of the file to be sent.
- * @param bytesToTransfer The total number of bytes to transfer from the file.
+ * @param hostUDPport The UDP port of the destination.
+ * @param filename The name of the file to be sent, or "-" for standard input.
+ * @param bytesToTransfer The total number of bytes to transfer from the file, 0 for all of standard input.
+ * @param options The settings of the transfer.
+ * @param zeroCopy Non-zero to send the payload straight from a memory mapping of the file.
+ * @param telemetry The link capacity to report against and where to write the telemetry.
+ * @param isResumable Non-zero to resume an earlier run of the same transfer; not for standard input.
  * @return Void.
  */
 void rsend(char* hostname, 
             unsigned short int hostUDPport, 
             char* filename, 
-            unsigned long long int bytesToTransfer) 
+            unsigned long long int bytesToTransfer,
+            RudpOptions *options,
+            int zeroCopy,
+            TelemetryOptions *telemetry,
+            int isResumable) 
 {
-    int sockDescriptor;
     struct sockaddr_in destAddr;
-    char buffer[BUFFER_SIZE];
-    ssize_t readBytes, sentBytes;
-    FILE *file;
-
-    unsigned long long int totalBytesSent = 0;
-    unsigned long long int totalValidBytesSent = 0;
-
-    int sequenceNumber = 0;
-
-    /*
-    * Initialize variables for Timeout calculation
-    */
-    double estimatedRTT = EXPECTED_RTT;
-    double deviationRTT = 0;
-    struct timeval sendTime, receiveTime;
+    FILE *file = NULL;
+    char *mapping = NULL;
+    int isStdin = strcmp(filename, "-") == 0;
+    SenderTransfer *transfer;
+    RudpSource source;
 
     /*
      * Resolve the hostname to support domain & ip addresses.
      */
-    struct addrinfo hints, *servinfo;
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
-
-    int status;
-    printf("Sending %s to: %s\n", filename, hostname);
-    if((status = getaddrinfo(hostname, NULL, &hints, &servinfo)) != 0){
-        perror("Address translation failed.");
+    printf("Sending %s to: %s\n", isStdin ? "standard input" : filename, hostname);
+    if (resolveReceiver(hostname, hostUDPport, &destAddr) != RUDP_OK) {
+        fprintf(stderr, "Address translation failed.\n");
         exit(EXIT_FAILURE);
     }
 
     /*
-     * Create UDP socket.
+     * Open file for reading to learn its size. The streams read it with pread, or from its mapping.
+     * Standard input is read as it comes.
      */
-    sockDescriptor = socket(AF_INET, SOCK_DGRAM, 0);
-    if(sockDescriptor < 0){
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+    if (isStdin) {
+        initStreamSource(&source, STDIN_FILENO, bytesToTransfer);
+    } else {
+        if((file = fopen(filename, "rb")) == NULL) {
+            perror("Opening file failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if (zeroCopy) {
+            if ((mapping = mapSourceFile(file, &bytesToTransfer)) == NULL && bytesToTransfer > 0) {
+                fclose(file);
+                exit(EXIT_FAILURE);
+            }
+            initMemorySource(&source, mapping, bytesToTransfer);
+        } else if (getTransferSize(file, &bytesToTransfer) < 0) {
+            fclose(file);
+            exit(EXIT_FAILURE);
+        } else {
+            initFileSource(&source, fileno(file), 0, bytesToTransfer);
+        }
+        if (isResumable && (options->resumeKey = fileResumeKey(file, bytesToTransfer)) == 0) {
+            fclose(file);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    /*
-    * Set socket timeout for ACKs
-    */
-    struct timeval timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 2000 * EXPECTED_RTT;
-    if (setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        perror("Error setting socket timeout");
-        close(sockDescriptor);
+    if ((transfer = malloc(sizeof(SenderTransfer))) == NULL) {
+        perror("Allocating transfer failed");
         exit(EXIT_FAILURE);
     }
-
-    memset(&destAddr, 0, sizeof(destAddr));
-    destAddr.sin_family = AF_INET;
-    destAddr.sin_port = htons(hostUDPport);
-    memcpy(&destAddr.sin_addr, &((struct sockaddr_in *)servinfo->ai_addr)->sin_addr, sizeof(struct in_addr));
-
-    freeaddrinfo(servinfo);
+    initSenderTransfer(transfer, &destAddr, options, 1);
+
+    int status = startSenderTransfer(transfer, &source, telemetry->prefix != NULL ? telemetry->traceIntervalMs : 0);
+    if (status == RUDP_OK) {
+        printf("Packet size: %d bytes\n", transfer->packetSize);
+        printf("Window size: %d packets\n", transfer->options.windowSize);
+        printf("Connection ID: %08x\n", transfer->connectionId);
+        if (options->resumeKey != 0) {
+            printf("Resume key: %016llx, %llu of %llu bytes already at the receiver\n", options->resumeKey,
+                   transfer->resumedBytes, transfer->totalBytes);
+        }
+        fflush(stdout);
+    }
 
     /*
-     * Open file for reading.
+     * Wait for every stream and add up their results.
      */
-    if((file = fopen(filename, "rb")) == NULL) {
-        perror("Opening file failed");
-        close(sockDescriptor);
+    int joinStatus = joinSenderTransfer(transfer);
+    if (status == RUDP_OK) {
+        status = joinStatus;
+    }
+    if (status == RUDP_ERROR_REFUSED) {
+        fprintf(stderr, "Sending failed: %s: %s\n", describeTransferStatus(status),
+                describeHandshakeStatus(transfer->handshakeStatus));
         exit(EXIT_FAILURE);
     }
-
-    /*
-    * Start timing for bandwidth calculation
-    */
-    struct timeval start, end;
-    gettimeofday(&start, NULL);
-
-    /*
-     * Continue sending file in chunks (packets) until all bytes are transferred.
-     */
-    while(totalValidBytesSent < bytesToTransfer && (readBytes = fread(buffer + sizeof(PacketHeader), 1, BUFFER_SIZE - sizeof(PacketHeader), file)) > 0){
-        PacketHeader header;
-        header.sequenceNumber = sequenceNumber;
-        header.flags = 0;
-
-        memcpy(buffer, &header, sizeof(header));
-
-        do {
-            sentBytes = sendto(sockDescriptor, buffer, readBytes + sizeof(PacketHeader), 0, (struct sockaddr *)&destAddr, sizeof(destAddr));
-            totalBytesSent += sentBytes;
-
-            PacketHeader ack;
-            ssize_t ackSize = recvfrom(sockDescriptor, &ack, sizeof(ack), 0, NULL, 0);
-
-            /*
-            * If ACK is for the current packet, update sequence number and timeout, and exit the resend loop.
-            */
-            if (ackSize > 0 && isFlagSet(ack.flags, IS_ACK) && ack.sequenceNumber == header.sequenceNumber) {
-                sequenceNumber++;
-                totalValidBytesSent += sentBytes - sizeof(PacketHeader);
-                
-                gettimeofday(&receiveTime, NULL);
-                double rtt = calculateRTT(sendTime, receiveTime);
-                updateTimeout(&estimatedRTT, &deviationRTT, rtt, &timeout);
-
-                if (setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-                    perror("Error setting socket timeout");
-                    close(sockDescriptor);
-                    exit(EXIT_FAILURE);
-                }
-
-                break; 
-            } else if (errno == EAGAIN || errno == EWOULDBLOCK){
-                /*
-                * If the ACK timeout occurs, double current timeout.
-                */
-                doubleTimeOut(&timeout);
-
-                if (setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-                    perror("Error setting socket timeout");
-                    close(sockDescriptor);
-                    exit(EXIT_FAILURE);
-                }
-
-            }
-
-        } while(1);
+    if (status != RUDP_OK) {
+        fprintf(stderr, "Sending failed: %s%s%s\n", describeTransferStatus(status),
+                status == RUDP_ERROR_SYSTEM ? ": " : "", status == RUDP_ERROR_SYSTEM ? strerror(errno) : "");
+        exit(EXIT_FAILURE);
+    }
+    bytesToTransfer = transfer->totalBytes;
+
+    int streamCount = options->streams;
+    unsigned long long int bytesSent = 0;
+    unsigned long long int parityPackets = 0;
+    unsigned long long int compressedPackets = 0;
+    unsigned long long int dataPackets = 0;
+    unsigned long long int dataBytes = 0;
+    unsigned long long int compressedBytes = 0;
+    IoStats ioStats;
+    Telemetry streamTelemetry[MAX_STREAMS];
+    Telemetry total;
+    memset(&ioStats, 0, sizeof(ioStats));
+    initTelemetry(&total, 0);
+    for (int i = 0; i < streamCount; i++) {
+        SenderStream *stream = &transfer->streams[i];
+        bytesSent += stream->bytesSent;
+        parityPackets += stream->parityPackets;
+        compressedPackets += stream->compressor.compressedPackets;
+        dataPackets += stream->compressor.packets;
+        dataBytes += stream->compressor.inputBytes;
+        compressedBytes += stream->compressor.outputBytes;
+        addIoStats(&ioStats, &stream->ioStats);
+        streamTelemetry[i] = stream->telemetry;
+        mergeTelemetry(&total, &streamTelemetry[i]);
     }
 
-    sendClosingPacket(sockDescriptor, &destAddr, sequenceNumber);
-
-    gettimeofday(&end, NULL);
+    unsigned long long int resumedBytes = transfer->resumedBytes;
+    displayPerformance(&transfer->start, &transfer->end, bytesToTransfer - resumedBytes, bytesSent, telemetry->linkCapacity);
+    if (streamCount > 1) {
+        printf("Streams: %d\n", streamCount);
+    }
+    printf("Congestion control: %s\n", options->congestionControl);
+    printf("Pacing: %s\n", options->pacing);
+    if (transfer->options.fecParity > 0) {
+        printf("FEC: %d parity per %d data packets, %llu parity packets sent\n", transfer->options.fecParity,
+               transfer->options.fecBlock, parityPackets);
+    }
+    if (transfer->options.compression) {
+        printf("Compression: %llu of %llu packets compressed, %.1f%% of the payload bytes saved\n", compressedPackets,
+               dataPackets, dataBytes > 0 ? 100.0 * (dataBytes - compressedBytes) / dataBytes : 0);
+    }
+    if (resumedBytes == 0) {
+        printf("CRC32C of the data: %08x\n", transfer->checksum);
+    } else {
+        printf("Resumed: %llu bytes sent, %llu already at the receiver\n", bytesToTransfer - resumedBytes, resumedBytes);
+    }
+    printf("Retransmitted packets: %llu\n", total.retransmissions);
+    if (total.corruptPackets > 0) {
+        printf("Corrupted ACKs dropped: %llu\n", total.corruptPackets);
+    }
+    printf("Timeouts: %llu, fast retransmissions: %llu, duplicate ACKs: %llu of %llu\n",
+           total.timeouts, total.fastRetransmissions, total.duplicateAcks, total.acks);
+    printf("RTT p50/p90/p99: %.3f/%.3f/%.3f ms\n",
+           rttPercentile(&total, 50), rttPercentile(&total, 90), rttPercentile(&total, 99));
+    for (int i = 0; i < streamCount; i++) {
+        RttEstimator *streamRtt = &transfer->streams[i].rtt;
+        if (streamCount > 1) {
+            printf("Stream %d ", i);
+        }
+        printf("RTT min/smoothed/variation: %.3f/%.3f/%.3f ms (%llu samples)\n",
+               streamRtt->minRtt, streamRtt->smoothedRtt, streamRtt->rttVariation, streamRtt->samples);
+    }
+    displayIoStats(&ioStats);
 
-    displayPerformance(&start, &end, totalBytesSent);
+    if (telemetry->prefix != NULL) {
+        double duration = calculateRTT(transfer->start, transfer->end) / 1000.0;
+        writeTelemetryFiles(telemetry, streamTelemetry, streamCount, bytesToTransfer - resumedBytes, duration);
+    }
 
-    fclose(file);
-    close(sockDescriptor);
+    destroySenderTransfer(transfer);
+    free(transfer);
+    if (mapping != NULL) {
+        munmap(mapping, bytesToTransfer);
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
 }
 
 /**
- * @brief Entry point for the UDP file receiver program.
+ * @brief Entry point for the UDP file sender program.
  * 
  * This function parses command line arguments and initiates the file sending process
- * by calling the rsend function. The program expects exactly two arguments:
- * the UDP port to send data to, and the filename of the file to be sent.
+ * by calling the rsend function. The program expects exactly four arguments:
+ * the receiver hostname, the UDP port to send data to, the filename of the file to be
+ * sent, or "-" to stream standard input, and the number of bytes to transfer, which only
+ * caps standard input and is 0 to send all of it. The window size can be changed with the
+ * optional -w flag, the congestion control algorithm with the optional -c flag and the
+ * number of datagrams per system call with the optional -b flag. The optional -z flag
+ * sends the file from a memory mapping without copying it, and the optional -s flag
+ * fixes the packet size instead of discovering it. The optional -g flag turns on UDP GSO,
+ * the optional -n flag splits the transfer into several parallel streams, the optional
+ * -p flag selects how packets are paced and the optional -f flag adds FEC parity packets.
+ * The optional -C flag compresses every payload that shrinks, and the optional -R flag
+ * resumes an earlier run of the same transfer that did not complete.
+ * The optional -L flag sets the link capacity the bandwidth utilization is computed
+ * against, and the optional -T, -i and -B flags write the telemetry of the transfer.
  * 
  * @param argc The number of command line arguments.
  * @param argv The array of command line arguments.
@@ -268,17 +380,123 @@ int main(int argc, char** argv) {
     unsigned long long int bytesToTransfer;
     char* hostname = NULL;
     char* filename = NULL;
+    RudpOptions options;
+    int zeroCopy = 0;
+    TelemetryOptions telemetry = {LINK_CAPACITY, NULL, DEFAULT_TRACE_INTERVAL_MS, TRACE_CSV};
+    int isResumable = 0;
+    int option;
+
+    memset(&options, 0, sizeof(options));
+    options.windowSize = DEFAULT_WINDOW_SIZE;
+    options.congestionControl = DEFAULT_CONGESTION_CONTROL;
+    options.pacing = "bucket";
+    options.batchSize = DEFAULT_BATCH_SIZE;
+    options.streams = 1;
+    options.verbose = 1;
+
+    while ((option = getopt(argc, argv, "w:c:b:zs:gn:p:f:CRL:T:i:B")) != -1) {
+        switch (option) {
+            case 'w':
+                options.windowSize = atoi(optarg);
+                break;
+            case 'c':
+                options.congestionControl = optarg;
+                break;
+            case 'b':
+                options.batchSize = atoi(optarg);
+                break;
+            case 'z':
+                zeroCopy = 1;
+                break;
+            case 's':
+                options.packetSize = atoi(optarg);
+                if (options.packetSize < MIN_PACKET_SIZE || options.packetSize > BUFFER_SIZE) {
+                    options.windowSize = -1;
+                }
+                break;
+            case 'g':
+                options.useOffload = 1;
+                break;
+            case 'p':
+                options.pacing = optarg;
+                if (parsePacingMode(optarg) < 0) {
+                    options.windowSize = -1;
+                }
+                break;
+            case 'f':
+                options.fecParity = 1;
+                if (sscanf(optarg, "%d,%d", &options.fecBlock, &options.fecParity) < 1 || options.fecBlock < 1
+                    || options.fecBlock > FEC_MAX_BLOCK || options.fecParity < 1 || options.fecParity > FEC_MAX_PARITY
+                    || options.fecParity > options.fecBlock) {
+                    options.windowSize = -1;
+                }
+                break;
+            case 'n':
+                options.streams = atoi(optarg);
+                if (options.streams < 1 || options.streams > MAX_STREAMS) {
+                    options.windowSize = -1;
+                }
+                break;
+            case 'C':
+                options.compression = 1;
+                break;
+            case 'R':
+                isResumable = 1;
+                break;
+            case 'L':
+                telemetry.linkCapacity = atof(optarg) * 1000000.0;
+                if (telemetry.linkCapacity <= 0) {
+                    options.windowSize = -1;
+                }
+                break;
+            case 'T':
+                telemetry.prefix = optarg;
+                break;
+            case 'i':
+                telemetry.traceIntervalMs = atof(optarg);
+                if (telemetry.traceIntervalMs < 0) {
+                    options.windowSize = -1;
+                }
+                break;
+            case 'B':
+                telemetry.traceFormat = TRACE_BINARY;
+                break;
+            default:
+                options.windowSize = -1;
+        }
+    }
 
-    if (argc != 5) {
-        fprintf(stderr, "usage: %s receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n\n", argv[0]);
+    int isStdin = argc - optind == 4 && strcmp(argv[optind + 2], "-") == 0;
+    if (argc - optind != 4 || options.windowSize < 1 || checkSenderOptions(&options) != RUDP_OK
+        || (isStdin && (zeroCopy || options.streams > 1 || isResumable))) {
+        fprintf(stderr, "usage: %s receiver_hostname receiver_port filename_to_xfer bytes_to_xfer [-w window_size] [-c algorithm] [-b batch_size] [-z] [-s packet_size] [-g] [-n streams] [-p pacing] [-f block[,parity]] [-C] [-R] [-L link_mbit] [-T prefix] [-i interval_ms] [-B]\n\n", argv[0]);
+        fprintf(stderr, "  filename_to_xfer is - to send standard input until it ends, with bytes_to_xfer as a cap or 0 for none;\n"
+                        "  standard input is sent as a single stream, without -z or -R\n");
+        fprintf(stderr, "  -w window_size  packets in flight, 1 to %d (default %d)\n", MAX_WINDOW_SIZE, DEFAULT_WINDOW_SIZE);
+        fprintf(stderr, "  -c algorithm    congestion control: aimd, cubic or bbr (default %s)\n", DEFAULT_CONGESTION_CONTROL);
+        fprintf(stderr, "  -b batch_size   datagrams per system call, 1 to %d (default %d)\n", MAX_BATCH_SIZE, DEFAULT_BATCH_SIZE);
+        fprintf(stderr, "  -z              send from a memory mapping of the file without copying it\n");
+        fprintf(stderr, "  -s packet_size  bytes per packet, %d to %d (default: discover the path MTU)\n", MIN_PACKET_SIZE, BUFFER_SIZE);
+        fprintf(stderr, "  -g              send runs of packets with UDP segmentation offload (GSO)\n");
+        fprintf(stderr, "  -n streams      parallel streams, each with its own thread and socket, 1 to %d (default 1)\n", MAX_STREAMS);
+        fprintf(stderr, "  -p pacing       pacing: none, bucket or txtime (needs the fq qdisc) (default bucket)\n");
+        fprintf(stderr, "  -f block,parity FEC parity packets per block of data packets, block up to %d and half the window,\n"
+                        "                  parity up to %d (default 1)\n", FEC_MAX_BLOCK, FEC_MAX_PARITY);
+        fprintf(stderr, "  -C              compress every payload that shrinks, skipping data that does not\n");
+        fprintf(stderr, "  -R              resume: only send what the receiver is missing from an earlier run of\n"
+                        "                  this transfer, for a receiver started with -R\n");
+        fprintf(stderr, "  -L link_mbit    link capacity for the bandwidth utilization, in Mb/s (default %.2f)\n", LINK_CAPACITY / 1000000.0);
+        fprintf(stderr, "  -T prefix       write a telemetry summary to prefix.json and a trace to prefix.csv\n");
+        fprintf(stderr, "  -i interval_ms  time between trace points, 0 for no trace (default %d)\n", DEFAULT_TRACE_INTERVAL_MS);
+        fprintf(stderr, "  -B              write the trace in binary to prefix.bin instead\n\n");
         exit(1);
     }
-    hostUDPport = (unsigned short int) atoi(argv[2]);
-    hostname = argv[1];
-    bytesToTransfer = atoll(argv[4]);
-    filename = argv[3];
+    hostUDPport = (unsigned short int) atoi(argv[optind + 1]);
+    hostname = argv[optind];
+    bytesToTransfer = atoll(argv[optind + 3]);
+    filename = argv[optind + 2];
 
-    rsend(hostname, hostUDPport, filename, bytesToTransfer);
+    rsend(hostname, hostUDPport, filename, bytesToTransfer, &options, zeroCopy, &telemetry, isResumable);
 
     return (EXIT_SUCCESS); 
-}
\ No newline at end of file
+}
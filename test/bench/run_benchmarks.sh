@@ -0,0 +1,305 @@
+#!/bin/bash
+#
+# @file run_benchmarks.sh
+# @brief Benchmarks the enhanced UDP protocol against the TCP baseline on loopback.
+#
+# Every combination of file size, packet size and network profile is transferred
+# REPEATS times with sender/receiver and with sender_tcp/receiver_tcp. The network
+# profiles are applied by impair_proxy, or by tc netem on the loopback interface with
+# -m netem, which needs root. The proxy only carries UDP, so in proxy mode TCP runs on
+# the clean profile only. Every run is timed from the start of the sender to the exit
+# of the receiver and its output file is compared with the input.
+#
+# Results:
+#   <prefix>.csv          one row per run
+#   <prefix>_summary.csv  one row per configuration
+#   <prefix>.json         the summary as JSON
+# With -c, the mean goodput of every configuration is compared with a previous
+# summary CSV, and the script fails if any dropped by more than the tolerance.
+# A UDP run on a profile that loses nothing (clean, delay10) must retransmit at most
+# SPURIOUS percent of its packets, or the script fails: every such retransmission was
+# spurious, from a timeout that fired before its ACK could arrive.
+#
+# @author Leo Kamino (LeonardoKamino)
+# @bug No known bugs.
+
+set -u
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+SIZES="1000000 8000000"
+PACKET_SIZES="1400 8000"
+PROFILES="clean delay10 loss1 rate20"
+REPEATS=3
+PREFIX=bench_results
+MODE=proxy
+SENDER_ARGS=""
+BASELINE=""
+TOLERANCE=10
+SPURIOUS=1
+TIMEOUT=120
+
+usage() {
+    cat >&2 <<EOF
+usage: $0 [-s sizes] [-p packet_sizes] [-f profiles] [-r repeats] [-o prefix] [-m proxy|netem]
+       [-a sender_args] [-c baseline_summary.csv] [-t tolerance_percent] [-x spurious_percent]
+
+  -s sizes         bytes per transfer, space separated (default "$SIZES")
+  -p packet_sizes  UDP packet sizes, space separated (default "$PACKET_SIZES")
+  -f profiles      network profiles, space separated, from: $(listProfiles)
+                   (default "$PROFILES")
+  -r repeats       runs per configuration (default $REPEATS)
+  -o prefix        prefix of the result files (default $PREFIX)
+  -m mode          apply the profiles with impair_proxy or tc netem on lo (default $MODE)
+  -a sender_args   extra arguments of the UDP sender, e.g. "-c bbr -n 2"
+  -c baseline      summary CSV of an earlier run to check for goodput regressions
+  -t tolerance     largest goodput drop against the baseline, in percent (default $TOLERANCE)
+  -x spurious      largest share of packets retransmitted on a lossless profile, in percent (default $SPURIOUS)
+EOF
+    exit 1
+}
+
+# Prints the impair_proxy arguments of a profile.
+proxyArgs() {
+    case "$1" in
+        clean)   echo "" ;;
+        delay10) echo "-d 10" ;;
+        loss1)   echo "-d 10 -l 1" ;;
+        burst)   echo "-d 10 -g 1,30" ;;
+        rate20)  echo "-r 20 -d 10" ;;
+        reorder) echo "-d 10 -j 2 -o 2" ;;
+        *)       return 1 ;;
+    esac
+}
+
+# Prints the tc netem arguments of a profile.
+netemArgs() {
+    case "$1" in
+        clean)   echo "" ;;
+        delay10) echo "delay 10ms" ;;
+        loss1)   echo "delay 10ms loss 1%" ;;
+        burst)   echo "delay 10ms loss gemodel 1% 30%" ;;
+        rate20)  echo "delay 10ms rate 20mbit" ;;
+        reorder) echo "delay 10ms 2ms reorder 2%" ;;
+        *)       return 1 ;;
+    esac
+}
+
+listProfiles() {
+    echo "clean delay10 loss1 burst rate20 reorder"
+}
+
+# Succeeds for a profile that neither drops nor reorders packets.
+isLossless() {
+    [ "$1" = clean ] || [ "$1" = delay10 ]
+}
+
+while getopts "s:p:f:r:o:m:a:c:t:x:" option; do
+    case "$option" in
+        s) SIZES=$OPTARG ;;
+        p) PACKET_SIZES=$OPTARG ;;
+        f) PROFILES=$OPTARG ;;
+        r) REPEATS=$OPTARG ;;
+        o) PREFIX=$OPTARG ;;
+        m) MODE=$OPTARG ;;
+        a) SENDER_ARGS=$OPTARG ;;
+        c) BASELINE=$OPTARG ;;
+        t) TOLERANCE=$OPTARG ;;
+        x) SPURIOUS=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+[ "$MODE" = proxy ] || [ "$MODE" = netem ] || usage
+for profile in $PROFILES; do
+    proxyArgs "$profile" > /dev/null || { echo "Unknown profile: $profile" >&2; usage; }
+done
+for program in sender receiver sender_tcp receiver_tcp impair_proxy; do
+    [ -x "$ROOT/$program" ] || { echo "$ROOT/$program is missing, run make first" >&2; exit 1; }
+done
+
+WORK=$(mktemp -d)
+PROXY_PID=""
+
+cleanup() {
+    [ -n "$PROXY_PID" ] && kill "$PROXY_PID" 2> /dev/null
+    [ "$MODE" = netem ] && tc qdisc del dev lo root 2> /dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Applies a profile with tc netem on the loopback interface.
+applyNetem() {
+    tc qdisc del dev lo root 2> /dev/null
+    local arguments
+    arguments=$(netemArgs "$1")
+    if [ -n "$arguments" ] && ! tc qdisc add dev lo root netem $arguments; then
+        echo "tc netem failed; run as root or use -m proxy" >&2
+        exit 1
+    fi
+}
+
+# Prints the TCP segments sent and retransmitted so far by the whole host.
+tcpSegments() {
+    awk '/^Tcp:/ { if (!names) { for (i = 1; i <= NF; i++) column[$i] = i; names = 1 }
+                   else print $column["OutSegs"], $column["RetransSegs"] }' /proc/net/snmp
+}
+
+# Runs one transfer and appends its row to the results.
+# Arguments: protocol size packet_size profile run
+runTransfer() {
+    local protocol=$1 size=$2 packetSize=$3 profile=$4 run=$5
+    local port=$((20000 + RANDOM % 20000))
+    local sendPort=$port
+    local input="$WORK/input_$size" output="$WORK/output"
+    rm -f "$output"
+
+    if [ "$MODE" = proxy ] && [ "$profile" != clean ]; then
+        sendPort=$((port + 1))
+        "$ROOT/impair_proxy" $sendPort 127.0.0.1 $port $(proxyArgs "$profile") -S "$run" > "$WORK/proxy.log" 2>&1 &
+        PROXY_PID=$!
+        sleep 0.2
+    fi
+
+    local before after
+    before=$(tcpSegments)
+    if [ "$protocol" = udp ]; then
+        timeout $TIMEOUT "$ROOT/receiver" $port "$output" > "$WORK/receiver.log" 2>&1 &
+    else
+        timeout $TIMEOUT "$ROOT/receiver_tcp" $port "$output" > "$WORK/receiver.log" 2>&1 &
+    fi
+    local receiverPid=$!
+    sleep 0.2
+
+    local start end
+    start=$(date +%s%N)
+    if [ "$protocol" = udp ]; then
+        timeout $TIMEOUT "$ROOT/sender" 127.0.0.1 $sendPort "$input" $size -s $packetSize $SENDER_ARGS > "$WORK/sender.log" 2>&1
+    else
+        timeout $TIMEOUT "$ROOT/sender_tcp" 127.0.0.1 $sendPort "$input" $size > "$WORK/sender.log" 2>&1
+    fi
+    wait $receiverPid
+    end=$(date +%s%N)
+    after=$(tcpSegments)
+
+    if [ -n "$PROXY_PID" ]; then
+        kill "$PROXY_PID" 2> /dev/null
+        wait "$PROXY_PID" 2> /dev/null
+        PROXY_PID=""
+    fi
+
+    local verified=0
+    cmp -s "$input" "$output" && verified=1
+
+    local throughput retransmissions packets
+    throughput=$(awk '/^Throughput:/ { print $2 }' "$WORK/sender.log")
+    if [ "$protocol" = udp ]; then
+        retransmissions=$(awk '/^Retransmitted packets:/ { print $3 }' "$WORK/sender.log")
+        packets=$(awk '/^Send syscalls:/ { print $5 }' "$WORK/sender.log")
+    else
+        read -r outBefore retransBefore <<< "$before"
+        read -r outAfter retransAfter <<< "$after"
+        retransmissions=$((retransAfter - retransBefore))
+        packets=$((outAfter - outBefore))
+    fi
+
+    awk -v protocol=$protocol -v size=$size -v packetSize=$packetSize -v profile=$profile -v run=$run \
+        -v start=$start -v end=$end -v throughput="${throughput:-0}" -v retransmissions="${retransmissions:-0}" \
+        -v packets="${packets:-0}" -v verified=$verified 'BEGIN {
+        duration = (end - start) / 1e9
+        goodput = verified && duration > 0 ? size * 8 / duration / 1e6 : 0
+        ratio = packets > 0 ? retransmissions / packets : 0
+        printf "%s,%d,%s,%s,%d,%.4f,%.3f,%.3f,%d,%d,%.5f,%d\n", protocol, size, packetSize, profile, run,
+               duration, throughput, goodput, retransmissions, packets, ratio, verified
+    }' >> "$PREFIX.csv"
+    tail -n 1 "$PREFIX.csv"
+}
+
+echo "protocol,size_bytes,packet_size,profile,run,duration_s,throughput_mbps,goodput_mbps,retransmissions,packets_sent,retransmission_ratio,verified" > "$PREFIX.csv"
+
+for size in $SIZES; do
+    head -c "$size" /dev/urandom > "$WORK/input_$size"
+done
+
+for profile in $PROFILES; do
+    [ "$MODE" = netem ] && applyNetem "$profile"
+    for size in $SIZES; do
+        for run in $(seq 1 "$REPEATS"); do
+            for packetSize in $PACKET_SIZES; do
+                runTransfer udp "$size" "$packetSize" "$profile" "$run"
+            done
+            if [ "$MODE" = netem ] || [ "$profile" = clean ]; then
+                runTransfer tcp "$size" - "$profile" "$run"
+            fi
+        done
+    done
+done
+
+# Summarizes the runs of every configuration: means, and nearest-rank percentiles of the duration.
+sort -t, -k1,1 -k2,2n -k3,3 -k4,4 -k6,6n <(tail -n +2 "$PREFIX.csv") | awk -F, -v summary="${PREFIX}_summary.csv" -v json="$PREFIX.json" '
+function percentile(p,    rank) {
+    rank = int(p / 100 * count + 0.999999)
+    return durations[rank < 1 ? 1 : rank]
+}
+function flush() {
+    if (count == 0) return
+    printf "%s,%.3f,%.3f,%.3f,%.5f,%.4f,%.4f,%.4f,%d,%d\n", key, throughput / count, goodput / count, minGoodput,
+           ratio / count, percentile(50), percentile(90), percentile(99), count, failures >> summary
+    split(key, part, ",")
+    printf "%s\n    {\"protocol\": \"%s\", \"size_bytes\": %s, \"packet_size\": \"%s\", \"profile\": \"%s\", " \
+           "\"runs\": %d, \"failures\": %d, \"throughput_mbps_mean\": %.3f, \"goodput_mbps_mean\": %.3f, " \
+           "\"goodput_mbps_min\": %.3f, \"retransmission_ratio_mean\": %.5f, \"duration_s_p50\": %.4f, " \
+           "\"duration_s_p90\": %.4f, \"duration_s_p99\": %.4f}", entries++ ? "," : "", part[1], part[2], part[3], part[4],
+           count, failures, throughput / count, goodput / count, minGoodput, ratio / count,
+           percentile(50), percentile(90), percentile(99) >> json
+    count = 0; throughput = 0; goodput = 0; ratio = 0; failures = 0
+}
+BEGIN {
+    print "protocol,size_bytes,packet_size,profile,throughput_mbps_mean,goodput_mbps_mean,goodput_mbps_min," \
+          "retransmission_ratio_mean,duration_s_p50,duration_s_p90,duration_s_p99,runs,failures" > summary
+    printf "{\n  \"results\": [" > json
+}
+{
+    current = $1 "," $2 "," $3 "," $4
+    if (current != key) { flush(); key = current }
+    durations[++count] = $6
+    throughput += $7; goodput += $8; ratio += $11
+    if (count == 1 || $8 < minGoodput) minGoodput = $8
+    if (!$12) failures++
+}
+END {
+    flush()
+    printf "\n  ]\n}\n" >> json
+}'
+
+echo
+column -t -s, "${PREFIX}_summary.csv" 2> /dev/null || cat "${PREFIX}_summary.csv"
+
+status=0
+if [ -n "$BASELINE" ]; then
+    echo
+    awk -F, -v tolerance="$TOLERANCE" 'FNR == 1 { next }
+        NR == FNR { baseline[$1 "," $2 "," $3 "," $4] = $6; next }
+        {
+            key = $1 "," $2 "," $3 "," $4
+            if (!(key in baseline) || baseline[key] <= 0) next
+            change = ($6 - baseline[key]) / baseline[key] * 100
+            if (change < -tolerance) { printf "REGRESSION %s: goodput %.3f -> %.3f Mb/s (%.1f%%)\n", key, baseline[key], $6, change; failed = 1 }
+            if ($13 > 0) { printf "FAILED %s: %d runs did not deliver the file\n", key, $13; failed = 1 }
+        }
+        END { if (!failed) print "No goodput regression beyond " tolerance "%"; exit failed }' "$BASELINE" "${PREFIX}_summary.csv" || status=1
+fi
+for profile in $PROFILES; do
+    isLossless "$profile" || continue
+    awk -F, -v profile="$profile" -v spurious="$SPURIOUS" '
+        NR > 1 && $1 == "udp" && $4 == profile && $11 * 100 > spurious {
+            printf "SPURIOUS %s,%s,%s run %s: %d of %d packets retransmitted\n", $2, $3, $4, $5, $9, $10
+            failed = 1
+        }
+        END { exit failed }' "$PREFIX.csv" || status=1
+done
+if awk -F, 'NR > 1 && !$12 { found = 1 } END { exit !found }' "$PREFIX.csv"; then
+    echo "Some transfers did not deliver the file intact" >&2
+    status=1
+fi
+exit $status
@@ -0,0 +1,658 @@
+/**
+ * @file impair_proxy.c
+ * @brief A userspace UDP proxy that impairs the traffic between a sender and a receiver.
+ *
+ * The performance tests rely on tc netem on CloudLab nodes, which needs root and a
+ * real link. This proxy reproduces the same impairments on loopback without either:
+ * it listens on a UDP port, forwards every datagram to the receiver and every reply
+ * back to its sender, and on the way applies a rate limit with a drop-tail queue,
+ * delay, jitter, random loss, bursty Gilbert-Elliott loss, duplication, reordering and
+ * corruption.
+ * Every sender address gets its own upstream socket, so parallel streams and competing
+ * senders stay apart and the receiver still sees one source port per stream. All
+ * random decisions come from a seeded generator, so a run can be repeated exactly.
+ *
+ * @author Leo Kamino (LeonardoKamino)
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * @def MAX_DATAGRAM
+ * Definition specifying the largest datagram forwarded.
+ */
+#define MAX_DATAGRAM 65536
+
+/**
+ * @def MAX_CLIENTS
+ * Definition specifying the largest number of sender addresses served.
+ */
+#define MAX_CLIENTS 256
+
+/**
+ * @def MAX_READS_PER_SOCKET
+ * Definition specifying how many datagrams are read from one socket before the due
+ * datagrams are sent, so a busy socket never delays the others.
+ */
+#define MAX_READS_PER_SOCKET 64
+
+/**
+ * @def SOCKET_BUFFER_SIZE
+ * Definition specifying the socket buffers asked for, so the proxy itself drops nothing.
+ */
+#define SOCKET_BUFFER_SIZE (8 << 20)
+
+/**
+ * @def DEFAULT_QUEUE_KB
+ * Definition specifying the default size of the queue in front of the rate limit, in KB.
+ */
+#define DEFAULT_QUEUE_KB 1000
+
+/**
+ * @def FORWARD
+ * Direction of the datagrams from the senders to the receiver.
+ */
+#define FORWARD 0
+
+/**
+ * @def REVERSE
+ * Direction of the datagrams from the receiver back to the senders.
+ */
+#define REVERSE 1
+
+/**
+ * @struct Impairment
+ * @brief The impairments applied to one direction, probabilities in percent.
+ */
+typedef struct {
+    double rateMbit;              /**< Link rate in Mbit/s, 0 for no limit. */
+    double queueBytes;            /**< Bytes the queue in front of the link holds. */
+    double delayMs;               /**< Fixed one-way delay. */
+    double jitterMs;              /**< Largest random change of the delay, either way. */
+    double loss;                  /**< Random loss, in the good state of the Gilbert-Elliott model. */
+    double burstEnter;            /**< Chance of moving to the bad state at each datagram, 0 for no bursts. */
+    double burstExit;             /**< Chance of moving back to the good state at each datagram. */
+    double burstLoss;             /**< Loss in the bad state. */
+    double duplicate;             /**< Chance of sending a datagram twice. */
+    double reorder;               /**< Chance of sending a datagram without its delay, ahead of the others. */
+    double corrupt;               /**< Chance of flipping one random bit of a datagram. */
+} Impairment;
+
+/**
+ * @struct Direction
+ * @brief State and counters of one direction of the proxy.
+ */
+typedef struct {
+    Impairment impairment;              /**< Impairments applied. */
+    int isBad;                          /**< Non-zero in the bad state of the Gilbert-Elliott model. */
+    unsigned long long linkFreeNs;      /**< Time the link finishes sending the queued datagrams. */
+    unsigned long long received;        /**< Datagrams read. */
+    unsigned long long forwarded;       /**< Datagrams sent on, copies included. */
+    unsigned long long lost;            /**< Datagrams dropped by the loss models. */
+    unsigned long long overflowed;      /**< Datagrams dropped because the queue was full. */
+    unsigned long long duplicated;      /**< Extra copies made. */
+    unsigned long long reordered;       /**< Datagrams sent ahead of their delay. */
+    unsigned long long corrupted;       /**< Datagrams with a bit flipped. */
+} Direction;
+
+/**
+ * @struct Client
+ * @brief A sender address and the socket its datagrams are forwarded from.
+ */
+typedef struct {
+    struct sockaddr_in clientAddr;      /**< Address of the sender. */
+    int upstream;                       /**< Socket connected to the receiver for this sender. */
+} Client;
+
+/**
+ * @struct PendingDatagram
+ * @brief A datagram held until its release time.
+ */
+typedef struct {
+    unsigned long long releaseNs;       /**< Time the datagram leaves. */
+    unsigned long long order;           /**< Arrival order, keeping datagrams with the same release time in order. */
+    int sockDescriptor;                 /**< Socket the datagram leaves on. */
+    struct sockaddr_in destAddr;        /**< Destination of the datagram. */
+    size_t length;                      /**< Bytes of data. */
+    char *data;                         /**< The datagram. */
+} PendingDatagram;
+
+/**
+ * @struct PendingQueue
+ * @brief Binary min-heap of held datagrams, ordered by release time.
+ */
+typedef struct {
+    PendingDatagram **items;            /**< The heap. */
+    int count;                          /**< Datagrams held. */
+    int capacity;                       /**< Room in items. */
+    unsigned long long nextOrder;       /**< Arrival order of the next datagram. */
+} PendingQueue;
+
+/**
+ * @brief Set by the signal handler to stop the proxy.
+ */
+static volatile sig_atomic_t isStopping = 0;
+
+/**
+ * @brief Stops the proxy on SIGINT or SIGTERM.
+ *
+ * @param signalNumber The signal received.
+ */
+void stopProxy(int signalNumber) {
+    (void)signalNumber;
+    isStopping = 1;
+}
+
+/**
+ * @brief Returns the current time of the monotonic clock.
+ *
+ * @return unsigned long long The time in ns.
+ */
+unsigned long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Draws a random number in [0, 1) with xorshift64*, so runs with the same seed repeat exactly.
+ *
+ * @param state The state of the generator, never 0.
+ * @return double The number.
+ */
+double randomUnit(unsigned long long *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Draws a random event of the given chance.
+ *
+ * @param state The state of the generator.
+ * @param percent The chance of the event in percent.
+ * @return int Non-zero if the event happens.
+ */
+int happens(unsigned long long *state, double percent) {
+    return percent > 0 && randomUnit(state) * 100.0 < percent;
+}
+
+/**
+ * @brief Adds a datagram to the queue.
+ *
+ * @param queue The queue.
+ * @param datagram The datagram, owned by the queue until it is popped.
+ */
+void pushPending(PendingQueue *queue, PendingDatagram *datagram) {
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity > 0 ? 2 * queue->capacity : 1024;
+        queue->items = realloc(queue->items, queue->capacity * sizeof(PendingDatagram *));
+        if (queue->items == NULL) {
+            perror("Growing the queue failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    datagram->order = queue->nextOrder++;
+    int child = queue->count++;
+    while (child > 0) {
+        int parent = (child - 1) / 2;
+        PendingDatagram *above = queue->items[parent];
+        if (above->releaseNs < datagram->releaseNs
+            || (above->releaseNs == datagram->releaseNs && above->order < datagram->order)) {
+            break;
+        }
+        queue->items[child] = above;
+        child = parent;
+    }
+    queue->items[child] = datagram;
+}
+
+/**
+ * @brief Removes the datagram with the earliest release time from the queue.
+ *
+ * @param queue The queue, not empty.
+ * @return PendingDatagram* The datagram, now owned by the caller.
+ */
+PendingDatagram *popPending(PendingQueue *queue) {
+    PendingDatagram *first = queue->items[0];
+    PendingDatagram *last = queue->items[--queue->count];
+    int parent = 0;
+
+    while (2 * parent + 1 < queue->count) {
+        int child = 2 * parent + 1;
+        if (child + 1 < queue->count
+            && (queue->items[child + 1]->releaseNs < queue->items[child]->releaseNs
+                || (queue->items[child + 1]->releaseNs == queue->items[child]->releaseNs
+                    && queue->items[child + 1]->order < queue->items[child]->order))) {
+            child++;
+        }
+        PendingDatagram *below = queue->items[child];
+        if (last->releaseNs < below->releaseNs || (last->releaseNs == below->releaseNs && last->order < below->order)) {
+            break;
+        }
+        queue->items[parent] = below;
+        parent = child;
+    }
+    queue->items[parent] = last;
+    return first;
+}
+
+/**
+ * @brief Applies the impairments of a direction to a datagram and holds what survives.
+ *
+ * Each copy of the datagram first goes through the loss models. The Gilbert-Elliott
+ * model moves between its good and bad states at every datagram and loses datagrams
+ * with the chance of its current state. A surviving copy is then queued in front of
+ * the rate limit, and dropped if the queue is full, and is released once the link has
+ * sent it and its delay, changed by the jitter, has passed. A reordered copy skips the
+ * delay and overtakes the datagrams held before it. A corrupted copy has one random bit
+ * flipped, like the corruption of tc netem.
+ *
+ * @param direction The direction the datagram travels in.
+ * @param queue The queue of held datagrams.
+ * @param random The state of the random generator.
+ * @param data The datagram.
+ * @param length The bytes of the datagram.
+ * @param sockDescriptor The socket the datagram leaves on.
+ * @param destAddr The destination of the datagram.
+ */
+void impairDatagram(Direction *direction, PendingQueue *queue, unsigned long long *random,
+                    const char *data, size_t length, int sockDescriptor, struct sockaddr_in *destAddr) {
+    Impairment *impairment = &direction->impairment;
+    int copies = 1;
+    direction->received++;
+
+    if (happens(random, impairment->duplicate)) {
+        copies = 2;
+        direction->duplicated++;
+    }
+
+    for (int copy = 0; copy < copies; copy++) {
+        if (impairment->burstEnter > 0) {
+            if (direction->isBad) {
+                direction->isBad = !happens(random, impairment->burstExit);
+            } else {
+                direction->isBad = happens(random, impairment->burstEnter);
+            }
+        }
+        if (happens(random, direction->isBad ? impairment->burstLoss : impairment->loss)) {
+            direction->lost++;
+            continue;
+        }
+
+        unsigned long long now = nowNs();
+        unsigned long long departure = now;
+        if (impairment->rateMbit > 0) {
+            double bytesPerNs = impairment->rateMbit * 1e6 / 8 / 1e9;
+            double backlogBytes = direction->linkFreeNs > now ? (direction->linkFreeNs - now) * bytesPerNs : 0;
+            if (backlogBytes + length > impairment->queueBytes) {
+                direction->overflowed++;
+                continue;
+            }
+            departure = (direction->linkFreeNs > now ? direction->linkFreeNs : now) + (unsigned long long)(length / bytesPerNs);
+            direction->linkFreeNs = departure;
+        }
+
+        double delayMs = impairment->delayMs;
+        if (happens(random, impairment->reorder)) {
+            delayMs = 0;
+            direction->reordered++;
+        } else if (impairment->jitterMs > 0) {
+            delayMs += (2 * randomUnit(random) - 1) * impairment->jitterMs;
+            if (delayMs < 0) {
+                delayMs = 0;
+            }
+        }
+
+        PendingDatagram *datagram = malloc(sizeof(PendingDatagram));
+        if (datagram == NULL || (datagram->data = malloc(length)) == NULL) {
+            perror("Allocating a datagram failed");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(datagram->data, data, length);
+        if (length > 0 && happens(random, impairment->corrupt)) {
+            size_t bit = (size_t)(randomUnit(random) * length * 8);
+            datagram->data[bit / 8] ^= 1 << (bit % 8);
+            direction->corrupted++;
+        }
+        datagram->length = length;
+        datagram->releaseNs = departure + (unsigned long long)(delayMs * 1e6);
+        datagram->sockDescriptor = sockDescriptor;
+        datagram->destAddr = *destAddr;
+        pushPending(queue, datagram);
+    }
+}
+
+/**
+ * @brief Creates a non-blocking UDP socket with large buffers.
+ *
+ * @return int The socket.
+ */
+int openProxySocket() {
+    int sockDescriptor = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sockDescriptor < 0) {
+        perror("Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int bufferSize = SOCKET_BUFFER_SIZE;
+    if (setsockopt(sockDescriptor, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) < 0
+        || setsockopt(sockDescriptor, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize)) < 0) {
+        perror("Error setting socket buffer size");
+    }
+    return sockDescriptor;
+}
+
+/**
+ * @brief Returns the client of a sender address, adding it if it is new.
+ *
+ * @param clients The clients.
+ * @param clientCount The number of clients, increased when one is added.
+ * @param clientAddr The address of the sender.
+ * @return Client* The client, or NULL if there are MAX_CLIENTS already.
+ */
+Client *findClient(Client *clients, int *clientCount, struct sockaddr_in *clientAddr) {
+    for (int i = 0; i < *clientCount; i++) {
+        if (clients[i].clientAddr.sin_addr.s_addr == clientAddr->sin_addr.s_addr
+            && clients[i].clientAddr.sin_port == clientAddr->sin_port) {
+            return &clients[i];
+        }
+    }
+    if (*clientCount == MAX_CLIENTS) {
+        return NULL;
+    }
+
+    Client *client = &clients[(*clientCount)++];
+    client->clientAddr = *clientAddr;
+    client->upstream = openProxySocket();
+    return client;
+}
+
+/**
+ * @brief Prints the counters of one direction.
+ *
+ * @param name The name of the direction.
+ * @param direction The direction.
+ */
+void displayDirection(const char *name, Direction *direction) {
+    printf("%s: %llu received, %llu forwarded, %llu lost, %llu queue drops, %llu duplicated, %llu reordered, "
+           "%llu corrupted\n", name, direction->received, direction->forwarded, direction->lost, direction->overflowed,
+           direction->duplicated, direction->reordered, direction->corrupted);
+}
+
+/**
+ * @brief Forwards datagrams between the senders and the receiver until stopped.
+ *
+ * One loop waits in ppoll for the sockets to become readable or for the next held
+ * datagram to fall due, reads what arrived, and sends every datagram whose release
+ * time passed.
+ *
+ * @param listenPort The port the senders send to.
+ * @param targetAddr The address of the receiver.
+ * @param directions The impairments of the forward and reverse directions.
+ * @param seed The seed of the random generator.
+ */
+void runProxy(unsigned short int listenPort, struct sockaddr_in *targetAddr, Direction *directions, unsigned long long seed) {
+    static Client clients[MAX_CLIENTS];
+    static struct pollfd fds[MAX_CLIENTS + 1];
+    static char buffer[MAX_DATAGRAM];
+    int clientCount = 0;
+    PendingQueue queue;
+    unsigned long long random = seed != 0 ? seed : 1;
+    int isFullReported = 0;
+
+    memset(&queue, 0, sizeof(queue));
+
+    int listenSocket = openProxySocket();
+    struct sockaddr_in listenAddr;
+    memset(&listenAddr, 0, sizeof(listenAddr));
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_port = htons(listenPort);
+    listenAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listenSocket, (struct sockaddr *)&listenAddr, sizeof(listenAddr)) < 0) {
+        perror("Bind failed");
+        close(listenSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    while (!isStopping) {
+        /*
+         * Sleep until a socket is readable or the next held datagram is due.
+         */
+        fds[0].fd = listenSocket;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < clientCount; i++) {
+            fds[i + 1].fd = clients[i].upstream;
+            fds[i + 1].events = POLLIN;
+        }
+
+        struct timespec wait = {1, 0};
+        if (queue.count > 0) {
+            unsigned long long now = nowNs();
+            unsigned long long release = queue.items[0]->releaseNs;
+            unsigned long long waitNs = release > now ? release - now : 0;
+            wait.tv_sec = waitNs / 1000000000ULL;
+            wait.tv_nsec = waitNs % 1000000000ULL;
+        }
+        if (ppoll(fds, clientCount + 1, &wait, NULL) < 0 && errno != EINTR) {
+            perror("ppoll failed");
+            break;
+        }
+
+        /*
+         * Datagrams from the senders go to the receiver from their own upstream socket,
+         * and replies from the receiver go back to the sender of that socket.
+         */
+        int pollCount = clientCount + 1;
+        for (int i = 0; i < pollCount; i++) {
+            if (!(fds[i].revents & POLLIN)) {
+                continue;
+            }
+            for (int reads = 0; reads < MAX_READS_PER_SOCKET; reads++) {
+                struct sockaddr_in sourceAddr;
+                socklen_t sourceLength = sizeof(sourceAddr);
+                ssize_t length = recvfrom(fds[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&sourceAddr, &sourceLength);
+                if (length < 0) {
+                    break;
+                }
+
+                if (i == 0) {
+                    Client *client = findClient(clients, &clientCount, &sourceAddr);
+                    if (client == NULL) {
+                        if (!isFullReported) {
+                            fprintf(stderr, "Too many senders, ignoring new ones\n");
+                            isFullReported = 1;
+                        }
+                        continue;
+                    }
+                    impairDatagram(&directions[FORWARD], &queue, &random, buffer, length, client->upstream, targetAddr);
+                } else {
+                    impairDatagram(&directions[REVERSE], &queue, &random, buffer, length, listenSocket,
+                                   &clients[i - 1].clientAddr);
+                }
+            }
+        }
+
+        /*
+         * Send every datagram whose release time passed.
+         */
+        unsigned long long now = nowNs();
+        while (queue.count > 0 && queue.items[0]->releaseNs <= now) {
+            PendingDatagram *datagram = popPending(&queue);
+            Direction *direction = datagram->sockDescriptor == listenSocket ? &directions[REVERSE] : &directions[FORWARD];
+            if (sendto(datagram->sockDescriptor, datagram->data, datagram->length, 0,
+                       (struct sockaddr *)&datagram->destAddr, sizeof(datagram->destAddr)) < 0) {
+                direction->overflowed++;
+            } else {
+                direction->forwarded++;
+            }
+            free(datagram->data);
+            free(datagram);
+        }
+    }
+
+    displayDirection("Sender to receiver", &directions[FORWARD]);
+    displayDirection("Receiver to sender", &directions[REVERSE]);
+
+    while (queue.count > 0) {
+        PendingDatagram *datagram = popPending(&queue);
+        free(datagram->data);
+        free(datagram);
+    }
+    free(queue.items);
+    for (int i = 0; i < clientCount; i++) {
+        close(clients[i].upstream);
+    }
+    close(listenSocket);
+}
+
+/**
+ * @brief Entry point for the impairment proxy.
+ *
+ * This function parses the command line arguments and runs the proxy. The program
+ * expects the port to listen on and the hostname and port of the receiver. The optional
+ * -r flag limits the rate, with a queue of -q KB in front of it, -d and -j set the
+ * delay and jitter, -l the random loss, -g the Gilbert-Elliott burst loss, -u the
+ * duplication, -o the reordering and -x the corruption. The impairments apply to both
+ * directions unless the optional -F flag leaves the replies untouched. The optional -S
+ * flag seeds the random generator. The proxy runs until it is interrupted, then prints
+ * its counters.
+ *
+ * @param argc The number of command line arguments.
+ * @param argv The array of command line arguments.
+ * @return int EXIT_SUCCESS returned on successful completion or error code 1 on failure.
+ */
+int main(int argc, char** argv) {
+    Impairment impairment;
+    Direction directions[2];
+    int isForwardOnly = 0;
+    unsigned long long seed = 1;
+    int isValid = 1;
+    int option;
+
+    memset(&impairment, 0, sizeof(impairment));
+    impairment.queueBytes = DEFAULT_QUEUE_KB * 1000.0;
+    impairment.burstLoss = 100;
+
+    while ((option = getopt(argc, argv, "r:q:d:j:l:g:u:o:x:FS:")) != -1) {
+        switch (option) {
+            case 'r':
+                impairment.rateMbit = atof(optarg);
+                break;
+            case 'q':
+                impairment.queueBytes = atof(optarg) * 1000.0;
+                break;
+            case 'd':
+                impairment.delayMs = atof(optarg);
+                break;
+            case 'j':
+                impairment.jitterMs = atof(optarg);
+                break;
+            case 'l':
+                impairment.loss = atof(optarg);
+                break;
+            case 'g':
+                if (sscanf(optarg, "%lf,%lf,%lf", &impairment.burstEnter, &impairment.burstExit, &impairment.burstLoss) < 2
+                    || impairment.burstEnter <= 0 || impairment.burstExit <= 0) {
+                    isValid = 0;
+                }
+                break;
+            case 'u':
+                impairment.duplicate = atof(optarg);
+                break;
+            case 'o':
+                impairment.reorder = atof(optarg);
+                break;
+            case 'x':
+                impairment.corrupt = atof(optarg);
+                break;
+            case 'F':
+                isForwardOnly = 1;
+                break;
+            case 'S':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                isValid = 0;
+        }
+    }
+
+    if (argc - optind != 3 || !isValid || impairment.rateMbit < 0 || impairment.queueBytes <= 0
+        || impairment.delayMs < 0 || impairment.jitterMs < 0) {
+        fprintf(stderr, "usage: %s listen_port receiver_hostname receiver_port [-r rate_mbit] [-q queue_kb] [-d delay_ms] [-j jitter_ms]\n"
+                        "       [-l loss_percent] [-g enter,exit[,bad_loss]] [-u dup_percent] [-o reorder_percent]\n"
+                        "       [-x corrupt_percent] [-F] [-S seed]\n\n", argv[0]);
+        fprintf(stderr, "  -r rate_mbit        link rate in Mbit/s (default unlimited)\n");
+        fprintf(stderr, "  -q queue_kb         queue in front of the link in KB, drop-tail (default %d)\n", DEFAULT_QUEUE_KB);
+        fprintf(stderr, "  -d delay_ms         one-way delay (default 0)\n");
+        fprintf(stderr, "  -j jitter_ms        random change of the delay, either way (default 0)\n");
+        fprintf(stderr, "  -l loss_percent     random loss (default 0)\n");
+        fprintf(stderr, "  -g enter,exit[,bad_loss]\n");
+        fprintf(stderr, "                      Gilbert-Elliott burst loss: percent chances of entering and leaving\n");
+        fprintf(stderr, "                      the bad state per datagram, and loss in the bad state (default 100)\n");
+        fprintf(stderr, "  -u dup_percent      datagrams sent twice (default 0)\n");
+        fprintf(stderr, "  -o reorder_percent  datagrams sent without their delay, ahead of others (default 0)\n");
+        fprintf(stderr, "  -x corrupt_percent  datagrams with one random bit flipped (default 0)\n");
+        fprintf(stderr, "  -F                  impair only the sender to receiver direction\n");
+        fprintf(stderr, "  -S seed             seed of the random decisions (default 1)\n\n");
+        exit(1);
+    }
+
+    unsigned short int listenPort = (unsigned short int) atoi(argv[optind]);
+    char *hostname = argv[optind + 1];
+    unsigned short int targetPort = (unsigned short int) atoi(argv[optind + 2]);
+
+    struct addrinfo hints, *servinfo;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(hostname, NULL, &hints, &servinfo) != 0) {
+        perror("Address translation failed.");
+        exit(EXIT_FAILURE);
+    }
+    struct sockaddr_in targetAddr;
+    memset(&targetAddr, 0, sizeof(targetAddr));
+    targetAddr.sin_family = AF_INET;
+    targetAddr.sin_port = htons(targetPort);
+    memcpy(&targetAddr.sin_addr, &((struct sockaddr_in *)servinfo->ai_addr)->sin_addr, sizeof(struct in_addr));
+    freeaddrinfo(servinfo);
+
+    memset(directions, 0, sizeof(directions));
+    directions[FORWARD].impairment = impairment;
+    if (!isForwardOnly) {
+        directions[REVERSE].impairment = impairment;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopProxy;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Proxy listening on port %d, forwarding to %s:%d\n", listenPort, hostname, targetPort);
+    printf("Rate %.3g Mbit/s, queue %.0f KB, delay %.3g ms, jitter %.3g ms, loss %.3g%%, burst %.3g%%/%.3g%%/%.3g%%, "
+           "duplicate %.3g%%, reorder %.3g%%, corrupt %.3g%%%s\n",
+           impairment.rateMbit, impairment.queueBytes / 1000, impairment.delayMs, impairment.jitterMs, impairment.loss,
+           impairment.burstEnter, impairment.burstExit, impairment.burstLoss, impairment.duplicate, impairment.reorder,
+           impairment.corrupt, isForwardOnly ? ", sender to receiver only" : "");
+    fflush(stdout);
+
+    runProxy(listenPort, &targetAddr, directions, seed);
+    return (EXIT_SUCCESS);
+}
@@ -108,7 +108,7 @@ void tsend(char* hostname, unsigned short int hostPort, char* filename, unsigned
 
     gettimeofday(&end, NULL);
     
-    displayPerformance(&start, &end, totalBytesSent);
+    displayPerformance(&start, &end, totalBytesSent, totalBytesSent, LINK_CAPACITY);
 
 
     fclose(file);
@@ -0,0 +1,397 @@
+/**
+ * @file wire_bench.c
+ * @brief Checks the wire format of the packet header and measures its encoding.
+ *
+ * The header is encoded by hand in network byte order, so this program first checks
+ * it against bytes written out by hand, round-trips headers with offsets of many
+ * terabytes and sequence numbers past 2^32, rebuilds sequence numbers across the wrap
+ * of their 32 bits, skips and finds extensions, rejects malformed headers, and checks
+ * that the checksum still catches every flipped bit. It checks the CRC32C against its
+ * published value and a bit-by-bit reference, the hardware path against the tables at
+ * every alignment and at lengths around its lanes, and the DataHash of data added out
+ * of order and split between hashes against the CRC32C of the whole. It then times
+ * the encoding and decoding of a header, and the sealing and checking of a whole
+ * packet, next to a plain copy of the in-memory header as the old format sent it. It
+ * exits with a non-zero status if any check fails, so `make bench` stops there.
+ *
+ * @author Leo Kamino (LeonardoKamino)
+ * @bug No known bugs.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../src/includes/integrity.h"
+
+/**
+ * @def BENCH_ITERATIONS
+ * Definition specifying how many headers each measurement encodes or decodes.
+ */
+#define BENCH_ITERATIONS 20000000
+
+/**
+ * @def CRC_BUFFER
+ * Definition specifying the largest buffer the CRC32C paths are compared on, past two groups of long lanes.
+ */
+#define CRC_BUFFER (7 * CRC32C_LONG_LANE + 13)
+
+/**
+ * @def BENCH_PAYLOAD
+ * Definition specifying the payload of the packets sealed and checked, a full Ethernet packet.
+ */
+#define BENCH_PAYLOAD (1472 - WIRE_HEADER_SIZE)
+
+/**
+ * @brief Number of checks that failed.
+ */
+static int failures;
+
+/**
+ * @brief Keeps the compiler from optimizing a measured loop away.
+ */
+static volatile unsigned long long sink;
+
+/**
+ * @brief Records a check and reports it if it failed.
+ *
+ * @param isPassed Non-zero if the check passed.
+ * @param what What was checked.
+ */
+void check(int isPassed, const char *what) {
+    if (!isPassed) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/**
+ * @brief Returns the time of CLOCK_MONOTONIC in ns.
+ *
+ * @return double The time.
+ */
+double nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**
+ * @brief Checks that two headers hold the same fields, the sequence number as sent.
+ *
+ * @param a The first header.
+ * @param b The second header.
+ * @return int Non-zero if they match.
+ */
+int isSameHeader(const PacketHeader *a, const PacketHeader *b) {
+    return a->flags == b->flags && a->connectionId == b->connectionId && a->offset == b->offset
+        && a->timestamp == b->timestamp && a->checksum == b->checksum
+        && (a->sequenceNumber & 0xffffffffLL) == (b->sequenceNumber & 0xffffffffLL);
+}
+
+/**
+ * @brief Checks the encoding against bytes written out by hand, and round trips.
+ */
+void checkEncoding() {
+    static const unsigned char expected[WIRE_HEADER_SIZE] = {
+        WIRE_VERSION, 0x46, 0x00, 0x00,
+        0xde, 0xad, 0xbe, 0xef,
+        0x00, 0x00, 0x00, 0x07,
+        0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x2a,
+        0x01, 0x02, 0x03, 0x04,
+        0xca, 0xfe, 0xba, 0xbe,
+    };
+    PacketHeader header;
+    PacketHeader decoded;
+    WireHeader wire;
+
+    header.sequenceNumber = (3LL << 32) + 7;
+    header.flags = setFlag(setFlag(setFlag(0, IS_ACK), IS_PROBE), IS_HANDSHAKE);
+    header.timestamp = 0x01020304;
+    header.connectionId = 0xdeadbeef;
+    header.checksum = 0xcafebabe;
+    header.offset = (5LL << 40) + 42;
+    encodePacketHeader(&header, &wire);
+    check(memcmp(wire.bytes, expected, sizeof(expected)) == 0, "encoding matches the bytes written by hand");
+    check(decodePacketHeader(&wire, sizeof(wire), &decoded) == WIRE_HEADER_SIZE, "a header decodes to its size");
+    check(isSameHeader(&header, &decoded), "a header round trips");
+
+    /*
+     * Offsets up to the largest file, and every flag.
+     */
+    long long offsets[] = {0, 1, (1LL << 32) - 1, 1LL << 32, 3LL << 40, (1LL << 50) + 12345, (1LL << 62) + 7,
+                           0x7fffffffffffffffLL};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        header.offset = offsets[i];
+        header.flags = (int)(i * 37) & 0x7f;
+        encodePacketHeader(&header, &wire);
+        check(decodePacketHeader(&wire, sizeof(wire), &decoded) > 0 && isSameHeader(&header, &decoded),
+              "a header with a large offset round trips");
+    }
+}
+
+/**
+ * @brief Checks the sequence numbers rebuilt from their low 32 bits around the wrap.
+ */
+void checkSequenceNumbers() {
+    long long span = 1LL << 32;
+    long long references[] = {0, 100, span / 2, span - 5, span, span + 3, 7 * span - 1, (1LL << 40) + 999};
+    int distances[] = {0, 1, 5, 255, 256, -1, -5, -255, -256, 100000, -100000};
+
+    for (size_t r = 0; r < sizeof(references) / sizeof(references[0]); r++) {
+        for (size_t d = 0; d < sizeof(distances) / sizeof(distances[0]); d++) {
+            long long sequenceNumber = references[r] + distances[d];
+            if (sequenceNumber < 0) {
+                continue;
+            }
+            PacketHeader header;
+            PacketHeader decoded;
+            WireHeader wire;
+            memset(&header, 0, sizeof(header));
+            header.sequenceNumber = sequenceNumber;
+            encodePacketHeader(&header, &wire);
+            decodePacketHeader(&wire, sizeof(wire), &decoded);
+            check(expandSequenceNumber(decoded.sequenceNumber, references[r]) == sequenceNumber,
+                  "a sequence number is rebuilt near the one expected");
+        }
+    }
+}
+
+/**
+ * @brief Checks that extensions are skipped and found, and that malformed headers are dropped.
+ */
+void checkExtensions() {
+    unsigned char datagram[WIRE_HEADER_SIZE + 16];
+    PacketHeader header;
+    PacketHeader decoded;
+    size_t length;
+
+    memset(&header, 0, sizeof(header));
+    header.sequenceNumber = 9;
+    header.offset = 1LL << 45;
+    encodePacketHeader(&header, (WireHeader *)datagram);
+
+    /*
+     * Two extensions of 3 and 1 bytes, then 5 bytes of payload.
+     */
+    unsigned char extensions[] = {7, 3, 'a', 'b', 'c', 9, 1, 'z'};
+    datagram[3] = sizeof(extensions);
+    memcpy(datagram + WIRE_HEADER_SIZE, extensions, sizeof(extensions));
+    memcpy(datagram + WIRE_HEADER_SIZE + sizeof(extensions), "hello", 5);
+    size_t datagramSize = WIRE_HEADER_SIZE + sizeof(extensions) + 5;
+
+    size_t headerSize = decodePacketHeader(datagram, datagramSize, &decoded);
+    check(headerSize == WIRE_HEADER_SIZE + sizeof(extensions), "extensions are skipped to the payload");
+    check(decoded.offset == header.offset && memcmp(datagram + headerSize, "hello", 5) == 0,
+          "the header and payload around extensions are intact");
+    const unsigned char *value = findHeaderExtension(datagram, headerSize, 9, &length);
+    check(value != NULL && length == 1 && value[0] == 'z', "an extension is found by its type");
+    check(findHeaderExtension(datagram, headerSize, 8, &length) == NULL, "a missing extension is not found");
+
+    datagram[WIRE_HEADER_SIZE + 1] = 200;
+    check(decodePacketHeader(datagram, datagramSize, &decoded) == 0, "an extension past the header is dropped");
+    datagram[WIRE_HEADER_SIZE + 1] = 3;
+    datagram[3] = 200;
+    check(decodePacketHeader(datagram, datagramSize, &decoded) == 0, "extensions past the datagram are dropped");
+    datagram[3] = 0;
+    datagram[0] = WIRE_VERSION + 1;
+    check(decodePacketHeader(datagram, datagramSize, &decoded) == 0, "another version is dropped");
+    datagram[0] = WIRE_VERSION;
+    check(decodePacketHeader(datagram, WIRE_HEADER_SIZE - 1, &decoded) == 0, "a short datagram is dropped");
+}
+
+/**
+ * @brief Checks that a sealed packet is intact, whatever its timestamp, and that any
+ * other flipped bit is caught.
+ */
+void checkChecksum() {
+    unsigned char datagram[WIRE_HEADER_SIZE + 64];
+    PacketHeader header;
+
+    memset(&header, 0, sizeof(header));
+    header.sequenceNumber = (1LL << 33) + 17;
+    header.flags = setFlag(0, HAS_PARITY);
+    header.connectionId = 12345;
+    header.offset = 7LL << 40;
+    for (int i = 0; i < 64; i++) {
+        datagram[WIRE_HEADER_SIZE + i] = i * 7;
+    }
+    sealPacket(&header, (WireHeader *)datagram, datagram + WIRE_HEADER_SIZE, 64);
+    check(isPacketIntact(datagram, sizeof(datagram)), "a sealed packet is intact");
+    setWireTimestamp((WireHeader *)datagram, 987654321);
+    check(isPacketIntact(datagram, sizeof(datagram)), "a new timestamp keeps the packet intact");
+
+    int isEveryFlipCaught = 1;
+    for (size_t bit = 0; bit < 8 * sizeof(datagram); bit++) {
+        if (bit / 8 >= WIRE_SEALED_BYTES && bit / 8 < WIRE_SEALED_BYTES + 4) {
+            continue; // The timestamp is not covered.
+        }
+        datagram[bit / 8] ^= 1 << (bit % 8);
+        isEveryFlipCaught &= !isPacketIntact(datagram, sizeof(datagram));
+        datagram[bit / 8] ^= 1 << (bit % 8);
+    }
+    check(isEveryFlipCaught, "every flipped bit but those of the timestamp is caught");
+}
+
+/**
+ * @brief Computes a CRC32C one bit at a time, without inversions, as a reference.
+ *
+ * @param crc The CRC so far.
+ * @param data The bytes.
+ * @param length The number of bytes.
+ * @return uint32_t The CRC.
+ */
+uint32_t referenceCrc32c(uint32_t crc, const unsigned char *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Checks the CRC32C against its published value, its table and hardware paths
+ * against each other, and the DataHash against the CRC32C of the whole data.
+ */
+void checkCrc32c() {
+    static unsigned char buffer[CRC_BUFFER + 8];
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (unsigned char)(i * 131 + (i >> 8) * 7 + 1);
+    }
+
+    check(crc32c(0, "123456789", 9) == 0xe3069283, "the CRC32C of \"123456789\" is 0xe3069283");
+    check(crc32c(crc32c(0, "1234", 4), "56789", 5) == 0xe3069283, "a CRC32C continues across buffers");
+
+    /*
+     * Every alignment, lengths around 8 bytes and the short and long lanes, and seeds
+     * that are not zero, so each step of the fast paths meets the others.
+     */
+    size_t lengths[] = {0, 1, 7, 8, 9, 3 * CRC32C_SHORT_LANE - 1, 3 * CRC32C_SHORT_LANE, 3 * CRC32C_SHORT_LANE + 5,
+                        3 * CRC32C_LONG_LANE - 1, 3 * CRC32C_LONG_LANE, 3 * CRC32C_LONG_LANE + 3 * CRC32C_SHORT_LANE + 7,
+                        6 * CRC32C_LONG_LANE + 1, CRC_BUFFER};
+    uint32_t seeds[] = {0, 0xffffffff, 0x12345678};
+    int isTablesRight = 1;
+    int isHardwareRight = 1;
+    updateCrc32c(0, buffer, 0); // Builds the tables and detects the hardware.
+    for (size_t align = 0; align < 8; align++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            for (size_t s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++) {
+                uint32_t expected = referenceCrc32c(seeds[s], buffer + align, lengths[l]);
+                isTablesRight &= updateCrc32cTables(seeds[s], buffer + align, lengths[l]) == expected;
+#if CRC32C_HAS_HARDWARE
+                if (crc32cHasHardware) {
+                    isHardwareRight &= updateCrc32cHardware(seeds[s], buffer + align, lengths[l]) == expected;
+                }
+#endif
+            }
+        }
+    }
+    check(isTablesRight, "the tables match the bit-by-bit CRC32C at every length and alignment");
+    check(isHardwareRight, "the hardware path matches the bit-by-bit CRC32C at every length and alignment");
+#if CRC32C_HAS_HARDWARE
+    if (!crc32cHasHardware) {
+        printf("No SSE4.2 and PCLMULQDQ: the hardware path of the CRC32C was not checked\n");
+    }
+#endif
+
+    /*
+     * The data in blocks of uneven sizes, added backwards, and split between two hashes
+     * as two streams would, must hash to the CRC32C of the whole.
+     */
+    size_t blocks[] = {0, 1, 100, 101, 3 * CRC32C_LONG_LANE + 1, 1003, 1500, CRC_BUFFER};
+    size_t blockCount = sizeof(blocks) / sizeof(blocks[0]);
+    unsigned int whole = crc32c(0, buffer, CRC_BUFFER);
+    DataHash inOrder;
+    DataHash backwards;
+    DataHash halves[2];
+    initDataHash(&inOrder);
+    initDataHash(&backwards);
+    initDataHash(&halves[0]);
+    initDataHash(&halves[1]);
+    for (size_t b = 0; b + 1 < blockCount; b++) {
+        addDataHash(&inOrder, buffer + blocks[b], blocks[b + 1] - blocks[b], blocks[b]);
+        size_t last = blockCount - 2 - b;
+        addDataHash(&backwards, buffer + blocks[last], blocks[last + 1] - blocks[last], blocks[last]);
+        addDataHash(&halves[b % 2], buffer + blocks[b], blocks[b + 1] - blocks[b], blocks[b]);
+    }
+    check(dataChecksum(finishDataHash(&inOrder), CRC_BUFFER) == whole, "a DataHash of data in order is its CRC32C");
+    check(dataChecksum(finishDataHash(&backwards), CRC_BUFFER) == whole,
+          "a DataHash of data added backwards is its CRC32C");
+    check(dataChecksum(finishDataHash(&halves[0]) ^ finishDataHash(&halves[1]), CRC_BUFFER) == whole,
+          "DataHashes of parts of the data combine into its CRC32C");
+}
+
+/**
+ * @brief Times the encoding, decoding, sealing and checking of headers.
+ */
+void measure() {
+    static char datagram[WIRE_HEADER_SIZE + BENCH_PAYLOAD];
+    PacketHeader header;
+    PacketHeader decoded;
+    WireHeader wire;
+    unsigned long long total = 0;
+    double start;
+
+    memset(&header, 0, sizeof(header));
+    header.connectionId = 0x1234567;
+    header.flags = setFlag(0, HAS_PARITY);
+    memset(datagram, 0x5a, sizeof(datagram));
+
+    printf("Header: %d bytes on the wire, %zu bytes in memory\n", WIRE_HEADER_SIZE, sizeof(PacketHeader));
+
+    start = nowNs();
+    for (long long i = 0; i < BENCH_ITERATIONS; i++) {
+        header.sequenceNumber = i;
+        header.offset = i * BENCH_PAYLOAD;
+        memcpy(datagram, &header, sizeof(header));
+        total += datagram[i & 7];
+    }
+    printf("Copy of the in-memory header: %.2f ns\n", (nowNs() - start) / BENCH_ITERATIONS);
+
+    start = nowNs();
+    for (long long i = 0; i < BENCH_ITERATIONS; i++) {
+        header.sequenceNumber = i;
+        header.offset = i * BENCH_PAYLOAD;
+        encodePacketHeader(&header, &wire);
+        total += wire.bytes[i & 7];
+    }
+    printf("Encode: %.2f ns\n", (nowNs() - start) / BENCH_ITERATIONS);
+
+    start = nowNs();
+    for (long long i = 0; i < BENCH_ITERATIONS; i++) {
+        wire.bytes[11] = (unsigned char)i;
+        total += decodePacketHeader(&wire, sizeof(wire), &decoded);
+        total += expandSequenceNumber(decoded.sequenceNumber, i);
+    }
+    printf("Decode and rebuild the sequence number: %.2f ns\n", (nowNs() - start) / BENCH_ITERATIONS);
+
+    int packets = BENCH_ITERATIONS / 100;
+    start = nowNs();
+    for (int i = 0; i < packets; i++) {
+        header.sequenceNumber = i;
+        sealPacket(&header, (WireHeader *)datagram, datagram + WIRE_HEADER_SIZE, BENCH_PAYLOAD);
+        total += isPacketIntact(datagram, sizeof(datagram));
+    }
+    printf("Seal and check a %zu byte packet: %.2f ns\n", sizeof(datagram), (nowNs() - start) / packets);
+    sink = total;
+}
+
+int main() {
+    checkEncoding();
+    checkSequenceNumbers();
+    checkExtensions();
+    checkChecksum();
+    checkCrc32c();
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("Every wire format check passed\n");
+
+    measure();
+    return 0;
+}